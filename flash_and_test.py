@@ -6,12 +6,16 @@ from __future__ import annotations
 import argparse
 import glob
 import json
+import math
 import os
 import re
 import shutil
 import subprocess
 import sys
+import threading
 import time
+from collections import Counter
+from concurrent.futures import ThreadPoolExecutor, as_completed
 from dataclasses import dataclass, field
 from pathlib import Path
 
@@ -23,8 +27,23 @@ except ImportError:
 
 SCRIPT_DIR = Path(__file__).resolve().parent
 SERIAL_GLOB = "/dev/serial/by-id/*power_monitor*"
+PORT_SERIAL_RE = re.compile(r"power_monitor_([0-9A-Za-z]+)-if\d+")
+# RP2040 boot ROM; its USB serial number is the flash unique ID, the same one
+# the firmware reports, so picotool --ser finds a unit in either mode
+BOOTSEL_USB_ID = ("2e8a", "0003")
 TRACK_SERIAL_RE = re.compile(r"Tracking device serial number (\S+) for reboot")
 VERSION_RE = re.compile(r"^\s*version:\s+(\S+)", re.MULTILINE)
+PROTOCOL_TESTS = 6
+
+# --bench request kinds. "config" reads settings only (no sensor or estimator
+# work behind it), "v" is the smallest sensor read, "all" the largest response.
+# "set" writes the device's own settings back, so a run leaves the configuration
+# as it found it; it still marks them dirty, so expect a flash commit (a USB
+# stall) every SETTINGS_COMMIT_MAX_DELAY_MS while SETs keep coming.
+BENCH_CONFIG_FIELDS = ["min_v", "max_v", "hrs_capacity", "chg_threshold_a"]
+BENCH_KINDS = ("config", "v", "all", "set")
+BENCH_DEFAULT_MIXES = ["config", "all", "set"]
+BENCH_WARMUP = 20
 
 
 @dataclass
@@ -33,12 +52,17 @@ class Results:
     serial_comm: str = "FAIL"
     firmware: str = "FAIL"
     protocol_pass: int = 0
-    protocol_total: int = 4
+    protocol_total: int = PROTOCOL_TESTS
     sensor: str = "FAIL"
     sensor_detail: str = ""
     comm_failed: bool = False
     flash_failed: bool = False
     messages: list[str] = field(default_factory=list)
+    # fleet mode
+    unit: str = ""
+    port: str = ""
+    device_fw: str | None = None
+    elapsed_s: float = 0.0
 
     def exit_code(self) -> int:
         if self.flash_failed:
@@ -50,9 +74,12 @@ class Results:
         return 0
 
 
+_log_ctx = threading.local()  # per-unit prefix for --fleet
+
+
 def log(msg: str, *, verbose: bool) -> None:
     if verbose:
-        print(msg)
+        print(f"{getattr(_log_ctx, 'prefix', '')}{msg}")
 
 
 def resolve_uf2(explicit: str | None) -> Path:
@@ -155,6 +182,11 @@ def drain_input(ser: serial.Serial, settle_s: float) -> None:
         ser.timeout = old_timeout
 
 
+def is_event_message(resp: dict) -> bool:
+    """Asynchronous {"event":...} lines (alerts etc.) are not responses."""
+    return "event" in resp
+
+
 def is_boot_only_message(resp: dict) -> bool:
     return (
         resp.get("error") == "ina226_not_found"
@@ -165,6 +197,19 @@ def is_boot_only_message(resp: dict) -> bool:
     )
 
 
+@dataclass
+class ClockSync:
+    """Maps device t_us onto the host's wall clock (microseconds since the epoch)."""
+
+    offset_us: float  # host - device at ref_dev_us
+    drift_ppm: float  # device clock rate error against the host
+    ref_dev_us: int
+    rtt_us: int  # round trip of the exchange the offset came from
+
+    def to_host_us(self, dev_us: int) -> float:
+        return dev_us + self.offset_us + (dev_us - self.ref_dev_us) * self.drift_ppm * 1e-6
+
+
 class Device:
     def __init__(self, port: str, timeout: float, *, settle_s: float = 2.5) -> None:
         self.port = port
@@ -195,13 +240,38 @@ class Device:
                     resp = json.loads(line)
                 except json.JSONDecodeError:
                     return {"_raw": line, "_parse_error": True}
-                if is_boot_only_message(resp):
+                if is_boot_only_message(resp) or is_event_message(resp):
                     continue
                 return resp
 
         log("  RECV (timeout)", verbose=verbose)
         return None
 
+    def sync(self, *, rounds: int = 8, verbose: bool = False) -> ClockSync | None:
+        """NTP-style offset from the fastest of several round trips.
+
+        The device stamps the request when it arrives, so on the fastest exchange
+        the midpoint of send and receive is the best guess for that instant. The
+        drift comes from the device's own fit over every sync it has seen, which
+        gets better the longer a host keeps calling this.
+        """
+        best: tuple[int, int, int] | None = None  # (rtt, dev_us, host midpoint)
+        drift_ppm = 0.0
+        for _ in range(rounds):
+            t0 = time.time_ns() // 1000
+            resp = self.query({"sync": {"host_us": t0}}, verbose=verbose, retries=1)
+            t1 = time.time_ns() // 1000
+            if not resp or "dev_us" not in resp or resp.get("host_us") != t0:
+                continue
+            drift_ppm = float(resp.get("drift_ppm", 0.0))
+            rtt = t1 - t0
+            if best is None or rtt < best[0]:
+                best = (rtt, int(resp["dev_us"]), (t0 + t1) // 2)
+        if best is None:
+            return None
+        rtt, dev_us, host_us = best
+        return ClockSync(offset_us=host_us - dev_us, drift_ppm=drift_ppm, ref_dev_us=dev_us, rtt_us=rtt)
+
 
 def response_ok(resp: dict) -> bool:
     if resp.get("ok"):
@@ -259,8 +329,25 @@ def run_comm_tests(
     )
     if ok:
         protocol_pass += 1
+    else:
+        return fw_ok, protocol_pass, True, device_fw
+
+    # a flag reads back as a JSON boolean and must be accepted as one
+    resp = dev.query({"get": ["r_learn"]}, verbose=verbose)
+    r_learn = resp.get("r_learn") if resp else None
+    if not isinstance(r_learn, bool):
+        return fw_ok, protocol_pass, True, device_fw
+    resp = dev.query({"set": {"r_learn": r_learn}}, verbose=verbose)
+    if not resp or not response_ok(resp) or resp.get("r_learn") is not r_learn:
+        return fw_ok, protocol_pass, True, device_fw
+    protocol_pass += 1
+
+    clock = dev.sync(rounds=4, verbose=verbose)
+    if clock is not None:
+        log(f"  clock offset {clock.offset_us:.0f} us (rtt {clock.rtt_us} us)", verbose=verbose)
+        protocol_pass += 1
 
-    return fw_ok, protocol_pass, protocol_pass < 4, device_fw
+    return fw_ok, protocol_pass, protocol_pass < PROTOCOL_TESTS, device_fw
 
 
 def run_sensor_tests(dev: Device, *, verbose: bool) -> tuple[str, str]:
@@ -298,6 +385,313 @@ def run_sensor_tests(dev: Device, *, verbose: bool) -> tuple[str, str]:
     return "PASS", ""
 
 
+def parse_mix(spec: str) -> list[tuple[str, int]]:
+    """"config:3,all:1" -> [("config", 3), ("all", 1)]; the weight defaults to 1."""
+    mix = []
+    for part in spec.split(","):
+        kind, _, weight = part.strip().partition(":")
+        if kind not in BENCH_KINDS:
+            raise ValueError(f"unknown request kind {kind!r} in mix {spec!r} (one of {', '.join(BENCH_KINDS)})")
+        try:
+            n = int(weight) if weight else 1
+        except ValueError:
+            n = 0
+        if n < 1:
+            raise ValueError(f"bad weight {weight!r} in mix {spec!r}")
+        mix.append((kind, n))
+    return mix
+
+
+def bench_error(kind: str, resp: dict | None) -> str | None:
+    if resp is None:
+        return "timeout"
+    if "_parse_error" in resp:
+        return "bad_json"
+    if "error" in resp:
+        return str(resp["error"])
+    if kind == "set" and not response_ok(resp):
+        return "not_ok"
+    return None
+
+
+def percentile(sorted_vals: list[float], p: float) -> float:
+    """Nearest-rank percentile of an ascending list."""
+    return sorted_vals[max(0, math.ceil(p / 100.0 * len(sorted_vals)) - 1)]
+
+
+@dataclass
+class BenchStats:
+    latencies_us: list[float] = field(default_factory=list)  # answered requests only
+    errors: Counter = field(default_factory=Counter)
+    requests: int = 0
+
+    def add(self, latency_us: float, error: str | None) -> None:
+        self.requests += 1
+        if error != "timeout":
+            self.latencies_us.append(latency_us)
+        if error:
+            self.errors[error] += 1
+
+    def merge(self, other: BenchStats) -> None:
+        self.latencies_us += other.latencies_us
+        self.errors.update(other.errors)
+        self.requests += other.requests
+
+    def summary(self, elapsed_s: float) -> dict:
+        lat = sorted(self.latencies_us)
+        n_err = sum(self.errors.values())
+        out = {
+            "requests": self.requests,
+            "rps": round(self.requests / elapsed_s, 1) if elapsed_s > 0 else 0.0,
+            "errors": n_err,
+            "error_rate": round(n_err / self.requests, 6) if self.requests else 0.0,
+            "error_codes": dict(self.errors),
+            "latency_us": None,
+        }
+        if lat:
+            out["latency_us"] = {
+                "min": round(lat[0]),
+                "mean": round(sum(lat) / len(lat)),
+                "p50": round(percentile(lat, 50)),
+                "p90": round(percentile(lat, 90)),
+                "p99": round(percentile(lat, 99)),
+                "max": round(lat[-1]),
+            }
+        return out
+
+
+def run_bench_mix(
+    dev: Device, mix: list[tuple[str, int]], requests: dict[str, dict], seconds: float, *, verbose: bool
+) -> dict:
+    """One request at a time, round robin over the weighted mix, for `seconds`.
+
+    Latency is the round trip as Device.query sees it: write, flush, and read
+    up to the response line. A request that times out is counted as an error
+    and left out of the latency figures, and whatever arrives late is drained
+    so it cannot be taken for the next response.
+    """
+    schedule = [kind for kind, weight in mix for _ in range(weight)]
+    for k in range(BENCH_WARMUP):
+        if dev.query(requests[schedule[k % len(schedule)]], verbose=verbose, retries=1) is None:
+            drain_input(dev.ser, 0.0)
+
+    per_kind = {kind: BenchStats() for kind, _ in mix}
+    start = time.perf_counter()
+    deadline = start + seconds
+    i = 0
+    while time.perf_counter() < deadline:
+        kind = schedule[i % len(schedule)]
+        i += 1
+        t0 = time.perf_counter_ns()
+        resp = dev.query(requests[kind], verbose=verbose, retries=1)
+        latency_us = (time.perf_counter_ns() - t0) / 1000.0
+        per_kind[kind].add(latency_us, bench_error(kind, resp))
+        if resp is None:
+            drain_input(dev.ser, 0.0)
+    elapsed = time.perf_counter() - start
+
+    total = BenchStats()
+    for stats in per_kind.values():
+        total.merge(stats)
+    result = {"mix": ",".join(f"{kind}:{weight}" for kind, weight in mix), "seconds": round(elapsed, 3)}
+    result.update(total.summary(elapsed))
+    if len(per_kind) > 1:
+        result["kinds"] = {kind: stats.summary(elapsed) for kind, stats in per_kind.items()}
+    return result
+
+
+def print_bench(report: dict) -> None:
+    print()
+    print(f"BENCH fw {report['fw']} on {report['port']}, {report['seconds_per_mix']:g} s per mix")
+    print(f"{'mix':<24} {'req/s':>8} {'p50 us':>8} {'p90 us':>8} {'p99 us':>8} {'max us':>8}  errors")
+
+    def row(label: str, s: dict) -> None:
+        lat = s["latency_us"] or {}
+        cols = " ".join(f"{lat.get(p, '-'):>8}" for p in ("p50", "p90", "p99", "max"))
+        errors = f"{s['errors']} ({s['error_rate'] * 100:.2f}%)"
+        if s["error_codes"]:
+            errors += " " + " ".join(f"{code}={n}" for code, n in sorted(s["error_codes"].items()))
+        print(f"{label:<24} {s['rps']:>8.1f} {cols}  {errors}")
+
+    for result in report["mixes"]:
+        row(result["mix"], result)
+        for kind, s in result.get("kinds", {}).items():
+            row(f"  {kind}", s)
+
+
+def run_bench(
+    dev: Device, args: argparse.Namespace, mixes: list[list[tuple[str, int]]], expected_fw: str, port: str
+) -> int:
+    resp = dev.query({"get": ["fw"] + BENCH_CONFIG_FIELDS}, verbose=args.verbose)
+    if resp is None or "fw" not in resp:
+        print("error: no response to the initial GET", file=sys.stderr)
+        return 2
+    device_fw = resp["fw"]
+    if expected_fw and device_fw != expected_fw:
+        print(f"error: device runs fw {device_fw}, expected {expected_fw}", file=sys.stderr)
+        return 2
+    missing = [k for k in BENCH_CONFIG_FIELDS if k not in resp]
+    if missing:
+        print(f"error: device did not report {', '.join(missing)}", file=sys.stderr)
+        return 2
+    requests = {
+        "config": {"get": BENCH_CONFIG_FIELDS},
+        "v": {"get": ["v"]},
+        "all": {"get": "all"},
+        "set": {"set": {k: resp[k] for k in BENCH_CONFIG_FIELDS}},
+    }
+
+    report = {
+        "time": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+        "fw": device_fw,
+        "port": port,
+        "seconds_per_mix": args.bench,
+        "timeout_s": args.timeout,
+        "mixes": [],
+    }
+    for mix in mixes:
+        report["mixes"].append(run_bench_mix(dev, mix, requests, args.bench, verbose=args.verbose))
+
+    if args.bench_json == "-":
+        json.dump(report, sys.stdout, indent=2)
+        print()
+    else:
+        print_bench(report)
+        if args.bench_json:
+            with open(args.bench_json, "w") as f:
+                json.dump(report, f, indent=2)
+                f.write("\n")
+    return 0
+
+
+def test_unit(dev: Device, results: Results, expected_fw: str, *, verbose: bool) -> None:
+    fw_ok, protocol_pass, comm_failed, results.device_fw = run_comm_tests(dev, expected_fw, verbose=verbose)
+    results.protocol_pass = protocol_pass
+    results.protocol_total = PROTOCOL_TESTS
+    results.firmware = "PASS" if fw_ok else "FAIL"
+    results.comm_failed = comm_failed or not fw_ok
+
+    if results.comm_failed:
+        results.sensor = "SKIP"
+        results.sensor_detail = "comm tests failed"
+    else:
+        results.sensor, results.sensor_detail = run_sensor_tests(dev, verbose=verbose)
+
+
+@dataclass
+class FleetUnit:
+    serial: str | None  # None if it cannot be read from the port name
+    port: str | None  # None while in BOOTSEL mode
+
+
+def bootsel_serials() -> list[str]:
+    """Serial numbers of the RP2040s in BOOTSEL mode, from sysfs."""
+    serials = []
+    for vendor_path in glob.glob("/sys/bus/usb/devices/*/idVendor"):
+        dev_dir = Path(vendor_path).parent
+        try:
+            ids = ((dev_dir / "idVendor").read_text().strip(), (dev_dir / "idProduct").read_text().strip())
+            if ids == BOOTSEL_USB_ID:
+                serials.append((dev_dir / "serial").read_text().strip())
+        except OSError:
+            continue
+    return serials
+
+
+def enumerate_fleet(expect: int, timeout: float) -> list[FleetUnit]:
+    """Every power_monitor port and BOOTSEL device, waiting up to `timeout` for `expect` of them."""
+    deadline = time.monotonic() + timeout
+    while True:
+        units: dict[str, FleetUnit] = {}
+        for port in sorted(glob.glob(SERIAL_GLOB)):
+            match = PORT_SERIAL_RE.search(os.path.basename(port))
+            serial = match.group(1) if match else None
+            units[serial or port] = FleetUnit(serial, port)
+        for serial in bootsel_serials():
+            units.setdefault(serial, FleetUnit(serial, None))
+        if len(units) >= expect or time.monotonic() >= deadline:
+            return [units[k] for k in sorted(units)]
+        time.sleep(0.5)
+
+
+def run_fleet_unit(unit: FleetUnit, args: argparse.Namespace, uf2: Path | None, expected_fw: str) -> Results:
+    """Flash and test one unit of the fleet; errors end up in its Results, not raised."""
+    results = Results(unit=unit.serial or unit.port or "?")
+    _log_ctx.prefix = f"[{results.unit}] "
+    t0 = time.monotonic()
+    try:
+        if args.skip_flash:
+            if unit.port is None:
+                raise RuntimeError("in BOOTSEL mode (flash it, or drop --skip-flash)")
+            port = unit.port
+        else:
+            if unit.serial is None:
+                raise RuntimeError("no serial number in the port name, so picotool cannot target it")
+            picotool_flash(uf2, unit.serial, verbose=args.verbose)
+            results.flash = "PASS"
+            port = find_port(unit.serial, args.timeout)
+        results.port = port
+        results.serial_comm = "PASS"
+
+        dev = Device(port, args.timeout, settle_s=0.5 if args.skip_flash else 2.5)
+        try:
+            test_unit(dev, results, expected_fw, verbose=args.verbose)
+        finally:
+            dev.close()
+    except (RuntimeError, TimeoutError, OSError) as exc:
+        # one line for the table
+        results.messages.append(" ".join(str(exc).split())[:160] or type(exc).__name__)
+        if not args.skip_flash and results.flash != "PASS":
+            results.flash = "FAIL"
+            results.flash_failed = True
+        else:
+            results.comm_failed = True
+    results.elapsed_s = time.monotonic() - t0
+    return results
+
+
+def print_fleet(rows: list[Results], found: int, expect: int, wall_s: float) -> None:
+    print()
+    print(f"{'UNIT':<18} {'PORT':<9} {'FLASH':<6} {'COMM':<5} {'FIRMWARE':<20} {'PROTO':<5} {'SENSOR':<6} {'TIME':>6}  DETAIL")
+    for r in rows:
+        fw = f"{r.firmware} ({r.device_fw})" if r.device_fw else r.firmware
+        port = os.path.relpath(os.path.realpath(r.port), "/dev") if r.port else "-"
+        proto = f"{r.protocol_pass}/{r.protocol_total}"
+        detail = "; ".join(d for d in (*r.messages, r.sensor_detail) if d)
+        print(f"{r.unit:<18} {port:<9} {r.flash:<6} {r.serial_comm:<5} {fw:<20} {proto:<5} {r.sensor:<6} "
+              f"{r.elapsed_s:>5.1f}s  {detail}")
+    passed = sum(1 for r in rows if r.exit_code() == 0)
+    print(f"{found} units: {passed} passed, {found - passed} failed, wall time {wall_s:.1f} s")
+    if found < expect:
+        print(f"  expected {expect} units, found {found}")
+
+
+def run_fleet(args: argparse.Namespace, uf2: Path | None, expected_fw: str) -> int:
+    t0 = time.monotonic()
+    units = enumerate_fleet(args.expect, args.timeout)
+    if not units:
+        print(f"error: no devices found ({SERIAL_GLOB} or BOOTSEL)", file=sys.stderr)
+        return 2
+    n_bootsel = sum(1 for u in units if u.port is None)
+    print(f"Found {len(units)} units ({n_bootsel} in BOOTSEL), {args.jobs} at a time")
+
+    rows: list[Results] = []
+    with ThreadPoolExecutor(max_workers=args.jobs) as pool:
+        futures = [pool.submit(run_fleet_unit, u, args, uf2, expected_fw) for u in units]
+        for fut in as_completed(futures):
+            r = fut.result()
+            rows.append(r)
+            print(f"  {r.unit}: {'PASS' if r.exit_code() == 0 else 'FAIL'} ({r.elapsed_s:.1f} s)", flush=True)
+    rows.sort(key=lambda r: r.unit)
+    print_fleet(rows, len(units), args.expect, time.monotonic() - t0)
+
+    # the most basic failure wins: flash (1), then comm (2), then sensor (3)
+    codes = [r.exit_code() for r in rows if r.exit_code()]
+    if codes:
+        return min(codes)
+    return 2 if len(units) < args.expect else 0
+
+
 def print_summary(results: Results, expected_fw: str, device_fw: str | None) -> None:
     print()
     print(f"FLASH/VERIFY     {results.flash}")
@@ -324,24 +718,61 @@ def main() -> int:
     parser.add_argument("--skip-flash", action="store_true", help="Skip picotool flash; run tests only")
     parser.add_argument("--build", action="store_true", help="Build firmware before flashing")
     parser.add_argument("--serial", help="Target device serial number (picotool --ser)")
+    parser.add_argument("--port", help="Serial port to test instead of searching /dev/serial/by-id "
+                        "(e.g. the pty of power_monitor_host --pty)")
+    parser.add_argument("--fw", help="Expected firmware version instead of the UF2's (\"host\" for the mock); "
+                        "with --skip-flash no UF2 is needed")
+    parser.add_argument("--bench", type=float, metavar="S",
+                        help="Instead of the tests, benchmark request latency and throughput for S seconds per mix")
+    parser.add_argument("--mix", action="append", metavar="KIND[:W],...",
+                        help="Weighted request mix for --bench; KIND is one of " + ", ".join(BENCH_KINDS)
+                        + " (repeatable, one run per mix; default: " + ", ".join(BENCH_DEFAULT_MIXES) + " in turn)")
+    parser.add_argument("--bench-json", metavar="FILE",
+                        help="Also write the --bench report as JSON to FILE ('-': JSON only, to stdout)")
+    parser.add_argument("--fleet", action="store_true",
+                        help="Flash and test every power_monitor port and BOOTSEL device in parallel")
+    parser.add_argument("--jobs", type=int, default=8, help="Units handled at once with --fleet")
+    parser.add_argument("--expect", type=int, default=1,
+                        help="With --fleet, wait up to --timeout for this many units; fewer is a failure")
     parser.add_argument("--timeout", type=float, default=10.0, help="Serial wait/read timeout in seconds")
     parser.add_argument("--verbose", action="store_true", help="Print every serial request/response")
     args = parser.parse_args()
+    try:
+        mixes = [parse_mix(spec) for spec in (args.mix or BENCH_DEFAULT_MIXES)]
+    except ValueError as exc:
+        parser.error(str(exc))
+    if (args.mix or args.bench_json) and not args.bench:
+        parser.error("--mix and --bench-json need --bench")
+    if args.bench is not None and args.bench <= 0:
+        parser.error("--bench needs a positive number of seconds")
+    if args.fleet and (args.serial or args.port or args.bench):
+        parser.error("--fleet finds its own units; it does not take --serial, --port or --bench")
+    if args.jobs < 1:
+        parser.error("--jobs must be at least 1")
+    # progress lines stay off stdout when it carries the JSON report
+    info = sys.stderr if args.bench_json == "-" else sys.stdout
 
     results = Results()
     expected_fw = ""
-    device_fw: str | None = None
     tracked_serial = args.serial
 
     try:
         if args.build:
             maybe_build(verbose=args.verbose)
 
-        uf2 = resolve_uf2(args.uf2)
-        print(f"Using UF2: {uf2}")
+        # with --skip-flash, --fw or --bench (which only checks a version it is
+        # given) there is no need for a UF2
+        uf2 = None
+        if not args.skip_flash or not (args.fw or args.bench):
+            uf2 = resolve_uf2(args.uf2)
+            print(f"Using UF2: {uf2}", file=info)
 
-        expected_fw = picotool_info_version(uf2, verbose=args.verbose)
-        print(f"Expected firmware version: {expected_fw}")
+        if args.fw or uf2:
+            expected_fw = args.fw or picotool_info_version(uf2, verbose=args.verbose)
+            print(f"Expected firmware version: {expected_fw}", file=info)
+
+        if args.fleet:
+            return run_fleet(args, uf2, expected_fw)
 
         if args.skip_flash:
             results.flash = "SKIP"
@@ -349,26 +780,19 @@ def main() -> int:
             tracked_serial = picotool_flash(uf2, args.serial, verbose=args.verbose) or tracked_serial
             results.flash = "PASS"
 
-        port = find_port(tracked_serial, args.timeout)
-        print(f"Serial port: {port}")
+        port = args.port or find_port(tracked_serial, args.timeout)
+        print(f"Serial port: {port}", file=info)
         results.serial_comm = "PASS"
 
         settle_s = 0.5 if args.skip_flash else 2.5
         dev = Device(port, args.timeout, settle_s=settle_s)
+        if args.bench:
+            try:
+                return run_bench(dev, args, mixes, expected_fw, port)
+            finally:
+                dev.close()
         try:
-            fw_ok, protocol_pass, comm_failed, device_fw = run_comm_tests(
-                dev, expected_fw, verbose=args.verbose
-            )
-            results.protocol_pass = protocol_pass
-            results.protocol_total = 4
-            results.firmware = "PASS" if fw_ok else "FAIL"
-            results.comm_failed = comm_failed or not fw_ok
-
-            if results.comm_failed:
-                results.sensor = "SKIP"
-                results.sensor_detail = "comm tests failed"
-            else:
-                results.sensor, results.sensor_detail = run_sensor_tests(dev, verbose=args.verbose)
+            test_unit(dev, results, expected_fw, verbose=args.verbose)
         finally:
             dev.close()
 
@@ -377,7 +801,7 @@ def main() -> int:
         results.flash_failed = not args.skip_flash
         if args.skip_flash:
             results.comm_failed = True
-        print_summary(results, expected_fw, device_fw)
+        print_summary(results, expected_fw, results.device_fw)
         return 1 if results.flash_failed else 2
     except RuntimeError as exc:
         print(f"error: {exc}", file=sys.stderr)
@@ -386,16 +810,16 @@ def main() -> int:
             results.flash_failed = True
         else:
             results.comm_failed = True
-        print_summary(results, expected_fw, device_fw)
+        print_summary(results, expected_fw, results.device_fw)
         code = results.exit_code()
         return code if code != 0 else 2
     except TimeoutError as exc:
         print(f"error: {exc}", file=sys.stderr)
         results.comm_failed = True
-        print_summary(results, expected_fw, device_fw)
+        print_summary(results, expected_fw, results.device_fw)
         return 2
 
-    print_summary(results, expected_fw, device_fw)
+    print_summary(results, expected_fw, results.device_fw)
     return results.exit_code()
 
 
@@ -0,0 +1,141 @@
+/*
+ * Host-side simulator for the INA226 alert comparator.
+ *
+ * Feeds a v/a trace through the same rule selection and comparator the
+ * firmware uses (ina226_alert.c) and prints the {"event":"alert",...} lines
+ * the device would emit. The input is CSV with a header row; it needs "v" and
+ * "a" columns plus either "t_s" (seconds) or "timestamp" (ISO 8601, as written
+ * to HB5power.log).
+ *
+ *   alert_sim [--bus-uv V] [--oc A] [--op W] [--bus-ov V] [--latch]
+ *             [--shunt-ohms R] [--i-max A] [log.csv]
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ina226_alert.h"
+#include "trace_csv.h"
+
+static void emit(alert_rule_t rule, int active, const char *src, unsigned long long t_us, float limit, float v, float a, float w) {
+    printf("{\"event\":\"alert\",\"rule\":\"%s\",\"active\":%s,\"src\":\"%s\",\"t_us\":%llu,\"limit\":%.3f,\"v\":%.3f,\"a\":%.4f,\"w\":%.4f}\n",
+           ina226_alert_rule_name(rule), active ? "true" : "false", src, t_us, limit, v, a, w);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: alert_sim [--bus-uv V] [--oc A] [--op W] [--bus-ov V] [--latch] [--shunt-ohms R] [--i-max A] [log.csv]\n");
+}
+
+int main(int argc, char **argv) {
+    float limits[ALERT_RULE_COUNT] = {0};
+    float shunt_ohms = 0.1f, i_max = 2.0f;
+    int latch = 0;
+    const char *path = NULL;
+
+    for (int k = 1; k < argc; k++) {
+        const char *arg = argv[k];
+        int has_val = k + 1 < argc;
+        if (!strcmp(arg, "--bus-uv") && has_val)          limits[ALERT_BUS_UV] = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--oc") && has_val)         limits[ALERT_OVER_CURRENT] = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--op") && has_val)         limits[ALERT_OVER_POWER] = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--bus-ov") && has_val)     limits[ALERT_BUS_OV] = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--shunt-ohms") && has_val) shunt_ohms = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--i-max") && has_val)      i_max = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--latch"))                 latch = 1;
+        else if (arg[0] == '-' && arg[1]) { usage(); return 2; }
+        else path = arg;
+    }
+
+    FILE *in = path ? fopen(path, "r") : stdin;
+    if (!in) { perror(path); return 1; }
+
+    // same calibration as ina226_init()
+    ina226_scale_t sc = { shunt_ohms, i_max / 32768.0f, 25.0f * i_max / 32768.0f };
+    uint16_t cal = (uint16_t)(0.00512f / (sc.current_lsb * sc.shunt_ohms) + 0.5f);
+    for (int k = 0; k < ALERT_RULE_COUNT; k++) {
+        float fs = ina226_alert_full_scale((alert_rule_t)k, &sc);
+        if (fabsf(limits[k]) >= fs)
+            fprintf(stderr, "%s limit %g is beyond what the chip measures (%g); it will never trip\n",
+                    ina226_alert_rule_name((alert_rule_t)k), limits[k], fs);
+    }
+
+    ina226_alert_model_t chip;
+    ina226_alert_model_init(&chip);
+    int hw = ina226_alert_pick_hw(limits);
+    if (hw >= 0) {
+        ina226_alert_model_write(&chip, INA226_REG_ALERT, ina226_alert_limit((alert_rule_t)hw, limits[hw], &sc));
+        ina226_alert_model_write(&chip, INA226_REG_MASK,
+                                 ina226_alert_function((alert_rule_t)hw, limits[hw]) | (latch ? INA226_MASK_LEN : 0));
+    }
+
+    char line[TRACE_LINE_MAX];
+    char *cols[TRACE_MAX_COLS];
+    trace_cols_t tc;
+    if (!fgets(line, sizeof(line), in)) { fprintf(stderr, "empty input\n"); return 1; }
+    if (trace_header(cols, trace_split(line, cols, TRACE_MAX_COLS), &tc)) {
+        fprintf(stderr, "need v, a and t_s or timestamp columns\n");
+        return 1;
+    }
+
+    int active[ALERT_RULE_COUNT] = {0};
+    unsigned long events[ALERT_RULE_COUNT] = {0};
+    unsigned long rows = 0;
+    double t0 = 0.0;
+
+    while (fgets(line, sizeof(line), in)) {
+        int n = trace_split(line, cols, TRACE_MAX_COLS);
+        double t;
+        if (trace_row_time(cols, n, &tc, &t)) continue;
+        if (!rows) t0 = t;
+        unsigned long long t_us = (unsigned long long)llround((t - t0) * 1e6);
+        rows++;
+
+        // raw registers as the chip would compute them
+        float v = strtof(cols[tc.v], NULL), a = strtof(cols[tc.a], NULL);
+        long shunt = lroundf(a * shunt_ohms / 2.5e-6f);
+        if (shunt > 32767) shunt = 32767;
+        if (shunt < -32768) shunt = -32768;
+        long bus = lroundf(v / 1.25e-3f);
+        if (bus < 0) bus = 0;
+        if (bus > 32767) bus = 32767; // BUS is 15 bits
+        long cur = shunt * cal / 2048;
+        long pwr = labs(cur) * bus / 20000;
+        int overflow = pwr > 65535 || cur > 32767 || cur < -32768;
+        if (pwr > 65535) pwr = 65535;
+        float w = (float)pwr * sc.power_lsb;
+
+        if (ina226_alert_model_convert(&chip, (int16_t)shunt, (uint16_t)bus, (uint16_t)pwr, overflow) && hw >= 0) {
+            active[hw] = chip.asserted;
+            events[hw]++;
+            emit((alert_rule_t)hw, chip.asserted, "hw", t_us, limits[hw], v, a, w);
+        }
+        // the firmware reads Mask/Enable for CVRF after every conversion
+        ina226_alert_model_read_mask(&chip);
+        if (latch && hw >= 0 && active[hw] && !chip.asserted) {
+            active[hw] = 0;
+            events[hw]++;
+            emit((alert_rule_t)hw, 0, "hw", t_us, limits[hw], v, a, w);
+        }
+
+        for (int k = 0; k < ALERT_RULE_COUNT; k++) {
+            if (k == hw || limits[k] == 0.0f) continue;
+            alert_rule_t rule = (alert_rule_t)k;
+            int hit = ina226_alert_compare(ina226_alert_function(rule, limits[k]),
+                                           ina226_alert_limit(rule, limits[k], &sc),
+                                           (int16_t)shunt, (uint16_t)bus, (uint16_t)pwr);
+            if (hit == active[k]) continue;
+            active[k] = hit;
+            events[k]++;
+            emit(rule, hit, "sw", t_us, limits[k], v, a, w);
+        }
+    }
+    if (in != stdin) fclose(in);
+
+    fprintf(stderr, "rows=%lu hw_rule=%s", rows, hw >= 0 ? ina226_alert_rule_name((alert_rule_t)hw) : "none");
+    for (int k = 0; k < ALERT_RULE_COUNT; k++) {
+        if (limits[k] != 0.0f) fprintf(stderr, " %s=%lu", ina226_alert_rule_name((alert_rule_t)k), events[k]);
+    }
+    fprintf(stderr, "\n");
+    return 0;
+}
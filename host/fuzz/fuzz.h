@@ -0,0 +1,22 @@
+#ifndef PM_FUZZ_H
+#define PM_FUZZ_H
+
+/*
+ * Shared by the fuzz targets. Each target #includes pm_core.c so it can reach
+ * the static reader and parsers directly, and defines the libFuzzer entry
+ * point; with gcc, fuzz_main.c supplies main() (replay, AFL, or a built-in
+ * mutator).
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+// Property violations abort like a sanitizer report, so every driver keeps the input.
+#define FUZZ_CHECK(cond) do { \
+    if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); abort(); } \
+} while (0)
+
+#endif
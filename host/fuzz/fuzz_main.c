@@ -0,0 +1,295 @@
+/*
+ * main() for the fuzz targets when they are not linked with libFuzzer (gcc
+ * builds, AFL). It runs LLVMFuzzerTestOneInput() on:
+ * - each file given, and every file in each directory given (replay a corpus
+ *   or a crash under the sanitizers)
+ * - stdin if no paths are given, which is how AFL drives it
+ *   (afl-fuzz -i host/fuzz/corpus -o out -x host/fuzz/pm.dict -- fuzz_requests);
+ *   built with afl-clang-fast it loops in persistent mode
+ * - with --mutate N, N random mutations of those inputs, spliced with each
+ *   other and with --dict tokens. This has no coverage feedback, but finds the
+ *   shallow bugs and runs anywhere the sanitizers do.
+ *
+ *   fuzz_requests [--mutate N] [--seed S] [--dict FILE] [--max-len L] [--crash-dir DIR] [FILE|DIR]...
+ *
+ * When a check or a sanitizer stops the run, the input is written to
+ * crash-<hash> in --crash-dir (default .) for replay.
+ */
+#define _DEFAULT_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/common_interface_defs.h>
+#define HAVE_DEATH_CALLBACK 1
+#endif
+
+#include "fuzz.h"
+
+#define MAX_INPUTS 4096
+#define MAX_TOKENS 512
+
+typedef struct {
+    uint8_t *data;
+    size_t   len;
+} blob_t;
+
+static blob_t      g_inputs[MAX_INPUTS];
+static int         g_n_inputs = 0;
+static blob_t      g_tokens[MAX_TOKENS];
+static int         g_n_tokens = 0;
+static const char *g_crash_dir = ".";
+
+// the input being run, for the crash handlers
+static const uint8_t *g_cur = NULL;
+static size_t         g_cur_len = 0;
+
+// Async-signal-safe: write the current input to crash-<fnv1a>.
+static void save_crash(void) {
+    if (!g_cur) return;
+    uint32_t h = 2166136261u;
+    for (size_t k = 0; k < g_cur_len; k++) h = (h ^ g_cur[k]) * 16777619u;
+    char path[512];
+    size_t n = strlen(g_crash_dir);
+    if (n > sizeof(path) - 32) n = sizeof(path) - 32;
+    memcpy(path, g_crash_dir, n);
+    memcpy(path + n, "/crash-", 7);
+    n += 7;
+    for (int k = 7; k >= 0; k--) path[n++] = "0123456789abcdef"[(h >> (k * 4)) & 15];
+    path[n] = '\0';
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+    if (write(fd, g_cur, g_cur_len) < 0) { /* nothing more to do from here */ }
+    close(fd);
+    static const char msg[] = "input saved to ";
+    if (write(2, msg, sizeof(msg) - 1) < 0 || write(2, path, n) < 0 || write(2, "\n", 1) < 0) { /* ditto */ }
+    g_cur = NULL;
+}
+
+static void on_signal(int sig) {
+    save_crash();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void run(const uint8_t *data, size_t len) {
+    g_cur = data;
+    g_cur_len = len;
+    LLVMFuzzerTestOneInput(data, len);
+    g_cur = NULL;
+}
+
+static int read_file(const char *path, blob_t *b) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    size_t cap = 4096, n = 0;
+    uint8_t *buf = malloc(cap);
+    size_t got;
+    while (buf && (got = fread(buf + n, 1, cap - n, f)) > 0) {
+        n += got;
+        if (n == cap) buf = realloc(buf, cap *= 2);
+    }
+    fclose(f);
+    if (!buf) return -1;
+    b->data = buf;
+    b->len = n;
+    return 0;
+}
+
+static void add_input(const char *path) {
+    if (g_n_inputs == MAX_INPUTS) return;
+    if (read_file(path, &g_inputs[g_n_inputs])) { perror(path); exit(1); }
+    g_n_inputs++;
+}
+
+static void add_path(const char *path) {
+    struct stat st;
+    if (stat(path, &st)) { perror(path); exit(1); }
+    if (!S_ISDIR(st.st_mode)) { add_input(path); return; }
+    struct dirent **names;
+    int n = scandir(path, &names, NULL, alphasort);
+    if (n < 0) { perror(path); exit(1); }
+    for (int k = 0; k < n; k++) {
+        char sub[1024];
+        snprintf(sub, sizeof(sub), "%s/%s", path, names[k]->d_name);
+        if (names[k]->d_name[0] != '.' && !stat(sub, &st) && S_ISREG(st.st_mode)) add_input(sub);
+        free(names[k]);
+    }
+    free(names);
+}
+
+// Dictionary in the libFuzzer/AFL format: [name=]"value" per line, with \\, \" and \xNN escapes.
+static void load_dict(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) { perror(path); exit(1); }
+    char line[512];
+    while (fgets(line, sizeof(line), f) && g_n_tokens < MAX_TOKENS) {
+        char *q = strchr(line, '"');
+        if (line[0] == '#' || !q) continue;
+        uint8_t tok[256];
+        size_t n = 0;
+        for (char *p = q + 1; *p && *p != '"' && n < sizeof(tok); p++) {
+            if (*p != '\\') { tok[n++] = (uint8_t)*p; continue; }
+            p++;
+            if (*p == 'x' && p[1] && p[2]) {
+                char hex[3] = { p[1], p[2], 0 };
+                tok[n++] = (uint8_t)strtoul(hex, NULL, 16);
+                p += 2;
+            } else if (*p) {
+                tok[n++] = (uint8_t)*p;
+            } else {
+                break;
+            }
+        }
+        if (!n) continue;
+        g_tokens[g_n_tokens].data = malloc(n);
+        memcpy(g_tokens[g_n_tokens].data, tok, n);
+        g_tokens[g_n_tokens++].len = n;
+    }
+    fclose(f);
+}
+
+static uint32_t g_rng = 1;
+static uint32_t rnd(uint32_t n) {
+    uint32_t x = g_rng;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    g_rng = x;
+    return n ? x % n : 0;
+}
+
+// Insert src[0..n) at pos, within cap.
+static size_t insert(uint8_t *buf, size_t len, size_t cap, size_t pos, const uint8_t *src, size_t n) {
+    if (n > cap - len) n = cap - len;
+    memmove(buf + pos + n, buf + pos, len - pos);
+    memcpy(buf + pos, src, n);
+    return len + n;
+}
+
+static size_t mutate(uint8_t *buf, size_t len, size_t cap) {
+    int ops = 1 + (int)rnd(4);
+    while (ops--) {
+        size_t pos = rnd((uint32_t)len + 1);
+        switch (rnd(7)) {
+        case 0: // flip a bit
+            if (len) buf[pos % len] ^= (uint8_t)(1u << rnd(8));
+            break;
+        case 1: { // a random or interesting byte
+            static const uint8_t k_bytes[] = { 0, '"', '\\', '{', '}', '[', ']', ',', ':', '-', '.', 'e', '\n', 0x7F, 0xFF };
+            uint8_t b = rnd(2) ? (uint8_t)rnd(256) : k_bytes[rnd(sizeof(k_bytes))];
+            if (len && rnd(2)) buf[pos % len] = b;
+            else len = insert(buf, len, cap, pos, &b, 1);
+            break;
+        }
+        case 2: // delete a range
+            if (len) {
+                size_t n = 1 + rnd((uint32_t)(len - pos % len < 16 ? len - pos % len : 16));
+                pos %= len;
+                memmove(buf + pos, buf + pos + n, len - pos - n);
+                len -= n;
+            }
+            break;
+        case 3: // duplicate a range
+            if (len) {
+                size_t from = rnd((uint32_t)len), n = 1 + rnd((uint32_t)(len - from));
+                uint8_t tmp[256];
+                if (n > sizeof(tmp)) n = sizeof(tmp);
+                memcpy(tmp, buf + from, n);
+                len = insert(buf, len, cap, pos, tmp, n);
+            }
+            break;
+        case 4: case 5: // a dictionary token
+            if (g_n_tokens) {
+                const blob_t *t = &g_tokens[rnd((uint32_t)g_n_tokens)];
+                len = insert(buf, len, cap, pos, t->data, t->len);
+            }
+            break;
+        default: { // splice in part of another input
+            const blob_t *o = &g_inputs[rnd((uint32_t)g_n_inputs)];
+            if (o->len) {
+                size_t from = rnd((uint32_t)o->len), n = 1 + rnd((uint32_t)(o->len - from));
+                len = insert(buf, len, cap, pos, o->data + from, n);
+            }
+            break;
+        }
+        }
+    }
+    return len;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: fuzz_<target> [--mutate N] [--seed S] [--dict FILE] [--max-len L] [--crash-dir DIR] [FILE|DIR]...\n");
+}
+
+int main(int argc, char **argv) {
+    long mutations = 0;
+    size_t max_len = 4096;
+    for (int k = 1; k < argc; k++) {
+        const char *arg = argv[k];
+        int has_val = k + 1 < argc;
+        if (!strcmp(arg, "--mutate") && has_val)         mutations = strtol(argv[++k], NULL, 0);
+        else if (!strcmp(arg, "--seed") && has_val)      g_rng = (uint32_t)strtoul(argv[++k], NULL, 0) | 1u;
+        else if (!strcmp(arg, "--dict") && has_val)      load_dict(argv[++k]);
+        else if (!strcmp(arg, "--max-len") && has_val)   max_len = strtoul(argv[++k], NULL, 0);
+        else if (!strcmp(arg, "--crash-dir") && has_val) g_crash_dir = argv[++k];
+        else if (arg[0] == '-' && arg[1]) { usage(); return 2; }
+        else add_path(arg);
+    }
+
+    signal(SIGABRT, on_signal);
+    signal(SIGSEGV, on_signal);
+    signal(SIGBUS, on_signal);
+    signal(SIGFPE, on_signal);
+#ifdef HAVE_DEATH_CALLBACK
+    __sanitizer_set_death_callback(save_crash);
+#endif
+
+    if (!g_n_inputs) {
+        blob_t in;
+        if (mutations) { usage(); return 2; }
+#ifdef __AFL_LOOP
+        while (__AFL_LOOP(10000)) {
+#endif
+            if (read_file("/dev/stdin", &in)) { perror("stdin"); return 1; }
+            run(in.data, in.len);
+            free(in.data);
+#ifdef __AFL_LOOP
+        }
+#endif
+        return 0;
+    }
+
+    for (int k = 0; k < g_n_inputs; k++) run(g_inputs[k].data, g_inputs[k].len);
+    if (!mutations) {
+        fprintf(stderr, "ran %d inputs\n", g_n_inputs);
+        return 0;
+    }
+
+    uint8_t *buf = malloc(max_len);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long k = 0; k < mutations; k++) {
+        const blob_t *base = &g_inputs[rnd((uint32_t)g_n_inputs)];
+        size_t len = base->len < max_len ? base->len : max_len;
+        memcpy(buf, base->data, len);
+        len = mutate(buf, len, max_len);
+        // run from an exact-size copy so ASan sees reads past the end
+        uint8_t *in = malloc(len ? len : 1);
+        memcpy(in, buf, len);
+        run(in, len);
+        free(in);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double s = (double)(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    fprintf(stderr, "ran %d inputs and %ld mutations in %.1f s (%.0f execs/s), no failures\n",
+            g_n_inputs, mutations, s, s > 0 ? mutations / s : 0.0);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * parse_get_request() on one NUL-terminated request of arbitrary bytes. The
+ * copy is heap-allocated to its exact size so ASan catches reads past the
+ * end. A rejected field name is echoed into JSON, so it must come back
+ * NUL-terminated, within bad_field, and free of anything that needs escaping.
+ */
+#include "../../pm_core.c"
+
+#include "fuzz.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    char *s = malloc(size + 1);
+    if (!s) return 0;
+    memcpy(s, data, size);
+    s[size] = '\0';
+
+    uint64_t want = 0;
+    char bad_field[32]; // as handle_request()
+    memset(bad_field, 0x55, sizeof(bad_field));
+    int rc = parse_get_request(s, &want, bad_field, sizeof(bad_field));
+    FUZZ_CHECK(rc >= -1 && rc <= 1);
+    if (rc == 1) FUZZ_CHECK((want & ~(GET_BIT(GET_F_COUNT) - 1)) == 0);
+    if (rc == -1) {
+        size_t len = strnlen(bad_field, sizeof(bad_field));
+        FUZZ_CHECK(len < sizeof(bad_field));
+        for (size_t k = 0; k < len; k++) {
+            unsigned char c = (unsigned char)bad_field[k];
+            FUZZ_CHECK(c >= 0x20 && c < 0x7F && c != '"' && c != '\\');
+        }
+    }
+    free(s);
+    return 0;
+}
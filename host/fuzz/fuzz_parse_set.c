@@ -0,0 +1,42 @@
+/*
+ * parse_set_request() and the other parsers that read numbers out of a
+ * request ("stream", "sync") on one NUL-terminated request of arbitrary bytes,
+ * heap-allocated to its exact size. Every value SET accepts must be finite,
+ * since the handler range-checks with comparisons that NaN passes, and an
+ * "ocv" table must be in range and well formed enough for ocv_table_set().
+ */
+#include "../../pm_core.c"
+
+#include "fuzz.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    char *s = malloc(size + 1);
+    if (!s) return 0;
+    memcpy(s, data, size);
+    s[size] = '\0';
+
+    set_request_t req;
+    memset(&req, 0, sizeof(req));
+    if (parse_set_request(s, &req)) {
+        FUZZ_CHECK((req.present & ~(SET_BIT(SET_K_COUNT) - 1)) == 0);
+        FUZZ_CHECK(req.bad >= -1 && req.bad < SET_K_COUNT);
+        for (int k = 0; k < SET_K_COUNT; k++) {
+            if (req.present & SET_BIT(k)) FUZZ_CHECK(isfinite(req.val[k]));
+        }
+        FUZZ_CHECK(req.ocv_preset >= -2 && req.ocv_preset < OCV_PRESET_COUNT);
+        FUZZ_CHECK(req.ocv_n >= -1 && req.ocv_n <= OCV_MAX_POINTS);
+        for (int k = 0; k < req.ocv_n; k++) FUZZ_CHECK(isfinite(req.ocv_v[k]) && isfinite(req.ocv_pct[k]));
+        ocv_table_t t;
+        if (req.ocv_n > 0 && ocv_table_set(&t, req.ocv_v, req.ocv_pct, req.ocv_n) == 0) {
+            for (int k = 0; k < t.n; k++) FUZZ_CHECK(isfinite(t.v[k]) && t.pct[k] >= 0.0f && t.pct[k] <= 100.0f);
+            for (int k = 0; k + 1 < t.n; k++) FUZZ_CHECK(isfinite(t.slope[k]));
+        }
+    }
+
+    uint32_t every;
+    if (parse_stream_request(s, &every) == 1) FUZZ_CHECK(every <= 1000000);
+    int64_t host_us;
+    if (parse_sync_request(s, &host_us) == 1) FUZZ_CHECK(host_us >= 0);
+    free(s);
+    return 0;
+}
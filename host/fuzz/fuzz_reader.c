@@ -0,0 +1,42 @@
+/*
+ * read_json_object() on an arbitrary byte stream, as it would arrive over CDC.
+ * Every object it returns must be complete: it starts with '{', ends with the
+ * '}' that balances it (outside strings), and fits the caller's buffer.
+ * Objects too long for the reader must be dropped whole (-2), never cut up.
+ */
+#include "../../pm_core.c"
+
+#include "fuzz.h"
+#include "hal_host.h"
+
+// The object as the reader should see it: depth returns to 0 only at the end.
+static int object_balanced(const char *s, size_t len) {
+    int depth = 0, in_str = 0, esc = 0;
+    for (size_t k = 0; k < len; k++) {
+        char c = s[k];
+        if (esc) { esc = 0; continue; }
+        if (c == '\\') { esc = 1; continue; }
+        if (c == '"') { in_str = !in_str; continue; }
+        if (in_str) continue;
+        if (c == '{') depth++;
+        else if (c == '}' && --depth == 0) return k == len - 1;
+    }
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static char out[1024]; // as pm_core_poll()
+    hal_host_clock_virtual(1);
+    memset(&g_rx, 0, sizeof(g_rx));
+    hal_host_input_push(data, size);
+
+    while (!hal_host_input_eof()) {
+        int n = read_json_object(out, sizeof(out), 10);
+        FUZZ_CHECK(n >= -2 && n < (int)sizeof(out));
+        if (n <= 0) continue;
+        FUZZ_CHECK(strlen(out) == (size_t)n);
+        FUZZ_CHECK(out[0] == '{');
+        FUZZ_CHECK(object_balanced(out, (size_t)n));
+    }
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * The whole request path: arbitrary bytes go into the host HAL's input queue
+ * and pm_core_poll() runs against the INA226 model in virtual time, long
+ * enough to act on every request (SET, commit, stream and sync included).
+ * Every line the firmware prints must be a single valid JSON value (no NaN or
+ * inf, no unescaped control characters), since hosts parse them as such.
+ *
+ * Each input boots from scratch: hal_host_reset() and pm_core_reset() put the
+ * clock, flash, sampler and every piece of firmware state back to power-on,
+ * the INA226 model is re-initialized and pm_core_init() runs again, so a
+ * crash reproduces from its input alone.
+ */
+#define _GNU_SOURCE // open_memstream
+#include "../../pm_core.c"
+
+#include "fuzz.h"
+#include "hal_host.h"
+#include "ina226_model.h"
+
+#define POLLS_AFTER_INPUT 40     // ~0.4 s of virtual time after the last byte, so a stream emits
+#define MAX_OUTPUT        (1u << 20)
+
+// ======= Minimal strict JSON validator (RFC 8259 grammar) =======
+static const char *json_value(const char *p, int depth);
+
+static const char *json_ws(const char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+    return p;
+}
+
+static const char *json_string(const char *p) {
+    if (*p++ != '"') return NULL;
+    for (;;) {
+        unsigned char c = (unsigned char)*p++;
+        if (c == '"') return p;
+        if (c < 0x20) return NULL; // includes the terminating NUL
+        if (c != '\\') continue;
+        c = (unsigned char)*p++;
+        if (c == 'u') {
+            for (int k = 0; k < 4; k++, p++) if (!isxdigit((unsigned char)*p)) return NULL;
+        } else if (!strchr("\"\\/bfnrt", c) || !c) {
+            return NULL;
+        }
+    }
+}
+
+static const char *json_number(const char *p) {
+    if (*p == '-') p++;
+    if (*p == '0') p++;
+    else if (*p >= '1' && *p <= '9') while (isdigit((unsigned char)*p)) p++;
+    else return NULL;
+    if (*p == '.') {
+        p++;
+        if (!isdigit((unsigned char)*p)) return NULL;
+        while (isdigit((unsigned char)*p)) p++;
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        if (*p == '+' || *p == '-') p++;
+        if (!isdigit((unsigned char)*p)) return NULL;
+        while (isdigit((unsigned char)*p)) p++;
+    }
+    return p;
+}
+
+static const char *json_list(const char *p, char close, int depth, int members) {
+    p = json_ws(p + 1);
+    if (*p == close) return p + 1;
+    for (;;) {
+        if (members) {
+            p = json_string(json_ws(p));
+            if (!p) return NULL;
+            p = json_ws(p);
+            if (*p++ != ':') return NULL;
+        }
+        p = json_value(p, depth + 1);
+        if (!p) return NULL;
+        p = json_ws(p);
+        if (*p == close) return p + 1;
+        if (*p++ != ',') return NULL;
+    }
+}
+
+static const char *json_value(const char *p, int depth) {
+    if (depth > 32) return NULL;
+    p = json_ws(p);
+    switch (*p) {
+    case '{': return json_list(p, '}', depth, 1);
+    case '[': return json_list(p, ']', depth, 0);
+    case '"': return json_string(p);
+    case 't': return strncmp(p, "true", 4) ? NULL : p + 4;
+    case 'f': return strncmp(p, "false", 5) ? NULL : p + 5;
+    case 'n': return strncmp(p, "null", 4) ? NULL : p + 4;
+    default:  return json_number(p);
+    }
+}
+
+static void check_output(char *out) {
+    for (char *line = out, *nl; *line; line = nl + 1) {
+        nl = strchr(line, '\n');
+        FUZZ_CHECK(nl); // every response is newline-terminated
+        *nl = '\0';
+        const char *end = json_value(line, 0);
+        if (!end || *json_ws(end)) {
+            fprintf(stderr, "invalid JSON line: %s\n", line);
+            FUZZ_CHECK(!"invalid JSON");
+        }
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static ina226_model_t ina;
+    static int attached = 0;
+    if (!attached) {
+        hal_host_clock_virtual(1);
+        ina226_model_attach(&ina, INA226_ADDR);
+        attached = 1;
+    }
+
+    char *out = NULL;
+    size_t out_len = 0;
+    FILE *real_stdout = stdout;
+    stdout = open_memstream(&out, &out_len);
+    if (!stdout) { stdout = real_stdout; return 0; }
+
+    hal_host_reset();
+    pm_core_reset();
+    ina226_model_init(&ina, 0.1f, 1);
+    ina.v_bus = 26.0f;
+    ina.i_load = 0.25f;
+    pm_core_init();
+    hal_host_input_push(data, size);
+    for (int idle = 0; idle < POLLS_AFTER_INPUT && out_len < MAX_OUTPUT; ) {
+        pm_core_poll();
+        fflush(stdout);
+        if (hal_host_input_eof()) idle++;
+    }
+
+    fclose(stdout);
+    stdout = real_stdout;
+    check_output(out);
+    free(out);
+    return 0;
+}
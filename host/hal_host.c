@@ -0,0 +1,342 @@
+/*
+ * pm_hal.h on Linux; see hal_host.h. The sampler is the core 1 loop from
+ * power_monitor.c turned into a polled state machine: hal_idle() runs it, so it
+ * gets the same chances to see a conversion as the busy-waiting main loop
+ * gives core 1 on the device.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hal_host.h"
+#include "ina226.h"
+#include "ina226_alert.h"
+#include "pm_hal.h"
+
+#define SAMPLE_RING_LEN   64     // as on the device
+#define ALERT_RING_LEN    16
+#define SAMPLER_POLL_US   100
+#define SAMPLER_EARLY_US  500
+#define VIRTUAL_IDLE_MAX_US 10000 // virtual clock: longest jump per idle (one read_json_object window)
+#define REAL_IDLE_NS      50000  // real clock: sleep this long per idle instead of spinning
+#define FLASH_SLOT_SIZE   4096
+#define INPUT_QUEUE_LEN   65536
+
+// ======= Clock =======
+static int      g_virtual = 0;
+static uint64_t g_virtual_us = 0;
+static struct timespec g_epoch;
+static int      g_epoch_set = 0;
+
+static void sampler_service(void);
+static uint64_t sampler_next_us(void);
+
+uint64_t hal_time_us64(void) {
+    if (g_virtual) return g_virtual_us;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    if (!g_epoch_set) { g_epoch = ts; g_epoch_set = 1; }
+    return (uint64_t)(ts.tv_sec - g_epoch.tv_sec) * 1000000u + (uint64_t)((ts.tv_nsec - g_epoch.tv_nsec) / 1000);
+}
+
+uint32_t hal_time_us32(void) { return (uint32_t)hal_time_us64(); }
+
+// Real nanoseconds even on the virtual clock: {"bench":N} measures the host CPU.
+uint32_t hal_cycles(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec) & HAL_CYCLES_MASK;
+}
+
+uint32_t hal_cycles_hz(void) { return 1000000000u; }
+
+void hal_host_clock_virtual(int on) {
+    g_virtual = on;
+    g_virtual_us = 0;
+}
+
+void hal_host_advance_us(uint64_t us) {
+    if (g_virtual) {
+        g_virtual_us += us;
+    } else {
+        struct timespec ts = { (time_t)(us / 1000000u), (long)(us % 1000000u) * 1000 };
+        nanosleep(&ts, NULL);
+    }
+    sampler_service();
+}
+
+void hal_idle(void) {
+    if (g_virtual) {
+        // nothing happens before the sampler's next poll, so jump straight to it
+        uint64_t next = sampler_next_us();
+        uint64_t step = next > g_virtual_us && next - g_virtual_us < VIRTUAL_IDLE_MAX_US ? next - g_virtual_us : VIRTUAL_IDLE_MAX_US;
+        g_virtual_us += step;
+    } else {
+        struct timespec ts = { 0, REAL_IDLE_NS };
+        nanosleep(&ts, NULL);
+    }
+    sampler_service();
+}
+
+// ======= Input =======
+static int      g_in_fd = -1;
+static int      g_in_tty = 0;    // pty master: a hangup means no client yet, not EOF
+static uint8_t  g_in_q[INPUT_QUEUE_LEN];
+static size_t   g_in_head = 0, g_in_tail = 0;
+
+void hal_host_input_fd(int fd) { g_in_fd = fd; g_in_tty = 0; }
+void hal_host_input_tty(int fd) { g_in_fd = fd; g_in_tty = 1; }
+
+void hal_host_input_push(const void *data, size_t len) {
+    if (g_in_head == g_in_tail) g_in_head = g_in_tail = 0;
+    if (len > sizeof(g_in_q) - g_in_tail) len = sizeof(g_in_q) - g_in_tail; // drop the excess, like a full CDC buffer
+    memcpy(g_in_q + g_in_tail, data, len);
+    g_in_tail += len;
+}
+
+int hal_host_input_eof(void) {
+    return g_in_fd < 0 && g_in_head == g_in_tail;
+}
+
+int hal_getchar(void) {
+    if (g_in_head != g_in_tail) return g_in_q[g_in_head++];
+    if (g_in_fd < 0) return -1;
+    if (!g_virtual) {
+        struct pollfd p = { .fd = g_in_fd, .events = POLLIN };
+        if (poll(&p, 1, 0) <= 0) return -1;
+        if (g_in_tty && !(p.revents & POLLIN)) return -1;
+    }
+    uint8_t buf[512];
+    ssize_t n = read(g_in_fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return -1;
+    if (n <= 0 && g_in_tty) return -1;
+    if (n <= 0) { g_in_fd = -1; return -1; }
+    hal_host_input_push(buf, (size_t)n);
+    return g_in_q[g_in_head++];
+}
+
+// ======= I2C =======
+typedef struct {
+    uint8_t addr;
+    int     used;
+    hal_host_i2c_dev_t dev;
+} i2c_slot_t;
+
+static i2c_slot_t g_i2c[HAL_HOST_I2C_DEVS];
+
+int hal_host_i2c_attach(uint8_t addr, const hal_host_i2c_dev_t *dev) {
+    i2c_slot_t *free_slot = NULL;
+    for (int k = 0; k < HAL_HOST_I2C_DEVS; k++) {
+        if (g_i2c[k].used && g_i2c[k].addr == addr) { free_slot = &g_i2c[k]; break; }
+        if (!g_i2c[k].used && !free_slot) free_slot = &g_i2c[k];
+    }
+    if (!free_slot) return -1;
+    free_slot->addr = addr;
+    free_slot->used = 1;
+    free_slot->dev = *dev;
+    return 0;
+}
+
+static const hal_host_i2c_dev_t *i2c_find(uint8_t addr) {
+    for (int k = 0; k < HAL_HOST_I2C_DEVS; k++) {
+        if (g_i2c[k].used && g_i2c[k].addr == addr) {
+            if (g_i2c[k].dev.advance) g_i2c[k].dev.advance(g_i2c[k].dev.ctx, hal_time_us64());
+            return &g_i2c[k].dev;
+        }
+    }
+    return NULL; // nobody ACKs
+}
+
+int hal_i2c_write16(uint8_t addr, uint8_t reg, uint16_t val) {
+    const hal_host_i2c_dev_t *d = i2c_find(addr);
+    return d && d->write16 && !d->write16(d->ctx, reg, val) ? 0 : -1;
+}
+
+// ======= Flash =======
+static uint8_t     g_flash[2][FLASH_SLOT_SIZE];
+static int         g_flash_init = 0;
+static const char *g_flash_path = NULL;
+
+void hal_host_flash_erase(void) {
+    memset(g_flash, 0xFF, sizeof(g_flash));
+    g_flash_init = 1;
+}
+
+int hal_host_flash_file(const char *path) {
+    hal_host_flash_erase();
+    g_flash_path = path;
+    FILE *f = fopen(path, "rb");
+    if (!f) return errno == ENOENT ? 0 : -1;
+    size_t n = fread(g_flash, 1, sizeof(g_flash), f);
+    fclose(f);
+    return n == sizeof(g_flash) ? 0 : -1;
+}
+
+const uint8_t *hal_flash_slot(int slot) {
+    if (!g_flash_init) hal_host_flash_erase();
+    return g_flash[slot ? 1 : 0];
+}
+
+int hal_flash_write_slot(int slot, const uint8_t *data, size_t len) {
+    if (len > FLASH_SLOT_SIZE || len % HAL_FLASH_PAGE_SIZE) return -1;
+    if (!g_flash_init) hal_host_flash_erase();
+    uint8_t *s = g_flash[slot ? 1 : 0];
+    memset(s, 0xFF, FLASH_SLOT_SIZE);
+    memcpy(s, data, len);
+    if (!g_flash_path) return 0;
+    FILE *f = fopen(g_flash_path, "wb");
+    if (!f) return -1;
+    size_t n = fwrite(g_flash, 1, sizeof(g_flash), f);
+    return fclose(f) == 0 && n == sizeof(g_flash) ? 0 : -1;
+}
+
+// ======= Sampler =======
+static raw_sample_t g_ring[SAMPLE_RING_LEN];
+static uint32_t     g_ring_head = 0, g_ring_tail = 0;
+static alert_edge_t g_alert_ring[ALERT_RING_LEN];
+static uint32_t     g_alert_head = 0, g_alert_tail = 0;
+static int          g_alert_level = 0;  // asserted
+static hal_sampler_stats_t g_stats;
+static diag_hist_t  g_i2c_us;
+static uint32_t     g_nominal_us = 0;    // 0 = not started
+static uint32_t     g_period_us = 0;     // tracked from the sample spacing, as on core 1
+static uint64_t     g_due_us = 0;
+static uint64_t     g_last_t_us = 0;
+static uint32_t     g_popped = 0;
+static int          g_retry = 0;
+static int          g_in_service = 0;
+
+static int sampler_r16(const hal_host_i2c_dev_t *d, uint8_t reg, uint16_t *out) {
+    uint32_t t0 = hal_time_us32();
+    if (!d || !d->read16 || d->read16(d->ctx, reg, out)) { g_stats.i2c_nak++; return -1; }
+    diag_hist_add(&g_i2c_us, hal_time_us32() - t0);
+    return 0;
+}
+
+static void alert_poll(const hal_host_i2c_dev_t *d) {
+    if (!d || !d->alert_pin) return;
+    int level = !d->alert_pin(d->ctx); // active low, as the RP2040 ISR reads it
+    if (level == g_alert_level) return;
+    g_alert_level = level;
+    if (g_alert_head - g_alert_tail >= ALERT_RING_LEN) { g_stats.alert_dropped++; return; }
+    g_alert_ring[g_alert_head++ & (ALERT_RING_LEN - 1)] = (alert_edge_t){ hal_time_us64(), (uint8_t)level };
+}
+
+static void sampler_service(void) {
+    if (!g_nominal_us || g_in_service) return;
+    g_in_service = 1;
+    const hal_host_i2c_dev_t *d = i2c_find(INA226_ADDR);
+    alert_poll(d);
+    uint64_t now = hal_time_us64();
+    if (now >= g_due_us) {
+        uint16_t mask, bus, cur, pwr;
+        if (sampler_r16(d, INA226_REG_MASK, &mask)) {
+            g_stats.i2c_errors++;
+            g_retry = 1;
+            g_due_us = now + SAMPLER_POLL_US;
+        } else if (!(mask & INA226_MASK_CVRF)) {
+            g_due_us = now + SAMPLER_POLL_US;
+        } else if (sampler_r16(d, INA226_REG_BUS, &bus) || sampler_r16(d, INA226_REG_CURRENT, &cur) ||
+                   sampler_r16(d, INA226_REG_POWER, &pwr)) {
+            g_stats.i2c_errors++;
+            g_retry = 1;
+            g_due_us = now + SAMPLER_POLL_US;
+        } else {
+            if (g_ring_head - g_ring_tail >= SAMPLE_RING_LEN) {
+                g_stats.ring_dropped++;
+            } else {
+                g_ring[g_ring_head++ & (SAMPLE_RING_LEN - 1)] =
+                    (raw_sample_t){ now, bus, (int16_t)cur, pwr, mask };
+            }
+            if (g_retry) { g_stats.i2c_retries++; g_retry = 0; }
+            uint64_t gap = now - g_last_t_us;
+            if (g_last_t_us && gap > g_nominal_us - (g_nominal_us >> 2) && gap < g_nominal_us + (g_nominal_us >> 2)) {
+                g_period_us = (uint32_t)gap;
+            }
+            g_last_t_us = now;
+            g_due_us = now + g_period_us - SAMPLER_EARLY_US;
+        }
+    }
+    g_in_service = 0;
+}
+
+static uint64_t sampler_next_us(void) {
+    return g_nominal_us ? g_due_us : UINT64_MAX;
+}
+
+void hal_host_sampler_service(void) { sampler_service(); }
+
+uint32_t hal_host_samples(void) { return g_popped; }
+
+void hal_sampler_start(uint32_t period_us) {
+    g_nominal_us = g_period_us = period_us > SAMPLER_EARLY_US ? period_us : SAMPLER_EARLY_US + 1;
+    g_due_us = hal_time_us64();
+}
+
+int hal_sampler_pop(raw_sample_t *s) {
+    sampler_service();
+    if (g_ring_tail == g_ring_head) return 0;
+    *s = g_ring[g_ring_tail++ & (SAMPLE_RING_LEN - 1)];
+    g_popped++;
+    return 1;
+}
+
+// Nothing runs concurrently here, so writes go straight to the device.
+int hal_sampler_write_reg(uint8_t reg, uint16_t val) {
+    const hal_host_i2c_dev_t *d = i2c_find(INA226_ADDR);
+    if (!d || !d->write16 || d->write16(d->ctx, reg, val)) { g_stats.i2c_errors++; g_stats.i2c_nak++; }
+    alert_poll(d);
+    return 0;
+}
+
+int hal_alert_pop(uint64_t upto_us, alert_edge_t *e) {
+    if (g_alert_tail == g_alert_head) return 0;
+    const alert_edge_t *q = &g_alert_ring[g_alert_tail & (ALERT_RING_LEN - 1)];
+    if (q->t_us > upto_us) return 0;
+    *e = *q;
+    g_alert_tail++;
+    return 1;
+}
+
+void hal_alert_flush(void) { g_alert_tail = g_alert_head; }
+
+void hal_sampler_stats(hal_sampler_stats_t *st) {
+    *st = g_stats;
+    st->i2c_us = &g_i2c_us;
+}
+
+// ======= Memory =======
+// The process stack has no fixed size to paint; the heap is glibc's main arena.
+void hal_mem_stats(hal_mem_stats_t *m) {
+    memset(m, 0, sizeof(*m));
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 mi = mallinfo2();
+    m->heap_used = (uint32_t)mi.uordblks;
+    m->heap_peak = (uint32_t)mi.arena;
+#endif
+}
+
+// ======= Reset =======
+void hal_host_reset(void) {
+    g_virtual_us = 0;
+    g_epoch_set = 0;
+    g_in_head = g_in_tail = 0;
+    hal_host_flash_erase();
+    g_ring_head = g_ring_tail = 0;
+    g_alert_head = g_alert_tail = 0;
+    g_alert_level = 0;
+    memset(&g_stats, 0, sizeof(g_stats));
+    memset(&g_i2c_us, 0, sizeof(g_i2c_us));
+    g_nominal_us = g_period_us = 0;
+    g_due_us = g_last_t_us = 0;
+    g_popped = 0;
+    g_retry = 0;
+    g_in_service = 0;
+}
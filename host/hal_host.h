@@ -0,0 +1,59 @@
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+/*
+ * Host implementation of pm_hal.h. pm_core.c runs unchanged on top of it with:
+ * - simulated I2C devices, attached by 7-bit address (the sampler polls the
+ *   one at INA226_ADDR the way core 1 does on the RP2040)
+ * - two RAM flash slots, optionally backed by a file
+ * - request bytes from a file descriptor and/or an in-memory queue
+ * - a real monotonic clock, or a virtual one that only moves when the
+ *   firmware idles (deterministic and as fast as the CPU allows)
+ * Responses go to stdout as on the device.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    void *ctx;
+    int (*read16)(void *ctx, uint8_t reg, uint16_t *val);   // 0 on ACK
+    int (*write16)(void *ctx, uint8_t reg, uint16_t val);
+    void (*advance)(void *ctx, uint64_t now_us);            // optional: clock moved to now_us
+    int (*alert_pin)(void *ctx);                            // optional: ALERT level, 1 = high (pulled up)
+} hal_host_i2c_dev_t;
+
+// At most HAL_HOST_I2C_DEVS devices; attaching to a used address replaces it.
+#define HAL_HOST_I2C_DEVS 4
+int  hal_host_i2c_attach(uint8_t addr, const hal_host_i2c_dev_t *dev);
+
+// Clock. Virtual time starts at 0 and, each time the firmware idles, jumps to
+// the sampler's next poll (at most 10 ms ahead); it can also be advanced
+// explicitly.
+void hal_host_clock_virtual(int on);
+void hal_host_advance_us(uint64_t us);
+
+// Input. Queued bytes are read before the fd; -1 disables the fd. In virtual
+// mode the fd is read blocking, since waiting would not advance time anyway.
+// A tty fd (a pty master) never reaches EOF: while no client has the other end
+// open there is just no input, as with an unopened CDC port. Real clock only.
+void hal_host_input_fd(int fd);
+void hal_host_input_tty(int fd);
+void hal_host_input_push(const void *data, size_t len);
+int  hal_host_input_eof(void);      // fd closed (or none) and the queue is empty
+
+// Flash. With a path, the slots are loaded from it (if it exists) and
+// rewritten after every commit.
+int  hal_host_flash_file(const char *path);
+void hal_host_flash_erase(void);
+
+// Poll the attached INA226 now instead of at the next idle.
+void hal_host_sampler_service(void);
+uint32_t hal_host_samples(void);    // samples the firmware has taken from the sampler
+
+// Back to a fresh boot: clock at 0, no queued input, erased flash, sampler
+// stopped with its counters cleared. Attached devices, the clock mode, the
+// input fd and the flash file are kept (the file is rewritten on the next
+// commit). Pair with pm_core_reset().
+void hal_host_reset(void);
+
+#endif
@@ -0,0 +1,164 @@
+#include "ina226_model.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "hal_host.h"
+#include "ina226.h"
+
+#define SHUNT_LSB_V 2.5e-6f
+#define BUS_LSB_V   1.25e-3f
+
+static const uint16_t k_avg_n[8] = { 1, 4, 16, 64, 128, 256, 512, 1024 };
+static const uint16_t k_ct_us[8] = { 140, 204, 332, 588, 1100, 2116, 4156, 8244 };
+
+static unsigned model_mode(const ina226_model_t *m) { return m->config & 7u; }
+static int model_continuous(const ina226_model_t *m) { return (model_mode(m) & 4u) != 0; }
+static int model_powered(const ina226_model_t *m) { return (model_mode(m) & 3u) != 0; } // 000 and 100 are power-down
+
+// standard normal, xorshift32 + Box-Muller
+static float model_gauss(ina226_model_t *m) {
+    float u[2];
+    for (int k = 0; k < 2; k++) {
+        uint32_t x = m->rng;
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        m->rng = x;
+        u[k] = ((float)(x >> 8) + 1.0f) / 16777217.0f; // (0, 1]
+    }
+    return sqrtf(-2.0f * logf(u[0])) * cosf(6.2831853f * u[1]);
+}
+
+void ina226_model_reset(ina226_model_t *m) {
+    m->config = INA226_CONFIG_RESET;
+    m->cal = 0;
+    m->shunt = m->current = 0;
+    m->bus = m->power = 0;
+    ina226_alert_model_init(&m->alert);
+    m->conv_start_us = m->now_us;
+    m->converting = 1;
+    m->conversions = 0;
+}
+
+void ina226_model_init(ina226_model_t *m, float shunt_ohms, uint32_t seed) {
+    *m = (ina226_model_t){ .shunt_ohms = shunt_ohms, .rng = seed ? seed : 1u };
+    ina226_model_reset(m);
+}
+
+uint32_t ina226_model_period_us(const ina226_model_t *m) {
+    uint32_t ct = 0;
+    if (model_mode(m) & 1u) ct += k_ct_us[(m->config >> 3) & 7u];
+    if (model_mode(m) & 2u) ct += k_ct_us[(m->config >> 6) & 7u];
+    return (uint32_t)k_avg_n[(m->config >> 9) & 7u] * ct;
+}
+
+static uint64_t model_period_actual(const ina226_model_t *m) {
+    double p = ina226_model_period_us(m) * (1.0 + m->clock_ppm * 1e-6);
+    return p < 1.0 ? 1 : (uint64_t)llround(p);
+}
+
+static int16_t sat16(float x) { return x >= 32767.0f ? 32767 : x <= -32768.0f ? -32768 : (int16_t)lroundf(x); }
+
+// End of an averaged conversion at t_us: update the result registers and flags.
+static void model_complete(ina226_model_t *m, uint64_t t_us) {
+    float v = m->v_bus, i = m->i_load;
+    if (m->source) m->source(m->source_ctx, t_us, &v, &i);
+    float root_n = sqrtf((float)k_avg_n[(m->config >> 9) & 7u]);
+
+    if (model_mode(m) & 1u) {
+        float vs = i * m->shunt_ohms;
+        if (m->noise_shunt_v > 0.0f) vs += model_gauss(m) * m->noise_shunt_v / root_n;
+        m->shunt = sat16(vs / SHUNT_LSB_V);
+    }
+    if (model_mode(m) & 2u) {
+        float vb = v;
+        if (m->noise_bus_v > 0.0f) vb += model_gauss(m) * m->noise_bus_v / root_n;
+        int16_t b = sat16(vb / BUS_LSB_V);
+        m->bus = b < 0 ? 0 : (uint16_t)b; // 15 bits, never negative
+    }
+
+    int overflow = 0;
+    int32_t cur = (int32_t)m->shunt * m->cal / 2048;
+    if (cur > 32767 || cur < -32768) { overflow = 1; cur = cur > 0 ? 32767 : -32768; }
+    m->current = (int16_t)cur;
+    uint32_t pwr = (uint32_t)abs(cur) * m->bus / 20000u;
+    if (pwr > 0xFFFFu) { overflow = 1; pwr = 0xFFFFu; }
+    m->power = (uint16_t)pwr;
+
+    ina226_alert_model_convert(&m->alert, m->shunt, m->bus, m->power, overflow);
+    m->conversions++;
+}
+
+void ina226_model_advance(ina226_model_t *m, uint64_t now_us) {
+    if (now_us < m->now_us) return;
+    m->now_us = now_us;
+    while (m->converting) {
+        uint64_t p = model_period_actual(m);
+        if (now_us - m->conv_start_us < p) break;
+        if (model_continuous(m)) {
+            // only the newest of several missed results is visible
+            uint64_t n = (now_us - m->conv_start_us) / p;
+            m->conv_start_us += (n - 1) * p;
+            m->conversions += (uint32_t)(n - 1);
+        } else {
+            m->converting = 0; // triggered: one result, then idle
+        }
+        m->conv_start_us += p;
+        model_complete(m, m->conv_start_us);
+    }
+}
+
+int ina226_model_read(ina226_model_t *m, uint8_t reg, uint16_t *val) {
+    switch (reg) {
+    case INA226_REG_CONFIG:  *val = m->config; break;
+    case INA226_REG_SHUNT:   *val = (uint16_t)m->shunt; break;
+    case INA226_REG_BUS:     *val = m->bus; break;
+    case INA226_REG_POWER:   *val = m->power; break;
+    case INA226_REG_CURRENT: *val = (uint16_t)m->current; break;
+    case INA226_REG_CAL:     *val = m->cal; break;
+    case INA226_REG_MASK:    *val = ina226_alert_model_read_mask(&m->alert); break;
+    case INA226_REG_ALERT:   *val = m->alert.limit; break;
+    case INA226_REG_MFG_ID:  *val = INA226_MFG_ID; break;
+    case INA226_REG_DIE_ID:  *val = INA226_DIE_ID; break;
+    default: return -1;
+    }
+    return 0;
+}
+
+int ina226_model_write(ina226_model_t *m, uint8_t reg, uint16_t val) {
+    switch (reg) {
+    case INA226_REG_CONFIG:
+        if (val & 0x8000u) { ina226_model_reset(m); break; }
+        m->config = (val & 0x0FFFu) | 0x4000u; // D14-D12 read back as 100
+        m->alert.flags &= (uint16_t)~INA226_MASK_CVRF;
+        m->conv_start_us = m->now_us;
+        m->converting = model_powered(m);
+        break;
+    case INA226_REG_CAL:
+        m->cal = val & 0x7FFFu; // D15 is reserved
+        break;
+    case INA226_REG_MASK:
+    case INA226_REG_ALERT:
+        ina226_alert_model_write(&m->alert, reg, val);
+        break;
+    case INA226_REG_SHUNT: case INA226_REG_BUS: case INA226_REG_POWER: case INA226_REG_CURRENT:
+    case INA226_REG_MFG_ID: case INA226_REG_DIE_ID:
+        break; // read-only: ACKed, ignored
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+int ina226_model_alert_pin(const ina226_model_t *m) {
+    return ina226_alert_model_pin(&m->alert);
+}
+
+static int attach_read(void *ctx, uint8_t reg, uint16_t *val) { return ina226_model_read(ctx, reg, val); }
+static int attach_write(void *ctx, uint8_t reg, uint16_t val) { return ina226_model_write(ctx, reg, val); }
+static void attach_advance(void *ctx, uint64_t now_us) { ina226_model_advance(ctx, now_us); }
+static int attach_pin(void *ctx) { return ina226_model_alert_pin(ctx); }
+
+int ina226_model_attach(ina226_model_t *m, uint8_t addr) {
+    hal_host_i2c_dev_t dev = { m, attach_read, attach_write, attach_advance, attach_pin };
+    return hal_host_i2c_attach(addr, &dev);
+}
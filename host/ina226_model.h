@@ -0,0 +1,67 @@
+#ifndef INA226_MODEL_H
+#define INA226_MODEL_H
+
+/*
+ * Register-level INA226 for the host build. It covers what the datasheet
+ * specifies for the registers power_monitor.c touches:
+ * - CONFIG: reset, operating modes, and AVG/VBUSCT/VSHCT timing
+ * - SHUNT and BUS, quantized and saturated
+ * - CURRENT and POWER, computed from CAL, with the OVF flag
+ * - Mask/Enable and Alert Limit, with the ALERT pin
+ * - the manufacturer and die ID registers
+ * Writing CONFIG aborts the conversion in progress, as on the chip.
+ * Conversions complete on the model's own clock, which may run off nominal by
+ * clock_ppm like the chip's internal oscillator. The ALERT behaviour is
+ * ina226_alert.c's model.
+ *
+ * The analog inputs are v_bus and i_load, or a source callback sampled at the
+ * end of every conversion. Gaussian noise can be added per raw conversion
+ * (before averaging, so AVG reduces it by sqrt(N)).
+ *
+ * ina226_model_attach() plugs the model into the host HAL's I2C bus.
+ */
+#include <stdint.h>
+
+#include "ina226_alert.h"
+
+#define INA226_REG_MFG_ID   0xFE
+#define INA226_REG_DIE_ID   0xFF
+#define INA226_MFG_ID       0x5449   // "TI"
+#define INA226_DIE_ID       0x2260
+#define INA226_CONFIG_RESET 0x4127   // power-on CONFIG
+
+typedef struct {
+    // analog side (set freely between conversions)
+    float    shunt_ohms;
+    float    v_bus;          // V at IN-/VBUS
+    float    i_load;         // A through the shunt, IN+ to IN-
+    void   (*source)(void *ctx, uint64_t t_us, float *v_bus, float *i_load); // optional, overrides the two above
+    void    *source_ctx;
+    float    noise_bus_v;    // 1-sigma per raw conversion
+    float    noise_shunt_v;
+    float    clock_ppm;      // conversion timing error
+    uint32_t rng;
+
+    // registers
+    uint16_t config, cal;
+    int16_t  shunt, current;
+    uint16_t bus, power;
+    ina226_alert_model_t alert;
+
+    // timing
+    uint64_t now_us;
+    uint64_t conv_start_us;  // start of the conversion in progress
+    int      converting;     // 0 in power-down or after a triggered conversion
+    uint32_t conversions;    // completed since reset
+} ina226_model_t;
+
+void     ina226_model_init(ina226_model_t *m, float shunt_ohms, uint32_t seed);
+void     ina226_model_reset(ina226_model_t *m);  // power-on register state, as CONFIG.RST
+uint32_t ina226_model_period_us(const ina226_model_t *m); // one averaged result, nominal
+void     ina226_model_advance(ina226_model_t *m, uint64_t now_us);
+int      ina226_model_read(ina226_model_t *m, uint8_t reg, uint16_t *val);  // -1 = NAK
+int      ina226_model_write(ina226_model_t *m, uint8_t reg, uint16_t val);
+int      ina226_model_alert_pin(const ina226_model_t *m);                   // 1 = high
+int      ina226_model_attach(ina226_model_t *m, uint8_t addr);
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * Microbenchmarks for the protocol hot paths, in the style of Google
+ * Benchmark. The cases are k_bench_cases in pm_core.c (compiled in here with
+ * PM_BENCH): request ingestion, GET/SET parsing, the OCV lookup and GET
+ * formatting. Each runs until --min-time has passed and reports wall and CPU
+ * ns per op, heap allocations per op (the firmware should make none) and, for
+ * request cases, bytes/s. The firmware runs against the INA226 model, warmed
+ * up so the estimators and the sample behind the GET fields are live.
+ *
+ *   pm_bench [--filter SUBSTR] [--min-time S] [--json]
+ *
+ * --json writes Google Benchmark's JSON, so its tools/compare.py can diff two
+ * runs. The same cases run on the device in a PM_BENCH build:
+ * {"bench":N} answers with cycles per op.
+ */
+#define _GNU_SOURCE
+#include "../pm_core.c"
+
+#include <time.h>
+#include <unistd.h>
+
+#include "hal_host.h"
+#include "ina226_model.h"
+
+// Heap calls made by anything in the process, libc included. glibc lets the
+// program interpose malloc and forward to its own; ASan has to own it instead.
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define COUNT_ALLOCS 1
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void  __libc_free(void *p);
+
+static uint64_t g_allocs = 0;
+
+void *malloc(size_t size) { g_allocs++; return __libc_malloc(size); }
+void *calloc(size_t n, size_t size) { g_allocs++; return __libc_calloc(n, size); }
+void *realloc(void *p, size_t size) { g_allocs++; return __libc_realloc(p, size); }
+void  free(void *p) { __libc_free(p); }
+#endif
+
+typedef struct {
+    const bench_case_t *bc;
+    uint64_t iters;
+    double   real_ns, cpu_ns;  // per op
+    double   allocs;           // per op, -1 if not counted
+    double   bytes_per_s;      // 0 if not a request case
+} result_t;
+
+static double clock_s(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Grow the iteration count until a run lasts min_time, as Google Benchmark does.
+static void run_case(const bench_case_t *bc, double min_time, result_t *res) {
+    uint64_t iters = 1;
+    for (;;) {
+#ifdef COUNT_ALLOCS
+        uint64_t a0 = g_allocs;
+#endif
+        double w0 = clock_s(CLOCK_MONOTONIC), c0 = clock_s(CLOCK_PROCESS_CPUTIME_ID);
+        for (uint64_t k = 0; k < iters; k++) bc->run(bc->req);
+        double wall = clock_s(CLOCK_MONOTONIC) - w0, cpu = clock_s(CLOCK_PROCESS_CPUTIME_ID) - c0;
+        if (wall >= min_time || iters >= (1ull << 34)) {
+            res->bc = bc;
+            res->iters = iters;
+            res->real_ns = wall * 1e9 / (double)iters;
+            res->cpu_ns = cpu * 1e9 / (double)iters;
+#ifdef COUNT_ALLOCS
+            res->allocs = (double)(g_allocs - a0) / (double)iters;
+#else
+            res->allocs = -1.0;
+#endif
+            res->bytes_per_s = bc->req && wall > 0.0 ? (double)strlen(bc->req) * (double)iters / wall : 0.0;
+            return;
+        }
+        double scale = wall > 0.0 ? min_time / wall * 1.4 : 10.0;
+        if (scale > 10.0) scale = 10.0;
+        uint64_t next = (uint64_t)((double)iters * scale);
+        iters = next > iters ? next : iters + 1;
+    }
+}
+
+static const char *human_rate(double x, char *buf, size_t cap) {
+    static const char k_units[] = " kMGT";
+    int u = 0;
+    while (x >= 1024.0 && u < 4) { x /= 1024.0; u++; }
+    snprintf(buf, cap, "%.4g%c", x, k_units[u]);
+    if (buf[strlen(buf) - 1] == ' ') buf[strlen(buf) - 1] = '\0';
+    return buf;
+}
+
+static void print_console(const result_t *res, int n) {
+    char date[32];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    printf("%s\nRunning pm_bench (fw %s)\nRun on %ld CPUs\n", date, FW_VERSION, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("------------------------------------------------------------------------------------------\n");
+    printf("%-28s %13s %15s %12s %9s\n", "Benchmark", "Time", "CPU", "Iterations", "allocs/op");
+    printf("------------------------------------------------------------------------------------------\n");
+    for (int k = 0; k < n; k++) {
+        const result_t *r = &res[k];
+        char allocs[16], rate[32];
+        if (r->allocs < 0.0) snprintf(allocs, sizeof(allocs), "n/a");
+        else snprintf(allocs, sizeof(allocs), "%.3g", r->allocs);
+        printf("%-28s %10.1f ns %12.1f ns %12llu %9s", r->bc->name, r->real_ns, r->cpu_ns,
+               (unsigned long long)r->iters, allocs);
+        if (r->bytes_per_s > 0.0) printf(" bytes_per_second=%s/s", human_rate(r->bytes_per_s, rate, sizeof(rate)));
+        printf("\n");
+    }
+}
+
+static void print_json(const result_t *res, int n) {
+    char date[32];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    printf("{\n  \"context\": {\n    \"date\": \"%s\",\n    \"executable\": \"pm_bench\",\n"
+           "    \"fw\": \"%s\",\n    \"num_cpus\": %ld,\n    \"library_build_type\": \"release\"\n  },\n"
+           "  \"benchmarks\": [\n", date, FW_VERSION, sysconf(_SC_NPROCESSORS_ONLN));
+    for (int k = 0; k < n; k++) {
+        const result_t *r = &res[k];
+        printf("    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n      \"run_type\": \"iteration\",\n"
+               "      \"repetitions\": 1,\n      \"repetition_index\": 0,\n      \"threads\": 1,\n"
+               "      \"iterations\": %llu,\n      \"real_time\": %.4f,\n      \"cpu_time\": %.4f,\n"
+               "      \"time_unit\": \"ns\"",
+               r->bc->name, r->bc->name, (unsigned long long)r->iters, r->real_ns, r->cpu_ns);
+        if (r->allocs >= 0.0) printf(",\n      \"allocs_per_op\": %.4f", r->allocs);
+        if (r->bytes_per_s > 0.0) printf(",\n      \"bytes_per_second\": %.1f", r->bytes_per_s);
+        printf("\n    }%s\n", k + 1 < n ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: pm_bench [--filter SUBSTR] [--min-time S] [--json]\n");
+}
+
+int main(int argc, char **argv) {
+    const char *filter = NULL;
+    double min_time = 0.5;
+    int json = 0;
+    for (int k = 1; k < argc; k++) {
+        const char *arg = argv[k];
+        int has_val = k + 1 < argc;
+        if (!strcmp(arg, "--filter") && has_val)        filter = argv[++k];
+        else if (!strcmp(arg, "--min-time") && has_val) min_time = strtod(argv[++k], NULL);
+        else if (!strcmp(arg, "--json"))                json = 1;
+        else { usage(); return 2; }
+    }
+
+    // firmware up on the model with a few seconds of samples behind it; its
+    // boot output is not part of the report
+    static ina226_model_t ina;
+    ina226_model_init(&ina, 0.1f, 1);
+    ina.v_bus = 26.4f;
+    ina.i_load = 0.8f;
+    hal_host_clock_virtual(1);
+    ina226_model_attach(&ina, INA226_ADDR);
+    FILE *real_stdout = stdout;
+    stdout = fopen("/dev/null", "w");
+    if (!stdout) { perror("/dev/null"); return 1; }
+    if (pm_core_init()) { fprintf(stderr, "pm_core_init failed\n"); return 1; }
+    while (hal_time_us64() < 5000000u) pm_core_poll();
+    fclose(stdout);
+    stdout = real_stdout;
+    bench_setup();
+
+    result_t res[BENCH_CASES];
+    int n = 0;
+    for (size_t c = 0; c < BENCH_CASES; c++) {
+        if (filter && !strstr(k_bench_cases[c].name, filter)) continue;
+        run_case(&k_bench_cases[c], min_time, &res[n++]);
+    }
+    if (json) print_json(res, n);
+    else print_console(res, n);
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * The firmware (pm_core.c) built natively: reads requests on stdin, answers on
+ * stdout, against the register model in ina226_model.c fed a constant bus
+ * voltage and current.
+ *
+ *   power_monitor_host [--v V] [--a A] [--shunt-ohms R] [--noise-bus-mv MV]
+ *                      [--noise-shunt-uv UV] [--clock-ppm PPM] [--seed N]
+ *                      [--no-ina] [--virtual] [--for S] [--flash FILE]
+ *                      [--pty [--link PATH]]
+ *
+ * Input is read from one second after start, so the first GET finds a
+ * reading. Without --for it exits at end of input. --virtual runs on simulated
+ * time: input is read as fast as it comes and time only passes while the
+ * firmware idles, so output is reproducible. --flash keeps settings in FILE
+ * across runs.
+ *
+ * --pty serves a pseudo-terminal instead of stdio, so serial clients (pyserial,
+ * Tcl, minicom) talk to it as to the board: raw mode, CRLF line endings as
+ * from the Pico SDK's USB stdio, output dropped while no client has the port
+ * open, and writes that give up after 500 ms when the client stops reading.
+ * The pty's name goes to stderr; --link also points a symlink at it, e.g.
+ * /dev/serial/by-id/usb-Homebase_power_monitor_MOCK-if00 (as root) so tools
+ * that search by-id find it. It runs until interrupted.
+ *
+ *   echo '{"get":"all"}' | power_monitor_host --virtual --for 2
+ *   power_monitor_host --pty --link /tmp/serial/usb-Homebase_power_monitor_MOCK-if00 --noise-bus-mv 5
+ */
+#define _GNU_SOURCE // fopencookie, posix_openpt
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "hal_host.h"
+#include "ina226.h"
+#include "ina226_model.h"
+#include "pm_core.h"
+#include "pm_hal.h"
+
+#define PTY_WRITE_TIMEOUT_MS 500 // PICO_STDIO_USB_STDOUT_TIMEOUT_US
+
+static int         g_pty = -1;
+static const char *g_link = NULL;
+
+// stdout on the pty master, behaving like stdio_usb: "\n" goes out as "\r\n",
+// nothing is sent while the port is closed, and a client that stops reading
+// costs at most PTY_WRITE_TIMEOUT_MS per write before the rest is dropped.
+static ssize_t pty_write(void *ctx, const char *buf, size_t len) {
+    (void)ctx;
+    struct pollfd p = { .fd = g_pty, .events = POLLOUT };
+    if (poll(&p, 1, 0) == 1 && (p.revents & POLLHUP)) return (ssize_t)len; // not open
+    char out[1024];
+    size_t n = 0;
+    for (size_t k = 0; k <= len; k++) {
+        if (k < len && n + 2 <= sizeof(out)) {
+            if (buf[k] == '\n') out[n++] = '\r';
+            out[n++] = buf[k];
+            continue;
+        }
+        for (size_t off = 0; off < n; ) {
+            ssize_t w = write(g_pty, out + off, n - off);
+            if (w > 0) { off += (size_t)w; continue; }
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0 && errno == EAGAIN && poll(&p, 1, PTY_WRITE_TIMEOUT_MS) == 1 && !(p.revents & POLLHUP)) continue;
+            return (ssize_t)len; // stalled or gone: drop, as the SDK does
+        }
+        n = 0;
+        if (k < len) k--; // out was full: this byte goes in the next chunk
+    }
+    return (ssize_t)len;
+}
+
+static void pty_unlink(void) {
+    if (g_link) unlink(g_link);
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    exit(0); // runs pty_unlink
+}
+
+// Open a pty in raw mode and make it stdin/stdout for the firmware.
+static int pty_open(void) {
+    g_pty = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (g_pty < 0 || grantpt(g_pty) || unlockpt(g_pty)) { perror("posix_openpt"); return -1; }
+    const char *name = ptsname(g_pty);
+    struct termios t;
+    if (!name || tcgetattr(g_pty, &t)) { perror("ptsname"); return -1; }
+    cfmakeraw(&t);
+    tcsetattr(g_pty, TCSANOW, &t);
+
+    if (g_link) {
+        char dir[4096];
+        snprintf(dir, sizeof(dir), "%s", g_link);
+        for (char *sl = strchr(dir + 1, '/'); sl; sl = strchr(sl + 1, '/')) {
+            *sl = '\0';
+            mkdir(dir, 0755); // best effort; symlink() reports what matters
+            *sl = '/';
+        }
+        struct stat st;
+        if (!lstat(g_link, &st) && S_ISLNK(st.st_mode)) unlink(g_link); // stale, from an earlier run
+        if (symlink(name, g_link)) { perror(g_link); g_link = NULL; return -1; }
+        atexit(pty_unlink);
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        signal(SIGHUP, on_signal);
+    }
+    fprintf(stderr, "serving on %s%s%s\n", name, g_link ? " via " : "", g_link ? g_link : "");
+
+    stdout = fopencookie(NULL, "w", (cookie_io_functions_t){ .write = pty_write });
+    if (!stdout) { perror("fopencookie"); return -1; }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: power_monitor_host [--v V] [--a A] [--shunt-ohms R] [--noise-bus-mv MV] [--noise-shunt-uv UV]\n"
+                    "                          [--clock-ppm PPM] [--seed N] [--no-ina] [--virtual] [--for S] [--flash FILE]\n"
+                    "                          [--pty [--link PATH]]\n");
+}
+
+int main(int argc, char **argv) {
+    float v = 26.0f, a = 0.25f, shunt_ohms = 0.1f, noise_bus_v = 0.0f, noise_shunt_v = 0.0f, clock_ppm = 0.0f;
+    uint32_t seed = 1;
+    int virtual_clock = 0, attach = 1, pty = 0;
+    double for_s = 0.0;
+    const char *flash_path = NULL;
+
+    for (int k = 1; k < argc; k++) {
+        const char *arg = argv[k];
+        int has_val = k + 1 < argc;
+        if (!strcmp(arg, "--v") && has_val)                v = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--a") && has_val)           a = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--shunt-ohms") && has_val)  shunt_ohms = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--noise-bus-mv") && has_val)   noise_bus_v = strtof(argv[++k], NULL) * 1e-3f;
+        else if (!strcmp(arg, "--noise-shunt-uv") && has_val) noise_shunt_v = strtof(argv[++k], NULL) * 1e-6f;
+        else if (!strcmp(arg, "--clock-ppm") && has_val)   clock_ppm = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--seed") && has_val)        seed = (uint32_t)strtoul(argv[++k], NULL, 0);
+        else if (!strcmp(arg, "--for") && has_val)         for_s = strtod(argv[++k], NULL);
+        else if (!strcmp(arg, "--flash") && has_val)       flash_path = argv[++k];
+        else if (!strcmp(arg, "--link") && has_val)        g_link = argv[++k];
+        else if (!strcmp(arg, "--pty"))                    pty = 1;
+        else if (!strcmp(arg, "--virtual"))                virtual_clock = 1;
+        else if (!strcmp(arg, "--no-ina"))                 attach = 0;
+        else { usage(); return 2; }
+    }
+    if ((g_link && !pty) || (pty && virtual_clock)) { usage(); return 2; }
+
+    if (pty && pty_open()) return 1;
+    setvbuf(stdout, NULL, _IOLBF, 0); // one response per line, as over CDC
+    hal_host_clock_virtual(virtual_clock);
+    if (flash_path && hal_host_flash_file(flash_path)) { perror(flash_path); return 1; }
+    static ina226_model_t ina;
+    ina226_model_init(&ina, shunt_ohms, seed);
+    ina.v_bus = v;
+    ina.i_load = a;
+    ina.noise_bus_v = noise_bus_v;
+    ina.noise_shunt_v = noise_shunt_v;
+    ina.clock_ppm = clock_ppm;
+    if (attach) ina226_model_attach(&ina, INA226_ADDR);
+    pm_core_init();
+    while (hal_time_us64() < 1000000u) pm_core_poll(); // let a few conversions land first, like USB enumeration
+    if (pty) hal_host_input_tty(g_pty);
+    else hal_host_input_fd(0);
+
+    uint64_t end_us = (uint64_t)(for_s * 1e6);
+    while (!hal_host_input_eof() || hal_time_us64() < end_us) pm_core_poll();
+    return 0;
+}
@@ -0,0 +1,411 @@
+// Reader and writer for the columnar log format (pm_log.h).
+#include "pm_log.h"
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "the format is read and written in host order");
+
+namespace pmlog {
+
+namespace {
+
+const size_t FILE_HEADER = 16, BLOCK_HEADER = 32, INDEX_ENTRY = 32, TRAILER = 24;
+
+uint32_t crc32(const uint8_t *p, size_t n) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t k = 0; k < 256; k++) {
+            uint32_t c = k;
+            for (int b = 0; b < 8; b++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[k] = c;
+        }
+        return t;
+    }();
+    uint32_t c = ~0u;
+    while (n--) c = table[(c ^ *p++) & 0xff] ^ (c >> 8);
+    return ~c;
+}
+
+template <typename T> T get(const uint8_t *p) {
+    T v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+template <typename T> void put(std::string &s, T v) {
+    s.append(reinterpret_cast<const char *>(&v), sizeof v);
+}
+
+uint64_t zigzag(uint64_t v) { return (v << 1) ^ (uint64_t)((int64_t)v >> 63); }
+uint64_t unzigzag(uint64_t u) { return (u >> 1) ^ (0 - (u & 1)); }
+
+// one word as a tag byte (shift << 4 | len) and its nonzero middle bytes
+void put_word(std::string &tags, std::string &payload, uint64_t x) {
+    if (!x) {
+        tags += '\0';
+        return;
+    }
+    int shift = __builtin_ctzll(x) / 8, len = 8 - __builtin_clzll(x) / 8 - shift;
+    tags += (char)(shift << 4 | len);
+    x >>= 8 * shift;
+    for (int k = 0; k < len; k++, x >>= 8) payload += (char)(x & 0xff);
+}
+
+// a section of n words, which must use exactly `bytes`
+bool get_words(const uint8_t *p, size_t bytes, uint32_t n, uint64_t *out) {
+    if (bytes < n) return false;
+    const uint8_t *q = p + n, *end = p + bytes;
+    for (uint32_t i = 0; i < n; i++) {
+        int len = p[i] & 15, shift = p[i] >> 4;
+        if (len + shift > 8 || len > end - q) return false;
+        uint64_t x = 0;
+        for (int k = 0; k < len; k++) x |= (uint64_t)q[k] << 8 * (shift + k);
+        q += len;
+        out[i] = x;
+    }
+    return q == end;
+}
+
+} // namespace
+
+// ---- Reader ----
+
+bool Reader::fail(const std::string &why) {
+    err_ = why;
+    return false;
+}
+
+bool Reader::open(const std::string &path) {
+    close();
+    err_.clear();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return fail(path + ": " + strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)FILE_HEADER) {
+        ::close(fd);
+        return fail(path + ": not a pmlog file");
+    }
+    size_ = (size_t)st.st_size;
+    void *p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        size_ = 0;
+        return fail(path + ": " + strerror(errno));
+    }
+    map_ = static_cast<const uint8_t *>(p);
+
+    uint16_t ncols = get<uint16_t>(map_ + 6);
+    header_bytes_ = get<uint32_t>(map_ + 8);
+    if (get<uint32_t>(map_) != MAGIC || header_bytes_ % 8 || header_bytes_ < FILE_HEADER || header_bytes_ > size_) {
+        close();
+        return fail(path + ": not a pmlog file");
+    }
+    if (get<uint16_t>(map_ + 4) != VERSION) {
+        close();
+        return fail(path + ": unsupported pmlog version");
+    }
+    const char *names = reinterpret_cast<const char *>(map_ + FILE_HEADER);
+    const char *end = reinterpret_cast<const char *>(map_ + header_bytes_);
+    while (cols_.size() < ncols && names < end) {
+        size_t n = strnlen(names, (size_t)(end - names));
+        if (names + n == end) break;
+        cols_.emplace_back(names, n);
+        names += n + 1;
+    }
+    if (cols_.size() != ncols) {
+        close();
+        return fail(path + ": bad column names");
+    }
+    if (!load_index()) {
+        recovered_ = true;
+        scan_blocks();
+    }
+    return true;
+}
+
+void Reader::close() {
+    if (map_) munmap(const_cast<uint8_t *>(map_), size_);
+    map_ = nullptr;
+    size_ = 0;
+    cols_.clear();
+    blocks_.clear();
+    recovered_ = false;
+}
+
+bool Reader::load_index() {
+    if (size_ < header_bytes_ + TRAILER) return false;
+    const uint8_t *tr = map_ + size_ - TRAILER;
+    uint64_t at = get<uint64_t>(tr);
+    uint32_t n = get<uint32_t>(tr + 8);
+    if (get<uint32_t>(tr + 20) != END_MAGIC || at < header_bytes_ || at + (uint64_t)n * INDEX_ENTRY + TRAILER != size_)
+        return false;
+    if (crc32(map_ + at, (size_t)n * INDEX_ENTRY) != get<uint32_t>(tr + 12)) return false;
+    size_t min_block = BLOCK_HEADER + 4 * (cols_.size() + 1);
+    uint64_t next = header_bytes_;
+    for (uint32_t k = 0; k < n; k++) {
+        const uint8_t *e = map_ + at + (size_t)k * INDEX_ENTRY;
+        BlockInfo b{get<int64_t>(e), get<int64_t>(e + 8), get<uint64_t>(e + 16), get<uint32_t>(e + 24),
+                    get<uint32_t>(e + 28)};
+        if (b.offset != next || !b.rows || b.bytes < min_block || b.offset + b.bytes > at) {
+            blocks_.clear();
+            return false;
+        }
+        next = b.offset + b.bytes;
+        blocks_.push_back(b);
+    }
+    return true;
+}
+
+void Reader::scan_blocks() {
+    size_t min_block = BLOCK_HEADER + 4 * (cols_.size() + 1);
+    for (uint64_t off = header_bytes_; off + BLOCK_HEADER <= size_;) {
+        const uint8_t *p = map_ + off;
+        BlockInfo b{get<int64_t>(p + 8), get<int64_t>(p + 16), off, get<uint32_t>(p + 4), get<uint32_t>(p + 24)};
+        if (get<uint32_t>(p) != BLOCK_MAGIC || !b.rows || b.bytes < min_block || b.bytes > size_ - off) break;
+        if (crc32(p + BLOCK_HEADER, b.bytes - BLOCK_HEADER) != get<uint32_t>(p + 28)) break;
+        blocks_.push_back(b);
+        off += b.bytes;
+    }
+}
+
+int Reader::column(const std::string &name) const {
+    for (size_t k = 0; k < cols_.size(); k++) {
+        if (cols_[k] == name) return (int)k;
+    }
+    return -1;
+}
+
+uint64_t Reader::rows() const {
+    uint64_t n = 0;
+    for (const BlockInfo &b : blocks_) n += b.rows;
+    return n;
+}
+
+uint64_t Reader::data_end() const {
+    return blocks_.empty() ? header_bytes_ : blocks_.back().offset + blocks_.back().bytes;
+}
+
+bool Reader::read(int64_t t0, int64_t t1, const std::vector<int> &cols, Series &out) {
+    out.t.clear();
+    out.values.assign(cols.size(), {});
+    for (int c : cols) {
+        if (c < 0 || (size_t)c >= cols_.size()) return fail("no such column");
+    }
+    size_t nsec = cols_.size() + 1;
+    std::vector<uint64_t> w;
+    std::vector<int64_t> t;
+    std::vector<uint32_t> pick;
+    for (const BlockInfo &b : blocks_) {
+        if (b.t_max < t0 || b.t_min > t1) continue;
+        const uint8_t *p = map_ + b.offset;
+        if (get<uint32_t>(p) != BLOCK_MAGIC || get<uint32_t>(p + 4) != b.rows || get<uint32_t>(p + 24) != b.bytes ||
+            (!recovered_ && crc32(p + BLOCK_HEADER, b.bytes - BLOCK_HEADER) != get<uint32_t>(p + 28)))
+            return fail("corrupt block at offset " + std::to_string(b.offset));
+
+        // section offsets
+        std::vector<size_t> at(nsec + 1);
+        at[0] = BLOCK_HEADER + 4 * nsec;
+        for (size_t s = 0; s < nsec; s++) at[s + 1] = at[s] + get<uint32_t>(p + BLOCK_HEADER + 4 * s);
+        if (at[nsec] != b.bytes) return fail("corrupt block at offset " + std::to_string(b.offset));
+
+        w.resize(b.rows);
+        t.resize(b.rows);
+        if (!get_words(p + at[0], at[1] - at[0], b.rows, w.data()))
+            return fail("corrupt block at offset " + std::to_string(b.offset));
+        uint64_t d = 0;
+        t[0] = (int64_t)unzigzag(w[0]);
+        for (uint32_t i = 1; i < b.rows; i++) {
+            d += unzigzag(w[i]);
+            t[i] = (int64_t)((uint64_t)t[i - 1] + d);
+        }
+        pick.clear();
+        for (uint32_t i = 0; i < b.rows; i++) {
+            if (t[i] >= t0 && t[i] <= t1) pick.push_back(i);
+        }
+        if (pick.empty()) continue;
+        for (uint32_t i : pick) out.t.push_back(t[i]);
+
+        for (size_t k = 0; k < cols.size(); k++) {
+            size_t s = (size_t)cols[k] + 1;
+            if (!get_words(p + at[s], at[s + 1] - at[s], b.rows, w.data()))
+                return fail("corrupt block at offset " + std::to_string(b.offset));
+            for (uint32_t i = 1; i < b.rows; i++) w[i] ^= w[i - 1];
+            std::vector<double> &v = out.values[k];
+            size_t base = v.size();
+            v.resize(base + pick.size());
+            for (size_t j = 0; j < pick.size(); j++) memcpy(&v[base + j], &w[pick[j]], sizeof(double));
+        }
+    }
+    return true;
+}
+
+// ---- Writer ----
+
+bool Writer::fail(const std::string &why) {
+    err_ = why;
+    return false;
+}
+
+bool Writer::open(const std::string &path, const std::vector<std::string> &columns, const Options &opt) {
+    close();
+    err_.clear();
+    if (columns.empty() || columns.size() > 0xffff) return fail("a log needs 1 to 65535 columns");
+    for (const std::string &c : columns) {
+        if (c.empty() || c.find('\0') != std::string::npos) return fail("bad column name");
+    }
+    opt_ = opt;
+    if (!opt_.block_rows) opt_.block_rows = 1;
+    ncols_ = columns.size();
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return fail(path + ": " + strerror(errno));
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        ::close(fd);
+        return fail(path + ": in use by another writer");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return fail(path + ": " + strerror(errno));
+    }
+    fd_ = fd;
+    if (st.st_size == 0) {
+        std::string names;
+        for (const std::string &c : columns) names += c + '\0';
+        names.resize((names.size() + 7) / 8 * 8, '\0');
+        std::string h;
+        put<uint32_t>(h, MAGIC);
+        put<uint16_t>(h, VERSION);
+        put<uint16_t>(h, (uint16_t)ncols_);
+        put<uint32_t>(h, (uint32_t)(FILE_HEADER + names.size()));
+        put<uint32_t>(h, 0);
+        h += names;
+        if (pwrite(fd_, h.data(), h.size(), 0) != (ssize_t)h.size()) {
+            fail(path + ": " + strerror(errno));
+            ::close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        end_ = h.size();
+    } else {
+        // pick up where the last writer stopped, dropping anything after its
+        // last whole block
+        Reader r;
+        if (!r.open(path) || r.columns() != columns) {
+            fail(r.error().empty() ? path + ": written with other columns" : r.error());
+            ::close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        blocks_ = r.blocks();
+        end_ = r.data_end();
+    }
+    if (!write_index()) {
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    return true;
+}
+
+bool Writer::append(int64_t t_us, const double *values) {
+    if (fd_ < 0) return fail("not open");
+    t_.push_back(t_us);
+    rows_.insert(rows_.end(), values, values + ncols_);
+    if (t_.size() >= opt_.block_rows || (opt_.max_block_us && t_us - t_.front() >= opt_.max_block_us))
+        return write_block();
+    return true;
+}
+
+bool Writer::flush() {
+    return fd_ < 0 || t_.empty() || write_block();
+}
+
+void Writer::close() {
+    if (fd_ < 0) return;
+    flush();
+    ::close(fd_);
+    fd_ = -1;
+    blocks_.clear();
+    t_.clear();
+    rows_.clear();
+}
+
+bool Writer::write_block() {
+    uint32_t n = (uint32_t)t_.size();
+    std::vector<std::string> tags(ncols_ + 1), payload(ncols_ + 1);
+    for (std::string &s : tags) s.reserve(n);
+
+    // time: t0, then the first delta, then changes of delta
+    BlockInfo b{t_[0], t_[0], end_, n, 0};
+    uint64_t prev_d = 0;
+    put_word(tags[0], payload[0], zigzag((uint64_t)t_[0]));
+    for (uint32_t i = 1; i < n; i++) {
+        uint64_t d = (uint64_t)t_[i] - (uint64_t)t_[i - 1];
+        put_word(tags[0], payload[0], zigzag(d - prev_d));
+        prev_d = d;
+        b.t_min = std::min(b.t_min, t_[i]);
+        b.t_max = std::max(b.t_max, t_[i]);
+    }
+    for (size_t c = 0; c < ncols_; c++) {
+        uint64_t prev = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            uint64_t x;
+            memcpy(&x, &rows_[(size_t)i * ncols_ + c], sizeof x);
+            put_word(tags[c + 1], payload[c + 1], x ^ prev);
+            prev = x;
+        }
+    }
+
+    std::string body;
+    for (size_t s = 0; s <= ncols_; s++) put<uint32_t>(body, (uint32_t)(tags[s].size() + payload[s].size()));
+    for (size_t s = 0; s <= ncols_; s++) body += tags[s] + payload[s];
+    b.bytes = (uint32_t)(BLOCK_HEADER + body.size());
+
+    std::string blk;
+    put<uint32_t>(blk, BLOCK_MAGIC);
+    put<uint32_t>(blk, n);
+    put<int64_t>(blk, b.t_min);
+    put<int64_t>(blk, b.t_max);
+    put<uint32_t>(blk, b.bytes);
+    put<uint32_t>(blk, crc32(reinterpret_cast<const uint8_t *>(body.data()), body.size()));
+    blk += body;
+    if (pwrite(fd_, blk.data(), blk.size(), (off_t)end_) != (ssize_t)blk.size())
+        return fail(std::string("write: ") + strerror(errno));
+    end_ += blk.size();
+    blocks_.push_back(b);
+    t_.clear();
+    rows_.clear();
+    return write_index();
+}
+
+bool Writer::write_index() {
+    std::string idx;
+    for (const BlockInfo &b : blocks_) {
+        put<int64_t>(idx, b.t_min);
+        put<int64_t>(idx, b.t_max);
+        put<uint64_t>(idx, b.offset);
+        put<uint32_t>(idx, b.rows);
+        put<uint32_t>(idx, b.bytes);
+    }
+    uint32_t crc = crc32(reinterpret_cast<const uint8_t *>(idx.data()), idx.size());
+    put<uint64_t>(idx, end_);
+    put<uint32_t>(idx, (uint32_t)blocks_.size());
+    put<uint32_t>(idx, crc);
+    put<uint32_t>(idx, 0);
+    put<uint32_t>(idx, END_MAGIC);
+    if (pwrite(fd_, idx.data(), idx.size(), (off_t)end_) != (ssize_t)idx.size() ||
+        ftruncate(fd_, (off_t)(end_ + idx.size())) != 0)
+        return fail(std::string("write: ") + strerror(errno));
+    return true;
+}
+
+} // namespace pmlog
@@ -0,0 +1,137 @@
+#ifndef PM_LOG_H
+#define PM_LOG_H
+
+/*
+ * A compact columnar log of monitor readings (.pmlog), for histories that
+ * run to months: pmd --log writes one, pmlog converts HB5power.log-style CSV
+ * into one, and readers here and in pm_log.py map the file and decode only
+ * the blocks and columns a time range needs.
+ *
+ * Rows are a timestamp (int64 us since 1970) plus any number of named double
+ * columns (NaN = no value). They are stored in blocks of up to a few
+ * thousand rows. Within a block every column is its own section:
+ *   - time: delta-of-delta of the timestamps, zigzag-encoded
+ *   - values: each double's bits XORed with the previous value's
+ * so a regular log interval and a steady reading both encode as zeros. Each
+ * 64-bit word is then stored as a tag byte plus its nonzero middle bytes:
+ * tag = shift << 4 | len, the word being len bytes at byte offset shift
+ * (tag 0 = zero). This is Gorilla's XOR scheme at byte rather than bit
+ * granularity, so numpy can decode a section without a Python loop.
+ *
+ * Layout, little-endian:
+ *   header   u32 magic "PML1", u16 version, u16 columns, u32 header_bytes,
+ *            u32 reserved, then the column names, each NUL-terminated,
+ *            zero-padded to header_bytes (a multiple of 8)
+ *   blocks   u32 magic "PMLB", u32 rows, i64 t_min, i64 t_max, u32 bytes
+ *            (whole block), u32 crc32 of the rest of the block,
+ *            u32 section_bytes[columns + 1] (time first), then the sections:
+ *            rows tag bytes, then the payload bytes
+ *   index    one entry per block: i64 t_min, i64 t_max, u64 offset,
+ *            u32 rows, u32 bytes
+ *   trailer  u64 index_offset, u32 blocks, u32 crc32 of the index,
+ *            u32 reserved, u32 magic "PMLE"
+ *
+ * Blocks are never rewritten. A new one goes where the index was, followed by
+ * a new index and trailer, so a file cut short by a crash still has every
+ * whole block before the cut: without a valid trailer, readers walk the block
+ * headers instead and stop at the first one that fails its CRC.
+ */
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pmlog {
+
+static const uint32_t MAGIC = 0x314c4d50u;       // "PML1"
+static const uint32_t BLOCK_MAGIC = 0x424c4d50u; // "PMLB"
+static const uint32_t END_MAGIC = 0x454c4d50u;   // "PMLE"
+static const uint16_t VERSION = 1;
+
+struct BlockInfo {
+    int64_t t_min, t_max;
+    uint64_t offset;
+    uint32_t rows, bytes;
+};
+
+// Rows of a time range: t[k] and values[c][k] for each requested column c.
+struct Series {
+    std::vector<int64_t> t;
+    std::vector<std::vector<double>> values;
+};
+
+class Reader {
+public:
+    Reader() = default;
+    ~Reader() { close(); }
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+
+    bool open(const std::string &path);
+    void close();
+    const std::string &error() const { return err_; }
+
+    const std::vector<std::string> &columns() const { return cols_; }
+    int column(const std::string &name) const;  // -1 if absent
+    const std::vector<BlockInfo> &blocks() const { return blocks_; }
+    uint64_t rows() const;
+    bool recovered() const { return recovered_; }  // no valid index; blocks were walked
+    uint64_t data_end() const;                     // end of the last whole block
+
+    // Rows with t0 <= t <= t1 in file order, for columns `cols` (indices);
+    // only blocks overlapping the range are touched. False on a corrupt block.
+    bool read(int64_t t0, int64_t t1, const std::vector<int> &cols, Series &out);
+
+private:
+    bool fail(const std::string &why);
+    bool load_index();
+    void scan_blocks();
+
+    const uint8_t *map_ = nullptr;
+    size_t size_ = 0;
+    uint32_t header_bytes_ = 0;
+    std::vector<std::string> cols_;
+    std::vector<BlockInfo> blocks_;
+    bool recovered_ = false;
+    std::string err_;
+};
+
+class Writer {
+public:
+    struct Options {
+        uint32_t block_rows = 4096;
+        // Also end a block once it spans this much time (0 = only when full),
+        // which bounds what a crash can lose from a slow log.
+        int64_t max_block_us = 0;
+    };
+
+    Writer() = default;
+    ~Writer() { close(); }
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+
+    // Creates `path`, or appends to it if it is a log with the same columns.
+    bool open(const std::string &path, const std::vector<std::string> &columns, const Options &opt);
+    bool append(int64_t t_us, const double *values);  // one value per column
+    bool flush();  // write out the rows held back for the current block
+    void close();
+    bool is_open() const { return fd_ >= 0; }
+    const std::string &error() const { return err_; }
+
+private:
+    bool fail(const std::string &why);
+    bool write_block();
+    bool write_index();
+
+    int fd_ = -1;
+    Options opt_;
+    size_t ncols_ = 0;
+    uint64_t end_ = 0;  // where the next block goes
+    std::vector<BlockInfo> blocks_;
+    std::vector<int64_t> t_;
+    std::vector<double> rows_;  // row-major, ncols_ per row
+    std::string err_;
+};
+
+} // namespace pmlog
+
+#endif
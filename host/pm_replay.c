@@ -0,0 +1,195 @@
+/*
+ * Replays a v/a log through the firmware: the trace drives the simulated
+ * INA226 (ina226_model.c) and pm_core.c runs unchanged on the host HAL in
+ * virtual time. Whatever the firmware prints goes to stdout, including alert
+ * and charging events and the responses to any requests given here. A
+ * throughput report goes to stderr, so this doubles as a benchmark of the
+ * per-sample firmware logic.
+ *
+ * Input CSV as for alert_sim (v, a, and t_s or timestamp). Current is held
+ * from the latest row until the next (zero-order hold), so a load step in a
+ * 1 s or 10 s log stays a step for the IR estimator and charge detection
+ * rather than becoming a ramp. Voltage is linearly interpolated, except across
+ * a step (current moving by IR_EST_SETTLE_MA or more), where it is held too so
+ * the IR drop lands with the current change.
+ * Gaps longer than --max-gap-s (logger not running) are jumped over, which the
+ * firmware sees as a sampling dropout.
+ *
+ *   pm_replay [--init JSON]... [--request JSON --every S] [--speed X]
+ *             [--noise-bus-mv MV] [--noise-shunt-uv UV] [--seed N]
+ *             [--max-gap-s S] [--flash FILE] [log.csv]
+ *
+ * --init requests are sent once at the start, e.g. '{"set":{"capacity_ah":12}}'.
+ * --request is sent every S seconds of log time. --speed paces the replay at X
+ * times real time; by default it runs as fast as it can.
+ *
+ *   pm_replay --init '{"set":{"alert_bus_uv_v":23}}' \
+ *             --request '{"get":["t_us","v","soc","hrs_remaining"]}' --every 3600 HB5power.log
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hal_host.h"
+#include "ina226.h"
+#include "ina226_model.h"
+#include "ir_est.h"
+#include "pm_core.h"
+#include "pm_hal.h"
+#include "trace_csv.h"
+
+#define MAX_INIT 16
+
+typedef struct {
+    double t;   // seconds from the first row
+    float  v, a;
+} row_t;
+
+typedef struct {
+    const row_t *rows;
+    size_t n, cur;  // cur: last row at or before the previous lookup
+} trace_t;
+
+// ina226_model source: the log at device time t_us (the device boots at the
+// first row); a held, v interpolated between steps.
+static void trace_source(void *ctx, uint64_t t_us, float *v, float *a) {
+    trace_t *tr = ctx;
+    double t = (double)t_us * 1e-6;
+    while (tr->cur + 1 < tr->n && tr->rows[tr->cur + 1].t <= t) tr->cur++;
+    const row_t *r0 = &tr->rows[tr->cur];
+    const row_t *r1 = r0 + 1;
+    // across a load step v jumps with a, or the IR drop would lead the step
+    if (tr->cur + 1 >= tr->n || t <= r0->t || fabsf(r1->a - r0->a) * 1000.0f >= IR_EST_SETTLE_MA) {
+        *v = r0->v;
+        *a = r0->a;
+        return;
+    }
+    float f = (float)((t - r0->t) / (r1->t - r0->t));
+    *v = r0->v + f * (r1->v - r0->v);
+    *a = r0->a;
+}
+
+static double wall_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: pm_replay [--init JSON]... [--request JSON --every S] [--speed X] [--noise-bus-mv MV] [--noise-shunt-uv UV]\n"
+                    "                 [--seed N] [--max-gap-s S] [--flash FILE] [log.csv]\n");
+}
+
+int main(int argc, char **argv) {
+    const char *init[MAX_INIT], *request = NULL, *flash_path = NULL, *path = NULL;
+    int n_init = 0;
+    double every_s = 0.0, speed = 0.0, max_gap_s = 600.0;
+    float noise_bus_v = 0.0f, noise_shunt_v = 0.0f;
+    uint32_t seed = 1;
+
+    for (int k = 1; k < argc; k++) {
+        const char *arg = argv[k];
+        int has_val = k + 1 < argc;
+        if (!strcmp(arg, "--init") && has_val && n_init < MAX_INIT) init[n_init++] = argv[++k];
+        else if (!strcmp(arg, "--request") && has_val)        request = argv[++k];
+        else if (!strcmp(arg, "--every") && has_val)          every_s = strtod(argv[++k], NULL);
+        else if (!strcmp(arg, "--speed") && has_val)          speed = strtod(argv[++k], NULL);
+        else if (!strcmp(arg, "--max-gap-s") && has_val)      max_gap_s = strtod(argv[++k], NULL);
+        else if (!strcmp(arg, "--noise-bus-mv") && has_val)   noise_bus_v = strtof(argv[++k], NULL) * 1e-3f;
+        else if (!strcmp(arg, "--noise-shunt-uv") && has_val) noise_shunt_v = strtof(argv[++k], NULL) * 1e-6f;
+        else if (!strcmp(arg, "--seed") && has_val)           seed = (uint32_t)strtoul(argv[++k], NULL, 0);
+        else if (!strcmp(arg, "--flash") && has_val)          flash_path = argv[++k];
+        else if (arg[0] == '-' && arg[1]) { usage(); return 2; }
+        else path = arg;
+    }
+    if (request && every_s <= 0.0) { fprintf(stderr, "--request needs --every\n"); return 2; }
+
+    FILE *in = path ? fopen(path, "r") : stdin;
+    if (!in) { perror(path); return 1; }
+    char line[TRACE_LINE_MAX];
+    char *cols[TRACE_MAX_COLS];
+    trace_cols_t tc;
+    if (!fgets(line, sizeof(line), in)) { fprintf(stderr, "empty input\n"); return 1; }
+    if (trace_header(cols, trace_split(line, cols, TRACE_MAX_COLS), &tc)) {
+        fprintf(stderr, "need v, a and t_s or timestamp columns\n");
+        return 1;
+    }
+    row_t *rows = NULL;
+    size_t nrows = 0, cap = 0;
+    double t0 = 0.0;
+    while (fgets(line, sizeof(line), in)) {
+        int n = trace_split(line, cols, TRACE_MAX_COLS);
+        double t;
+        if (trace_row_time(cols, n, &tc, &t)) continue;
+        if (!nrows) t0 = t;
+        if (nrows && t - t0 <= rows[nrows - 1].t) continue; // out of order or duplicate
+        if (nrows == cap) {
+            cap = cap ? cap * 2 : 4096;
+            rows = realloc(rows, cap * sizeof(*rows));
+            if (!rows) { perror("realloc"); return 1; }
+        }
+        rows[nrows++] = (row_t){ t - t0, strtof(cols[tc.v], NULL), strtof(cols[tc.a], NULL) };
+    }
+    if (in != stdin) fclose(in);
+    if (nrows < 2) { fprintf(stderr, "need at least two rows\n"); return 1; }
+
+    trace_t tr = { rows, nrows, 0 };
+    static ina226_model_t ina;
+    ina226_model_init(&ina, 0.1f, seed); // the shunt pm_core_init() assumes
+    ina.source = trace_source;
+    ina.source_ctx = &tr;
+    ina.noise_bus_v = noise_bus_v;
+    ina.noise_shunt_v = noise_shunt_v;
+
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+    hal_host_clock_virtual(1);
+    if (flash_path && hal_host_flash_file(flash_path)) { perror(flash_path); return 1; }
+    ina226_model_attach(&ina, INA226_ADDR);
+    pm_core_init();
+    for (int k = 0; k < n_init; k++) hal_host_input_push(init[k], strlen(init[k]));
+
+    double w0 = wall_s();
+    uint64_t end_us = (uint64_t)llround(rows[nrows - 1].t * 1e6);
+    uint64_t next_req_us = request ? (uint64_t)llround(every_s * 1e6) : UINT64_MAX;
+    size_t gap_row = 0;
+    for (;;) {
+        uint64_t now = hal_time_us64();
+        if (now >= end_us) break;
+
+        // jump over logger downtime
+        while (gap_row + 1 < nrows && rows[gap_row + 1].t * 1e6 <= (double)now) gap_row++;
+        if (gap_row + 1 < nrows && rows[gap_row + 1].t - rows[gap_row].t > max_gap_s) {
+            uint64_t resume_us = (uint64_t)llround(rows[gap_row + 1].t * 1e6);
+            if (next_req_us < resume_us) next_req_us = resume_us;
+            hal_host_advance_us(resume_us - now);
+            continue;
+        }
+
+        if (now >= next_req_us) {
+            hal_host_input_push(request, strlen(request));
+            next_req_us += (uint64_t)llround(every_s * 1e6);
+        }
+        pm_core_poll();
+
+        if (speed > 0.0) {
+            double ahead = (double)hal_time_us64() * 1e-6 / speed - (wall_s() - w0);
+            if (ahead > 0.001) {
+                fflush(stdout);
+                struct timespec ts = { (time_t)ahead, (long)((ahead - (time_t)ahead) * 1e9) };
+                nanosleep(&ts, NULL);
+            }
+        }
+    }
+    fflush(stdout);
+
+    double wall = wall_s() - w0;
+    uint32_t samples = hal_host_samples();
+    fprintf(stderr, "rows=%zu span_h=%.2f samples=%lu conversions=%lu wall_s=%.3f samples_per_s=%.0f speedup=%.0fx\n",
+            nrows, rows[nrows - 1].t / 3600.0, (unsigned long)samples, (unsigned long)ina.conversions,
+            wall, wall > 0.0 ? samples / wall : 0.0, wall > 0.0 ? (double)end_us * 1e-6 / wall : 0.0);
+    free(rows);
+    return 0;
+}
@@ -0,0 +1,54 @@
+// Reader side of the pmd shared-memory export (pm_shm.h).
+#define _POSIX_C_SOURCE 200809L // O_CLOEXEC
+#include "pm_shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const pm_shm_t *pm_shm_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(pm_shm_t)) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+    void *p = mmap(NULL, sizeof(pm_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+
+    const pm_shm_t *m = p;
+    if (m->magic != PM_SHM_MAGIC || m->version != PM_SHM_VERSION || m->size != sizeof(pm_shm_t)) {
+        munmap(p, sizeof(pm_shm_t));
+        errno = EPROTO;
+        return NULL;
+    }
+    return m;
+}
+
+void pm_shm_close(const pm_shm_t *m) {
+    if (m) munmap((void *)m, sizeof(pm_shm_t));
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || (defined(__ARM_ARCH) && __ARM_ARCH >= 7)
+    __asm__ volatile("yield");
+#endif
+}
+
+unsigned pm_shm_read(const pm_shm_t *m, pm_shm_t *out) {
+    for (unsigned retries = 0;; retries++) {
+        uint32_t s0 = __atomic_load_n(&m->seq, __ATOMIC_ACQUIRE);
+        if (s0 & 1u) { cpu_relax(); continue; }
+        memcpy(out, (const void *)m, sizeof *out);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&m->seq, __ATOMIC_RELAXED) == s0) return retries;
+    }
+}
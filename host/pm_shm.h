@@ -0,0 +1,94 @@
+#ifndef PM_SHM_H
+#define PM_SHM_H
+
+/*
+ * The latest state of one monitor in a shared, memory-mapped file, written by
+ * pmd (DIR/NAME.shm next to its socket) and read with no syscalls at all.
+ *
+ * The layout is fixed, little-endian, and the same for every reader (C here,
+ * pm_shm.py, pm_shm.tcl): offsets are in the comments and checked below.
+ * Consistency is a seqlock. The writer makes seq odd, updates the fields and
+ * makes it even again; a reader copies the block and retries if seq was odd
+ * or changed meanwhile. Readers never write, so any number of them can run
+ * without slowing the writer or each other.
+ *
+ * Times: *_mono_us are CLOCK_MONOTONIC (comparable across processes on the
+ * host), *_wall_us are CLOCK_REALTIME, dev_t_us is the device's clock.
+ * Values pmd has not got yet, or the device reported as null, are NaN.
+ */
+#include <stdint.h>
+
+#define PM_SHM_MAGIC   0x314d4850u  // "PHM1"
+#define PM_SHM_VERSION 1u
+
+#define PM_SHM_CONNECTED  0x1u  // the device's port is open
+#define PM_SHM_HAVE_SAMPLE 0x2u // sample fields are set
+#define PM_SHM_HAVE_STATE 0x4u  // state fields are set
+#define PM_SHM_CHARGING   0x8u  // state: charging
+
+typedef struct {
+    uint32_t magic;           //   0
+    uint32_t version;         //   4
+    uint32_t size;            //   8 sizeof(pm_shm_t)
+    uint32_t seq;             //  12 seqlock, odd while the writer is busy
+    uint32_t flags;           //  16 PM_SHM_*
+    uint32_t writer_pid;      //  20 0 once pmd has exited
+    uint64_t update_mono_us;  //  24 last write of any kind
+
+    // latest sample from the device stream
+    uint32_t sample_seq;      //  32
+    uint32_t reserved0;       //  36
+    uint64_t dev_t_us;        //  40
+    uint64_t sample_mono_us;  //  48 when pmd received it
+    uint64_t sample_wall_us;  //  56
+    double   v, a, w;         //  64 72 80
+
+    // battery state, polled with a GET every --poll-ms
+    uint64_t state_mono_us;   //  88
+    double   pct;             //  96
+    double   soc;             // 104
+    double   soc_sigma;       // 112
+    double   avg_w;           // 120
+    double   remaining_wh;    // 128
+    double   hrs_remaining;   // 136
+    double   hrs_to_full;     // 144
+
+    // pmd's link counters
+    uint64_t samples;         // 152
+    uint64_t reconnects;      // 160
+    uint64_t timeouts;        // 168
+} pm_shm_t;                   // 176
+
+#ifdef __cplusplus
+static_assert(sizeof(pm_shm_t) == 176 && __builtin_offsetof(pm_shm_t, samples) == 152, "pm_shm_t layout");
+#else
+_Static_assert(sizeof(pm_shm_t) == 176 && __builtin_offsetof(pm_shm_t, samples) == 152, "pm_shm_t layout");
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Map a pmd export read-only. NULL with errno set on failure; EPROTO if the
+// file is not a compatible export.
+const pm_shm_t *pm_shm_open(const char *path);
+void pm_shm_close(const pm_shm_t *m);
+
+// Consistent copy of the block. Returns the number of retries it took.
+unsigned pm_shm_read(const pm_shm_t *m, pm_shm_t *out);
+
+// Writer side (pmd): bracket every update.
+static inline void pm_shm_write_begin(pm_shm_t *m) {
+    __atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void pm_shm_write_end(pm_shm_t *m) {
+    __atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * Reads per second from the pmd shared-memory export (pm_shm.h) with many
+ * concurrent readers, each a thread looping on pm_shm_read().
+ *
+ *   pm_shm_bench [--readers N,N,...] [--seconds S] [--writer-hz HZ] [FILE]
+ *
+ * With FILE (e.g. $XDG_RUNTIME_DIR/power_monitor/<serial>.shm) the writer is
+ * a running pmd. Without it the benchmark writes its own export in /dev/shm
+ * at --writer-hz (default 1000; 0 = as fast as it can), with fields that
+ * must agree with each other, and counts any torn copy a reader gets. That
+ * count must be 0. Each reader count in the list (default 1,4,16,64) runs
+ * for --seconds (default 2).
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pm_shm.h"
+
+#define MAX_READERS 1024
+
+typedef struct {
+    const pm_shm_t *m;
+    double   seconds;
+    int      check;         // own writer: v, a, w and sample_seq must agree
+    uint64_t reads, retries, torn;
+    char     pad[64];       // keep the counters of neighbouring readers apart
+} reader_t;
+
+static volatile int g_stop;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);  // vDSO: no syscall
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void *reader_main(void *arg) {
+    reader_t *r = arg;
+    pm_shm_t s;
+    double until = now_s() + r->seconds;
+    for (;;) {
+        for (int k = 0; k < 1024; k++) {
+            r->retries += pm_shm_read(r->m, &s);
+            if (r->check && (s.a != 2.0 * s.v || s.w != 3.0 * s.v || s.v != (double)s.sample_seq)) r->torn++;
+        }
+        r->reads += 1024;
+        if (now_s() >= until) break;
+    }
+    return NULL;
+}
+
+typedef struct {
+    pm_shm_t *m;
+    double    hz;
+    uint64_t  writes;
+} writer_t;
+
+static void *writer_main(void *arg) {
+    writer_t *w = arg;
+    double period = w->hz > 0.0 ? 1.0 / w->hz : 0.0, next = now_s();
+    while (!g_stop) {
+        pm_shm_write_begin(w->m);
+        uint32_t k = w->m->sample_seq + 1;
+        w->m->sample_seq = k;
+        w->m->v = (double)k;
+        w->m->a = 2.0 * k;
+        w->m->w = 3.0 * k;
+        w->m->samples = k;
+        pm_shm_write_end(w->m);
+        w->writes++;
+        if (period > 0.0) {
+            next += period;
+            double wait = next - now_s();
+            if (wait > 0.0) {
+                struct timespec ts = { (time_t)wait, (long)((wait - (time_t)wait) * 1e9) };
+                nanosleep(&ts, NULL);
+            }
+        }
+    }
+    return NULL;
+}
+
+// a private export for the self-writing mode, laid out as pmd does it
+static pm_shm_t *make_export(char *path, size_t cap) {
+    snprintf(path, cap, "/dev/shm/pm_shm_bench.%d", (int)getpid());
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(pm_shm_t)) != 0) { perror(path); return NULL; }
+    pm_shm_t *m = mmap(NULL, sizeof *m, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) { perror("mmap"); return NULL; }
+    m->magic = PM_SHM_MAGIC;
+    m->version = PM_SHM_VERSION;
+    m->size = sizeof *m;
+    m->writer_pid = (uint32_t)getpid();
+    m->flags = PM_SHM_CONNECTED | PM_SHM_HAVE_SAMPLE;
+    return m;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: pm_shm_bench [--readers N,N,...] [--seconds S] [--writer-hz HZ] [FILE]\n");
+}
+
+int main(int argc, char **argv) {
+    const char *list = "1,4,16,64", *file = NULL;
+    double seconds = 2.0, writer_hz = 1000.0;
+    for (int k = 1; k < argc; k++) {
+        const char *arg = argv[k];
+        int has_val = k + 1 < argc;
+        if (!strcmp(arg, "--readers") && has_val)        list = argv[++k];
+        else if (!strcmp(arg, "--seconds") && has_val)   seconds = strtod(argv[++k], NULL);
+        else if (!strcmp(arg, "--writer-hz") && has_val) writer_hz = strtod(argv[++k], NULL);
+        else if (arg[0] != '-' && !file)                 file = arg;
+        else { usage(); return 2; }
+    }
+    if (seconds <= 0.0) { usage(); return 2; }
+
+    char own_path[64] = "";
+    writer_t writer = { 0 };
+    pthread_t writer_th;
+    const pm_shm_t *m;
+    if (file) {
+        m = pm_shm_open(file);
+        if (!m) { fprintf(stderr, "pm_shm_bench: %s: %s\n", file, strerror(errno)); return 1; }
+    } else {
+        writer.m = make_export(own_path, sizeof own_path);
+        if (!writer.m) return 1;
+        writer.hz = writer_hz;
+        m = writer.m;
+        pthread_create(&writer_th, NULL, writer_main, &writer);
+    }
+
+    printf("pm_shm_bench: %s, writer %s, %ld CPUs\n", file ? file : own_path,
+           file ? "pmd" : writer_hz > 0.0 ? "own" : "own, unthrottled", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %14s %14s %10s %12s %8s\n", "readers", "reads/s", "per reader", "ns/read", "retries/M", "torn");
+
+    static reader_t readers[MAX_READERS];
+    static pthread_t threads[MAX_READERS];
+    int rc = 0;
+    for (const char *p = list; *p;) {
+        char *end;
+        long n = strtol(p, &end, 10);
+        if (end == p || n < 1 || n > MAX_READERS) { usage(); rc = 2; break; }
+        p = *end == ',' ? end + 1 : end;
+
+        uint64_t writes0 = writer.writes;
+        double t0 = now_s();
+        for (long k = 0; k < n; k++) {
+            readers[k] = (reader_t){ .m = m, .seconds = seconds, .check = !file };
+            pthread_create(&threads[k], NULL, reader_main, &readers[k]);
+        }
+        uint64_t reads = 0, retries = 0, torn = 0;
+        for (long k = 0; k < n; k++) {
+            pthread_join(threads[k], NULL);
+            reads += readers[k].reads;
+            retries += readers[k].retries;
+            torn += readers[k].torn;
+        }
+        double dt = now_s() - t0;
+        double rate = (double)reads / dt;
+        printf("%8ld %14.0f %14.0f %10.1f %12.1f %8llu", n, rate, rate / (double)n,
+               1e9 * dt * (double)n / (double)reads, 1e6 * (double)retries / (double)reads, (unsigned long long)torn);
+        if (!file) printf("   writes/s=%.0f", (double)(writer.writes - writes0) / dt);
+        printf("\n");
+        if (torn) rc = 1;
+    }
+
+    if (!file) {
+        g_stop = 1;
+        pthread_join(writer_th, NULL);
+        unlink(own_path);
+    } else {
+        pm_shm_close(m);
+    }
+    return rc;
+}
@@ -0,0 +1,375 @@
+/*
+ * CPU cost of pmd per 1000 samples/s across a fleet. Real monitors stream a
+ * few samples/s each, so the load comes from fake ones: ptys linked into a
+ * private by-id directory that answer pmd's requests and stream sample
+ * events at a set rate. pmd is started on that directory (so it finds them
+ * through its hotplug path) and its CPU time is read from /proc.
+ *
+ *   pmd_fleet_bench [--pmd PATH] [--devices N] [--rates R,R,...] [--seconds S]
+ *                   [--clients K] [--requests N] [-- PMD_ARGS...]
+ *
+ * R is the fleet's total samples/s (default 1000,5000,20000), split evenly
+ * over --devices (default 12). Each rate is measured for --seconds (default
+ * 5) after one second of warm-up. --clients K (default 1) subscribes K
+ * stream clients per device, so the fan-out is included. --requests N
+ * (default 2000) then sends N uncached GETs to one device, all at once, and
+ * reports requests/s through pmd's pipeline. Arguments after -- go to pmd.
+ */
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+#include "json_scan.h"
+#include "loop.h"
+
+using namespace pmd;
+
+struct FakeDevice {
+    std::string name;
+    int master = -1;
+    ObjectReader reader{1023};
+    uint32_t every = 0;   // streaming every Nth sample, 0 = off
+    uint32_t skip = 0;
+    uint64_t seq = 0;
+    double carry = 0;     // samples owed from previous ticks
+    uint64_t emitted = 0, dropped = 0;
+};
+
+struct StreamClient {
+    int fd = -1;
+    uint64_t lines = 0;
+    std::string partial;
+};
+
+static std::vector<FakeDevice> g_dev;
+static std::vector<StreamClient> g_clients;
+static double g_rate_per_dev = 0;
+
+static void usage() {
+    fprintf(stderr, "usage: pmd_fleet_bench [--pmd PATH] [--devices N] [--rates R,R,...] [--seconds S]\n"
+                    "                       [--clients K] [--requests N] [-- PMD_ARGS...]\n");
+}
+
+// as the device prints it: CRLF, nothing while the port is closed, and
+// dropped rather than waited for when pmd falls behind
+static void dev_write(FakeDevice &d, const char *s, int n) {
+    if (write(d.master, s, (size_t)n) != n) d.dropped++;
+}
+
+static void dev_request(FakeDevice &d, const std::string &obj) {
+    std::vector<Member> m;
+    char out[512];
+    int n;
+    object_members(obj.data(), obj.size(), m);
+    if (const Member *st = find_member(m, "stream")) {
+        d.every = (uint32_t)strtoul(st->value.c_str(), nullptr, 10);
+        d.skip = 0;
+        n = snprintf(out, sizeof out, "{\"ok\":true,\"stream\":%u,\"seq\":%" PRIu64 "}\r\n", d.every, d.seq);
+    } else if (const Member *sy = find_member(m, "sync")) {
+        std::vector<Member> inner;
+        object_members(sy->value.data(), sy->value.size(), inner);
+        const Member *h = find_member(inner, "host_us");
+        n = snprintf(out, sizeof out,
+                     "{\"host_us\":%s,\"dev_us\":%" PRIu64 ",\"offset_us\":0,\"drift_ppm\":0.000,\"pairs\":1}\r\n",
+                     h ? h->value.c_str() : "0", now_us());
+    } else if (find_member(m, "get")) {
+        n = snprintf(out, sizeof out,
+                     "{\"pct\":50.00,\"soc\":50.00,\"soc_sigma\":1.00,\"charging\":false,\"avg_w\":2.000,"
+                     "\"remaining_wh\":60.00,\"hrs_remaining\":30.0,\"hrs_to_full\":null}\r\n");
+    } else {
+        n = snprintf(out, sizeof out, "{\"ok\":true}\r\n");
+    }
+    dev_write(d, out, n);
+}
+
+static void dev_tick(FakeDevice &d, double dt) {
+    d.carry += g_rate_per_dev * dt;
+    char out[160];
+    for (; d.carry >= 1.0; d.carry -= 1.0) {
+        d.seq++;
+        if (!d.every || ++d.skip < d.every) continue;
+        d.skip = 0;
+        int n = snprintf(out, sizeof out,
+                         "{\"event\":\"sample\",\"seq\":%" PRIu64 ",\"t_us\":%" PRIu64
+                         ",\"v\":26.%03u,\"a\":0.%04u,\"w\":3.%04u}\r\n",
+                         d.seq, now_us(), (unsigned)(d.seq % 1000), (unsigned)(d.seq % 10000),
+                         (unsigned)(d.seq * 7 % 10000));
+        d.emitted++;
+        dev_write(d, out, n);
+    }
+}
+
+static bool make_device(FakeDevice &d, const std::string &by_id, int k) {
+    d.master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (d.master < 0 || grantpt(d.master) != 0 || unlockpt(d.master) != 0) return false;
+    termios t;
+    tcgetattr(d.master, &t);
+    cfmakeraw(&t);
+    tcsetattr(d.master, TCSANOW, &t);
+    char name[32];
+    snprintf(name, sizeof name, "FAKE%02d", k);
+    d.name = name;
+    std::string link = by_id + "/usb-Homebase_power_monitor_" + d.name + "-if00";
+    return symlink(ptsname(d.master), link.c_str()) == 0;
+}
+
+static int connect_unix(const std::string &path) {
+    sockaddr_un a{};
+    a.sun_family = AF_UNIX;
+    snprintf(a.sun_path, sizeof a.sun_path, "%s", path.c_str());
+    for (int tries = 0; tries < 200; tries++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(fd, (sockaddr *)&a, sizeof a) == 0) return fd;
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+static double proc_cpu_s(pid_t pid) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof path, "/proc/%d/stat", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    size_t n = fread(buf, 1, sizeof buf - 1, f);
+    fclose(f);
+    buf[n] = 0;
+    const char *p = strrchr(buf, ')');  // the command name may hold spaces
+    unsigned long long ut = 0, st = 0;
+    if (p) sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &ut, &st);
+    return (double)(ut + st) / (double)sysconf(_SC_CLK_TCK);
+}
+
+static double self_cpu_s() { return proc_cpu_s(getpid()); }
+
+// Runs the fake devices and stream clients for `seconds`.
+static void run(int ep, int timer, double seconds) {
+    uint64_t until = now_us() + (uint64_t)(seconds * 1e6), last = now_us();
+    epoll_event evs[64];
+    char buf[65536];
+    while (now_us() < until) {
+        int n = epoll_wait(ep, evs, 64, 100);
+        for (int k = 0; k < n; k++) {
+            uint64_t tag = evs[k].data.u64;
+            if (tag == 0) {  // timer
+                uint64_t exp;
+                if (read(timer, &exp, sizeof exp) < 0) continue;
+                uint64_t now = now_us();
+                for (FakeDevice &d : g_dev) dev_tick(d, (double)(now - last) * 1e-6);
+                last = now;
+            } else if (tag <= g_dev.size()) {
+                FakeDevice &d = g_dev[tag - 1];
+                ssize_t r;
+                while ((r = read(d.master, buf, sizeof buf)) > 0) {
+                    for (ssize_t j = 0; j < r; j++) {
+                        if (d.reader.feed(buf[j]) == ObjectReader::OBJECT) dev_request(d, d.reader.object());
+                    }
+                }
+            } else {
+                StreamClient &c = g_clients[tag - 1 - g_dev.size()];
+                ssize_t r;
+                while ((r = read(c.fd, buf, sizeof buf)) > 0) {
+                    for (ssize_t j = 0; j < r; j++) c.lines += buf[j] == '\n';
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    std::string pmd_path = "./pmd";
+    const char *rates = "1000,5000,20000";
+    int devices = 12, clients = 1, requests = 2000;
+    double seconds = 5;
+    std::vector<std::string> pmd_args;
+    {
+        std::string self = argv[0];
+        size_t slash = self.rfind('/');
+        if (slash != std::string::npos) pmd_path = self.substr(0, slash + 1) + "pmd";
+    }
+    for (int k = 1; k < argc; k++) {
+        const char *arg = argv[k];
+        bool has_val = k + 1 < argc;
+        if (!strcmp(arg, "--pmd") && has_val)              pmd_path = argv[++k];
+        else if (!strcmp(arg, "--devices") && has_val)    devices = atoi(argv[++k]);
+        else if (!strcmp(arg, "--rates") && has_val)      rates = argv[++k];
+        else if (!strcmp(arg, "--seconds") && has_val)    seconds = strtod(argv[++k], NULL);
+        else if (!strcmp(arg, "--clients") && has_val)    clients = atoi(argv[++k]);
+        else if (!strcmp(arg, "--requests") && has_val)   requests = atoi(argv[++k]);
+        else if (!strcmp(arg, "--")) { while (++k < argc) pmd_args.push_back(argv[k]); }
+        else { usage(); return 2; }
+    }
+    if (devices < 1 || devices > 256 || clients < 0 || requests < 0 || seconds <= 0) { usage(); return 2; }
+
+    char tmpl[] = "/tmp/pmd_fleet_bench.XXXXXX";
+    if (!mkdtemp(tmpl)) { perror("mkdtemp"); return 1; }
+    std::string root = tmpl, by_id = root + "/by-id", run_dir = root + "/run";
+    mkdir(by_id.c_str(), 0700);
+
+    g_dev.resize((size_t)devices);
+    for (int k = 0; k < devices; k++) {
+        if (!make_device(g_dev[(size_t)k], by_id, k)) { perror("pty"); return 1; }
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        std::vector<const char *> av = {pmd_path.c_str(), "--by-id", by_id.c_str(), "--dir", run_dir.c_str()};
+        for (const std::string &a : pmd_args) av.push_back(a.c_str());
+        av.push_back(nullptr);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 2);
+        execv(pmd_path.c_str(), (char *const *)av.data());
+        _exit(127);
+    }
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    itimerspec its{{0, 1000000}, {0, 1000000}};
+    timerfd_settime(timer, 0, &its, nullptr);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    epoll_ctl(ep, EPOLL_CTL_ADD, timer, &ev);
+    for (size_t k = 0; k < g_dev.size(); k++) {
+        ev.data.u64 = k + 1;
+        epoll_ctl(ep, EPOLL_CTL_ADD, g_dev[k].master, &ev);
+    }
+
+    // let pmd find the devices and start their streams
+    g_rate_per_dev = 0;
+    run(ep, timer, 0.5);
+    int rc = 0;
+    for (FakeDevice &d : g_dev) {
+        for (int c = 0; c < clients; c++) {
+            StreamClient sc;
+            sc.fd = connect_unix(run_dir + "/" + d.name + ".sock");
+            if (sc.fd < 0 || write(sc.fd, "{\"stream\":1}", 12) != 12) {
+                fprintf(stderr, "pmd_fleet_bench: pmd is not serving %s\n", d.name.c_str());
+                rc = 1;
+                break;
+            }
+            fcntl(sc.fd, F_SETFL, O_NONBLOCK);
+            g_clients.push_back(sc);
+        }
+        if (rc) break;
+    }
+    for (size_t k = 0; k < g_clients.size() && !rc; k++) {
+        ev.data.u64 = g_dev.size() + 1 + k;
+        epoll_ctl(ep, EPOLL_CTL_ADD, g_clients[k].fd, &ev);
+    }
+    run(ep, timer, 0.5);
+    for (FakeDevice &d : g_dev) {
+        if (!d.every && !rc) {
+            fprintf(stderr, "pmd_fleet_bench: pmd did not start the stream on %s\n", d.name.c_str());
+            rc = 1;
+        }
+    }
+
+    if (!rc) {
+        printf("pmd_fleet_bench: %d devices, %d stream clients each, %ld CPUs\n", devices, clients,
+               sysconf(_SC_NPROCESSORS_ONLN));
+        printf("%10s %12s %12s %10s %18s %10s\n", "samples/s", "sent/s", "fanned out/s", "pmd cpu%",
+               "cpu% per 1k/s", "dropped");
+    }
+    for (const char *p = rates; *p && !rc;) {
+        char *end;
+        double rate = strtod(p, &end);
+        if (end == p || rate <= 0) { usage(); rc = 2; break; }
+        p = *end == ',' ? end + 1 : end;
+
+        g_rate_per_dev = rate / devices;
+        run(ep, timer, 1.0);  // warm-up
+
+        uint64_t emitted0 = 0, dropped0 = 0, lines0 = 0;
+        for (FakeDevice &d : g_dev) { emitted0 += d.emitted; dropped0 += d.dropped; }
+        for (StreamClient &c : g_clients) lines0 += c.lines;
+        double cpu0 = proc_cpu_s(pid);
+        uint64_t t0 = now_us();
+        run(ep, timer, seconds);
+        double dt = (double)(now_us() - t0) * 1e-6, cpu = proc_cpu_s(pid) - cpu0;
+
+        uint64_t emitted = 0, dropped = 0, lines = 0;
+        for (FakeDevice &d : g_dev) { emitted += d.emitted; dropped += d.dropped; }
+        for (StreamClient &c : g_clients) lines += c.lines;
+        double sps = (double)(emitted - emitted0) / dt, cpu_pct = 100.0 * cpu / dt;
+        printf("%10.0f %12.0f %12.0f %10.2f %18.3f %10" PRIu64 "\n", rate, sps, (double)(lines - lines0) / dt,
+               cpu_pct, sps > 0 ? cpu_pct * 1000.0 / sps : 0.0, dropped - dropped0);
+        fflush(stdout);
+    }
+
+    // uncached requests, all sent at once: pmd keeps its pipeline full
+    if (!rc && requests > 0) {
+        g_rate_per_dev = 0;
+        int fd = connect_unix(run_dir + "/" + g_dev[0].name + ".sock");
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        static const char req[] = "{\"get\":\"pct\"}";
+        int sent = 0, replies = 0, errors = 0;
+        std::string line;
+        char buf[65536];
+        uint64_t t0 = now_us(), give_up = t0 + 30000000u;
+        epoll_event evs[64];
+        while (replies < requests && now_us() < give_up) {
+            // at most 64 outstanding, pmd's per-client limit
+            while (sent < requests && sent - replies < 64 && write(fd, req, sizeof req - 1) == (ssize_t)sizeof req - 1) sent++;
+            int n = epoll_wait(ep, evs, 64, 1);
+            for (int k = 0; k < n; k++) {
+                uint64_t tag = evs[k].data.u64;
+                if (tag >= 1 && tag <= g_dev.size()) {
+                    FakeDevice &d = g_dev[tag - 1];
+                    ssize_t r;
+                    while ((r = read(d.master, buf, sizeof buf)) > 0) {
+                        for (ssize_t j = 0; j < r; j++) {
+                            if (d.reader.feed(buf[j]) == ObjectReader::OBJECT) dev_request(d, d.reader.object());
+                        }
+                    }
+                } else if (tag == 0) {
+                    uint64_t exp;
+                    if (read(timer, &exp, sizeof exp) < 0) {}
+                } else {
+                    StreamClient &c = g_clients[tag - 1 - g_dev.size()];
+                    while (read(c.fd, buf, sizeof buf) > 0) {}
+                }
+            }
+            ssize_t r;
+            while ((r = read(fd, buf, sizeof buf)) > 0) {
+                for (ssize_t j = 0; j < r; j++) {
+                    if (buf[j] != '\n') { line += buf[j]; continue; }
+                    replies++;
+                    errors += line.find("\"error\"") != std::string::npos;
+                    line.clear();
+                }
+            }
+        }
+        double dt = (double)(now_us() - t0) * 1e-6;
+        printf("requests: %d uncached GETs in %.3f s, %.0f requests/s through pmd, %d errors\n", replies, dt,
+               replies / dt, errors);
+        if (errors) rc = 1;
+        close(fd);
+    }
+    printf("bench process cpu: %.2f s\n", self_cpu_s());
+
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+    for (FakeDevice &d : g_dev) {
+        unlink((by_id + "/usb-Homebase_power_monitor_" + d.name + "-if00").c_str());
+        close(d.master);
+    }
+    rmdir(by_id.c_str());
+    rmdir(run_dir.c_str());
+    rmdir(root.c_str());
+    return rc;
+}
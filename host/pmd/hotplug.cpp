@@ -0,0 +1,78 @@
+#include "hotplug.h"
+
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+#include <vector>
+
+namespace pmd {
+
+Hotplug::Hotplug(Loop &loop, std::string dir, Found found)
+    : loop_(loop), dir_(std::move(dir)), found_(std::move(found)) {}
+
+bool Hotplug::start() {
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || !loop_.add(this, EPOLLIN)) {
+        fprintf(stderr, "pmd: inotify: %s\n", strerror(errno));
+        return false;
+    }
+    arm();
+    return true;
+}
+
+// Watch dir_ if it exists, else its nearest existing parent for the next
+// component to appear. Scans whenever dir_ is (again) the one watched.
+void Hotplug::arm() {
+    if (wd_ >= 0) inotify_rm_watch(fd, wd_);
+    wd_ = -1;
+    std::string at = dir_;
+    for (;;) {
+        struct stat st;
+        if (stat(at.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) break;
+        size_t slash = at.rfind('/');
+        at = slash > 0 && slash != std::string::npos ? at.substr(0, slash) : "/";
+    }
+    watching_dir_ = at == dir_;
+    uint32_t mask = IN_CREATE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+    wd_ = inotify_add_watch(fd, at.c_str(), mask);
+    if (wd_ < 0) fprintf(stderr, "pmd: watch %s: %s\n", at.c_str(), strerror(errno));
+    if (watching_dir_) scan();
+}
+
+void Hotplug::scan() {
+    std::vector<std::string> links;
+    if (DIR *d = opendir(dir_.c_str())) {
+        while (dirent *e = readdir(d)) {
+            if (strstr(e->d_name, "power_monitor")) links.push_back(dir_ + "/" + e->d_name);
+        }
+        closedir(d);
+    }
+    std::sort(links.begin(), links.end());
+    for (const std::string &l : links) found_(l);
+}
+
+void Hotplug::on_io(uint32_t) {
+    alignas(inotify_event) char buf[4096];
+    bool rearm = false;
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof buf);
+        if (n <= 0) break;
+        for (char *p = buf; p < buf + n;) {
+            const inotify_event *ev = reinterpret_cast<const inotify_event *>(p);
+            p += sizeof *ev + ev->len;
+            if (ev->wd != wd_) continue;  // e.g. IN_IGNORED for the watch arm() just replaced
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) rearm = true;
+            else if (!watching_dir_) rearm = true;  // a parent gained an entry; dir_ may exist now
+            else if (ev->len && strstr(ev->name, "power_monitor")) found_(dir_ + "/" + ev->name);
+        }
+    }
+    if (rearm) arm();
+}
+
+} // namespace pmd
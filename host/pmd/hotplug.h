@@ -0,0 +1,39 @@
+#ifndef PMD_HOTPLUG_H
+#define PMD_HOTPLUG_H
+
+/*
+ * Watches a directory of device links (/dev/serial/by-id) with inotify and
+ * reports every power_monitor link in it, at start and whenever one appears.
+ * udev removes the directory with the last serial device and creates it again
+ * with the next one, so while it is missing the nearest existing parent is
+ * watched instead.
+ */
+#include <functional>
+#include <string>
+
+#include "loop.h"
+
+namespace pmd {
+
+class Hotplug : public Handler {
+public:
+    using Found = std::function<void(const std::string &path)>;
+
+    Hotplug(Loop &loop, std::string dir, Found found);
+    bool start();
+    void on_io(uint32_t events) override;
+
+private:
+    void arm();
+    void scan();
+
+    Loop &loop_;
+    const std::string dir_;
+    Found found_;
+    int wd_ = -1;
+    bool watching_dir_ = false;  // else a parent, waiting for dir_ to appear
+};
+
+} // namespace pmd
+
+#endif
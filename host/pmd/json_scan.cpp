@@ -0,0 +1,148 @@
+#include "json_scan.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace pmd {
+
+ObjectReader::Result ObjectReader::feed(char c) {
+    if (!c) return NONE;
+
+    if (!depth_) {
+        if (c == '{') {
+            buf_.assign(1, c);
+            depth_ = 1;
+            in_str_ = esc_ = overflow_ = false;
+        }
+        return NONE;
+    }
+
+    if (buf_.size() >= max_len_) overflow_ = true;
+    if (!overflow_) buf_ += c;
+    if (esc_) { esc_ = false; return NONE; }
+    if (c == '\\') { esc_ = true; return NONE; }
+    if (c == '"') { in_str_ = !in_str_; return NONE; }
+    if (in_str_) return NONE;
+
+    if (c == '{') depth_++;
+    else if (c == '}' && --depth_ == 0) return overflow_ ? TOO_LONG : OBJECT;
+    return NONE;
+}
+
+namespace {
+
+struct Cursor {
+    const char *p, *end;
+
+    void ws() { while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++; }
+    bool eat(char c) {
+        ws();
+        if (p == end || *p != c) return false;
+        p++;
+        return true;
+    }
+};
+
+bool skip_value(Cursor &c, int depth);
+
+bool skip_string(Cursor &c) {
+    if (c.p == c.end || *c.p != '"') return false;
+    for (c.p++; c.p < c.end; c.p++) {
+        if (*c.p == '\\') { if (++c.p == c.end) return false; }
+        else if (*c.p == '"') { c.p++; return true; }
+    }
+    return false;
+}
+
+bool skip_container(Cursor &c, char close, int depth, bool members) {
+    c.p++;
+    if (c.eat(close)) return true;
+    for (;;) {
+        if (members) {
+            c.ws();
+            if (!skip_string(c) || !c.eat(':')) return false;
+        }
+        if (!skip_value(c, depth + 1)) return false;
+        if (c.eat(close)) return true;
+        if (!c.eat(',')) return false;
+    }
+}
+
+bool skip_value(Cursor &c, int depth) {
+    if (depth > 32) return false;
+    c.ws();
+    if (c.p == c.end) return false;
+    switch (*c.p) {
+    case '{': return skip_container(c, '}', depth, true);
+    case '[': return skip_container(c, ']', depth, false);
+    case '"': return skip_string(c);
+    default: {
+        // numbers and literals: the firmware judges them, only their extent matters here
+        const char *start = c.p;
+        while (c.p < c.end && (std::strchr("+-.eE", *c.p) || (*c.p >= '0' && *c.p <= '9') ||
+                               (*c.p >= 'a' && *c.p <= 'z'))) c.p++;
+        return c.p > start;
+    }
+    }
+}
+
+} // namespace
+
+bool object_members(const char *text, size_t len, std::vector<Member> &out) {
+    out.clear();
+    Cursor c{text, text + len};
+    if (!c.eat('{')) return false;
+    if (c.eat('}')) { c.ws(); return c.p == c.end; }
+    for (;;) {
+        c.ws();
+        const char *k = c.p;
+        if (!skip_string(c)) return false;
+        Member m;
+        m.key.assign(k + 1, c.p - k - 2);
+        if (!c.eat(':')) return false;
+        c.ws();
+        const char *v = c.p;
+        if (!skip_value(c, 1)) return false;
+        m.value.assign(v, c.p - v);
+        out.push_back(std::move(m));
+        if (c.eat('}')) break;
+        if (!c.eat(',')) return false;
+    }
+    c.ws();
+    return c.p == c.end;
+}
+
+const Member *find_member(const std::vector<Member> &members, const char *key) {
+    for (const Member &m : members) {
+        if (m.key == key) return &m;
+    }
+    return nullptr;
+}
+
+bool string_list(const std::string &raw, std::vector<std::string> &out) {
+    out.clear();
+    Cursor c{raw.data(), raw.data() + raw.size()};
+    bool list = c.eat('[');
+    if (list && c.eat(']')) return false;
+    for (;;) {
+        c.ws();
+        const char *s = c.p;
+        if (!skip_string(c)) return false;
+        std::string name(s + 1, c.p - s - 2);
+        if (name.find('\\') != std::string::npos) return false;
+        out.push_back(std::move(name));
+        if (!list) break;
+        if (c.eat(']')) break;
+        if (!c.eat(',')) return false;
+    }
+    c.ws();
+    return c.p == c.end;
+}
+
+bool parse_uint(const std::string &raw, unsigned long long max, unsigned long long &out) {
+    if (raw.empty() || raw.size() > 20 || raw.find_first_not_of("0123456789") != std::string::npos) return false;
+    out = std::strtoull(raw.c_str(), nullptr, 10);
+    return out <= max;
+}
+
+} // namespace pmd
@@ -0,0 +1,51 @@
+#ifndef PMD_JSON_SCAN_H
+#define PMD_JSON_SCAN_H
+
+/*
+ * Just enough JSON for pmd to route requests and read sample events. The
+ * firmware stays the parser of record: anything pmd does not answer itself
+ * goes to the device byte for byte.
+ */
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace pmd {
+
+// Frames objects out of a byte stream by the firmware's rules (rx_byte in
+// pm_core.c): bytes between objects are skipped, braces inside strings do not
+// count, NULs are dropped, and an object longer than max_len is dropped whole.
+class ObjectReader {
+public:
+    enum Result { NONE, OBJECT, TOO_LONG };
+
+    explicit ObjectReader(size_t max_len) : max_len_(max_len) {}
+    Result feed(char c);
+    const std::string &object() const { return buf_; }
+
+private:
+    std::string buf_;
+    size_t max_len_;
+    int  depth_ = 0;
+    bool in_str_ = false, esc_ = false, overflow_ = false;
+};
+
+// One top-level member; key without its quotes (escapes left as sent),
+// value as its raw JSON text.
+struct Member {
+    std::string key;
+    std::string value;
+};
+
+// Top-level members of an object; false unless it is one well-formed object.
+bool object_members(const char *text, size_t len, std::vector<Member> &out);
+const Member *find_member(const std::vector<Member> &members, const char *key);
+
+// "name" or ["name",...], names without escapes.
+bool string_list(const std::string &raw, std::vector<std::string> &out);
+// A plain non-negative integer no larger than max.
+bool parse_uint(const std::string &raw, unsigned long long max, unsigned long long &out);
+
+} // namespace pmd
+
+#endif
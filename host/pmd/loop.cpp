@@ -0,0 +1,79 @@
+#include "loop.h"
+
+#include <sys/epoll.h>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+
+namespace pmd {
+
+Loop::Loop() : epfd_(epoll_create1(EPOLL_CLOEXEC)) {
+    if (epfd_ < 0) perror("epoll_create1");
+}
+
+Loop::~Loop() {
+    sweep();
+    if (epfd_ >= 0) close(epfd_);
+}
+
+bool Loop::add(Handler *h, uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.ptr = h;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, h->fd, &ev) == 0) return true;
+    perror("epoll_ctl");
+    return false;
+}
+
+void Loop::mod(Handler *h, uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.ptr = h;
+    epoll_ctl(epfd_, EPOLL_CTL_MOD, h->fd, &ev);
+}
+
+void Loop::del(Handler *h) {
+    if (h->fd < 0) return;
+    epoll_ctl(epfd_, EPOLL_CTL_DEL, h->fd, nullptr);
+    close(h->fd);
+    h->fd = -1;
+}
+
+void Loop::retire(Handler *h) {
+    if (h->retired) return;
+    h->retired = true;
+    del(h);
+    retired_.push_back(h);
+}
+
+int Loop::wait(int timeout_ms) {
+    epoll_event evs[64];
+    int n = epoll_wait(epfd_, evs, 64, timeout_ms);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+    for (int k = 0; k < n; k++) {
+        Handler *h = static_cast<Handler *>(evs[k].data.ptr);
+        if (!h->retired) h->on_io(evs[k].events);
+    }
+    sweep();
+    return n;
+}
+
+void Loop::sweep() {
+    for (Handler *h : retired_) delete h;
+    retired_.clear();
+}
+
+uint64_t now_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+uint64_t wall_us() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+} // namespace pmd
@@ -0,0 +1,44 @@
+#ifndef PMD_LOOP_H
+#define PMD_LOOP_H
+
+/*
+ * A single-threaded epoll loop. Each fd belongs to a Handler; a handler that
+ * is done calls retire(), and is deleted once the current batch of events
+ * has been dispatched, so a later event in the same batch never reaches a
+ * freed object.
+ */
+#include <cstdint>
+#include <vector>
+
+namespace pmd {
+
+class Handler {
+public:
+    virtual ~Handler() = default;
+    virtual void on_io(uint32_t events) = 0;
+    int fd = -1;
+    bool retired = false;
+};
+
+class Loop {
+public:
+    Loop();
+    ~Loop();
+    bool add(Handler *h, uint32_t events);
+    void mod(Handler *h, uint32_t events);
+    void del(Handler *h);                    // stops its events and closes its fd
+    void retire(Handler *h);                 // del(), then delete it after this batch
+    int  wait(int timeout_ms);               // dispatch one batch; -1 on error
+    void sweep();                            // delete retired handlers
+
+private:
+    int epfd_;
+    std::vector<Handler *> retired_;
+};
+
+uint64_t now_us();       // CLOCK_MONOTONIC
+uint64_t wall_us();      // CLOCK_REALTIME, for the device's clock sync
+
+} // namespace pmd
+
+#endif
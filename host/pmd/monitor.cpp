@@ -0,0 +1,679 @@
+#include "monitor.h"
+
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+namespace pmd {
+
+static const size_t   MAX_REQUEST = 1023;         // the firmware's request buffer, less the NUL
+static const size_t   SAMPLE_BACKLOG = 64 * 1024; // a client this far behind skips samples...
+static const size_t   MAX_BACKLOG = 1024 * 1024;  // ...and is dropped this far behind
+static const uint32_t MAX_QUEUED = 64;            // requests one client may have waiting
+static const size_t   MAX_LINE = 16 * 1024;       // longest device line kept
+static const size_t   PIPELINE_BYTES = 1023;      // request bytes in flight, past the first
+
+#define ERR(code) "{\"error\":\"" code "\"}"
+
+static void send_cstr(Client &c, const char *s) { c.send(s, strlen(s)); }
+
+// ======= Client =======
+
+Client::Client(Monitor &m, int f, uint64_t i) : id(i), mon_(m), reader_(MAX_REQUEST) { fd = f; }
+
+void Client::on_io(uint32_t events) {
+    if (events & EPOLLIN) {
+        char buf[4096];
+        for (;;) {
+            ssize_t n = read(fd, buf, sizeof buf);
+            if (n == 0) { mon_.client_gone(*this); return; }
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN) break;
+                mon_.client_gone(*this);
+                return;
+            }
+            for (ssize_t k = 0; k < n; k++) {
+                ObjectReader::Result r = reader_.feed(buf[k]);
+                if (r == ObjectReader::OBJECT) mon_.request(*this, reader_.object());
+                else if (r == ObjectReader::TOO_LONG) send_cstr(*this, ERR("request_too_long"));
+                if (retired) return;
+            }
+        }
+    }
+    if (events & EPOLLERR) { mon_.client_gone(*this); return; }
+    if (events & EPOLLOUT) flush();
+}
+
+void Client::send(const char *line, size_t n) {
+    if (retired) return;
+    out_.append(line, n);
+    out_ += '\n';
+    if (out_.size() > MAX_BACKLOG) {
+        fprintf(stderr, "pmd: %s: dropping client %" PRIu64 ", %zu bytes unread\n", mon_.name.c_str(), id, out_.size());
+        mon_.client_gone(*this);
+        return;
+    }
+    if (!want_out_) flush();
+}
+
+bool Client::send_sample(const std::string &line) {
+    if (out_.size() > SAMPLE_BACKLOG) { dropped++; return false; }
+    send(line.data(), line.size());
+    return true;
+}
+
+void Client::flush() {
+    size_t done = 0;
+    while (done < out_.size()) {
+        ssize_t n = ::send(fd, out_.data() + done, out_.size() - done, MSG_NOSIGNAL);
+        if (n > 0) { done += (size_t)n; continue; }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) break;
+        mon_.client_gone(*this);
+        return;
+    }
+    out_.erase(0, done);
+    bool want = !out_.empty();
+    if (want != want_out_) {
+        want_out_ = want;
+        mon_.loop.mod(this, want ? (uint32_t)(EPOLLIN | EPOLLOUT) : (uint32_t)EPOLLIN);
+    }
+}
+
+// ======= Monitor: clients =======
+
+Monitor::Monitor(Loop &l, const Options &opt, std::string n, std::string p)
+    : loop(l), name(std::move(n)), port(std::move(p)), opt_(opt) {}
+
+Monitor::~Monitor() {
+    for (auto &kv : clients_) loop.retire(kv.second);
+    if (listener_) loop.retire(listener_);
+    if (fd >= 0) close(fd);
+    if (!sock_path_.empty()) unlink(sock_path_.c_str());
+}
+
+bool Monitor::listen(const std::string &dir) {
+    std::string path = dir + "/" + name + ".sock";
+    sockaddr_un a{};
+    a.sun_family = AF_UNIX;
+    if (path.size() >= sizeof a.sun_path) {
+        fprintf(stderr, "pmd: socket path too long: %s\n", path.c_str());
+        return false;
+    }
+    memcpy(a.sun_path, path.c_str(), path.size() + 1);
+
+    // a socket file left by a pmd that died is replaced; one that answers is not
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe >= 0 && connect(probe, (sockaddr *)&a, sizeof a) == 0) {
+        close(probe);
+        fprintf(stderr, "pmd: %s is already being served\n", path.c_str());
+        return false;
+    }
+    if (probe >= 0) close(probe);
+    unlink(path.c_str());
+
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s < 0 || bind(s, (sockaddr *)&a, sizeof a) != 0 || ::listen(s, 64) != 0) {
+        fprintf(stderr, "pmd: %s: %s\n", path.c_str(), strerror(errno));
+        if (s >= 0) close(s);
+        return false;
+    }
+    sock_path_ = path;
+    listener_ = new Listener(*this);
+    listener_->fd = s;
+    return loop.add(listener_, EPOLLIN);
+}
+
+bool Monitor::export_to(const std::string &dir) {
+    if (!shm_.open(dir + "/" + name + ".shm")) return false;
+    export_link();
+    return true;
+}
+
+static const std::vector<std::string> LOG_COLUMNS = {
+    "v", "a", "w", "pct", "soc", "soc_sigma", "charging", "avg_w",
+    "remaining_wh", "hrs_remaining", "hrs_to_full", "min_v", "max_v"};
+
+bool Monitor::log_to(const std::string &dir) {
+    // a block at least every 10 minutes, so a crash or power cut loses no
+    // more than that
+    pmlog::Writer::Options o;
+    o.max_block_us = 600 * 1000000LL;
+    if (log_.open(dir + "/" + name + ".pmlog", LOG_COLUMNS, o)) return true;
+    fprintf(stderr, "pmd: %s\n", log_.error().c_str());
+    return false;
+}
+
+void Monitor::accept_clients() {
+    for (;;) {
+        int c = accept4(listener_->fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (c < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) fprintf(stderr, "pmd: %s: accept: %s\n", name.c_str(), strerror(errno));
+            return;
+        }
+        Client *cl = new Client(*this, c, next_client_++);
+        if (!loop.add(cl, EPOLLIN)) { close(c); delete cl; continue; }
+        clients_[cl->id] = cl;
+        if (opt_.verbose) fprintf(stderr, "pmd: %s: client %" PRIu64 " connected\n", name.c_str(), cl->id);
+    }
+}
+
+void Monitor::client_gone(Client &c) {
+    if (c.retired) return;
+    if (opt_.verbose) fprintf(stderr, "pmd: %s: client %" PRIu64 " gone\n", name.c_str(), c.id);
+    clients_.erase(c.id);
+    loop.retire(&c);  // its queued requests still go out; the replies are dropped
+}
+
+Client *Monitor::client(uint64_t id) {
+    auto it = clients_.find(id);
+    return it == clients_.end() ? nullptr : it->second;
+}
+
+void Monitor::request(Client &c, const std::string &obj) {
+    if (opt_.verbose) fprintf(stderr, "pmd: %s: %" PRIu64 "> %s\n", name.c_str(), c.id, obj.c_str());
+
+    // Malformed requests go to the device too, so clients see its errors.
+    std::vector<Member> m;
+    bool parsed = object_members(obj.data(), obj.size(), m);
+    if (parsed) {
+        bool get = find_member(m, "get"), set = find_member(m, "set");
+        if (find_member(m, "pmd")) { reply_local(c, m); return; }
+        if (!get && !set && find_member(m, "stream")) { reply_local(c, m); return; }
+        if (get && !set && answer_from_cache(c, m)) return;
+    }
+
+    if (!connected_) { send_cstr(c, ERR("device_unavailable")); return; }
+    if (c.queued >= MAX_QUEUED) { send_cstr(c, ERR("busy")); return; }
+    // A sync pairs the host clock with the moment the device reads the
+    // request, so it must not wait behind others in the device's buffer.
+    queue_.push_back({CLIENT, c.id, obj, 0, parsed && find_member(m, "sync")});
+    c.queued++;
+    forwarded_++;
+    pump();
+}
+
+// {"pmd":"status"} and {"stream":N}, which never reach the device
+void Monitor::reply_local(Client &c, const std::vector<Member> &m) {
+    if (const Member *p = find_member(m, "pmd")) {
+        if (p->value == "\"status\"") status(c);
+        else send_cstr(c, "{\"error\":\"invalid_value\",\"field\":\"pmd\"}");
+        return;
+    }
+
+    // Same parse as the firmware's: leading integer, 0..1000000. N counts
+    // samples pmd receives, which is every sample at the default --every 1.
+    const std::string &v = find_member(m, "stream")->value;
+    char *end;
+    long n = strtol(v.c_str(), &end, 10);
+    if (end == v.c_str() || n < 0 || n > 1000000) {
+        send_cstr(c, "{\"error\":\"invalid_value\",\"field\":\"stream\"}");
+        return;
+    }
+    c.stream_every = (uint32_t)n;
+    c.stream_skip = 0;
+    char buf[96];
+    int len = snprintf(buf, sizeof buf, "{\"ok\":true,\"stream\":%ld,\"seq\":%s}", n, have_sample_ ? seq_.c_str() : "0");
+    c.send(buf, (size_t)len);
+}
+
+// A GET for nothing but t_us/v/a/w is the latest sample, which the stream
+// already delivered: answer it here in the firmware's field order and format.
+bool Monitor::answer_from_cache(Client &c, const std::vector<Member> &m) {
+    if (m.size() != 1 || !connected_ || !have_sample_) return false;
+    if (now_us() - sample_at_ > (uint64_t)opt_.max_age_ms * 1000u) return false;
+
+    std::vector<std::string> names;
+    if (!string_list(m[0].value, names)) return false;
+    unsigned want = 0;
+    for (const std::string &f : names) {
+        if (f == "t_us") want |= 1;
+        else if (f == "v") want |= 2;
+        else if (f == "a") want |= 4;
+        else if (f == "w") want |= 8;
+        else return false;
+    }
+
+    std::string r = "{";
+    auto field = [&](const char *key, const std::string &val) {
+        if (r.size() > 1) r += ',';
+        r += '"'; r += key; r += "\":"; r += val;
+    };
+    if (want & 1) field("t_us", t_us_);
+    if (want & 2) field("v", v_);
+    if (want & 4) field("a", a_);
+    if (want & 8) field("w", w_);
+    r += '}';
+    cache_hits_++;
+    c.send(r.data(), r.size());
+    return true;
+}
+
+static void json_str(std::string &out, const std::string &s) {
+    out += '"';
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') out += '\\';
+        if ((unsigned char)ch >= 0x20) out += ch;
+    }
+    out += '"';
+}
+
+void Monitor::status(Client &c) {
+    unsigned streaming = 0;
+    uint64_t dropped = 0;
+    for (auto &kv : clients_) {
+        if (kv.second->stream_every) streaming++;
+        dropped += kv.second->dropped;
+    }
+    std::string r = "{\"pmd\":{\"name\":";
+    json_str(r, name);
+    r += ",\"port\":";
+    json_str(r, port);
+    char buf[512];
+    char age[24] = "null";
+    if (have_sample_) snprintf(age, sizeof age, "%" PRIu64, (now_us() - sample_at_) / 1000u);
+    snprintf(buf, sizeof buf,
+             ",\"connected\":%s,\"clients\":%zu,\"streaming\":%u,\"every\":%u,\"samples\":%" PRIu64
+             ",\"seq\":%s,\"sample_age_ms\":%s,\"cache_hits\":%" PRIu64 ",\"forwarded\":%" PRIu64
+             ",\"queued\":%zu,\"timeouts\":%" PRIu64 ",\"unsolicited\":%" PRIu64 ",\"reconnects\":%" PRIu64
+             ",\"samples_dropped\":%" PRIu64,
+             connected_ ? "true" : "false", clients_.size(), streaming, opt_.every, samples_,
+             have_sample_ ? seq_.c_str() : "null", age, cache_hits_, forwarded_, queue_.size(), timeouts_,
+             unsolicited_, opens_ ? opens_ - 1 : 0, dropped);
+    r += buf;
+    if (const FleetStats *f = opt_.fleet) {
+        char per[24] = "null";
+        if (f->samples_per_s > 0) snprintf(per, sizeof per, "%.3f", f->cpu_pct * 1000.0 / f->samples_per_s);
+        snprintf(buf, sizeof buf,
+                 ",\"fleet\":{\"devices\":%u,\"connected\":%u,\"samples_per_s\":%.1f,\"cpu_pct\":%.2f,"
+                 "\"cpu_pct_per_ksps\":%s}",
+                 f->devices, f->connected, f->samples_per_s, f->cpu_pct, per);
+        r += buf;
+    }
+    r += "}}";
+    c.send(r.data(), r.size());
+}
+
+// ======= Monitor: device link =======
+
+void Monitor::open_port(uint64_t now) {
+    int f = open(port.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (f < 0) {
+        if (!warned_open_) fprintf(stderr, "pmd: %s: %s: %s, retrying\n", name.c_str(), port.c_str(), strerror(errno));
+        warned_open_ = true;
+        reopen_at_ = now + (uint64_t)opt_.reopen_ms * 1000u;
+        return;
+    }
+    ioctl(f, TIOCEXCL);  // pmd owns the port; other openers get EBUSY
+    termios t;
+    if (tcgetattr(f, &t) == 0) {
+        cfmakeraw(&t);
+        t.c_cflag |= CLOCAL | CREAD;
+        t.c_cc[VMIN] = 1;   // so an empty non-blocking read is EAGAIN, and 0 means hangup
+        t.c_cc[VTIME] = 0;
+        cfsetspeed(&t, B115200);  // ignored by USB CDC
+        tcsetattr(f, TCSANOW, &t);
+    }
+    tcflush(f, TCIOFLUSH);
+
+    fd = f;
+    if (!loop.add(this, EPOLLIN)) { close(f); fd = -1; reopen_at_ = now + (uint64_t)opt_.reopen_ms * 1000u; return; }
+    connected_ = true;
+    warned_open_ = false;
+    want_out_ = false;
+    line_.clear();
+    port_out_.clear();
+    opens_++;
+    poll_at_ = now;
+    fprintf(stderr, "pmd: %s: connected to %s\n", name.c_str(), port.c_str());
+    export_link();
+
+    // Drop whatever the device had queued for a previous owner, then start the
+    // shared stream. The device keeps its stream setting across our reconnects.
+    queue_.push_front({STREAM_SETUP, 0, "", 0});
+    resync(true);
+    static const char ev[] = "{\"event\":\"pmd_connected\"}";
+    broadcast(ev, sizeof ev - 1);
+}
+
+void Monitor::close_port(const char *why) {
+    fprintf(stderr, "pmd: %s: lost %s (%s)\n", name.c_str(), port.c_str(), why);
+    loop.del(this);
+    connected_ = false;
+    inflight_ = inflight_bytes_ = 0;
+    trace_lines_ = 0;
+    poll_queued_ = false;
+    reopen_at_ = now_us() + (uint64_t)opt_.reopen_ms * 1000u;
+    export_link();
+    log_.flush();
+
+    std::vector<Pending> failed(queue_.begin(), queue_.end());
+    queue_.clear();
+    for (const Pending &p : failed) {
+        Client *c = p.kind == CLIENT ? client(p.client) : nullptr;
+        if (!c) continue;
+        c->queued--;
+        send_cstr(*c, ERR("device_disconnected"));
+    }
+    static const char ev[] = "{\"event\":\"pmd_disconnected\"}";
+    broadcast(ev, sizeof ev - 1);
+}
+
+void Monitor::write_port(const std::string &s) {
+    if (opt_.verbose) fprintf(stderr, "pmd: %s: dev< %s\n", name.c_str(), s.c_str());
+    port_out_ += s;
+    size_t done = 0;
+    while (done < port_out_.size()) {
+        ssize_t n = write(fd, port_out_.data() + done, port_out_.size() - done);
+        if (n > 0) { done += (size_t)n; continue; }
+        if (n < 0 && errno == EINTR) continue;
+        break;
+    }
+    port_out_.erase(0, done);
+    bool want = !port_out_.empty();
+    if (want != want_out_) {
+        want_out_ = want;
+        loop.mod(this, want ? (uint32_t)(EPOLLIN | EPOLLOUT) : (uint32_t)EPOLLIN);
+    }
+}
+
+void Monitor::on_io(uint32_t events) {
+    if (events & EPOLLIN) {
+        char buf[4096];
+        for (;;) {
+            ssize_t n = read(fd, buf, sizeof buf);
+            if (n == 0) { close_port("end of file"); return; }
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN) break;
+                close_port(strerror(errno));
+                return;
+            }
+            for (ssize_t k = 0; k < n; k++) {
+                char ch = buf[k];
+                if (ch == '\r') continue;
+                if (ch != '\n') {
+                    if (line_.size() < MAX_LINE) line_ += ch;
+                    continue;
+                }
+                if (!line_.empty()) on_line(line_.data(), line_.size());
+                line_.clear();
+                if (!connected_) return;
+            }
+        }
+    }
+    if (events & (EPOLLHUP | EPOLLERR)) { close_port("hangup"); return; }
+    if (events & EPOLLOUT) write_port("");
+}
+
+void Monitor::on_line(const char *s, size_t n) {
+    std::vector<Member> m;
+    bool parsed = object_members(s, n, m);
+    const Member *ev = parsed ? find_member(m, "event") : nullptr;
+    if (!ev) { on_reply(m, parsed, s, n); return; }
+
+    if (ev->value == "\"sample\"") { on_sample(m, s, n); return; }
+    // alerts, charging transitions, ...: everyone gets them
+    broadcast(s, n);
+}
+
+// over a copy, since a send can drop a client that has stopped reading
+void Monitor::broadcast(const char *s, size_t n) {
+    std::vector<Client *> all;
+    for (auto &kv : clients_) all.push_back(kv.second);
+    for (Client *c : all) c->send(s, n);
+}
+
+void Monitor::on_sample(const std::vector<Member> &m, const char *s, size_t n) {
+    const Member *seq = find_member(m, "seq"), *t = find_member(m, "t_us");
+    const Member *v = find_member(m, "v"), *a = find_member(m, "a"), *w = find_member(m, "w");
+    if (!seq || !t || !v || !a || !w) return;
+    seq_ = seq->value; t_us_ = t->value; v_ = v->value; a_ = a->value; w_ = w->value;
+    have_sample_ = true;
+    sample_at_ = now_us();
+    samples_++;
+    if (shm_.active()) {
+        pm_shm_t *x = shm_.begin();
+        x->sample_seq = (uint32_t)strtoul(seq_.c_str(), nullptr, 10);
+        x->dev_t_us = strtoull(t_us_.c_str(), nullptr, 10);
+        x->sample_mono_us = sample_at_;
+        x->sample_wall_us = wall_us();
+        x->v = strtod(v_.c_str(), nullptr);
+        x->a = strtod(a_.c_str(), nullptr);
+        x->w = strtod(w_.c_str(), nullptr);
+        x->samples = samples_;
+        x->flags |= PM_SHM_HAVE_SAMPLE;
+        shm_.end();
+    }
+
+    std::string line(s, n);
+    std::vector<Client *> subs;
+    for (auto &kv : clients_) {
+        Client *c = kv.second;
+        if (c->stream_every && ++c->stream_skip >= c->stream_every) {
+            c->stream_skip = 0;
+            subs.push_back(c);
+        }
+    }
+    for (Client *c : subs) c->send_sample(line);
+}
+
+// connection state and counters
+void Monitor::export_link() {
+    if (!shm_.active()) return;
+    pm_shm_t *x = shm_.begin();
+    x->flags = connected_ ? x->flags | PM_SHM_CONNECTED : x->flags & ~PM_SHM_CONNECTED;
+    x->samples = samples_;
+    x->reconnects = opens_ ? opens_ - 1 : 0;
+    x->timeouts = timeouts_;
+    shm_.end();
+}
+
+// the reply to a POLL GET; null or missing numbers are NaN
+static double num(const std::vector<Member> &m, const char *key) {
+    const Member *x = find_member(m, key);
+    if (!x) return NAN;
+    char *end;
+    double d = strtod(x->value.c_str(), &end);
+    return end == x->value.c_str() ? NAN : d;
+}
+
+void Monitor::export_state(const std::vector<Member> &m) {
+    pm_shm_t *x = shm_.begin();
+    x->state_mono_us = now_us();
+    x->pct = num(m, "pct");
+    x->soc = num(m, "soc");
+    x->soc_sigma = num(m, "soc_sigma");
+    x->avg_w = num(m, "avg_w");
+    x->remaining_wh = num(m, "remaining_wh");
+    x->hrs_remaining = num(m, "hrs_remaining");
+    x->hrs_to_full = num(m, "hrs_to_full");
+    const Member *chg = find_member(m, "charging");
+    x->flags |= PM_SHM_HAVE_STATE;
+    if (chg && chg->value == "true") x->flags |= PM_SHM_CHARGING;
+    else x->flags &= ~PM_SHM_CHARGING;
+    shm_.end();
+}
+
+// one row per poll, in LOG_COLUMNS order: the latest sample if still fresh,
+// and the polled state
+void Monitor::log_state(const std::vector<Member> &m) {
+    double row[13];
+    bool fresh = have_sample_ && now_us() - sample_at_ <= (uint64_t)opt_.max_age_ms * 1000u;
+    row[0] = fresh ? strtod(v_.c_str(), nullptr) : NAN;
+    row[1] = fresh ? strtod(a_.c_str(), nullptr) : NAN;
+    row[2] = fresh ? strtod(w_.c_str(), nullptr) : NAN;
+    row[3] = num(m, "pct");
+    row[4] = num(m, "soc");
+    row[5] = num(m, "soc_sigma");
+    const Member *chg = find_member(m, "charging");
+    row[6] = !chg ? NAN : chg->value == "true" ? 1.0 : chg->value == "false" ? 0.0 : NAN;
+    row[7] = num(m, "avg_w");
+    row[8] = num(m, "remaining_wh");
+    row[9] = num(m, "hrs_remaining");
+    row[10] = num(m, "hrs_to_full");
+    row[11] = num(m, "min_v");
+    row[12] = num(m, "max_v");
+    if (!log_.append((int64_t)wall_us(), row)) {
+        fprintf(stderr, "pmd: %s: log: %s; logging stopped\n", name.c_str(), log_.error().c_str());
+        log_.close();
+    }
+}
+
+// Trace headers announce how many trace_data lines follow.
+static uint32_t trace_chunks(const std::vector<Member> &m) {
+    const Member *t = find_member(m, "trace");
+    std::vector<Member> inner;
+    unsigned long long k;
+    if (!t || !object_members(t->value.data(), t->value.size(), inner)) return 0;
+    const Member *c = find_member(inner, "chunks");
+    return c && parse_uint(c->value, 100000, k) ? (uint32_t)k : 0;
+}
+
+void Monitor::on_reply(const std::vector<Member> &m, bool parsed, const char *s, size_t n) {
+    if (opt_.verbose) fprintf(stderr, "pmd: %s: dev> %.*s\n", name.c_str(), (int)n, s);
+    if (!inflight_) { unsolicited_++; return; }
+
+    // The device answers in order, so a reply is the oldest request's.
+    Pending &p = queue_.front();
+    deadline_ = now_us() + (uint64_t)opt_.timeout_ms * 1000u;
+    switch (p.kind) {
+    case RESYNC: {
+        // anything before our sentinel's echo answers a request we gave up on
+        const Member *h = parsed ? find_member(m, "host_us") : nullptr;
+        if (!h || strtoull(h->value.c_str(), nullptr, 10) != p.sync_us) { unsolicited_++; return; }
+        break;
+    }
+    case STREAM_SETUP:
+        if (!parsed || !find_member(m, "ok"))
+            fprintf(stderr, "pmd: %s: stream request refused: %.*s\n", name.c_str(), (int)n, s);
+        break;
+    case POLL:
+        poll_queued_ = false;
+        if (parsed && !find_member(m, "error")) {
+            if (shm_.active()) export_state(m);
+            if (log_.is_open()) log_state(m);
+        }
+        break;
+    case CLIENT: {
+        Client *c = client(p.client);
+        if (c) c->send(s, n);
+        if (trace_lines_) {
+            if (--trace_lines_) return;
+        } else if (parsed && (trace_lines_ = trace_chunks(m))) {
+            return;
+        }
+        if (c) c->queued--;
+        break;
+    }
+    }
+    inflight_--;
+    inflight_bytes_ -= p.text.size();
+    queue_.pop_front();
+    pump();
+}
+
+void Monitor::resync(bool front) {
+    Pending p{RESYNC, 0, "", 0, true};
+    if (front) queue_.push_front(p);
+    else queue_.push_back(p);
+}
+
+// Keep up to --pipeline requests in flight, so the device always has the next
+// one waiting instead of idling for a USB round trip between requests.
+void Monitor::pump() {
+    if (!connected_) return;
+    while (inflight_ < queue_.size() && inflight_ < opt_.pipeline) {
+        Pending &p = queue_[inflight_];
+        fill(p);
+        if (inflight_ && (p.alone || inflight_bytes_ + p.text.size() > PIPELINE_BYTES)) break;
+        if (!inflight_) deadline_ = now_us() + (uint64_t)opt_.timeout_ms * 1000u;
+        inflight_++;
+        inflight_bytes_ += p.text.size();
+        write_port(p.text);
+        if (p.alone) break;
+    }
+}
+
+void Monitor::fill(Pending &p) {
+    if (p.kind == RESYNC) {
+        // the clock pair is a real one, so it also helps the device's sync fit
+        p.sync_us = wall_us();
+        p.text = "{\"sync\":{\"host_us\":" + std::to_string(p.sync_us) + "}}";
+    } else if (p.kind == STREAM_SETUP) {
+        p.text = "{\"stream\":" + std::to_string(opt_.every) + "}";
+    } else if (p.kind == POLL) {
+        p.text = "{\"get\":[\"pct\",\"soc\",\"soc_sigma\",\"charging\",\"avg_w\",\"remaining_wh\","
+                 "\"hrs_remaining\",\"hrs_to_full\"";
+        p.text += log_.is_open() ? ",\"min_v\",\"max_v\"]}" : "]}";
+    }
+}
+
+void Monitor::kick() {
+    if (!connected_) reopen_at_ = 0;
+}
+
+bool Monitor::polling() const {
+    return (shm_.active() || log_.is_open()) && opt_.poll_ms && connected_ && !poll_queued_;
+}
+
+uint64_t Monitor::next_deadline() const {
+    if (!connected_) return reopen_at_;
+    uint64_t t = inflight_ ? deadline_ : UINT64_MAX;
+    return polling() && poll_at_ < t ? poll_at_ : t;
+}
+
+void Monitor::on_timer(uint64_t now) {
+    if (!connected_) {
+        if (now >= reopen_at_) open_port(now);
+        return;
+    }
+    if (polling() && now >= poll_at_) {
+        // behind any queued client requests, and never more than one waiting
+        poll_at_ = now + (uint64_t)opt_.poll_ms * 1000u;
+        poll_queued_ = true;
+        queue_.push_back({POLL, 0, "", 0});
+        pump();
+    }
+    if (!inflight_ || now < deadline_) return;
+
+    // No answer: fail everything in flight, since the replies of the ones
+    // behind can no longer be told apart, then resync so that late replies
+    // cannot be taken for the next requests'.
+    timeouts_++;
+    std::vector<Pending> failed(queue_.begin(), queue_.begin() + inflight_);
+    queue_.erase(queue_.begin(), queue_.begin() + inflight_);
+    inflight_ = inflight_bytes_ = 0;
+    trace_lines_ = 0;
+    for (Pending &p : failed) {
+        if (p.kind == CLIENT) {
+            if (Client *c = client(p.client)) {
+                c->queued--;
+                send_cstr(*c, ERR("timeout"));
+            }
+            continue;
+        }
+        static const char *const what[] = {"", "sync", "stream request", "state poll"};
+        fprintf(stderr, "pmd: %s: no answer to %s\n", name.c_str(), what[p.kind]);
+        if (p.kind == POLL) poll_queued_ = false;
+        if (p.kind == STREAM_SETUP) queue_.push_front(p);
+    }
+    export_link();
+    resync(true);
+    pump();
+}
+
+} // namespace pmd
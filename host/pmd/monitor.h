@@ -0,0 +1,157 @@
+#ifndef PMD_MONITOR_H
+#define PMD_MONITOR_H
+
+/*
+ * One power monitor behind one Unix socket. The Monitor owns the serial port
+ * and keeps a single device-side stream running; clients share it. Requests
+ * pmd can answer from the latest sample never reach the device, everything
+ * else is queued and sent in order, a few requests ahead of their replies;
+ * the firmware answers in the order it reads them.
+ */
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include "json_scan.h"
+#include "loop.h"
+#include "pm_log.h"
+#include "shm_export.h"
+
+namespace pmd {
+
+// Process-wide figures over the last stats window, for {"pmd":"status"}.
+struct FleetStats {
+    uint32_t devices = 0, connected = 0;
+    double samples_per_s = 0, cpu_pct = 0;
+};
+
+struct Options {
+    uint32_t every = 1;          // device-side stream decimation
+    uint32_t timeout_ms = 1000;  // per forwarded request
+    uint32_t pipeline = 4;       // requests sent ahead of their replies
+    uint32_t max_age_ms = 1000;  // oldest sample still served from cache
+    uint32_t reopen_ms = 1000;   // retry interval while the port is gone
+    uint32_t poll_ms = 1000;     // battery state GETs for the shared-memory export; 0 = none
+    bool shm = true;
+    const FleetStats *fleet = nullptr;
+    bool verbose = false;
+};
+
+class Monitor;
+
+class Client : public Handler {
+public:
+    Client(Monitor &m, int fd, uint64_t id);
+    void on_io(uint32_t events) override;
+    void send(const char *line, size_t n);       // one line; '\n' is added
+    bool send_sample(const std::string &line);   // false if dropped for backlog
+
+    const uint64_t id;
+    uint32_t stream_every = 0;  // 0 = not subscribed
+    uint32_t stream_skip = 0;
+    uint32_t queued = 0;        // requests waiting on the device
+    uint64_t dropped = 0;       // sample lines skipped for backlog
+
+private:
+    void flush();
+    Monitor &mon_;
+    ObjectReader reader_;
+    std::string out_;
+    bool want_out_ = false;
+};
+
+class Monitor : public Handler {
+public:
+    Monitor(Loop &loop, const Options &opt, std::string name, std::string port);
+    ~Monitor() override;
+
+    bool listen(const std::string &dir);   // create <dir>/<name>.sock
+    bool export_to(const std::string &dir); // and <dir>/<name>.shm
+    bool log_to(const std::string &dir);    // append polled rows to <dir>/<name>.pmlog
+    void on_io(uint32_t events) override;  // device port
+    void on_timer(uint64_t now);
+    uint64_t next_deadline() const;        // monotonic us, UINT64_MAX if none
+    void kick();                           // the port (re)appeared: open it now
+    bool connected() const { return connected_; }
+    uint64_t samples() const { return samples_; }
+
+    // from clients
+    void accept_clients();
+    void request(Client &c, const std::string &obj);
+    void client_gone(Client &c);
+
+    Loop &loop;
+    const std::string name, port;
+
+private:
+    enum Kind { CLIENT, RESYNC, STREAM_SETUP, POLL };
+    struct Pending {
+        Kind kind;
+        uint64_t client;     // Client::id for CLIENT
+        std::string text;
+        uint64_t sync_us;    // RESYNC sentinel
+        bool alone = false;  // only sent with nothing in flight (clock pairs)
+    };
+
+    void open_port(uint64_t now);
+    void close_port(const char *why);
+    void write_port(const std::string &s);
+    void on_line(const char *s, size_t n);
+    void broadcast(const char *s, size_t n);
+    void on_sample(const std::vector<Member> &m, const char *s, size_t n);
+    void on_reply(const std::vector<Member> &m, bool parsed, const char *s, size_t n);
+    void pump();
+    void fill(Pending &p);
+    void resync(bool front);
+    void reply_local(Client &c, const std::vector<Member> &m);
+    bool answer_from_cache(Client &c, const std::vector<Member> &m);
+    void status(Client &c);
+    bool polling() const;
+    void export_link();
+    void export_state(const std::vector<Member> &m);
+    void log_state(const std::vector<Member> &m);
+    Client *client(uint64_t id);
+
+    struct Listener : Handler {
+        Monitor &mon;
+        explicit Listener(Monitor &m) : mon(m) {}
+        void on_io(uint32_t) override { mon.accept_clients(); }
+    };
+
+    const Options &opt_;
+    Listener *listener_ = nullptr;
+    std::string sock_path_;
+    std::unordered_map<uint64_t, Client *> clients_;
+    uint64_t next_client_ = 1;
+
+    // device link
+    bool connected_ = false;
+    uint64_t reopen_at_ = 0;
+    std::string line_, port_out_;
+    bool want_out_ = false;
+    std::deque<Pending> queue_;
+    size_t inflight_ = 0;        // queue_ entries already sent
+    size_t inflight_bytes_ = 0;
+    uint64_t deadline_ = 0;      // for the oldest of them
+    uint32_t trace_lines_ = 0;   // trace_data lines still owed to the oldest request
+    bool warned_open_ = false;
+
+    // latest sample, as the device printed it
+    bool have_sample_ = false;
+    std::string seq_, t_us_, v_, a_, w_;
+    uint64_t sample_at_ = 0;
+
+    ShmExport shm_;
+    pmlog::Writer log_;
+    uint64_t poll_at_ = 0;
+    bool poll_queued_ = false;
+
+    // counters for {"pmd":"status"}
+    uint64_t samples_ = 0, cache_hits_ = 0, forwarded_ = 0, timeouts_ = 0;
+    uint64_t unsolicited_ = 0, reconnects_ = 0, opens_ = 0;
+};
+
+} // namespace pmd
+
+#endif
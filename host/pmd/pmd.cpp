@@ -0,0 +1,235 @@
+/*
+ * pmd: keeps each power monitor's serial port open and shares it with any
+ * number of local clients over a Unix socket per device.
+ *
+ *   pmd [--dir DIR] [--by-id DIR] [--every N] [--pipeline N] [--timeout-ms T]
+ *       [--max-age-ms T] [--poll-ms T] [--no-shm] [--log DIR] [--stats S] [--verbose]
+ *       [[NAME=]PORT ...]
+ *
+ * Clients speak the device's own protocol on DIR/NAME.sock (one JSON object
+ * per request, one line per reply). Without ports, pmd serves every
+ * power_monitor link in --by-id (default /dev/serial/by-id), and watches it
+ * with inotify to pick up devices plugged in later. NAME defaults to the USB
+ * serial number taken from the by-id name, else the port's file name. DIR
+ * defaults to $XDG_RUNTIME_DIR/power_monitor, else /tmp/power_monitor-UID.
+ *
+ * All devices share one thread and one epoll loop; nothing blocks on a port.
+ *
+ * The device streams every Nth sample (--every, default 1) to pmd for as
+ * long as it is connected. GETs for only t_us/v/a/w are answered from the
+ * latest sample while it is younger than --max-age-ms, and {"stream":N}
+ * subscribes a client to the shared stream; neither reaches the device.
+ * Everything else is forwarded in arrival order, with up to --pipeline
+ * (default 4) requests in flight so the device never waits on the host.
+ * {"pmd":"status"} reports the daemon's own counters, and process CPU use
+ * per 1000 samples/s over the last --stats window (default 10 s); a nonzero
+ * --stats S also logs those figures to stderr every S seconds.
+ *
+ * DIR/NAME.shm exports the latest sample, the battery state (a GET every
+ * --poll-ms, default 1000) and the link counters as a memory-mapped seqlock
+ * block for readers that cannot afford even a socket round trip; see
+ * pm_shm.h. --no-shm turns it and the polling off.
+ *
+ * --log DIR appends a row per poll (the latest sample and the battery state,
+ * time in UTC) to DIR/NAME.pmlog, the columnar log of pm_log.h; pmlog and
+ * pm_log.py read it.
+ *
+ *   pmd /dev/serial/by-id/usb-Homebase_power_monitor_E6614C311B-if00
+ *   echo '{"get":["v","a"]}' | socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/power_monitor/E6614C311B.sock
+ */
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <regex>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "hotplug.h"
+#include "loop.h"
+#include "monitor.h"
+
+using namespace pmd;
+
+static void usage() {
+    fprintf(stderr, "usage: pmd [--dir DIR] [--by-id DIR] [--every N] [--pipeline N] [--timeout-ms T] [--max-age-ms T]\n"
+                    "           [--poll-ms T] [--no-shm] [--log DIR] [--stats S] [--verbose] [[NAME=]PORT ...]\n");
+}
+
+static bool mkdir_p(const std::string &dir) {
+    for (size_t k = 1; k <= dir.size(); k++) {
+        if (k < dir.size() && dir[k] != '/') continue;
+        std::string part = dir.substr(0, k);
+        if (mkdir(part.c_str(), 0700) != 0 && errno != EEXIST) {
+            fprintf(stderr, "pmd: %s: %s\n", part.c_str(), strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+// serial number from usb-Homebase_power_monitor_<SERIAL>-if00, else the file name
+static std::string port_name(const std::string &port) {
+    static const std::regex serial("power_monitor_([0-9A-Za-z]+)-if[0-9]+");
+    std::smatch m;
+    std::string base = port.substr(port.rfind('/') + 1);
+    if (std::regex_search(base, m, serial)) return m[1];
+    return base;
+}
+
+static uint64_t cpu_us() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000u +
+           (uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+}
+
+struct Signals : Handler {
+    bool stop = false;
+    void on_io(uint32_t) override {
+        signalfd_siginfo si;
+        while (read(fd, &si, sizeof si) == (ssize_t)sizeof si) stop = true;
+    }
+};
+
+int main(int argc, char **argv) {
+    Options opt;
+    std::string dir, by_id = "/dev/serial/by-id", log_dir;
+    double stats_s = 0;
+    std::vector<std::string> specs;
+    for (int k = 1; k < argc; k++) {
+        const char *arg = argv[k];
+        bool has_val = k + 1 < argc;
+        if (!strcmp(arg, "--dir") && has_val)                dir = argv[++k];
+        else if (!strcmp(arg, "--by-id") && has_val)         by_id = argv[++k];
+        else if (!strcmp(arg, "--every") && has_val)         opt.every = (uint32_t)strtoul(argv[++k], NULL, 0);
+        else if (!strcmp(arg, "--pipeline") && has_val)      opt.pipeline = (uint32_t)strtoul(argv[++k], NULL, 0);
+        else if (!strcmp(arg, "--timeout-ms") && has_val)    opt.timeout_ms = (uint32_t)strtoul(argv[++k], NULL, 0);
+        else if (!strcmp(arg, "--max-age-ms") && has_val)    opt.max_age_ms = (uint32_t)strtoul(argv[++k], NULL, 0);
+        else if (!strcmp(arg, "--poll-ms") && has_val)       opt.poll_ms = (uint32_t)strtoul(argv[++k], NULL, 0);
+        else if (!strcmp(arg, "--no-shm"))                   opt.shm = false;
+        else if (!strcmp(arg, "--log") && has_val)           log_dir = argv[++k];
+        else if (!strcmp(arg, "--stats") && has_val)         stats_s = strtod(argv[++k], NULL);
+        else if (!strcmp(arg, "--verbose"))                  opt.verbose = true;
+        else if (arg[0] != '-')                              specs.push_back(arg);
+        else { usage(); return 2; }
+    }
+    if (opt.every < 1 || opt.every > 1000000 || opt.timeout_ms < 1 || opt.pipeline < 1 || stats_s < 0) {
+        usage();
+        return 2;
+    }
+    while (by_id.size() > 1 && by_id.back() == '/') by_id.pop_back();
+
+    if (dir.empty()) {
+        const char *xdg = getenv("XDG_RUNTIME_DIR");
+        dir = xdg && *xdg ? std::string(xdg) + "/power_monitor" : "/tmp/power_monitor-" + std::to_string(getuid());
+    }
+    if (!mkdir_p(dir) || (!log_dir.empty() && !mkdir_p(log_dir))) return 1;
+
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigprocmask(SIG_BLOCK, &sigs, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    Loop loop;
+    Signals *sig = new Signals;
+    sig->fd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sig->fd < 0 || !loop.add(sig, EPOLLIN)) { perror("signalfd"); return 1; }
+
+    FleetStats fleet;
+    opt.fleet = &fleet;
+    std::vector<std::unique_ptr<Monitor>> mons;
+    bool failed = false;
+
+    // a port seen again is kicked rather than served twice
+    auto serve = [&](const std::string &name, const std::string &port) {
+        for (auto &m : mons) {
+            if (m->port == port) { m->kick(); return; }
+            if (m->name == name) {
+                fprintf(stderr, "pmd: %s: already served from %s, ignoring %s\n", name.c_str(), m->port.c_str(),
+                        port.c_str());
+                return;
+            }
+        }
+        std::unique_ptr<Monitor> m(new Monitor(loop, opt, name, port));
+        if (!m->listen(dir) || (opt.shm && !m->export_to(dir)) || (!log_dir.empty() && !m->log_to(log_dir))) {
+            failed = true;
+            return;
+        }
+        fprintf(stderr, "pmd: %s: serving %s on %s/%s.sock\n", name.c_str(), port.c_str(), dir.c_str(), name.c_str());
+        mons.push_back(std::move(m));
+    };
+
+    Hotplug *hotplug = nullptr;
+    if (specs.empty()) {
+        hotplug = new Hotplug(loop, by_id, [&](const std::string &path) { serve(port_name(path), path); });
+        if (!hotplug->start()) return 1;
+        if (mons.empty()) fprintf(stderr, "pmd: waiting for power_monitor devices in %s\n", by_id.c_str());
+    }
+    for (const std::string &spec : specs) {
+        size_t eq = spec.find('=');
+        std::string port = eq == std::string::npos ? spec : spec.substr(eq + 1);
+        std::string name = eq == std::string::npos ? port_name(port) : spec.substr(0, eq);
+        if (name.empty() || name.find('/') != std::string::npos) {
+            fprintf(stderr, "pmd: bad name in %s\n", spec.c_str());
+            return 2;
+        }
+        serve(name, port);
+    }
+    if (failed) return 1;
+
+    // samples/s and CPU over windows of --stats seconds (10 when not logging)
+    uint64_t window_us = (uint64_t)((stats_s > 0 ? stats_s : 10.0) * 1e6);
+    uint64_t win_at = now_us(), win_cpu = cpu_us(), win_samples = 0;
+
+    while (!sig->stop) {
+        uint64_t now = now_us();
+        for (auto &m : mons) m->on_timer(now);
+
+        if (now - win_at >= window_us) {
+            uint64_t cpu = cpu_us(), samples = 0;
+            fleet.devices = (uint32_t)mons.size();
+            fleet.connected = 0;
+            for (auto &m : mons) {
+                samples += m->samples();
+                fleet.connected += m->connected();
+            }
+            double dt = (double)(now - win_at) * 1e-6;
+            fleet.samples_per_s = (double)(samples - win_samples) / dt;
+            fleet.cpu_pct = 100.0 * (double)(cpu - win_cpu) * 1e-6 / dt;
+            if (stats_s > 0) {
+                fprintf(stderr, "pmd: %u devices, %u connected, %.1f samples/s, cpu %.2f%%", fleet.devices,
+                        fleet.connected, fleet.samples_per_s, fleet.cpu_pct);
+                if (fleet.samples_per_s > 0)
+                    fprintf(stderr, " (%.3f%% per 1000 samples/s)", fleet.cpu_pct * 1000.0 / fleet.samples_per_s);
+                fprintf(stderr, "\n");
+            }
+            win_at = now;
+            win_cpu = cpu;
+            win_samples = samples;
+        }
+
+        uint64_t next = win_at + window_us;
+        for (auto &m : mons) next = std::min(next, m->next_deadline());
+        now = now_us();
+        int timeout_ms = next <= now ? 0 : (int)std::min<uint64_t>((next - now + 999) / 1000, INT_MAX);
+        if (loop.wait(timeout_ms) < 0) { perror("epoll_wait"); break; }
+        if (failed) break;
+    }
+    mons.clear();
+    if (hotplug) loop.retire(hotplug);
+    loop.retire(sig);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,73 @@
+#include "shm_export.h"
+
+#include <sys/mman.h>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "loop.h"
+
+namespace pmd {
+
+ShmExport::~ShmExport() {
+    if (!m_) return;
+    pm_shm_t *m = begin();
+    m->flags &= ~PM_SHM_CONNECTED;
+    m->writer_pid = 0;
+    end();
+    munmap(m_, sizeof *m_);
+    unlink(path_.c_str());
+}
+
+bool ShmExport::open(const std::string &path) {
+    // Built under a temporary name and renamed into place, so a reader never
+    // maps a file that is still empty.
+    std::string tmp = path + ".new";
+    int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(pm_shm_t)) != 0) {
+        fprintf(stderr, "pmd: %s: %s\n", tmp.c_str(), strerror(errno));
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    void *p = mmap(nullptr, sizeof(pm_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "pmd: %s: %s\n", tmp.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    pm_shm_t *m = static_cast<pm_shm_t *>(p);
+    m->magic = PM_SHM_MAGIC;
+    m->version = PM_SHM_VERSION;
+    m->size = sizeof *m;
+    m->writer_pid = (uint32_t)getpid();
+    m->update_mono_us = now_us();
+    m->v = m->a = m->w = NAN;
+    m->pct = m->soc = m->soc_sigma = m->avg_w = NAN;
+    m->remaining_wh = m->hrs_remaining = m->hrs_to_full = NAN;
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        fprintf(stderr, "pmd: %s: %s\n", path.c_str(), strerror(errno));
+        munmap(p, sizeof *m);
+        unlink(tmp.c_str());
+        return false;
+    }
+    m_ = m;
+    path_ = path;
+    return true;
+}
+
+pm_shm_t *ShmExport::begin() {
+    pm_shm_write_begin(m_);
+    return m_;
+}
+
+void ShmExport::end() {
+    m_->update_mono_us = now_us();
+    pm_shm_write_end(m_);
+}
+
+} // namespace pmd
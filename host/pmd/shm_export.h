@@ -0,0 +1,28 @@
+#ifndef PMD_SHM_EXPORT_H
+#define PMD_SHM_EXPORT_H
+
+// pmd's side of the shared-memory export (pm_shm.h): one mapped file per device.
+#include <string>
+
+#include "pm_shm.h"
+
+namespace pmd {
+
+class ShmExport {
+public:
+    ~ShmExport();
+    bool open(const std::string &path);  // creates or replaces the file
+    bool active() const { return m_ != nullptr; }
+
+    // Bracket each update; begin() returns the block to fill in.
+    pm_shm_t *begin();
+    void end();
+
+private:
+    pm_shm_t *m_ = nullptr;
+    std::string path_;
+};
+
+} // namespace pmd
+
+#endif
@@ -0,0 +1,366 @@
+/*
+ * Converts, inspects and benchmarks columnar power logs (pm_log.h).
+ *
+ *   pmlog convert [--block-rows N] log.csv out.pmlog
+ *   pmlog info FILE.pmlog
+ *   pmlog cat [--from T] [--to T] [--columns a,b,...] FILE.pmlog
+ *   pmlog bench [--from T] [--to T] log.csv
+ *
+ * convert takes CSV as for alert_sim (a "timestamp" or "t_s" column; for
+ * example HB5power.log) and keeps every other column: numbers as they are,
+ * true/false as 1/0, anything else as NaN. It appends if out.pmlog already
+ * holds a log with the same columns. cat prints a time range back as CSV.
+ * bench times a full parse of the CSV against loading the converted log,
+ * whole and for the range (default: its last day).
+ *
+ * T is "YYYY-MM-DD[THH:MM:SS]" or seconds since 1970. Timestamps carry no zone;
+ * they are kept as written, which for pmd --log is UTC.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+extern "C" {
+#include "trace_csv.h"
+}
+#include "pm_log.h"
+
+static void usage() {
+    fprintf(stderr, "usage: pmlog convert [--block-rows N] log.csv out.pmlog\n"
+                    "       pmlog info FILE.pmlog\n"
+                    "       pmlog cat [--from T] [--to T] [--columns a,b,...] FILE.pmlog\n"
+                    "       pmlog bench [--from T] [--to T] log.csv\n");
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static bool parse_time(const char *s, int64_t &t_us) {
+    double t;
+    int y, m, d;
+    char tail;
+    if (trace_parse_iso(s, &t) == 0) {
+    } else if (sscanf(s, "%d-%d-%d%c", &y, &m, &d, &tail) == 3) {
+        if (trace_parse_iso((std::string(s) + "T00:00:00").c_str(), &t) != 0) return false;
+    } else {
+        char *end;
+        t = strtod(s, &end);
+        if (end == s || *end) return false;
+    }
+    t_us = (int64_t)llround(t * 1e6);
+    return true;
+}
+
+static std::string iso(int64_t t_us) {
+    time_t s = (time_t)(t_us >= 0 ? t_us / 1000000 : (t_us - 999999) / 1000000);
+    struct tm tm;
+    gmtime_r(&s, &tm);
+    char buf[48];
+    snprintf(buf, sizeof buf, "%04d-%02d-%02dT%02d:%02d:%02d.%06d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+             tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(t_us - (int64_t)s * 1000000));
+    return buf;
+}
+
+static double cell(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end != s && !*end) return v;
+    if (!strcmp(s, "true")) return 1;
+    if (!strcmp(s, "false")) return 0;
+    return NAN;
+}
+
+// The CSV's time column and the names of all the others.
+struct CsvLayout {
+    trace_cols_t tc;
+    std::vector<int> idx;
+    std::vector<std::string> names;
+};
+
+static bool csv_header(FILE *f, const char *path, CsvLayout &lay) {
+    char line[TRACE_LINE_MAX];
+    char *cols[TRACE_MAX_COLS];
+    if (!fgets(line, sizeof line, f)) {
+        fprintf(stderr, "pmlog: %s: empty\n", path);
+        return false;
+    }
+    int n = trace_split(line, cols, TRACE_MAX_COLS);
+    lay.tc.t_s = trace_find_col(cols, n, "t_s");
+    lay.tc.timestamp = trace_find_col(cols, n, "timestamp");
+    if (lay.tc.t_s < 0 && lay.tc.timestamp < 0) {
+        fprintf(stderr, "pmlog: %s: no timestamp or t_s column\n", path);
+        return false;
+    }
+    for (int k = 0; k < n; k++) {
+        if (k == lay.tc.t_s || k == lay.tc.timestamp) continue;
+        lay.idx.push_back(k);
+        lay.names.push_back(cols[k]);
+    }
+    return true;
+}
+
+// Time and values of one data row; false for rows without a usable time.
+static bool csv_row(char *line, const CsvLayout &lay, int64_t &t_us, std::vector<double> &vals) {
+    char *cols[TRACE_MAX_COLS];
+    int n = trace_split(line, cols, TRACE_MAX_COLS);
+    double t;
+    if (lay.tc.t_s >= 0) {
+        char *end;
+        if (n <= lay.tc.t_s) return false;
+        t = strtod(cols[lay.tc.t_s], &end);
+        if (end == cols[lay.tc.t_s]) return false;
+    } else if (n <= lay.tc.timestamp || trace_parse_iso(cols[lay.tc.timestamp], &t) != 0) {
+        return false;
+    }
+    t_us = (int64_t)llround(t * 1e6);
+    for (size_t k = 0; k < lay.idx.size(); k++) vals[k] = lay.idx[k] < n ? cell(cols[lay.idx[k]]) : NAN;
+    return true;
+}
+
+static int convert(const char *in, const char *out, uint32_t block_rows, uint64_t *rows_out) {
+    FILE *f = fopen(in, "r");
+    if (!f) {
+        fprintf(stderr, "pmlog: %s: %s\n", in, strerror(errno));
+        return 1;
+    }
+    CsvLayout lay;
+    if (!csv_header(f, in, lay)) {
+        fclose(f);
+        return 1;
+    }
+    pmlog::Writer w;
+    pmlog::Writer::Options opt;
+    opt.block_rows = block_rows;
+    if (!w.open(out, lay.names, opt)) {
+        fprintf(stderr, "pmlog: %s\n", w.error().c_str());
+        fclose(f);
+        return 1;
+    }
+    char line[TRACE_LINE_MAX];
+    std::vector<double> vals(lay.names.size());
+    uint64_t rows = 0, skipped = 0;
+    int64_t t;
+    while (fgets(line, sizeof line, f)) {
+        if (!csv_row(line, lay, t, vals)) { skipped++; continue; }
+        if (!w.append(t, vals.data())) {
+            fprintf(stderr, "pmlog: %s: %s\n", out, w.error().c_str());
+            fclose(f);
+            return 1;
+        }
+        rows++;
+    }
+    fclose(f);
+    if (!w.flush()) {
+        fprintf(stderr, "pmlog: %s: %s\n", out, w.error().c_str());
+        return 1;
+    }
+    w.close();
+    if (skipped) fprintf(stderr, "pmlog: %s: skipped %" PRIu64 " rows without a time\n", in, skipped);
+    *rows_out = rows;
+    return 0;
+}
+
+static long long file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long long)st.st_size : -1;
+}
+
+static int info(const char *path) {
+    pmlog::Reader r;
+    if (!r.open(path)) {
+        fprintf(stderr, "pmlog: %s\n", r.error().c_str());
+        return 1;
+    }
+    uint64_t rows = r.rows();
+    long long bytes = file_size(path);
+    printf("%s: %" PRIu64 " rows in %zu blocks, %lld bytes (%.1f per row)%s\n", path, rows, r.blocks().size(),
+           bytes, rows ? (double)bytes / (double)rows : 0.0, r.recovered() ? ", index rebuilt from blocks" : "");
+    if (rows) {
+        int64_t t0 = r.blocks()[0].t_min, t1 = r.blocks()[0].t_max;
+        for (const pmlog::BlockInfo &b : r.blocks()) {
+            t0 = std::min(t0, b.t_min);
+            t1 = std::max(t1, b.t_max);
+        }
+        printf("from %s to %s\n", iso(t0).c_str(), iso(t1).c_str());
+    }
+    printf("columns:");
+    for (const std::string &c : r.columns()) printf(" %s", c.c_str());
+    printf("\n");
+    return 0;
+}
+
+static int cat(const char *path, int64_t t0, int64_t t1, const char *columns) {
+    pmlog::Reader r;
+    if (!r.open(path)) {
+        fprintf(stderr, "pmlog: %s\n", r.error().c_str());
+        return 1;
+    }
+    std::vector<int> cols;
+    if (columns) {
+        std::string list = columns;
+        for (size_t at = 0; at <= list.size();) {
+            size_t comma = list.find(',', at);
+            if (comma == std::string::npos) comma = list.size();
+            std::string name = list.substr(at, comma - at);
+            int c = r.column(name);
+            if (c < 0) {
+                fprintf(stderr, "pmlog: %s: no column %s\n", path, name.c_str());
+                return 1;
+            }
+            cols.push_back(c);
+            at = comma + 1;
+        }
+    } else {
+        for (size_t c = 0; c < r.columns().size(); c++) cols.push_back((int)c);
+    }
+    pmlog::Series s;
+    if (!r.read(t0, t1, cols, s)) {
+        fprintf(stderr, "pmlog: %s: %s\n", path, r.error().c_str());
+        return 1;
+    }
+    printf("timestamp");
+    for (int c : cols) printf(",%s", r.columns()[(size_t)c].c_str());
+    printf("\n");
+    for (size_t k = 0; k < s.t.size(); k++) {
+        fputs(iso(s.t[k]).c_str(), stdout);
+        for (const std::vector<double> &v : s.values) printf(",%.10g", v[k]);
+        putchar('\n');
+    }
+    return 0;
+}
+
+static int bench(const char *csv, int64_t t0, int64_t t1, bool have_range) {
+    // the CSV baseline: every row split and parsed, as any CSV reader must
+    auto start = std::chrono::steady_clock::now();
+    FILE *f = fopen(csv, "r");
+    if (!f) {
+        fprintf(stderr, "pmlog: %s: %s\n", csv, strerror(errno));
+        return 1;
+    }
+    CsvLayout lay;
+    if (!csv_header(f, csv, lay)) {
+        fclose(f);
+        return 1;
+    }
+    char line[TRACE_LINE_MAX];
+    std::vector<double> vals(lay.names.size()), all;
+    std::vector<int64_t> ts;
+    int64_t t;
+    while (fgets(line, sizeof line, f)) {
+        if (!csv_row(line, lay, t, vals)) continue;
+        ts.push_back(t);
+        all.insert(all.end(), vals.begin(), vals.end());
+    }
+    fclose(f);
+    double csv_s = seconds_since(start);
+
+    char tmp[] = "/tmp/pmlog_bench.XXXXXX";
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    unlink(tmp);
+    uint64_t rows = 0;
+    start = std::chrono::steady_clock::now();
+    if (convert(csv, tmp, 4096, &rows)) return 1;
+    double conv_s = seconds_since(start);
+
+    pmlog::Reader r;
+    pmlog::Series s;
+    std::vector<int> cols;
+    for (size_t c = 0; c < lay.names.size(); c++) cols.push_back((int)c);
+    start = std::chrono::steady_clock::now();
+    if (!r.open(tmp) || !r.read(INT64_MIN, INT64_MAX, cols, s)) {
+        fprintf(stderr, "pmlog: %s\n", r.error().c_str());
+        unlink(tmp);
+        return 1;
+    }
+    double all_s = seconds_since(start);
+    bool same = s.t == ts;
+    for (size_t k = 0; same && k < s.t.size(); k++) {
+        for (size_t c = 0; c < cols.size(); c++) {
+            double a = all[k * cols.size() + c], b = s.values[c][k];
+            if (memcmp(&a, &b, sizeof a) != 0) same = false;
+        }
+    }
+
+    if (!have_range && !ts.empty()) {
+        t1 = r.blocks().back().t_max;
+        t0 = t1 - 86400 * (int64_t)1000000;
+    }
+    r.close();
+    start = std::chrono::steady_clock::now();
+    if (!r.open(tmp) || !r.read(t0, t1, cols, s)) {
+        fprintf(stderr, "pmlog: %s\n", r.error().c_str());
+        unlink(tmp);
+        return 1;
+    }
+    double range_s = seconds_since(start);
+
+    long long csv_bytes = file_size(csv), log_bytes = file_size(tmp);
+    unlink(tmp);
+    printf("rows=%zu columns=%zu csv_bytes=%lld pmlog_bytes=%lld ratio=%.1fx\n", ts.size(), cols.size(), csv_bytes,
+           log_bytes, log_bytes > 0 ? (double)csv_bytes / (double)log_bytes : 0.0);
+    printf("csv_parse_s=%.3f convert_s=%.3f\n", csv_s, conv_s);
+    printf("load_all_s=%.4f (%.0fx) identical=%s\n", all_s, csv_s / all_s, same ? "yes" : "NO");
+    printf("load_range_s=%.5f rows=%zu (%.0fx)\n", range_s, s.t.size(), csv_s / range_s);
+    return same ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) { usage(); return 2; }
+    const char *cmd = argv[1];
+    const char *columns = nullptr;
+    uint32_t block_rows = 4096;
+    int64_t t0 = INT64_MIN, t1 = INT64_MAX;
+    bool have_range = false;
+    std::vector<const char *> files;
+    for (int k = 2; k < argc; k++) {
+        const char *arg = argv[k];
+        bool has_val = k + 1 < argc;
+        if (!strcmp(arg, "--block-rows") && has_val) {
+            block_rows = (uint32_t)strtoul(argv[++k], nullptr, 10);
+        } else if (!strcmp(arg, "--from") && has_val) {
+            if (!parse_time(argv[++k], t0)) { usage(); return 2; }
+            have_range = true;
+        } else if (!strcmp(arg, "--to") && has_val) {
+            if (!parse_time(argv[++k], t1)) { usage(); return 2; }
+            have_range = true;
+        } else if (!strcmp(arg, "--columns") && has_val) {
+            columns = argv[++k];
+        } else if (arg[0] == '-' && arg[1]) {
+            usage();
+            return 2;
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    if (!strcmp(cmd, "convert") && files.size() == 2 && block_rows) {
+        uint64_t rows;
+        auto start = std::chrono::steady_clock::now();
+        if (convert(files[0], files[1], block_rows, &rows)) return 1;
+        long long in = file_size(files[0]), out = file_size(files[1]);
+        printf("rows=%" PRIu64 " csv_bytes=%lld pmlog_bytes=%lld ratio=%.1fx wall_s=%.3f\n", rows, in, out,
+               out > 0 ? (double)in / (double)out : 0.0, seconds_since(start));
+        return 0;
+    }
+    if (!strcmp(cmd, "info") && files.size() == 1) return info(files[0]);
+    if (!strcmp(cmd, "cat") && files.size() == 1) return cat(files[0], t0, t1, columns);
+    if (!strcmp(cmd, "bench") && files.size() == 1) return bench(files[0], t0, t1, have_range);
+    usage();
+    return 2;
+}
@@ -0,0 +1,218 @@
+/*
+ * Replays a v/a trace through the firmware's SoC estimator (soc_ekf.c) and the
+ * voltage-only pct (ocv.c) and reports how far each is from a coulomb-counted
+ * reference.
+ *
+ * The reference needs one known point: by default the trace is assumed to end
+ * with the battery empty (--end-pct 0, as for a run-down log like
+ * HB5power.log); --start-pct anchors it at the first row instead. From there
+ * the reference integrates current over the rated capacity. Gaps longer than
+ * --max-gap-s (logger not running) are not integrated.
+ *
+ * Input CSV as for alert_sim; current is positive when discharging unless
+ * --charge-positive is given. min_v/max_v default to the log's own columns
+ * when present. --learn-r runs the firmware's load-step resistance estimator
+ * (ir_est.c), seeded with --r-int, and feeds it to the filter as the device
+ * does.
+ *
+ *   soc_replay [--capacity-ah AH] [--r-int OHM] [--learn-r] [--preset NAME | --ocv FILE]
+ *              [--min-v V] [--max-v V] [--end-pct P | --start-pct P]
+ *              [--max-gap-s S] [--charge-positive] [--trace] [log.csv]
+ *
+ * --ocv takes a saved {"get":"ocv"} response. --trace prints a per-row CSV
+ * (t_s,v,a,ref,pct,soc,sigma,r_int) on stdout and moves the report to stderr.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir_est.h"
+#include "ocv.h"
+#include "soc_ekf.h"
+#include "trace_csv.h"
+
+typedef struct {
+    double t;
+    float  v, a;   // a: positive = discharging
+} row_t;
+
+typedef struct {
+    double sum2, max, sum;
+    unsigned long n;
+} err_t;
+
+static void err_add(err_t *e, double d) {
+    e->sum += d;
+    e->sum2 += d * d;
+    if (fabs(d) > e->max) e->max = fabs(d);
+    e->n++;
+}
+
+static void err_print(FILE *out, const char *name, const err_t *e) {
+    if (!e->n) return;
+    fprintf(out, "%-4s rms=%.2f max=%.2f bias=%+.2f (pct points)\n",
+            name, sqrt(e->sum2 / e->n), e->max, e->sum / e->n);
+}
+
+// [[v,pct],...] anywhere in the file, e.g. a saved {"get":"ocv"} response
+static int load_ocv_file(const char *path, ocv_table_t *t) {
+    FILE *f = fopen(path, "r");
+    if (!f) { perror(path); return -1; }
+    static char buf[4096];
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+
+    float v[OCV_MAX_POINTS], pct[OCV_MAX_POINTS];
+    int n = 0;
+    const char *p = strstr(buf, "[[");
+    while (p && (p = strchr(p, '[')) && n < OCV_MAX_POINTS) {
+        p++;
+        if (*p == '[') continue;
+        char *end;
+        v[n] = strtof(p, &end);
+        if (end == p || *end != ',') break;
+        pct[n] = strtof(end + 1, &end);
+        n++;
+        p = end;
+    }
+    if (ocv_table_set(t, v, pct, n)) {
+        fprintf(stderr, "%s: need 2..%d [v,pct] points, v increasing\n", path, OCV_MAX_POINTS);
+        return -1;
+    }
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: soc_replay [--capacity-ah AH] [--r-int OHM] [--learn-r] [--preset NAME | --ocv FILE] [--min-v V] [--max-v V]\n"
+                    "                  [--end-pct P | --start-pct P] [--max-gap-s S] [--charge-positive] [--trace] [log.csv]\n");
+}
+
+int main(int argc, char **argv) {
+    float capacity_ah = 10.0f, r_int = 0.05f;
+    float min_v = NAN, max_v = NAN;
+    double end_pct = 0.0, start_pct = NAN, max_gap_s = 600.0;
+    int preset = OCV_PRESET_KNEE, charge_positive = 0, trace = 0, learn_r = 0;
+    const char *ocv_path = NULL, *path = NULL;
+
+    for (int k = 1; k < argc; k++) {
+        const char *arg = argv[k];
+        int has_val = k + 1 < argc;
+        if (!strcmp(arg, "--capacity-ah") && has_val)  capacity_ah = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--r-int") && has_val)   r_int = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--ocv") && has_val)     ocv_path = argv[++k];
+        else if (!strcmp(arg, "--min-v") && has_val)   min_v = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--max-v") && has_val)   max_v = strtof(argv[++k], NULL);
+        else if (!strcmp(arg, "--end-pct") && has_val) end_pct = strtod(argv[++k], NULL);
+        else if (!strcmp(arg, "--start-pct") && has_val) start_pct = strtod(argv[++k], NULL);
+        else if (!strcmp(arg, "--max-gap-s") && has_val) max_gap_s = strtod(argv[++k], NULL);
+        else if (!strcmp(arg, "--charge-positive"))   charge_positive = 1;
+        else if (!strcmp(arg, "--trace"))             trace = 1;
+        else if (!strcmp(arg, "--learn-r"))           learn_r = 1;
+        else if (!strcmp(arg, "--preset") && has_val) {
+            const char *name = argv[++k];
+            preset = ocv_preset_lookup(name, (unsigned)strlen(name));
+            if (preset < 0) { fprintf(stderr, "unknown preset %s\n", name); return 2; }
+        }
+        else if (arg[0] == '-' && arg[1]) { usage(); return 2; }
+        else path = arg;
+    }
+
+    FILE *in = path ? fopen(path, "r") : stdin;
+    if (!in) { perror(path); return 1; }
+
+    char line[TRACE_LINE_MAX];
+    char *cols[TRACE_MAX_COLS];
+    trace_cols_t tc;
+    if (!fgets(line, sizeof(line), in)) { fprintf(stderr, "empty input\n"); return 1; }
+    int ncols = trace_split(line, cols, TRACE_MAX_COLS);
+    if (trace_header(cols, ncols, &tc)) {
+        fprintf(stderr, "need v, a and t_s or timestamp columns\n");
+        return 1;
+    }
+    int c_min = trace_find_col(cols, ncols, "min_v");
+    int c_max = trace_find_col(cols, ncols, "max_v");
+
+    row_t *rows = NULL;
+    size_t nrows = 0, cap = 0;
+    while (fgets(line, sizeof(line), in)) {
+        int n = trace_split(line, cols, TRACE_MAX_COLS);
+        double t;
+        if (trace_row_time(cols, n, &tc, &t)) continue;
+        if (isnan(min_v) && c_min >= 0 && n > c_min) min_v = strtof(cols[c_min], NULL);
+        if (isnan(max_v) && c_max >= 0 && n > c_max) max_v = strtof(cols[c_max], NULL);
+        if (nrows == cap) {
+            cap = cap ? cap * 2 : 4096;
+            rows = realloc(rows, cap * sizeof(*rows));
+            if (!rows) { perror("realloc"); return 1; }
+        }
+        float a = strtof(cols[tc.a], NULL);
+        rows[nrows++] = (row_t){ t, strtof(cols[tc.v], NULL), charge_positive ? -a : a };
+    }
+    if (in != stdin) fclose(in);
+    if (nrows < 2) { fprintf(stderr, "need at least two rows\n"); return 1; }
+    if (isnan(min_v)) min_v = 21.0f;
+    if (isnan(max_v)) max_v = 32.2f;
+
+    ocv_table_t ocv;
+    if (ocv_path ? load_ocv_file(ocv_path, &ocv) : ocv_table_preset(&ocv, (ocv_preset_t)preset, min_v, max_v)) {
+        if (!ocv_path) fprintf(stderr, "bad min_v/max_v for preset\n");
+        return 1;
+    }
+
+    // reference: Ah discharged from the first row, then anchored at one end
+    double *q_ah = malloc(nrows * sizeof(*q_ah));
+    if (!q_ah) { perror("malloc"); return 1; }
+    q_ah[0] = 0.0;
+    for (size_t k = 1; k < nrows; k++) {
+        double dt = rows[k].t - rows[k - 1].t;
+        q_ah[k] = q_ah[k - 1] + (dt > 0 && dt <= max_gap_s ? rows[k].a * dt / 3600.0 : 0.0);
+    }
+    double anchor = isnan(start_pct) ? end_pct + 100.0 * q_ah[nrows - 1] / capacity_ah : start_pct;
+
+    soc_ekf_t ekf;
+    soc_ekf_init(&ekf);
+    soc_ekf_set_capacity(&ekf, capacity_ah);
+    soc_ekf_set_r_int(&ekf, r_int);
+    soc_ekf_set_curve(&ekf, &ocv);
+    ir_est_t ir;
+    ir_est_init(&ir, r_int, 0.01f);
+
+    FILE *rep = trace ? stderr : stdout;
+    if (trace) printf("t_s,v,a,ref,pct,soc,sigma,r_int\n");
+    err_t e_pct = {0}, e_soc = {0};
+    for (size_t k = 0; k < nrows; k++) {
+        double dt = k ? rows[k].t - rows[k - 1].t : 0.0;
+        uint32_t dt_us = dt > 0 && dt <= max_gap_s ? (uint32_t)llround(dt * 1e6) : 0;
+        int32_t v_mv = (int32_t)lroundf(rows[k].v * 1000.0f), i_ma = (int32_t)lroundf(rows[k].a * 1000.0f);
+        if (learn_r) {
+            if (k && !dt_us) ir_est_break(&ir);
+            if (ir_est_sample(&ir, v_mv, i_ma)) soc_ekf_set_r_int(&ekf, ir.r_ohm);
+        }
+        soc_ekf_step(&ekf, v_mv, i_ma, dt_us);
+
+        double ref = anchor - 100.0 * q_ah[k] / capacity_ah;
+        double pct = ocv_pct(&ocv, rows[k].v + rows[k].a * ekf.r_mohm * 1e-3f);
+        double soc = soc_ekf_pct(&ekf);
+        err_add(&e_pct, pct - ref);
+        err_add(&e_soc, soc - ref);
+        if (trace) {
+            printf("%.3f,%.3f,%.4f,%.2f,%.2f,%.2f,%.2f,%.4f\n", rows[k].t - rows[0].t, rows[k].v, rows[k].a,
+                   ref, pct, soc, soc_ekf_sigma_pct(&ekf), ekf.r_mohm * 1e-3);
+        }
+    }
+
+    fprintf(rep, "rows=%zu span_h=%.2f discharged_ah=%.3f capacity_ah=%.2f r_int=%.3f ocv=%s ref_start=%.1f\n",
+            nrows, (rows[nrows - 1].t - rows[0].t) / 3600.0, q_ah[nrows - 1], capacity_ah, r_int,
+            ocv_path ? "custom" : ocv_preset_name((ocv_preset_t)preset), anchor);
+    if (learn_r) {
+        fprintf(rep, "r_int learned=%.4f sigma=%.4f steps=%lu rejected=%lu\n",
+                ir.r_ohm, sqrtf(ir.var), (unsigned long)ir.steps, (unsigned long)ir.rejected);
+    }
+    err_print(rep, "pct", &e_pct);
+    err_print(rep, "soc", &e_soc);
+    free(q_ah);
+    free(rows);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include "trace_csv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// days since 1970-01-01 for a proleptic Gregorian date
+static long days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+int trace_parse_iso(const char *s, double *out) {
+    int y, mo, d, h, mi;
+    double sec;
+    if (sscanf(s, "%d-%d-%d%*[T ]%d:%d:%lf", &y, &mo, &d, &h, &mi, &sec) != 6) return -1;
+    *out = (double)days_from_civil(y, mo, d) * 86400.0 + h * 3600.0 + mi * 60.0 + sec;
+    return 0;
+}
+
+int trace_split(char *line, char **cols, int max) {
+    int n = 0;
+    char *p = line;
+    while (n < max) {
+        cols[n++] = p;
+        char *c = strchr(p, ',');
+        if (!c) break;
+        *c = '\0';
+        p = c + 1;
+    }
+    char *nl = strpbrk(cols[n - 1], "\r\n");
+    if (nl) *nl = '\0';
+    return n;
+}
+
+int trace_find_col(char **cols, int n, const char *name) {
+    for (int k = 0; k < n; k++) {
+        if (strcmp(cols[k], name) == 0) return k;
+    }
+    return -1;
+}
+
+int trace_header(char **cols, int n, trace_cols_t *tc) {
+    tc->t_s = trace_find_col(cols, n, "t_s");
+    tc->timestamp = trace_find_col(cols, n, "timestamp");
+    tc->v = trace_find_col(cols, n, "v");
+    tc->a = trace_find_col(cols, n, "a");
+    return (tc->v < 0 || tc->a < 0 || (tc->t_s < 0 && tc->timestamp < 0)) ? -1 : 0;
+}
+
+int trace_row_time(char **cols, int n, const trace_cols_t *tc, double *t) {
+    if (n <= tc->v || n <= tc->a) return -1;
+    if (tc->t_s >= 0) {
+        if (n <= tc->t_s) return -1;
+        *t = strtod(cols[tc->t_s], NULL);
+        return 0;
+    }
+    if (n <= tc->timestamp) return -1;
+    return trace_parse_iso(cols[tc->timestamp], t);
+}
@@ -0,0 +1,30 @@
+#ifndef TRACE_CSV_H
+#define TRACE_CSV_H
+
+/*
+ * Minimal CSV helpers shared by the host tools. Traces have a header row and
+ * a time column that is either "t_s" (seconds) or "timestamp" (ISO 8601, as
+ * written to HB5power.log).
+ */
+
+#define TRACE_LINE_MAX 1024
+#define TRACE_MAX_COLS 32
+
+// Split `line` in place on commas; strips the line ending. Returns the column count.
+int trace_split(char *line, char **cols, int max);
+// Index of the header column called `name`, or -1.
+int trace_find_col(char **cols, int n, const char *name);
+// Seconds since 1970-01-01 for "YYYY-MM-DD[T ]HH:MM:SS[.frac]"; returns -1 if unparsable.
+int trace_parse_iso(const char *s, double *out);
+
+typedef struct {
+    int t_s, timestamp;  // one of the two time columns
+    int v, a;
+} trace_cols_t;
+
+// Locate time, v and a in a header; returns -1 if any is missing.
+int trace_header(char **cols, int n, trace_cols_t *tc);
+// Time of a data row in seconds; returns -1 if the row is short or unparsable.
+int trace_row_time(char **cols, int n, const trace_cols_t *tc, double *t);
+
+#endif
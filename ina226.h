@@ -0,0 +1,24 @@
+#ifndef INA226_H
+#define INA226_H
+
+/*
+ * INA226 register map and the configuration the firmware programs. Shared by
+ * pm_core.c, the RP2040 sampler and the host-side device models. Mask/Enable
+ * and Alert Limit live in ina226_alert.h.
+ */
+#define INA226_REG_CONFIG   0x00
+#define INA226_REG_SHUNT    0x01
+#define INA226_REG_BUS      0x02
+#define INA226_REG_POWER    0x03
+#define INA226_REG_CURRENT  0x04
+#define INA226_REG_CAL      0x05
+#define INA226_ADDR         0x40   // default 7-bit address
+#define INA226_SHUNT_OHMS   0.1f   // stock shunt
+#define INA226_I_MAX_A      2.0f   // CURRENT register full scale the firmware calibrates for
+
+// AVG=128, VBUSCT=1.1ms, VSHCT=1.1ms, MODE=111 (cont shunt+bus)
+#define INA226_CONFIG_AVG   0b100u
+#define INA226_CONFIG_VBUSCT 0b100u
+#define INA226_CONFIG_VSHCT 0b100u
+
+#endif
@@ -0,0 +1,127 @@
+#include "ina226_alert.h"
+
+static const char *k_rule_names[ALERT_RULE_COUNT] = {
+    "bus_uv", "over_current", "over_power", "bus_ov"
+};
+
+const char *ina226_alert_rule_name(alert_rule_t rule) {
+    return (unsigned)rule < ALERT_RULE_COUNT ? k_rule_names[rule] : "?";
+}
+
+uint16_t ina226_alert_function(alert_rule_t rule, float threshold) {
+    switch (rule) {
+    case ALERT_BUS_UV:       return INA226_MASK_BUL;
+    case ALERT_BUS_OV:       return INA226_MASK_BOL;
+    case ALERT_OVER_CURRENT: return threshold < 0.0f ? INA226_MASK_SUL : INA226_MASK_SOL;
+    case ALERT_OVER_POWER:   return INA226_MASK_POL;
+    default:                 return 0;
+    }
+}
+
+static uint16_t sat_u16(float x) {
+    if (x <= 0.0f) return 0;
+    if (x >= 65535.0f) return 65535;
+    return (uint16_t)(x + 0.5f);
+}
+
+static uint16_t sat_s16(float x) {
+    if (x <= -32768.0f) return (uint16_t)(int16_t)-32768;
+    if (x >= 32767.0f) return 32767;
+    return (uint16_t)(int16_t)(x < 0.0f ? x - 0.5f : x + 0.5f);
+}
+
+uint16_t ina226_alert_limit(alert_rule_t rule, float threshold, const ina226_scale_t *sc) {
+    switch (rule) {
+    case ALERT_BUS_UV:
+    case ALERT_BUS_OV:       return sat_u16(threshold / 1.25e-3f);
+    // the chip compares shunt voltage (2.5 uV/LSB), not the CURRENT register
+    case ALERT_OVER_CURRENT: return sat_s16(threshold * sc->shunt_ohms / 2.5e-6f);
+    case ALERT_OVER_POWER:   return sat_u16(threshold / sc->power_lsb);
+    default:                 return 0;
+    }
+}
+
+float ina226_alert_full_scale(alert_rule_t rule, const ina226_scale_t *sc) {
+    float i_fs = 32767.0f * 2.5e-6f / sc->shunt_ohms;
+    switch (rule) {
+    case ALERT_BUS_UV:
+    case ALERT_BUS_OV:       return 40.96f;
+    case ALERT_OVER_CURRENT: return i_fs;
+    case ALERT_OVER_POWER: {
+        float p_fs = i_fs * 40.96f;
+        return p_fs < 65535.0f * sc->power_lsb ? p_fs : 65535.0f * sc->power_lsb;
+    }
+    default:                 return 0.0f;
+    }
+}
+
+int ina226_alert_pick_hw(const float limits[ALERT_RULE_COUNT]) {
+    for (int k = 0; k < ALERT_RULE_COUNT; k++) {
+        if (limits[k] != 0.0f) return k;
+    }
+    return -1;
+}
+
+int ina226_alert_compare(uint16_t mask, uint16_t limit, int16_t shunt_raw, uint16_t bus_raw, uint16_t power_raw) {
+    // only the most significant enabled function is honored
+    if (mask & INA226_MASK_SOL) return shunt_raw > (int16_t)limit;
+    if (mask & INA226_MASK_SUL) return shunt_raw < (int16_t)limit;
+    if (mask & INA226_MASK_BOL) return bus_raw > limit;
+    if (mask & INA226_MASK_BUL) return bus_raw < limit;
+    if (mask & INA226_MASK_POL) return power_raw > limit;
+    return 0;
+}
+
+void ina226_alert_model_init(ina226_alert_model_t *m) {
+    m->mask = 0;
+    m->limit = 0;
+    m->flags = 0;
+    m->asserted = 0;
+}
+
+void ina226_alert_model_write(ina226_alert_model_t *m, uint8_t reg, uint16_t val) {
+    if (reg == INA226_REG_MASK) {
+        // flag bits are read-only
+        m->mask = val & (INA226_MASK_FUNCS | INA226_MASK_CNVR | INA226_MASK_APOL | INA226_MASK_LEN);
+        if (!(m->mask & (INA226_MASK_FUNCS | INA226_MASK_CNVR))) m->asserted = 0;
+    } else if (reg == INA226_REG_ALERT) {
+        m->limit = val;
+    }
+}
+
+int ina226_alert_model_convert(ina226_alert_model_t *m, int16_t shunt_raw, uint16_t bus_raw, uint16_t power_raw, int overflow) {
+    int was = m->asserted;
+    int hit = ina226_alert_compare(m->mask, m->limit, shunt_raw, bus_raw, power_raw);
+
+    m->flags |= INA226_MASK_CVRF;
+    if (overflow) m->flags |= INA226_MASK_OVF;
+    else m->flags &= (uint16_t)~INA226_MASK_OVF;
+
+    if (hit) {
+        m->flags |= INA226_MASK_AFF;
+        m->asserted = 1;
+    } else if (!(m->mask & INA226_MASK_LEN)) {
+        // transparent mode: cleared by the next conversion without a fault
+        m->flags &= (uint16_t)~INA226_MASK_AFF;
+        m->asserted = 0;
+    }
+    if (m->mask & INA226_MASK_CNVR) m->asserted = 1;
+    return m->asserted != was;
+}
+
+uint16_t ina226_alert_model_read_mask(ina226_alert_model_t *m) {
+    uint16_t v = m->mask | m->flags;
+    m->flags &= (uint16_t)~INA226_MASK_CVRF;
+    if (m->mask & INA226_MASK_LEN) {
+        m->flags &= (uint16_t)~INA226_MASK_AFF;
+        m->asserted = 0;
+    } else if ((m->mask & INA226_MASK_CNVR) && !(m->flags & INA226_MASK_AFF)) {
+        m->asserted = 0;
+    }
+    return v;
+}
+
+int ina226_alert_model_pin(const ina226_alert_model_t *m) {
+    // open-drain, active-low unless APOL is set
+    return (m->mask & INA226_MASK_APOL) ? m->asserted : !m->asserted;
+}
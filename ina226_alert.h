@@ -0,0 +1,85 @@
+#ifndef INA226_ALERT_H
+#define INA226_ALERT_H
+
+#include <stdint.h>
+
+/*
+ * INA226 alert comparator (Mask/Enable 0x06, Alert Limit 0x07).
+ *
+ * Shared by the firmware, which uses it to encode alert rules into register
+ * values, and by the host-side simulator, which also uses the comparator model
+ * to predict when the chip would assert ALERT. No Pico SDK dependencies.
+ */
+
+#define INA226_REG_MASK       0x06
+#define INA226_REG_ALERT      0x07
+
+// Mask/Enable bits
+#define INA226_MASK_SOL       0x8000u // shunt voltage over limit
+#define INA226_MASK_SUL       0x4000u // shunt voltage under limit
+#define INA226_MASK_BOL       0x2000u // bus voltage over limit
+#define INA226_MASK_BUL       0x1000u // bus voltage under limit
+#define INA226_MASK_POL       0x0800u // power over limit
+#define INA226_MASK_CNVR      0x0400u // ALERT on conversion ready
+#define INA226_MASK_AFF       0x0010u // alert function flag
+#define INA226_MASK_CVRF      0x0008u // conversion ready flag
+#define INA226_MASK_OVF       0x0004u // math overflow
+#define INA226_MASK_APOL      0x0002u // ALERT active-high
+#define INA226_MASK_LEN       0x0001u // latch ALERT until Mask/Enable is read
+#define INA226_MASK_FUNCS     (INA226_MASK_SOL | INA226_MASK_SUL | INA226_MASK_BOL | INA226_MASK_BUL | INA226_MASK_POL)
+
+// Alert rules exposed over the protocol, in hardware-arming priority order:
+// the chip compares one function at a time, the firmware checks the rest.
+typedef enum {
+    ALERT_BUS_UV = 0,   // bus voltage below limit (V)
+    ALERT_OVER_CURRENT, // current beyond limit (A, signed: >0 discharge, <0 charge)
+    ALERT_OVER_POWER,   // power above limit (W)
+    ALERT_BUS_OV,       // bus voltage above limit (V)
+    ALERT_RULE_COUNT
+} alert_rule_t;
+
+// Scaling the chip was calibrated with (see ina226_init).
+typedef struct {
+    float shunt_ohms;
+    float current_lsb;  // A/LSB
+    float power_lsb;    // W/LSB
+} ina226_scale_t;
+
+const char *ina226_alert_rule_name(alert_rule_t rule);
+
+// Mask/Enable function bit that implements `rule` for a given threshold.
+uint16_t ina226_alert_function(alert_rule_t rule, float threshold);
+
+// Alert Limit register value for `rule` at `threshold` (saturates to the register range).
+uint16_t ina226_alert_limit(alert_rule_t rule, float threshold, const ina226_scale_t *sc);
+
+// Largest |threshold| for `rule` the chip can measure: the shunt ADC saturates
+// at 81.92 mV and the bus ADC at 40.96 V, whatever the register range allows.
+float ina226_alert_full_scale(alert_rule_t rule, const ina226_scale_t *sc);
+
+// Rule to arm in the chip given per-rule limits (0 = disabled); -1 if none.
+int ina226_alert_pick_hw(const float limits[ALERT_RULE_COUNT]);
+
+// True if a conversion with these raw register values trips the comparator.
+int ina226_alert_compare(uint16_t mask, uint16_t limit, int16_t shunt_raw, uint16_t bus_raw, uint16_t power_raw);
+
+/*
+ * Behavioral model of the ALERT pin. Call ina226_alert_model_convert() at the
+ * end of every conversion and ina226_alert_model_read_mask() whenever the host
+ * reads Mask/Enable (which clears CVRF and, in latch mode, the alert).
+ */
+typedef struct {
+    uint16_t mask;      // Mask/Enable register as written (function + APOL/LEN)
+    uint16_t limit;     // Alert Limit register
+    uint16_t flags;     // AFF/CVRF/OVF as the chip would report them
+    int      asserted;  // logical ALERT state (pin level depends on APOL)
+} ina226_alert_model_t;
+
+void ina226_alert_model_init(ina226_alert_model_t *m);
+void ina226_alert_model_write(ina226_alert_model_t *m, uint8_t reg, uint16_t val);
+// Returns 1 if the logical ALERT state changed.
+int  ina226_alert_model_convert(ina226_alert_model_t *m, int16_t shunt_raw, uint16_t bus_raw, uint16_t power_raw, int overflow);
+uint16_t ina226_alert_model_read_mask(ina226_alert_model_t *m);
+int  ina226_alert_model_pin(const ina226_alert_model_t *m); // electrical level, 1 = high
+
+#endif
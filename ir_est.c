@@ -0,0 +1,66 @@
+#include "ir_est.h"
+
+#define IR_EST_LAMBDA    0.98f     // forgetting per step: ~50 steps of memory
+#define IR_EST_NOISE_V2  2.5e-5f   // (5 mV)^2 on each dV
+#define IR_EST_GATE2     16.0f     // reject innovations beyond 4 sigma...
+#define IR_EST_GATE_MIN  3         // ...once this many steps have been accepted
+#define IR_EST_R_MAX     2.0f
+#define IR_EST_VAR_MAX   1.0f
+
+void ir_est_init(ir_est_t *e, float r_ohm, float var) {
+    e->r_ohm = r_ohm;
+    e->var = var;
+    e->steps = 0;
+    e->rejected = 0;
+    e->hist_n = 0;
+}
+
+void ir_est_break(ir_est_t *e) {
+    e->hist_n = 0;
+}
+
+static int32_t iabs(int32_t x) { return x < 0 ? -x : x; }
+
+int ir_est_sample(ir_est_t *e, int32_t v_mv, int32_t i_ma) {
+    int changed = 0;
+    // history: [0],[1] steady before, [2] may straddle the step, [3] and this sample steady after
+    if (e->hist_n == 4 &&
+        iabs(e->hist_ma[1] - e->hist_ma[0]) < IR_EST_SETTLE_MA &&
+        iabs(i_ma - e->hist_ma[3]) < IR_EST_SETTLE_MA &&
+        iabs(e->hist_ma[3] - e->hist_ma[1]) >= IR_EST_STEP_MA) {
+        // v = ocv - i*R, so -dV = R * dI
+        float di = (float)(e->hist_ma[3] - e->hist_ma[1]) * 1e-3f;
+        float dv = (float)(e->hist_mv[1] - e->hist_mv[3]) * 1e-3f;
+        float var = e->var / IR_EST_LAMBDA;
+        if (var > IR_EST_VAR_MAX) var = IR_EST_VAR_MAX;
+        float innov = dv - di * e->r_ohm;
+        float s = di * di * var + IR_EST_NOISE_V2;
+        if (e->steps >= IR_EST_GATE_MIN && innov * innov > IR_EST_GATE2 * s) {
+            e->rejected++;
+        } else {
+            float k = var * di / s;
+            float r = e->r_ohm + k * innov;
+            e->r_ohm = r < 0.0f ? 0.0f : (r > IR_EST_R_MAX ? IR_EST_R_MAX : r);
+            e->var = var - k * di * var;
+            e->steps++;
+            changed = 1;
+        }
+        // restart from the settled side so the same step is not measured twice
+        e->hist_mv[0] = e->hist_mv[3]; e->hist_ma[0] = e->hist_ma[3];
+        e->hist_mv[1] = v_mv;          e->hist_ma[1] = i_ma;
+        e->hist_n = 2;
+        return changed;
+    }
+
+    if (e->hist_n == 4) {
+        for (int k = 0; k < 3; k++) {
+            e->hist_mv[k] = e->hist_mv[k + 1];
+            e->hist_ma[k] = e->hist_ma[k + 1];
+        }
+        e->hist_n = 3;
+    }
+    e->hist_mv[e->hist_n] = v_mv;
+    e->hist_ma[e->hist_n] = i_ma;
+    e->hist_n++;
+    return changed;
+}
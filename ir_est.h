@@ -0,0 +1,40 @@
+#ifndef IR_EST_H
+#define IR_EST_H
+
+#include <stdint.h>
+
+/*
+ * Battery internal-resistance estimator.
+ *
+ * Watches the sample stream for load steps (current settled before and after
+ * a jump of at least IR_EST_STEP_MA) and feeds each step's -dV/dI into a
+ * scalar recursive least-squares estimate with forgetting. Bus and shunt are
+ * converted one after the other, so a step that lands inside a conversion is
+ * measured across the sample on either side of it rather than the pair it
+ * splits.
+ *
+ * The per-sample path is integer compares on a 4-sample history; the float
+ * update only runs on accepted steps. No Pico SDK dependencies.
+ */
+
+#define IR_EST_STEP_MA   200   // minimum current change that counts as a step
+#define IR_EST_SETTLE_MA 50    // current must be this steady on both sides
+
+typedef struct {
+    float    r_ohm;       // estimate
+    float    var;         // its variance (ohm^2)
+    uint32_t steps;       // steps accepted since seeding
+    uint32_t rejected;    // steps discarded as outliers
+    int32_t  hist_mv[4];  // previous four samples, oldest first
+    int32_t  hist_ma[4];
+    uint8_t  hist_n;
+} ir_est_t;
+
+// Seed with a resistance and its variance (e.g. from settings).
+void ir_est_init(ir_est_t *e, float r_ohm, float var);
+// Drop the sample history, e.g. after a gap in the stream.
+void ir_est_break(ir_est_t *e);
+// Feed one sample (mV, mA with discharge positive). Returns 1 if the estimate changed.
+int  ir_est_sample(ir_est_t *e, int32_t v_mv, int32_t i_ma);
+
+#endif
@@ -0,0 +1,97 @@
+#include "ocv.h"
+
+#include <string.h>
+
+typedef struct {
+    const char *name;
+    uint8_t     cells;      // series cells; 0 = derived from min_v/max_v
+    uint8_t     n;
+    uint16_t    mv[12];     // per-cell resting voltage, ascending
+    uint8_t     pct[12];
+} ocv_preset_def_t;
+
+static const ocv_preset_def_t k_presets[OCV_PRESET_COUNT] = {
+    [OCV_PRESET_KNEE]   = { "knee", 0, 0, {0}, {0} },
+    [OCV_PRESET_LINEAR] = { "linear", 0, 0, {0}, {0} },
+    [OCV_PRESET_LIFEPO4_8S] = { "lifepo4_8s", 8, 12,
+        { 2500, 3000, 3130, 3200, 3230, 3250, 3260, 3280, 3300, 3320, 3350, 3400 },
+        {    0,   10,   20,   30,   40,   50,   60,   70,   80,   90,   99,  100 } },
+    [OCV_PRESET_LIION_7S] = { "liion_7s", 7, 12,
+        { 3000, 3300, 3450, 3550, 3620, 3680, 3740, 3800, 3870, 3950, 4050, 4200 },
+        {    0,    5,   10,   20,   30,   40,   50,   60,   70,   80,   90,  100 } },
+    [OCV_PRESET_LEAD_ACID_24V] = { "lead_acid_24v", 12, 11,
+        { 1883, 1918, 1943, 1968, 1992, 2008, 2025, 2050, 2083, 2117, 2142 },
+        {    0,   10,   20,   30,   40,   50,   60,   70,   80,   90,  100 } },
+};
+
+int ocv_table_set(ocv_table_t *t, const float *v, const float *pct, int n) {
+    if (n < 2 || n > OCV_MAX_POINTS) return -1;
+    for (int k = 0; k < n; k++) {
+        if (!(pct[k] >= 0.0f && pct[k] <= 100.0f)) return -1;
+        if (k && !(v[k] > v[k - 1] && pct[k] >= pct[k - 1])) return -1;
+    }
+    t->n = (uint8_t)n;
+    for (int k = 0; k < n; k++) {
+        t->v[k] = v[k];
+        t->pct[k] = pct[k];
+        t->slope[k] = k + 1 < n ? (pct[k + 1] - pct[k]) / (v[k + 1] - v[k]) : 0.0f;
+    }
+    return 0;
+}
+
+int ocv_table_preset(ocv_table_t *t, ocv_preset_t preset, float min_v, float max_v) {
+    float v[OCV_MAX_POINTS], pct[OCV_MAX_POINTS];
+    int n = 0;
+    switch (preset) {
+    case OCV_PRESET_KNEE: {
+        // first 10% between min_v and 24 V, the rest up to max_v
+        const float knee_v = 24.0f, tail_pct = 10.0f;
+        v[n] = min_v; pct[n++] = 0.0f;
+        if (knee_v > min_v && knee_v < max_v) { v[n] = knee_v; pct[n++] = tail_pct; }
+        v[n] = max_v; pct[n++] = 100.0f;
+        break;
+    }
+    case OCV_PRESET_LINEAR:
+        v[n] = min_v; pct[n++] = 0.0f;
+        v[n] = max_v; pct[n++] = 100.0f;
+        break;
+    case OCV_PRESET_LIFEPO4_8S:
+    case OCV_PRESET_LIION_7S:
+    case OCV_PRESET_LEAD_ACID_24V: {
+        const ocv_preset_def_t *d = &k_presets[preset];
+        for (; n < d->n; n++) {
+            v[n] = (float)d->mv[n] * d->cells * 1e-3f;
+            pct[n] = (float)d->pct[n];
+        }
+        break;
+    }
+    default:
+        return -1;
+    }
+    return ocv_table_set(t, v, pct, n);
+}
+
+float ocv_pct(const ocv_table_t *t, float v) {
+    int hi = t->n - 1;
+    if (v <= t->v[0]) return t->pct[0];
+    if (v >= t->v[hi]) return t->pct[hi];
+    int lo = 0; // invariant: v[lo] <= v < v[hi]
+    while (hi - lo > 1) {
+        int mid = (lo + hi) >> 1;
+        if (v >= t->v[mid]) lo = mid;
+        else hi = mid;
+    }
+    return t->pct[lo] + (v - t->v[lo]) * t->slope[lo];
+}
+
+const char *ocv_preset_name(ocv_preset_t preset) {
+    if (preset == OCV_PRESET_CUSTOM) return "custom";
+    return (unsigned)preset < OCV_PRESET_COUNT ? k_presets[preset].name : "?";
+}
+
+int ocv_preset_lookup(const char *name, unsigned len) {
+    for (int k = 0; k < OCV_PRESET_COUNT; k++) {
+        if (strlen(k_presets[k].name) == len && strncmp(k_presets[k].name, name, len) == 0) return k;
+    }
+    return -1;
+}
@@ -0,0 +1,47 @@
+#ifndef OCV_H
+#define OCV_H
+
+#include <stdint.h>
+
+/*
+ * Piecewise-linear open-circuit-voltage -> state-of-charge curve.
+ *
+ * Points are kept sorted by voltage with the per-segment slope precomputed, so
+ * a lookup is a binary search plus one multiply-add. Outside the table the
+ * end points are returned. No Pico SDK dependencies.
+ */
+
+#define OCV_MAX_POINTS 32
+
+typedef struct {
+    uint8_t n;
+    float   v[OCV_MAX_POINTS];      // strictly increasing
+    float   pct[OCV_MAX_POINTS];    // non-decreasing, 0..100
+    float   slope[OCV_MAX_POINTS];  // pct per volt from point k to k+1
+} ocv_table_t;
+
+// Built-in curves. OCV_PRESET_KNEE (the original firmware curve) and
+// OCV_PRESET_LINEAR are derived from min_v/max_v; the chemistry presets are
+// per-cell curves scaled to a pack.
+typedef enum {
+    OCV_PRESET_KNEE = 0,
+    OCV_PRESET_LINEAR,
+    OCV_PRESET_LIFEPO4_8S,
+    OCV_PRESET_LIION_7S,
+    OCV_PRESET_LEAD_ACID_24V,
+    OCV_PRESET_COUNT,
+    OCV_PRESET_CUSTOM = 0xFF      // uploaded points
+} ocv_preset_t;
+
+// Validate and load points; returns 0 on success, -1 if they are not a usable curve.
+int   ocv_table_set(ocv_table_t *t, const float *v, const float *pct, int n);
+// Load a preset; returns 0 on success, -1 for an unknown preset or bad min_v/max_v.
+int   ocv_table_preset(ocv_table_t *t, ocv_preset_t preset, float min_v, float max_v);
+// State of charge in percent (0..100) for an open-circuit voltage.
+float ocv_pct(const ocv_table_t *t, float v);
+
+const char *ocv_preset_name(ocv_preset_t preset);
+// Returns the preset for a name (len bytes, not NUL-terminated) or -1.
+int   ocv_preset_lookup(const char *name, unsigned len);
+
+#endif
@@ -1,30 +1,29 @@
 #!/usr/bin/env python3
 import argparse
+import bisect
 import csv
 import datetime as dt
+import json
 from pathlib import Path
 from typing import Optional
 
 import matplotlib.pyplot as plt
 import os
 
+from pm_log import PmLog, is_pmlog
+
 
 DEFAULT_LOG_PATH = Path(
     "/mnt/analysis/data/ngage/calibration_and_logging/HB5power.log"
 )
 
 
-def parse_rows(path: Path):
+COLUMNS = ("v", "a", "w", "pct", "min_v", "max_v", "hrs_remaining")
+
+
+def parse_rows(path: Path, start=None, end=None):
     times = []
-    data = {
-        "v": [],
-        "a": [],
-        "w": [],
-        "pct": [],
-        "min_v": [],
-        "max_v": [],
-        "hrs_remaining": [],
-    }
+    data = {key: [] for key in COLUMNS}
     with path.open(newline="") as handle:
         reader = csv.DictReader(handle)
         for row in reader:
@@ -33,6 +32,8 @@ def parse_rows(path: Path):
                 values = {key: float(row[key]) for key in data}
             except (KeyError, ValueError):
                 continue
+            if (start and ts < start) or (end and ts > end):
+                continue
 
             times.append(ts)
             for key, value in values.items():
@@ -40,33 +41,55 @@ def parse_rows(path: Path):
     return times, data
 
 
-def plot_log(times, data, output_path: Optional[Path]):
+def load_pmlog(path: Path, start=None, end=None):
+    """The same lists from a columnar log (pm_log.py), decoding only the range;
+    columns the log lacks are NaN."""
+    log = PmLog(path)
+    present = [key for key in COLUMNS if key in log.columns]
+    t, cols = log.read(start, end, present)
+    nan = [float("nan")] * t.size
+    return t.tolist(), {key: cols[key].tolist() if key in cols else nan for key in COLUMNS}
+
+
+def knee_table(min_v, max_v, knee_v=24.0, tail_pct=10.0):
+    """The firmware's default "knee" preset as [(v, pct), ...]."""
+    if min_v < knee_v < max_v:
+        return [(min_v, 0.0), (knee_v, tail_pct), (max_v, 100.0)]
+    return [(min_v, 0.0), (max_v, 100.0)]
+
+
+def load_ocv_table(path: Path):
+    """Read a saved {"get":"ocv"} response (or a bare [[v, pct], ...] list)."""
+    doc = json.loads(path.read_text())
+    points = doc["ocv"] if isinstance(doc, dict) else doc
+    table = [(float(v), float(pct)) for v, pct in points]
+    if len(table) < 2 or any(b[0] <= a[0] for a, b in zip(table, table[1:])):
+        raise SystemExit(f"{path}: need at least two points with increasing voltage")
+    return table
+
+
+def ocv_pct(table, v):
+    """Same piecewise-linear lookup as the firmware, clamped to the end points."""
+    if v <= table[0][0]:
+        return table[0][1]
+    if v >= table[-1][0]:
+        return table[-1][1]
+    k = bisect.bisect_right([p[0] for p in table], v) - 1
+    (v0, p0), (v1, p1) = table[k], table[k + 1]
+    return p0 + (v - v0) * (p1 - p0) / (v1 - v0)
+
+
+def plot_log(times, data, output_path: Optional[Path], ocv_table=None):
     if not times:
         raise SystemExit("No valid rows found in log file.")
 
     t0 = times[0]
     hours = [(t - t0).total_seconds() / 3600.0 for t in times]
-    min_v = data["min_v"][0]
-    max_v = data["max_v"][0]
-    knee_v = 24.0
-    tail_fraction = 0.1
+    if ocv_table is None:
+        ocv_table = knee_table(data["min_v"][0], data["max_v"][0])
 
     def alt_hours_remaining(voltages, capacity_hours):
-        if max_v <= min_v or knee_v <= min_v or max_v <= knee_v:
-            pct = [
-                max(0.0, min(1.0, (v - min_v) / (max_v - min_v)))
-                for v in voltages
-            ]
-        else:
-            pct = []
-            for v in voltages:
-                if v >= knee_v:
-                    head = (v - knee_v) / (max_v - knee_v)
-                    pct.append(tail_fraction + (1.0 - tail_fraction) * head)
-                else:
-                    tail = (v - min_v) / (knee_v - min_v)
-                    pct.append(tail_fraction * max(0.0, tail))
-        return [p * capacity_hours for p in pct]
+        return [ocv_pct(ocv_table, v) * 0.01 * capacity_hours for v in voltages]
 
     fig, axes = plt.subplots(3, 2, figsize=(12, 8), sharex=True)
     fig.suptitle("HB5 Power Log")
@@ -140,22 +163,43 @@ def main():
         "log_path",
         nargs="?",
         default=str(DEFAULT_LOG_PATH),
-        help="Path to HB5power.log CSV",
+        help="Path to HB5power.log CSV, or a columnar .pmlog (pmd --log, pmlog convert)",
+    )
+    parser.add_argument(
+        "--from",
+        dest="start",
+        help="Plot from this time on (ISO 8601, e.g. 2026-03-01T08:00).",
+    )
+    parser.add_argument(
+        "--to",
+        dest="end",
+        help="Plot up to this time (ISO 8601).",
     )
     parser.add_argument(
         "--output",
         "-o",
         help="Optional path to save the plot image instead of showing it.",
     )
+    parser.add_argument(
+        "--ocv",
+        help='SoC curve for the alternate estimate: a saved {"get":"ocv"} '
+        "response. Defaults to the firmware's knee preset.",
+    )
     args = parser.parse_args()
 
     log_path = Path(args.log_path)
     if not log_path.exists():
         raise SystemExit(f"Log file not found: {log_path}")
 
-    times, data = parse_rows(log_path)
+    start = dt.datetime.fromisoformat(args.start) if args.start else None
+    end = dt.datetime.fromisoformat(args.end) if args.end else None
+    if is_pmlog(log_path):
+        times, data = load_pmlog(log_path, start, end)
+    else:
+        times, data = parse_rows(log_path, start, end)
     output_path = Path(args.output) if args.output else None
-    plot_log(times, data, output_path)
+    ocv_table = load_ocv_table(Path(args.ocv)) if args.ocv else None
+    plot_log(times, data, output_path, ocv_table)
 
 
 if __name__ == "__main__":
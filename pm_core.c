@@ -0,0 +1,2107 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+
+#include "pm_core.h"
+#include "pm_hal.h"
+#include "ina226.h"
+#include "ina226_alert.h"
+#include "ocv.h"
+#include "soc_ekf.h"
+#include "ir_est.h"
+
+#ifndef FW_VERSION
+#define FW_VERSION "dev"
+#endif
+
+/*
+ * USB CDC JSON protocol (single JSON object per request, no newline needed):
+ * - Request must contain either:
+ *     {"get":["v","a","w","pct","charging","min_v","max_v","hrs_capacity","hrs_remaining","fw","chg_threshold_a",
+ *             "missed_conv","usb_stalls","usb_stall_max_us","dirty","ocv_preset"]}
+ *     or
+ *     {"get":"all"} (equivalent to requesting every supported field except "ocv" and "diag")
+ *     or
+ *     {"get":"ocv"} (any single field by name; "ocv" returns the SoC table as [[v,pct],...],
+ *     "diag" the health counters and latency histograms; neither is part of "all")
+ *   or
+ *     {"set":{"min_v":<float>,"max_v":<float>,"hrs_capacity":<float>,"chg_threshold_a":<float>}}
+ *   but not both in the same object.
+ *     {"commit":true} writes pending settings to flash now (may also accompany a SET).
+ *     {"stream":N} pushes every Nth sample as {"event":"sample",...}; 0 stops.
+ *     {"sync":{"host_us":H}} pairs host and device clocks (see "Sample stream and clock sync").
+ *     {"trace":"dump"} sends the PM_TRACE rings (builds with -DPM_TRACE=ON only).
+ *     {"bench":N} runs the protocol microbenchmarks N times each (builds with -DPM_BENCH=ON only).
+ *   You can request or set only the fields you care about; a GET list may
+ *   contain any subset of the supported keys, and SET may include any of
+ *   min_v, max_v, hrs_capacity (one or more fields). The SoC curve is set with
+ *   "ocv":[[v,pct],...] (2..32 points, v ascending) or "ocv_preset":"<name>".
+ * - Example responses:
+ *     {"v":28.523,"a":0.1234,"w":3.5123,"pct":67.12,"charging":true,"hrs_remaining":5.0}
+ *     {"ok":true,"min_v":21.000,"max_v":32.200,"hrs_capacity":10.0,"chg_threshold_a":-0.050,"dirty":true}
+ *     {"ok":true,"committed":true,"dirty":false}
+ * - Errors: {"error":"both_get_and_set"} | {"error":"bad_request"} | {"error":"i2c_read"} | {"error":"invalid_get_field","field":<str>,"supported":[...]}
+ *     | {"error":"invalid_value","field":<str>} | {"error":"request_too_long"} (object over 1023 bytes)
+ * - Notes:
+ *     pct is interpolated from the OCV table (default preset "knee": 0% at min_v, 10% at 24 V,
+ *     100% at max_v) at v_ocv = v + i*r_int_ohm and clamped to its end points; r_int_ohm is
+ *     learned from load steps while r_learn is on
+ *     a full charge (charging, v_ocv at the top of the curve, current tapered) followed by a
+ *     cutoff (v <= cutoff_v) measures the usable capacity, which is averaged into learned_ah;
+ *     soc and the runtime estimates use it once learned (see readme)
+ *     soc fuses coulomb counting (capacity_ah) with the OCV table read at v + i*r_int_ohm in a
+ *     fixed-point Kalman filter; soc_sigma is its 1-sigma uncertainty (both percent)
+ *     hrs_remaining = energy left on the OCV curve / average discharge power (time constant
+ *     power_tau_s), rounded to 0.1 hr; hrs_capacity * (pct / 100) until the average has warmed up
+ *     or while idle. hrs_to_full does the same toward 100% with chg_power_tau_s while charging.
+ *     charging is debounced: with x = current in the sign of chg_threshold_a, it turns on once
+ *     x >= |chg_threshold_a| has held for chg_dwell_ms and off once x < |chg_threshold_a| - chg_hyst_a
+ *     has held as long; each change is pushed as {"event":"charging_started"|"charging_stopped",...}
+ *     defaults if unset: min_v = 21.0, max_v = 32.2, hrs_capacity = 10.0, chg_threshold_a = -0.05
+ *     v/a/w come from the latest conversion read by the core 1 sampler, not a fresh I2C read,
+ *     and t_us is the device clock (us since boot) at which that conversion completed;
+ *     missed_conv counts conversions the sampler never read, usb_stalls/usb_stall_max_us count
+ *     the flash commits that held off core 0 (and with it USB) and the longest one.
+ *     SET changes RAM immediately; flash is written once SETs have been quiet for
+ *     SETTINGS_COMMIT_QUIET_MS (or on "commit"). dirty is true while a change is pending.
+ */
+
+typedef struct {
+    uint8_t addr;
+    float shunt_ohms;
+    float i_max;
+    float current_lsb; // A/LSB
+    float power_lsb;   // W/LSB
+} ina226_t;
+
+// ======= Persistent settings in flash (last two 4KB sectors) =======
+/*
+ * Two slots, written alternately. Each commit goes to the slot that does not
+ * hold the newest record, so a reset mid-erase or mid-program always leaves the
+ * previous record intact; load picks the valid slot with the highest seq.
+ * The payload is append-only: new settings go at the end and records with a
+ * shorter length keep defaults for the fields they predate. Slot B is the
+ * sector used by v1-v3 firmware, which is migrated on first boot.
+ */
+
+#define SETTINGS_MAX_BYTES          1024  // header + payload, whole pages
+
+#define SETTINGS_MAGIC   0x53544731u  // 'STG1'
+#define SETTINGS_VERSION 4
+
+// SET only updates RAM; the flash commit waits for this much quiet...
+#define SETTINGS_COMMIT_QUIET_MS    2000
+// ...but never defers a change longer than this under a steady stream of SETs.
+#define SETTINGS_COMMIT_MAX_DELAY_MS 30000
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;         // bumped on every commit; newest valid slot wins
+    uint32_t length;      // payload bytes that follow the header
+    uint32_t crc;         // CRC-32 of the payload
+} settings_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    float    min_v;
+    float    max_v;
+    float    hrs_capacity;
+    float    chg_threshold_a;
+    float    alert_limit[ALERT_RULE_COUNT]; // 0 = rule disabled
+    float    chg_hyst_a;
+    uint32_t chg_dwell_ms;
+    uint8_t  ocv_preset;                   // ocv_preset_t; OCV_PRESET_CUSTOM uses the points below
+    uint8_t  ocv_n;
+    float    ocv_v[OCV_MAX_POINTS];
+    float    ocv_pct[OCV_MAX_POINTS];
+    float    capacity_ah;
+    float    r_int_ohm;
+    float    power_tau_s;
+    float    chg_power_tau_s;
+    float    r_int_var;                     // r_int_ohm is the learned estimate when r_learn is set
+    uint32_t r_int_steps;
+    uint8_t  r_learn;
+    float    learned_ah;                    // capacity learning; cap_weight 0 = nothing learned yet
+    float    learned_wh;
+    float    cap_weight;
+    float    cycles;                        // equivalent full cycles
+    float    cutoff_v;                      // 0 = bottom of the OCV curve
+} settings_payload_t;
+
+_Static_assert(sizeof(settings_hdr_t) + sizeof(settings_payload_t) <= SETTINGS_MAX_BYTES, "settings record too large");
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t version;
+    float    min_v;
+    float    max_v;
+    float    hrs_capacity;
+    float    chg_threshold_a;
+    uint32_t magic_inv;   // ~magic for light corruption check
+} settings_v3_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t version;
+    float    min_v;
+    float    max_v;
+    float    hrs_capacity;
+    uint32_t magic_inv;   // ~magic for light corruption check
+} settings_v2_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t version;
+    float    min_v;
+    float    max_v;
+    uint32_t magic_inv;
+} settings_v1_t;
+
+// defaults (used if nothing valid in flash yet)
+static float g_min_v = 21.0f;
+static float g_max_v = 32.2f;
+static float g_hrs_capacity = 10.0f;
+static float g_chg_threshold_a = -0.05f; // signed; sign encodes direction
+static float g_chg_hyst_a = 0.02f;        // charging stops below |threshold| - hyst
+static uint32_t g_chg_dwell_ms = 3000;    // a new state must hold this long
+static float g_alert_limit[ALERT_RULE_COUNT] = {0}; // per alert_rule_t; 0 = disabled
+static uint8_t g_ocv_preset = OCV_PRESET_KNEE;
+static ocv_table_t g_ocv;                 // rebuilt by ocv_rebuild() unless custom
+static float g_capacity_ah = 10.0f;       // rated capacity
+static float g_learned_ah = 0.0f;         // measured full-to-cutoff capacity...
+static float g_learned_wh = 0.0f;
+static float g_cap_weight = 0.0f;         // ...and how many cycles back it (capped)
+static float g_cycles = 0.0f;
+static float g_cutoff_v = 0.0f;           // discharge end voltage; 0 = bottom of the OCV curve
+static float g_r_int_ohm = 0.05f;         // pack resistance for the OCV correction
+static int   g_r_learn = 1;               // track r_int_ohm from load steps
+static ir_est_t g_ir;                     // load-step estimator behind r_int_ohm
+#define R_INT_VAR0 0.01f                  // (0.1 ohm)^2 whenever r_int_ohm is set by hand
+static float g_power_tau_s = 300.0f;      // averaging time constant for discharge power...
+static float g_chg_power_tau_s = 120.0f;  // ...and for charge power
+static int   g_ina_ok = 0;
+
+static uint32_t g_settings_seq = 0;       // seq of the newest record in flash
+static int      g_settings_slot = -1;     // slot holding it (0=A, 1=B), -1 if none
+static int      g_settings_dirty = 0;     // RAM differs from flash
+static uint64_t g_settings_first_dirty_us = 0;
+static uint64_t g_settings_last_change_us = 0;
+
+// Flash commit accounting. Core 0 runs with interrupts masked for the whole
+// erase+program, so every commit is a USB stall of that length.
+static uint32_t g_usb_stalls = 0;
+static uint32_t g_usb_stall_max_us = 0;
+
+// Latency histograms behind {"get":"diag"} (diag_hist_t in pm_hal.h).
+static diag_hist_t g_diag_loop_us;    // main loop iteration
+static diag_hist_t g_diag_parse_us;   // GET/SET parsing
+static diag_hist_t g_diag_format_us;  // building a GET/SET response
+static diag_hist_t g_diag_write_us;   // handing it to USB CDC (blocks while the host is not reading)
+static diag_hist_t g_diag_req_us;     // request arrival to fully handled
+static diag_hist_t g_diag_flash_us;   // settings commit
+static uint32_t g_diag_requests = 0;
+static uint32_t g_diag_bad_requests = 0;
+static uint32_t g_diag_flash_fail = 0;
+
+// Supported GET fields (also used for validation and the "all" shortcut).
+// Order matches the GET_F_* bit indices below.
+static const char *k_get_fields[] = {
+    "v", "a", "w", "pct", "charging",
+    "min_v", "max_v", "hrs_capacity", "hrs_remaining",
+    "fw", "chg_threshold_a",
+    "missed_conv", "usb_stalls", "usb_stall_max_us",
+    "dirty",
+    "alert_bus_uv_v", "alert_oc_a", "alert_op_w", "alert_bus_ov_v", "alert_hw",
+    "chg_hyst_a", "chg_dwell_ms", "session_ah",
+    "ocv_preset", "ocv",
+    "soc", "soc_sigma", "capacity_ah", "r_int_ohm",
+    "hrs_to_full", "avg_w", "avg_chg_w", "remaining_wh", "power_tau_s", "chg_power_tau_s",
+    "v_ocv", "r_int_sigma", "r_int_steps", "r_learn",
+    "learned_ah", "learned_wh", "cap_weight", "cycles", "soh_pct", "cap_learning", "cutoff_v",
+    "t_us", "diag"
+};
+static const size_t k_get_fields_count = sizeof(k_get_fields) / sizeof(k_get_fields[0]);
+
+enum {
+    GET_F_V, GET_F_A, GET_F_W, GET_F_PCT, GET_F_CHG,
+    GET_F_MIN_V, GET_F_MAX_V, GET_F_HRS_CAP, GET_F_HRS_REM,
+    GET_F_FW, GET_F_CHG_THR,
+    GET_F_MISSED_CONV, GET_F_USB_STALLS, GET_F_USB_STALL_MAX_US,
+    GET_F_DIRTY,
+    GET_F_ALERT_FIRST,
+    GET_F_ALERT_HW = GET_F_ALERT_FIRST + ALERT_RULE_COUNT,
+    GET_F_CHG_HYST, GET_F_CHG_DWELL, GET_F_SESSION_AH,
+    GET_F_OCV_PRESET, GET_F_OCV,
+    GET_F_SOC, GET_F_SOC_SIGMA, GET_F_CAP_AH, GET_F_R_INT,
+    GET_F_HRS_FULL, GET_F_AVG_W, GET_F_AVG_CHG_W, GET_F_REM_WH, GET_F_PWR_TAU, GET_F_CHG_PWR_TAU,
+    GET_F_V_OCV, GET_F_R_INT_SIGMA, GET_F_R_INT_STEPS, GET_F_R_LEARN,
+    GET_F_LEARNED_AH, GET_F_LEARNED_WH, GET_F_CAP_WEIGHT, GET_F_CYCLES, GET_F_SOH, GET_F_CAP_LEARNING,
+    GET_F_CUTOFF_V,
+    GET_F_T_US, GET_F_DIAG,
+    GET_F_COUNT
+};
+_Static_assert(GET_F_COUNT == sizeof(k_get_fields) / sizeof(k_get_fields[0]), "k_get_fields out of sync");
+
+#define GET_BIT(f)  ((uint64_t)1 << (f))
+// fields too bulky for "all"; request them by name
+#define GET_VIEWS   (GET_BIT(GET_F_OCV) | GET_BIT(GET_F_DIAG))
+#define GET_ALL     ((GET_BIT(GET_F_COUNT) - 1) & ~GET_VIEWS)
+
+// Supported SET keys; alert limits follow alert_rule_t order.
+static const char *k_set_keys[] = {
+    "min_v", "max_v", "hrs_capacity", "chg_threshold_a",
+    "alert_bus_uv_v", "alert_oc_a", "alert_op_w", "alert_bus_ov_v",
+    "chg_hyst_a", "chg_dwell_ms",
+    "capacity_ah", "r_int_ohm",
+    "power_tau_s", "chg_power_tau_s",
+    "r_learn",
+    "cycles", "cutoff_v"
+};
+
+enum {
+    SET_K_MIN_V, SET_K_MAX_V, SET_K_HRS_CAP, SET_K_CHG_THR,
+    SET_K_ALERT_FIRST,
+    SET_K_CHG_HYST = SET_K_ALERT_FIRST + ALERT_RULE_COUNT,
+    SET_K_CHG_DWELL,
+    SET_K_CAP_AH, SET_K_R_INT,
+    SET_K_PWR_TAU, SET_K_CHG_PWR_TAU,
+    SET_K_R_LEARN,
+    SET_K_CYCLES, SET_K_CUTOFF_V,
+    SET_K_COUNT
+};
+_Static_assert(SET_K_COUNT == sizeof(k_set_keys) / sizeof(k_set_keys[0]), "k_set_keys out of sync");
+
+#define SET_BIT(k)  ((uint32_t)1 << (k))
+
+typedef struct {
+    float    val[SET_K_COUNT];
+    uint32_t present;
+    int      ocv_preset;  // -1 if absent, -2 if not a known preset
+    int      ocv_n;       // points in "ocv"; 0 if absent, -1 if malformed
+    int      bad;         // SET_K_* whose value is not a finite number, -1 if none
+    float    ocv_v[OCV_MAX_POINTS];
+    float    ocv_pct[OCV_MAX_POINTS];
+} set_request_t;
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *p, size_t n) {
+    crc = ~crc;
+    while (n--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+
+// Snapshot the live settings into a flash payload.
+static void settings_to_payload(settings_payload_t *pl) {
+    pl->min_v = g_min_v;
+    pl->max_v = g_max_v;
+    pl->hrs_capacity = g_hrs_capacity;
+    pl->chg_threshold_a = g_chg_threshold_a;
+    memcpy(pl->alert_limit, g_alert_limit, sizeof(pl->alert_limit));
+    pl->chg_hyst_a = g_chg_hyst_a;
+    pl->chg_dwell_ms = g_chg_dwell_ms;
+    pl->ocv_preset = g_ocv_preset;
+    pl->ocv_n = g_ocv.n;
+    memcpy(pl->ocv_v, g_ocv.v, sizeof(pl->ocv_v));
+    memcpy(pl->ocv_pct, g_ocv.pct, sizeof(pl->ocv_pct));
+    pl->capacity_ah = g_capacity_ah;
+    pl->r_int_ohm = g_r_int_ohm;
+    pl->power_tau_s = g_power_tau_s;
+    pl->chg_power_tau_s = g_chg_power_tau_s;
+    pl->r_int_var = g_ir.var;
+    pl->r_int_steps = g_ir.steps;
+    pl->r_learn = (uint8_t)g_r_learn;
+    pl->learned_ah = g_learned_ah;
+    pl->learned_wh = g_learned_wh;
+    pl->cap_weight = g_cap_weight;
+    pl->cycles = g_cycles;
+    pl->cutoff_v = g_cutoff_v;
+}
+
+// Rebuild the SoC table from its preset; presets follow min_v/max_v.
+static void ocv_rebuild(void) {
+    if (g_ocv_preset == OCV_PRESET_CUSTOM) return;
+    if (ocv_table_preset(&g_ocv, (ocv_preset_t)g_ocv_preset, g_min_v, g_max_v)) {
+        g_ocv_preset = OCV_PRESET_KNEE;
+        ocv_table_preset(&g_ocv, OCV_PRESET_KNEE, g_min_v, g_max_v);
+    }
+}
+
+// Calibration pm_core_init() programs; alert limits must be reachable with it.
+static const ina226_scale_t k_ina_scale = {
+    INA226_SHUNT_OHMS, INA226_I_MAX_A / 32768.0f, 25.0f * INA226_I_MAX_A / 32768.0f
+};
+
+static float alert_limit_max(alert_rule_t rule) {
+    return rule == ALERT_BUS_UV || rule == ALERT_BUS_OV ? 40.0f : ina226_alert_full_scale(rule, &k_ina_scale);
+}
+
+static int alert_limit_valid(alert_rule_t rule, float x) {
+    if (x == 0.0f) return 1;
+    float fs = alert_limit_max(rule);
+    switch (rule) {
+    case ALERT_BUS_UV:
+    case ALERT_BUS_OV:       return x > 0.0f && x < fs;
+    case ALERT_OVER_CURRENT: return x > -fs && x < fs;
+    case ALERT_OVER_POWER:   return x > 0.0f && x < fs;
+    default:                 return 0;
+    }
+}
+
+static int pack_v_valid(float v) { return v > -100.0f && v < 1000.0f; } // as settings_payload_valid()
+static int hrs_cap_valid(float h) { return h > 0.0f && h < 10000.0f; }   // ditto
+static int chg_hyst_valid(float x) { return x >= 0.0f && x < 10.0f; }
+static int chg_dwell_valid(float ms) { return ms >= 0.0f && ms <= 600000.0f; }
+static int capacity_ah_valid(float ah) { return ah >= 0.5f && ah <= 10000.0f; }
+static int r_int_valid(float ohms) { return ohms >= 0.0f && ohms <= 10.0f; }
+static int power_tau_valid(float s) { return s >= 1.0f && s <= 86400.0f; }
+static int cycles_valid(float n) { return n >= 0.0f && n < 1e6f; }
+static int cutoff_v_valid(float v) { return v >= 0.0f && v < 40.0f; }
+
+static void settings_from_payload(const settings_payload_t *pl) {
+    g_min_v = pl->min_v;
+    g_max_v = pl->max_v;
+    g_hrs_capacity = pl->hrs_capacity;
+    g_chg_threshold_a = pl->chg_threshold_a;
+    for (int k = 0; k < ALERT_RULE_COUNT; k++) {
+        g_alert_limit[k] = alert_limit_valid((alert_rule_t)k, pl->alert_limit[k]) ? pl->alert_limit[k] : 0.0f;
+    }
+    if (chg_hyst_valid(pl->chg_hyst_a)) g_chg_hyst_a = pl->chg_hyst_a;
+    if (chg_dwell_valid((float)pl->chg_dwell_ms)) g_chg_dwell_ms = pl->chg_dwell_ms;
+    if (capacity_ah_valid(pl->capacity_ah)) g_capacity_ah = pl->capacity_ah;
+    if (r_int_valid(pl->r_int_ohm)) g_r_int_ohm = pl->r_int_ohm;
+    if (power_tau_valid(pl->power_tau_s)) g_power_tau_s = pl->power_tau_s;
+    if (power_tau_valid(pl->chg_power_tau_s)) g_chg_power_tau_s = pl->chg_power_tau_s;
+    g_r_learn = pl->r_learn != 0;
+    if (pl->cap_weight > 0.0f && pl->cap_weight <= 100.0f && capacity_ah_valid(pl->learned_ah)) {
+        g_learned_ah = pl->learned_ah;
+        g_learned_wh = pl->learned_wh > 0.0f ? pl->learned_wh : 0.0f;
+        g_cap_weight = pl->cap_weight;
+    }
+    if (cycles_valid(pl->cycles)) g_cycles = pl->cycles;
+    if (cutoff_v_valid(pl->cutoff_v)) g_cutoff_v = pl->cutoff_v;
+    g_ir.r_ohm = g_r_int_ohm;
+    if (pl->r_int_var > 0.0f && pl->r_int_var <= 1.0f) {
+        g_ir.var = pl->r_int_var;
+        g_ir.steps = pl->r_int_steps;
+    }
+    if (pl->ocv_preset == OCV_PRESET_CUSTOM) {
+        float v[OCV_MAX_POINTS], pct[OCV_MAX_POINTS]; // copy out of the packed payload
+        memcpy(v, pl->ocv_v, sizeof(v));
+        memcpy(pct, pl->ocv_pct, sizeof(pct));
+        g_ocv_preset = ocv_table_set(&g_ocv, v, pct, pl->ocv_n) ? OCV_PRESET_KNEE : OCV_PRESET_CUSTOM;
+    } else {
+        g_ocv_preset = pl->ocv_preset < OCV_PRESET_COUNT ? pl->ocv_preset : OCV_PRESET_KNEE;
+    }
+    ocv_rebuild();
+}
+
+// Write the current settings to the older slot. Returns 0 on success.
+static int settings_save(void) {
+    settings_payload_t pl;
+    settings_to_payload(&pl);
+    settings_hdr_t h = {
+        .magic = SETTINGS_MAGIC,
+        .version = SETTINGS_VERSION,
+        .seq = g_settings_seq + 1,
+        .length = sizeof(pl),
+        .crc = crc32_update(0, (const uint8_t *)&pl, sizeof(pl)),
+    };
+    // flash is programmed in whole pages; pad with the erased value
+    static uint8_t page[SETTINGS_MAX_BYTES];
+    size_t used = sizeof(h) + sizeof(pl);
+    size_t len = (used + HAL_FLASH_PAGE_SIZE - 1) / HAL_FLASH_PAGE_SIZE * HAL_FLASH_PAGE_SIZE;
+    memset(page, 0xFF, len);
+    memcpy(page, &h, sizeof(h));
+    memcpy(page + sizeof(h), &pl, sizeof(pl));
+
+    int slot = g_settings_slot == 0 ? 1 : 0;
+
+    TRACE_BEGIN(TR_SETTINGS_SAVE);
+    uint64_t t0 = hal_time_us64();
+    int rc = hal_flash_write_slot(slot, page, len);
+    uint32_t dt = (uint32_t)(hal_time_us64() - t0);
+    TRACE_END(TR_SETTINGS_SAVE);
+    if (rc) { g_diag_flash_fail++; return -1; }
+    diag_hist_add(&g_diag_flash_us, dt);
+    g_usb_stalls++;
+    if (dt > g_usb_stall_max_us) g_usb_stall_max_us = dt;
+
+    g_settings_seq = h.seq;
+    g_settings_slot = slot;
+    g_settings_dirty = 0;
+    return 0;
+}
+
+// Record a RAM-only change; settings_service() commits it once SETs go quiet.
+static void settings_mark_dirty(void) {
+    uint64_t now = hal_time_us64();
+    if (!g_settings_dirty) g_settings_first_dirty_us = now;
+    g_settings_last_change_us = now;
+    g_settings_dirty = 1;
+}
+
+static void settings_service(void) {
+    if (!g_settings_dirty) return;
+    uint64_t now = hal_time_us64();
+    if (now - g_settings_last_change_us >= SETTINGS_COMMIT_QUIET_MS * 1000ull ||
+        now - g_settings_first_dirty_us >= SETTINGS_COMMIT_MAX_DELAY_MS * 1000ull) {
+        // on failure wait a full quiet period before retrying, so a dead
+        // flash doesn't hold core 0 (and USB) on every loop pass
+        if (settings_save()) g_settings_last_change_us = g_settings_first_dirty_us = now;
+    }
+}
+
+static int settings_payload_valid(const settings_payload_t *p) {
+    return p->max_v > p->min_v &&
+           p->max_v < 1000.0f && p->min_v > -100.0f &&
+           p->hrs_capacity > 0.0f && p->hrs_capacity < 10000.0f &&
+           p->chg_threshold_a != 0.0f &&
+           p->chg_threshold_a > -100.0f && p->chg_threshold_a < 100.0f;
+}
+
+// Returns the slot's header if it holds a complete, intact v4 record.
+static const settings_hdr_t *settings_slot_record(int slot) {
+    const settings_hdr_t *h = (const settings_hdr_t *)hal_flash_slot(slot);
+    if (h->magic != SETTINGS_MAGIC || h->version != SETTINGS_VERSION) return NULL;
+    if (h->length == 0 || h->length > SETTINGS_MAX_BYTES - sizeof(*h)) return NULL;
+    if (crc32_update(0, (const uint8_t *)(h + 1), h->length) != h->crc) return NULL;
+    return h;
+}
+
+static int settings_load_legacy(void) {
+    const uint8_t *legacy = hal_flash_slot(1);
+    const settings_v3_t *s = (const settings_v3_t *)legacy;
+    if (s->magic == SETTINGS_MAGIC && s->magic_inv == ~SETTINGS_MAGIC) {
+        if (s->version == 3 &&
+            s->max_v > s->min_v &&
+            s->max_v < 1000.0f && s->min_v > -100.0f &&
+            s->hrs_capacity > 0.0f && s->hrs_capacity < 10000.0f &&
+            s->chg_threshold_a != 0.0f &&
+            s->chg_threshold_a > -100.0f && s->chg_threshold_a < 100.0f) {
+            g_min_v = s->min_v;
+            g_max_v = s->max_v;
+            g_hrs_capacity = s->hrs_capacity;
+            g_chg_threshold_a = s->chg_threshold_a;
+            return 1;
+        }
+        if (s->version == 2) {
+            const settings_v2_t *v2 = (const settings_v2_t *)legacy;
+            if (v2->max_v > v2->min_v &&
+                v2->max_v < 1000.0f && v2->min_v > -100.0f &&
+                v2->hrs_capacity > 0.0f && v2->hrs_capacity < 10000.0f) {
+                g_min_v = v2->min_v;
+                g_max_v = v2->max_v;
+                g_hrs_capacity = v2->hrs_capacity;
+                g_chg_threshold_a = -0.05f; // default for legacy settings
+                return 1;
+            }
+        }
+        if (s->version == 1) {
+            const settings_v1_t *v1 = (const settings_v1_t *)legacy;
+            if (v1->max_v > v1->min_v &&
+                v1->max_v < 1000.0f && v1->min_v > -100.0f) {
+                g_min_v = v1->min_v;
+                g_max_v = v1->max_v;
+                g_hrs_capacity = 10.0f;
+                g_chg_threshold_a = -0.05f;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void settings_load_or_default(void) {
+    const settings_hdr_t *a = settings_slot_record(0);
+    const settings_hdr_t *b = settings_slot_record(1);
+    const settings_hdr_t *h = a;
+    int slot = 0;
+    if (b && (!a || (int32_t)(b->seq - a->seq) > 0)) { h = b; slot = 1; }
+
+    if (h) {
+        // start from defaults so fields newer than the record keep them
+        settings_payload_t pl;
+        settings_to_payload(&pl);
+        memcpy(&pl, h + 1, h->length < sizeof(pl) ? h->length : sizeof(pl));
+        g_settings_seq = h->seq;
+        g_settings_slot = slot;
+        if (settings_payload_valid(&pl)) {
+            settings_from_payload(&pl);
+            if (h->length != sizeof(pl)) settings_save(); // rewrite in the current layout
+            return;
+        }
+    } else {
+        settings_load_legacy();
+    }
+    ocv_rebuild();
+    // initialize a slot with defaults (or migrated legacy values) so future loads are fast
+    settings_save();
+}
+
+// ======= INA226 API =======
+static int ina226_init(ina226_t *dev, uint8_t addr, float shunt_ohms, float i_max) {
+    dev->addr = addr;
+    dev->shunt_ohms = shunt_ohms;
+    dev->i_max = i_max;
+    dev->current_lsb = i_max / 32768.0f;        // A/LSB
+    dev->power_lsb   = 25.0f * dev->current_lsb;// W/LSB
+
+    float fcal = 0.00512f / (dev->current_lsb * dev->shunt_ohms);
+    if (fcal < 1.0f || fcal > 65535.0f) return -10;
+    uint16_t cal = (uint16_t)(fcal + 0.5f);
+    if (hal_i2c_write16(dev->addr, INA226_REG_CAL, cal)) return -11;
+
+    uint16_t config = (INA226_CONFIG_AVG << 9) | (INA226_CONFIG_VBUSCT << 6) | (INA226_CONFIG_VSHCT << 3) | 0b111u;
+    if (hal_i2c_write16(dev->addr, INA226_REG_CONFIG, config)) return -12;
+
+    return 0;
+}
+
+// Time for one averaged shunt+bus conversion with the configured AVG/CT bits.
+static uint32_t ina226_conversion_period_us(void) {
+    static const uint16_t avg_n[8] = { 1, 4, 16, 64, 128, 256, 512, 1024 };
+    static const uint16_t ct_us[8] = { 140, 204, 332, 588, 1100, 2116, 4156, 8244 };
+    return (uint32_t)avg_n[INA226_CONFIG_AVG] * (ct_us[INA226_CONFIG_VBUSCT] + ct_us[INA226_CONFIG_VSHCT]);
+}
+
+static float ina226_bus_voltage_V(uint16_t raw) { return (float)raw * 1.25e-3f; }
+static float ina226_current_A(const ina226_t *dev, int16_t raw) { return (float)raw * dev->current_lsb; }
+static float ina226_power_W(const ina226_t *dev, uint16_t raw) { return (float)raw * dev->power_lsb; }
+
+static ina226_scale_t ina226_scale(const ina226_t *dev) {
+    ina226_scale_t sc = { dev->shunt_ohms, dev->current_lsb, dev->power_lsb };
+    return sc;
+}
+
+static float clampf(float x, float lo, float hi){ return x < lo ? lo : (x > hi ? hi : x); }
+
+// ======= Sample intake (core 0) =======
+typedef struct {
+    uint64_t t_us;
+    float v, i, p;
+} sample_t;
+
+static sample_t g_sample;
+static int      g_have_sample = 0;
+static uint32_t g_missed_conv = 0;
+
+static uint32_t g_sampler_period_us = 1000; // nominal conversion period
+
+static void sampler_start(void) {
+    g_sampler_period_us = ina226_conversion_period_us();
+    hal_sampler_start(g_sampler_period_us);
+}
+
+// ======= Alerts =======
+/*
+ * The INA226 compares one function at a time, so the highest-priority enabled
+ * rule (alert_rule_t order) is armed in the chip and timestamped by the ALERT
+ * interrupt; any other enabled rules are checked against each sample with the
+ * same comparator. Either way the host gets one {"event":"alert",...} line per
+ * transition.
+ */
+static int      g_alert_hw_rule = -1;           // rule armed in the chip, -1 if none
+static int      g_alert_active[ALERT_RULE_COUNT];
+static ina226_scale_t g_alert_scale;
+
+static void alerts_emit(alert_rule_t rule, int active, const char *src, uint64_t t_us, const sample_t *s) {
+    printf("{\"event\":\"alert\",\"rule\":\"%s\",\"active\":%s,\"src\":\"%s\",\"t_us\":%llu,\"limit\":%.3f",
+           ina226_alert_rule_name(rule), active ? "true" : "false", src,
+           (unsigned long long)t_us, g_alert_limit[rule]);
+    if (s) printf(",\"v\":%.3f,\"a\":%.4f,\"w\":%.4f", s->v, s->i, s->p);
+    printf("}\n");
+}
+
+// (Re)program the chip after the rules change. Active states restart from
+// idle, so a condition that still holds is reported again.
+static void alerts_apply(const ina226_t *dev) {
+    g_alert_scale = ina226_scale(dev);
+    g_alert_hw_rule = ina226_alert_pick_hw(g_alert_limit);
+    memset(g_alert_active, 0, sizeof(g_alert_active));
+    uint16_t mask = 0, limit = 0;
+    if (g_alert_hw_rule >= 0) {
+        alert_rule_t rule = (alert_rule_t)g_alert_hw_rule;
+        mask = ina226_alert_function(rule, g_alert_limit[rule]); // transparent, active low
+        limit = ina226_alert_limit(rule, g_alert_limit[rule], &g_alert_scale);
+    }
+    // limit first so the comparator never runs against a stale one
+    hal_sampler_write_reg(INA226_REG_ALERT, limit);
+    hal_sampler_write_reg(INA226_REG_MASK, mask);
+    hal_alert_flush(); // drop edges from the previous configuration
+}
+
+// Called for every sample, in order.
+static void alerts_on_sample(const sample_t *s) {
+    // hardware edges up to this conversion are reported with its reading
+    alert_edge_t e;
+    while (hal_alert_pop(s->t_us, &e)) {
+        if (g_alert_hw_rule < 0 || e.asserted == g_alert_active[g_alert_hw_rule]) continue;
+        g_alert_active[g_alert_hw_rule] = e.asserted;
+        alerts_emit((alert_rule_t)g_alert_hw_rule, e.asserted, "hw", e.t_us, s);
+    }
+
+    int16_t shunt_raw = (int16_t)clampf(s->i * g_alert_scale.shunt_ohms / 2.5e-6f, -32768.0f, 32767.0f);
+    uint16_t bus_raw = (uint16_t)clampf(s->v / 1.25e-3f, 0.0f, 65535.0f);
+    uint16_t power_raw = (uint16_t)clampf(s->p / g_alert_scale.power_lsb, 0.0f, 65535.0f);
+    for (int k = 0; k < ALERT_RULE_COUNT; k++) {
+        if (k == g_alert_hw_rule || g_alert_limit[k] == 0.0f) continue;
+        alert_rule_t rule = (alert_rule_t)k;
+        int hit = ina226_alert_compare(ina226_alert_function(rule, g_alert_limit[k]),
+                                       ina226_alert_limit(rule, g_alert_limit[k], &g_alert_scale),
+                                       shunt_raw, bus_raw, power_raw);
+        if (hit == g_alert_active[k]) continue;
+        g_alert_active[k] = hit;
+        alerts_emit(rule, hit, "sw", s->t_us, s);
+    }
+}
+
+// ======= Charging state =======
+/*
+ * Debounced charging detector. Current is measured in the charging direction
+ * (the sign of chg_threshold_a); charging starts once it has stayed at or
+ * beyond |threshold| for chg_dwell_ms and stops once it has stayed below
+ * |threshold| - chg_hyst_a for as long. Transitions are reported with the time
+ * of the crossing that began the dwell, together with the Ah moved during the
+ * session that just ended.
+ */
+typedef struct {
+    int      known;         // seeded from the first sample
+    int      charging;
+    int      pending;       // opposite state has been seen since pending_t_us
+    uint64_t pending_t_us;
+    double   pending_q_ah;
+    uint64_t session_t_us;  // current session started here...
+    double   session_q_ah;  // ...with the charge counter at this value
+    double   q_ah;          // net Ah in the charging direction since boot
+    uint64_t last_t_us;
+} charge_state_t;
+
+static charge_state_t g_chg;
+
+static void charge_on_sample(const sample_t *s) {
+    charge_state_t *c = &g_chg;
+    float x = g_chg_threshold_a > 0.0f ? s->i : -s->i;
+    float thr = g_chg_threshold_a > 0.0f ? g_chg_threshold_a : -g_chg_threshold_a;
+
+    if (!c->known) {
+        c->known = 1;
+        c->charging = x >= thr;
+        c->session_t_us = s->t_us;
+        c->session_q_ah = c->q_ah;
+        c->last_t_us = s->t_us;
+        return;
+    }
+
+    // coulomb count; gaps longer than a few conversions (sensor dropouts) are not bridged
+    uint64_t dt_us = s->t_us - c->last_t_us;
+    if (dt_us < 4ull * g_sampler_period_us) c->q_ah += (double)x * (double)dt_us / 3.6e9;
+    c->last_t_us = s->t_us;
+
+    int want = c->charging ? (x >= thr - g_chg_hyst_a) : (x >= thr);
+    if (want == c->charging) { c->pending = 0; return; }
+    if (!c->pending) {
+        c->pending = 1;
+        c->pending_t_us = s->t_us;
+        c->pending_q_ah = c->q_ah;
+    }
+    if (s->t_us - c->pending_t_us < (uint64_t)g_chg_dwell_ms * 1000ull) return;
+
+    double ah = c->pending_q_ah - c->session_q_ah;
+    double dur_s = (double)(c->pending_t_us - c->session_t_us) * 1e-6;
+    c->charging = want;
+    c->pending = 0;
+    c->session_t_us = c->pending_t_us;
+    c->session_q_ah = c->pending_q_ah;
+    if (want) {
+        printf("{\"event\":\"charging_started\",\"t_us\":%llu,\"discharged_ah\":%.4f,\"discharge_s\":%.1f}\n",
+               (unsigned long long)c->session_t_us, -ah, dur_s);
+    } else {
+        printf("{\"event\":\"charging_stopped\",\"t_us\":%llu,\"charged_ah\":%.4f,\"charge_s\":%.1f}\n",
+               (unsigned long long)c->session_t_us, ah, dur_s);
+    }
+}
+
+// Ah moved so far in the current session, positive in the session's direction.
+static float charge_session_ah(void) {
+    double ah = g_chg.q_ah - g_chg.session_q_ah;
+    return (float)(g_chg.charging ? ah : -ah);
+}
+
+// ======= SoC estimator =======
+/*
+ * soc_ekf.c runs on every sample in integer arithmetic; this feeds it mV/mA
+ * with current positive when discharging (opposite to the charging direction).
+ */
+static soc_ekf_t g_soc;
+static uint64_t  g_soc_last_t_us;
+
+// Learned capacity once there is one, else the rated value.
+static float capacity_effective(void) {
+    return g_cap_weight > 0.0f ? g_learned_ah : g_capacity_ah;
+}
+
+// Apply capacity/resistance and, if the curve changed, reload it (which re-seeds the estimate).
+static void soc_configure(int curve_changed) {
+    if (curve_changed) soc_ekf_set_curve(&g_soc, &g_ocv);
+    soc_ekf_set_capacity(&g_soc, capacity_effective());
+    soc_ekf_set_r_int(&g_soc, g_r_int_ohm);
+}
+
+// Learned resistance is persisted at most this often, and only once it has moved this much.
+#define R_INT_PERSIST_INTERVAL_US  (3600ull * 1000000ull)
+#define R_INT_PERSIST_REL          0.05f
+
+static float    g_r_int_saved_ohm;         // value in the last persisted settings
+static uint64_t g_r_int_saved_us;
+
+static int32_t milli(float x) { return (int32_t)(x < 0.0f ? x * 1000.0f - 0.5f : x * 1000.0f + 0.5f); }
+
+static float discharge_current(const sample_t *s) {
+    return g_chg_threshold_a > 0.0f ? -s->i : s->i;
+}
+
+// Terminal voltage corrected for the IR drop: what the pack would read at rest.
+static float v_ocv(const sample_t *s) {
+    return s->v + discharge_current(s) * g_r_int_ohm;
+}
+
+static void r_int_on_update(uint64_t now_us) {
+    g_r_int_ohm = g_ir.r_ohm;
+    soc_ekf_set_r_int(&g_soc, g_r_int_ohm);
+    float moved = g_r_int_ohm - g_r_int_saved_ohm;
+    if (moved < 0.0f) moved = -moved;
+    if (moved > R_INT_PERSIST_REL * g_r_int_saved_ohm && now_us - g_r_int_saved_us >= R_INT_PERSIST_INTERVAL_US) {
+        g_r_int_saved_ohm = g_r_int_ohm;
+        g_r_int_saved_us = now_us;
+        settings_mark_dirty();
+    }
+}
+
+static void soc_on_sample(const sample_t *s) {
+    int32_t v_mv = milli(s->v), i_ma = milli(discharge_current(s));
+    // like the charge counter, don't bridge sensor dropouts
+    uint64_t dt_us = g_soc.ready ? s->t_us - g_soc_last_t_us : 0;
+    if (dt_us >= 4ull * g_sampler_period_us) {
+        dt_us = 0;
+        ir_est_break(&g_ir);
+    }
+    g_soc_last_t_us = s->t_us;
+    if (g_r_learn && ir_est_sample(&g_ir, v_mv, i_ma)) r_int_on_update(s->t_us);
+    soc_ekf_step(&g_soc, v_mv, i_ma, (uint32_t)dt_us);
+}
+
+// ======= Runtime prediction =======
+/*
+ * Time to empty (and to full while charging) from the energy left on the OCV
+ * curve and an exponentially weighted average of recent power. Each direction
+ * keeps its own average so a charge does not wipe out the discharge history.
+ * Updated on every sample; GET only reads the cached result.
+ */
+#define RUNTIME_WARMUP_US  30000000ull // an average needs this much data before it is used
+#define RUNTIME_IDLE_W     0.05f       // below this there is no meaningful rate
+#define RUNTIME_MAX_HRS    9999.0f
+
+typedef struct {
+    float    avg_w, avg_chg_w;  // discharge / charge power averages, both >= 0 when flowing that way
+    uint64_t dis_us, chg_us;    // data behind each average, capped at the warm-up
+    uint64_t last_t_us;
+    float    now_wh, full_wh;
+    float    hrs_remaining;     // < 0 when not available
+    float    hrs_to_full;
+} runtime_t;
+
+static runtime_t g_rt = { .hrs_remaining = -1.0f, .hrs_to_full = -1.0f };
+
+// first-order low-pass; dt/(tau+dt) approximates 1 - exp(-dt/tau) without exp()
+static float ewma_step(float avg, float x, float dt_s, float tau_s) {
+    return avg + (x - avg) * dt_s / (tau_s + dt_s);
+}
+
+static float runtime_hours(float wh, float w) {
+    float h = wh / w;
+    return h > RUNTIME_MAX_HRS ? RUNTIME_MAX_HRS : h;
+}
+
+static void runtime_on_sample(const sample_t *s) {
+    runtime_t *rt = &g_rt;
+    float p_dis = s->v * discharge_current(s);
+    uint64_t dt_us = rt->last_t_us ? s->t_us - rt->last_t_us : 0;
+    if (dt_us >= 4ull * g_sampler_period_us) dt_us = 0; // dropout: don't stretch the last value over it
+    rt->last_t_us = s->t_us;
+
+    float dt_s = (float)dt_us * 1e-6f;
+    if (g_chg.charging) {
+        rt->avg_chg_w = rt->chg_us ? ewma_step(rt->avg_chg_w, -p_dis, dt_s, g_chg_power_tau_s) : -p_dis;
+        if (rt->chg_us < RUNTIME_WARMUP_US) rt->chg_us += dt_us ? dt_us : 1;
+    } else {
+        rt->avg_w = rt->dis_us ? ewma_step(rt->avg_w, p_dis, dt_s, g_power_tau_s) : p_dis;
+        if (rt->dis_us < RUNTIME_WARMUP_US) rt->dis_us += dt_us ? dt_us : 1;
+    }
+
+    rt->hrs_remaining = rt->hrs_to_full = -1.0f;
+    if (!g_soc.ready) return;
+    soc_ekf_energy_wh(&g_soc, capacity_effective(), &rt->now_wh, &rt->full_wh);
+    if (rt->dis_us >= RUNTIME_WARMUP_US && rt->avg_w > RUNTIME_IDLE_W) {
+        rt->hrs_remaining = runtime_hours(rt->now_wh, rt->avg_w);
+    }
+    if (g_chg.charging && rt->chg_us >= RUNTIME_WARMUP_US && rt->avg_chg_w > RUNTIME_IDLE_W) {
+        rt->hrs_to_full = runtime_hours(rt->full_wh - rt->now_wh, rt->avg_chg_w);
+    }
+}
+
+// ======= Capacity learning =======
+/*
+ * A full charge followed by a discharge to cutoff measures the usable
+ * capacity directly: the net Ah (and Wh) delivered in between. Each complete
+ * cycle is averaged into learned_ah with weight cap_weight, capped so the
+ * estimate keeps following the battery as it ages. Both end points also pin
+ * the SoC filter (100% / 0%). Charging in between is netted out; a second
+ * full charge restarts the measurement.
+ *
+ * full:   charging, v_ocv within CAP_FULL_MARGIN of the top of the curve and
+ *         charge current tapered below capacity/CAP_TAPER_C_DIV, for CAP_FULL_HOLD_US
+ * cutoff: not charging and v <= cutoff_v (bottom of the curve if 0) for CAP_CUTOFF_HOLD_US
+ */
+#define CAP_FULL_MARGIN      0.005f   // fraction of the full voltage
+#define CAP_TAPER_C_DIV      20.0f    // C/20
+#define CAP_FULL_HOLD_US     60000000ull
+#define CAP_CUTOFF_HOLD_US   10000000ull
+#define CAP_WEIGHT_MAX       4.0f     // newest cycle counts at least 1/(1+4)
+#define CAP_SAMPLE_MIN       0.3f     // accept a cycle within this range of the current capacity
+#define CAP_SAMPLE_MAX       1.5f
+#define CAP_CYCLES_PERSIST   0.1f     // persist the cycle count every tenth of a cycle
+
+enum { CAP_COND_NONE, CAP_COND_FULL, CAP_COND_CUTOFF };
+
+typedef struct {
+    int      counting;      // a full charge has been seen; ah/wh run until cutoff
+    double   ah, wh;        // net delivered since then
+    int      cond;          // CAP_COND_* currently being timed
+    int      fired;         // cond has already produced its event
+    uint64_t cond_t_us;
+    uint64_t last_t_us;
+    uint32_t rejected;      // cycles outside CAP_SAMPLE_MIN..MAX
+    float    cycles_saved;
+} cap_learn_t;
+
+static cap_learn_t g_cap;
+
+static float soh_pct(void) {
+    return g_cap_weight > 0.0f ? 100.0f * g_learned_ah / g_capacity_ah : 100.0f;
+}
+
+static void cap_on_full(const sample_t *s) {
+    cap_learn_t *c = &g_cap;
+    c->counting = 1;
+    c->ah = c->wh = 0.0;
+    soc_ekf_anchor(&g_soc, 100.0f, 1.0f);
+    printf("{\"event\":\"full\",\"t_us\":%llu,\"v\":%.3f,\"a\":%.4f}\n",
+           (unsigned long long)s->t_us, s->v, s->i);
+}
+
+static void cap_on_cutoff(const sample_t *s) {
+    cap_learn_t *c = &g_cap;
+    soc_ekf_anchor(&g_soc, 0.0f, 1.0f);
+    printf("{\"event\":\"cutoff\",\"t_us\":%llu,\"v\":%.3f,\"a\":%.4f,\"ah\":%.3f}\n",
+           (unsigned long long)s->t_us, s->v, s->i, c->counting ? c->ah : 0.0);
+    if (!c->counting) return;
+    c->counting = 0;
+
+    float ah = (float)c->ah, wh = (float)c->wh;
+    float ref = capacity_effective();
+    if (ah < CAP_SAMPLE_MIN * ref || ah > CAP_SAMPLE_MAX * ref || !capacity_ah_valid(ah)) {
+        c->rejected++;
+        return;
+    }
+    float w = g_cap_weight;
+    g_learned_ah = (g_learned_ah * w + ah) / (w + 1.0f);
+    g_learned_wh = (g_learned_wh * w + wh) / (w + 1.0f);
+    g_cap_weight = w + 1.0f > CAP_WEIGHT_MAX ? CAP_WEIGHT_MAX : w + 1.0f;
+    soc_configure(0);
+    settings_mark_dirty();
+    printf("{\"event\":\"capacity_learned\",\"t_us\":%llu,\"cycle_ah\":%.3f,\"cycle_wh\":%.2f,"
+           "\"learned_ah\":%.3f,\"learned_wh\":%.2f,\"cap_weight\":%.0f,\"soh_pct\":%.1f}\n",
+           (unsigned long long)s->t_us, ah, wh, g_learned_ah, g_learned_wh, g_cap_weight, soh_pct());
+}
+
+static void cap_on_sample(const sample_t *s) {
+    cap_learn_t *c = &g_cap;
+    float i_dis = discharge_current(s);
+    uint64_t dt_us = c->last_t_us ? s->t_us - c->last_t_us : 0;
+    if (dt_us >= 4ull * g_sampler_period_us) dt_us = 0;
+    c->last_t_us = s->t_us;
+
+    double dt_h = (double)dt_us / 3.6e9;
+    if (i_dis > 0.0f) g_cycles += (float)(i_dis * dt_h) / capacity_effective();
+    if (g_cycles - c->cycles_saved >= CAP_CYCLES_PERSIST) {
+        c->cycles_saved = g_cycles;
+        settings_mark_dirty();
+    }
+    if (c->counting) {
+        c->ah += i_dis * dt_h;
+        c->wh += s->v * i_dis * dt_h;
+    }
+
+    float full_v = g_ocv.v[g_ocv.n - 1] * (1.0f - CAP_FULL_MARGIN);
+    float cutoff_v = g_cutoff_v > 0.0f ? g_cutoff_v : g_ocv.v[0];
+    int cond = CAP_COND_NONE;
+    if (g_chg.charging && v_ocv(s) >= full_v && -i_dis <= capacity_effective() / CAP_TAPER_C_DIV) cond = CAP_COND_FULL;
+    else if (!g_chg.charging && s->v <= cutoff_v) cond = CAP_COND_CUTOFF;
+
+    if (cond != c->cond) {
+        c->cond = cond;
+        c->cond_t_us = s->t_us;
+        c->fired = 0;
+        return;
+    }
+    if (cond == CAP_COND_NONE || c->fired) return;
+    uint64_t hold = cond == CAP_COND_FULL ? CAP_FULL_HOLD_US : CAP_CUTOFF_HOLD_US;
+    if (s->t_us - c->cond_t_us < hold) return;
+    c->fired = 1;
+    if (cond == CAP_COND_FULL) cap_on_full(s);
+    else cap_on_cutoff(s);
+}
+
+// ======= Sample stream and clock sync =======
+/*
+ * Every sample carries t_us, the device clock (hal_time_us64) when the sampler saw the
+ * conversion complete. {"stream":N} pushes every Nth sample as an event line,
+ * {"stream":0} stops it. {"sync":{"host_us":H}} pairs the host's clock with the
+ * device clock at the moment the request arrived; a least-squares line through
+ * the last SYNC_PAIRS pairs gives the offset (host - device) and how fast the
+ * device clock drifts against the host's. The host's send time includes its
+ * USB latency, which biases the offset but not the drift; flash_and_test.py's
+ * Device.sync() corrects the offset with round-trip times.
+ */
+#define SYNC_PAIRS        8
+#define SYNC_RESET_US     100000  // a pair this far off the fit means the host clock jumped
+
+typedef struct {
+    uint64_t dev_us;
+    int64_t  host_us;
+} sync_pair_t;
+
+static uint32_t    g_stream_every = 0;    // 0 = not streaming
+static uint32_t    g_stream_skip = 0;
+static uint32_t    g_sample_seq = 0;      // samples taken since boot
+static sync_pair_t g_sync[SYNC_PAIRS];
+static uint32_t    g_sync_n = 0;          // pairs recorded, newest at (g_sync_n - 1) % SYNC_PAIRS
+
+static void stream_on_sample(const sample_t *s) {
+    if (!g_stream_every || ++g_stream_skip < g_stream_every) return;
+    g_stream_skip = 0;
+    printf("{\"event\":\"sample\",\"seq\":%lu,\"t_us\":%llu,\"v\":%.3f,\"a\":%.4f,\"w\":%.4f}\n",
+           (unsigned long)g_sample_seq, (unsigned long long)s->t_us, s->v, s->i, s->p);
+}
+
+// Fit host - dev = offset + drift * (dev - dev_newest) over the stored pairs.
+// Coordinates are relative to the newest pair so doubles keep microseconds.
+static void sync_fit(double *offset_us, double *drift) {
+    uint32_t n = g_sync_n < SYNC_PAIRS ? g_sync_n : SYNC_PAIRS;
+    const sync_pair_t *ref = &g_sync[(g_sync_n - 1) % SYNC_PAIRS];
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        const sync_pair_t *p = &g_sync[k];
+        double x = -(double)(ref->dev_us - p->dev_us);
+        double y = (double)(p->host_us - ref->host_us) - x;
+        sx += x; sy += y; sxx += x * x; sxy += x * y;
+    }
+    double den = n * sxx - sx * sx;
+    *drift = n > 1 && den > 0 ? (n * sxy - sx * sy) / den : 0.0;
+    *offset_us = (double)ref->host_us - (double)ref->dev_us + (sy - *drift * sx) / n;
+}
+
+static void sync_add(int64_t host_us, uint64_t dev_us) {
+    if (g_sync_n) {
+        double offset, drift;
+        sync_fit(&offset, &drift);
+        const sync_pair_t *ref = &g_sync[(g_sync_n - 1) % SYNC_PAIRS];
+        double predicted = offset + drift * (double)(dev_us - ref->dev_us);
+        if (fabs((double)host_us - (double)dev_us - predicted) > SYNC_RESET_US) g_sync_n = 0;
+    }
+    g_sync[g_sync_n % SYNC_PAIRS] = (sync_pair_t){ dev_us, host_us };
+    g_sync_n++;
+}
+
+// Drain everything core 1 has produced since the last call.
+static void sampler_poll(const ina226_t *dev) {
+    raw_sample_t r;
+    if (!hal_sampler_pop(&r)) return;
+    TRACE_BEGIN(TR_SAMPLER_POLL);
+    do {
+        sample_t s = {
+            .t_us = r.t_us,
+            .v = ina226_bus_voltage_V(r.bus),
+            .i = ina226_current_A(dev, r.cur),
+            .p = ina226_power_W(dev, r.pwr),
+        };
+
+        if (g_have_sample) {
+            // a gap of n periods means n-1 conversions were overwritten unread
+            uint64_t gap = s.t_us - g_sample.t_us;
+            uint32_t n = (uint32_t)((gap + g_sampler_period_us / 2) / g_sampler_period_us);
+            if (n > 1) g_missed_conv += n - 1;
+        }
+        g_sample = s;
+        g_have_sample = 1;
+        g_sample_seq++;
+        alerts_on_sample(&s);
+        charge_on_sample(&s);
+        soc_on_sample(&s);
+        cap_on_sample(&s);
+        runtime_on_sample(&s);
+        stream_on_sample(&s);
+    } while (hal_sampler_pop(&r));
+    TRACE_END(TR_SAMPLER_POLL);
+}
+
+// Latest sample is usable if core 1 produced one within the last few periods.
+static int sampler_fresh(void) {
+    return g_have_sample && (hal_time_us64() - g_sample.t_us) < 4ull * g_sampler_period_us;
+}
+
+// ======= Response builder =======
+typedef struct {
+    char  *buf;
+    char  *w;
+    size_t rem;
+    int    first;
+    uint32_t t0_us;  // for the format-time histogram
+} resp_t;
+
+static void resp_begin(resp_t *r, char *buf, size_t cap) {
+    r->buf = buf; r->w = buf; r->rem = cap; r->first = 1;
+    r->t0_us = hal_time_us32();
+    buf[0] = '\0';
+    TRACE_BEGIN(TR_FORMAT);
+}
+
+static void resp_appendv(resp_t *r, const char *fmt, va_list ap) {
+    if (r->rem <= 1) return;
+    int n = vsnprintf(r->w, r->rem, fmt, ap);
+    if (n < 0) return;
+    if ((size_t)n >= r->rem) n = (int)r->rem - 1; // truncated; keep the pointer in bounds
+    r->w += n; r->rem -= (size_t)n;
+}
+
+static void resp_append(resp_t *r, const char *fmt, ...) {
+    va_list ap; va_start(ap, fmt); resp_appendv(r, fmt, ap); va_end(ap);
+}
+
+// append "key":<fmt>, with a separating comma after the first field
+static void resp_field(resp_t *r, const char *key, const char *fmt, ...) {
+    resp_append(r, "%s\"%s\":", r->first ? "" : ",", key);
+    r->first = 0;
+    va_list ap; va_start(ap, fmt); resp_appendv(r, fmt, ap); va_end(ap);
+}
+
+// write a finished response to USB CDC, timing how long it took to build and to send
+static void resp_send(const resp_t *r) {
+    TRACE_END(TR_FORMAT);
+    uint32_t t = hal_time_us32();
+    diag_hist_add(&g_diag_format_us, t - r->t0_us);
+    TRACE_BEGIN(TR_USB_WRITE);
+    fputs(r->buf, stdout);
+    TRACE_END(TR_USB_WRITE);
+    diag_hist_add(&g_diag_write_us, hal_time_us32() - t);
+}
+
+// detect both "get" and "set" present
+static int has_both_get_and_set(const char *s) {
+    return strstr(s, "\"get\"") && strstr(s, "\"set\"");
+}
+
+// detect {"commit":true}
+static int parse_commit_request(const char *s) {
+    const char *c = strstr(s, "\"commit\"");
+    if (!c) return 0;
+    c += strlen("\"commit\"");
+    while (*c == ' ' || *c == ':') c++;
+    return strncmp(c, "true", 4) == 0;
+}
+
+// parse {"stream":N}; returns 1 if present and valid, -1 if malformed, 0 if absent
+static int parse_stream_request(const char *s, uint32_t *every) {
+    const char *c = strstr(s, "\"stream\"");
+    if (!c) return 0;
+    c += strlen("\"stream\"");
+    while (*c == ' ' || *c == ':') c++;
+    char *end;
+    long n = strtol(c, &end, 10);
+    if (end == c || n < 0 || n > 1000000) return -1;
+    *every = (uint32_t)n;
+    return 1;
+}
+
+// parse {"sync":{"host_us":H}}; same return convention as parse_stream_request
+static int parse_sync_request(const char *s, int64_t *host_us) {
+    const char *c = strstr(s, "\"sync\"");
+    if (!c) return 0;
+    c = strstr(c, "\"host_us\"");
+    if (!c) return -1;
+    c += strlen("\"host_us\"");
+    while (*c == ' ' || *c == ':') c++;
+    char *end;
+    long long h = strtoll(c, &end, 10);
+    if (end == c || h < 0) return -1;
+    *host_us = h;
+    return 1;
+}
+
+// copy a requested field name for the invalid_get_field reply; anything that
+// would need escaping in JSON becomes '?'
+static void copy_field_name(char *dst, size_t cap, const char *src, size_t len) {
+    size_t n = len < cap - 1 ? len : cap - 1;
+    for (size_t k = 0; k < n; k++) {
+        unsigned char c = (unsigned char)src[k];
+        dst[k] = (c < 0x20 || c >= 0x7F || c == '"' || c == '\\') ? '?' : (char)c;
+    }
+    dst[n] = '\0';
+}
+
+// look up a GET field name; returns its GET_F_* index or -1
+static int get_field_index(const char *name, size_t len) {
+    for (size_t f = 0; f < k_get_fields_count; f++) {
+        if (strlen(k_get_fields[f]) == len && strncmp(k_get_fields[f], name, len) == 0) return (int)f;
+    }
+    return -1;
+}
+
+// parse {"get":[ ... ]}, {"get":"all"} or {"get":"<field>"}; validates against supported list
+// returns 1 on success, -1 on invalid field, 0 if no get found
+static int parse_get_request(const char *s, uint64_t *want, char *bad_field, size_t bad_field_cap) {
+    const char *g = strstr(s, "\"get\"");
+    if (!g) return 0;
+    *want = 0;
+
+    // support both {"get":"<name>"} and {"get":["..."]}
+    const char *lb = strchr(g, '[');
+    const char *rb = lb ? strchr(lb, ']') : NULL;
+    const char *q = strchr(g, '"'); // first quote after "get"
+    const char *after_get = q ? q + 1 : g;
+
+    // Shortcut: {"get":"all"} or a single field, e.g. {"get":"ocv"}
+    const char *colon = strchr(after_get, ':');
+    if (colon) {
+        const char *quote_val = strchr(colon, '"');
+        if (quote_val) {
+            const char *quote_val_end = strchr(quote_val + 1, '"');
+            if (quote_val_end && (lb == NULL || quote_val < lb)) {
+                size_t len = (size_t)(quote_val_end - (quote_val + 1));
+                if (len == 3 && strncmp(quote_val + 1, "all", 3) == 0) {
+                    *want = GET_ALL;
+                    return 1;
+                }
+                int f = get_field_index(quote_val + 1, len);
+                if (f < 0) {
+                    copy_field_name(bad_field, bad_field_cap, quote_val + 1, len);
+                    return -1;
+                }
+                *want = GET_BIT(f);
+                return 1;
+            }
+        }
+    }
+
+    if (!lb || !rb || rb <= lb) return 0;
+
+    const char *p = lb;
+    while (p && p < rb) {
+        const char *q1 = strchr(p, '"');
+        if (!q1 || q1 >= rb) break;
+        const char *q2 = strchr(q1 + 1, '"');
+        if (!q2 || q2 > rb) break;
+        size_t len = (size_t)(q2 - (q1 + 1));
+        if (len == 0) { p = q2 + 1; continue; }
+
+        copy_field_name(bad_field, bad_field_cap, q1 + 1, len);
+
+        if (len == 3 && strncmp(q1 + 1, "all", 3) == 0) {
+            *want = GET_ALL;
+        } else {
+            int f = get_field_index(q1 + 1, len);
+            if (f < 0) {
+                return -1; // invalid field captured in bad_field
+            }
+            *want |= GET_BIT(f);
+        }
+        p = q2 + 1;
+    }
+
+    return 1;
+}
+
+static const char *skip_ws(const char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    return p;
+}
+
+// parse "ocv":[[v,pct],...] starting at the key; returns the point count or -1
+static int parse_ocv_points(const char *at, float *v, float *pct) {
+    const char *p = skip_ws(at + strlen("\"ocv\""));
+    if (*p++ != ':') return -1;
+    p = skip_ws(p);
+    if (*p++ != '[') return -1;
+    int n = 0;
+    for (;;) {
+        p = skip_ws(p);
+        if (*p++ != '[' || n == OCV_MAX_POINTS) return -1;
+        char *end;
+        v[n] = strtof(p, &end);
+        if (end == p || !isfinite(v[n])) return -1;
+        p = skip_ws(end);
+        if (*p++ != ',') return -1;
+        pct[n] = strtof(p, &end);
+        if (end == p || !isfinite(pct[n])) return -1;
+        p = skip_ws(end);
+        if (*p++ != ']') return -1;
+        n++;
+        p = skip_ws(p);
+        if (*p == ',') { p++; continue; }
+        if (*p == ']') break;
+        return -1;
+    }
+    return n;
+}
+
+// the number after "key" (at points at the key), optionally quoted; it must end before rb
+static int parse_set_value(const char *at, size_t key_len, const char *rb, float *out) {
+    const char *p = skip_ws(at + key_len);
+    if (*p++ != ':') return -1;
+    p = skip_ws(p);
+    int quoted = *p == '"';
+    if (quoted) p++;
+    char *end;
+    float v = strtof(p, &end);
+    if (end == p || end > rb || !isfinite(v)) return -1;
+    if (quoted && *end != '"') return -1;
+    *out = v;
+    return 0;
+}
+
+// a flag also takes the JSON booleans GET reports it as
+static int parse_set_flag(const char *at, size_t key_len, const char *rb, float *out) {
+    const char *p = skip_ws(at + key_len);
+    if (*p++ != ':') return -1;
+    p = skip_ws(p);
+    size_t n = strncmp(p, "true", 4) == 0 ? 4 : strncmp(p, "false", 5) == 0 ? 5 : 0;
+    if (!n) return parse_set_value(at, key_len, rb, out);
+    const char *end = skip_ws(p + n);
+    if (end > rb || (*end != ',' && *end != '}')) return -1;
+    *out = n == 4 ? 1.0f : 0.0f;
+    return 0;
+}
+
+// parse {"set":{"max_v":..,"min_v":..,"chg_threshold_a":..}}
+// returns 1 if a set object was found; req->present has a SET_BIT per key seen
+static int parse_set_request(const char *s, set_request_t *req) {
+    const char *st = strstr(s, "\"set\"");
+    if (!st) return 0;
+    req->present = 0;
+    req->ocv_preset = -1;
+    req->ocv_n = 0;
+    req->bad = -1;
+    const char *lb = strchr(st, '{');
+    const char *rb = lb ? strchr(lb, '}') : NULL;
+    if (!lb || !rb || rb <= lb) return 0;
+
+    const char *at = strstr(lb, "\"ocv\"");
+    if (at && at < rb) req->ocv_n = parse_ocv_points(at, req->ocv_v, req->ocv_pct);
+    at = strstr(lb, "\"ocv_preset\"");
+    if (at && at < rb) {
+        req->ocv_preset = -2;
+        const char *q1 = strchr(at + strlen("\"ocv_preset\""), '"');
+        const char *q2 = q1 ? strchr(q1 + 1, '"') : NULL;
+        if (q2 && q2 < rb) {
+            int preset = ocv_preset_lookup(q1 + 1, (unsigned)(q2 - q1 - 1));
+            if (preset >= 0) req->ocv_preset = preset;
+        }
+    }
+
+    for (int k = 0; k < SET_K_COUNT; k++) {
+        char key[32];
+        int key_len = snprintf(key, sizeof(key), "\"%s\"", k_set_keys[k]);
+        const char *at = strstr(lb, key);
+        if (!at || at >= rb) continue;
+        int rc = k == SET_K_R_LEARN ? parse_set_flag(at, (size_t)key_len, rb, &req->val[k])
+                                    : parse_set_value(at, (size_t)key_len, rb, &req->val[k]);
+        if (rc) {
+            if (req->bad < 0) req->bad = k;
+            continue;
+        }
+        req->present |= SET_BIT(k);
+    }
+    return 1;
+}
+
+static void format_hist(resp_t *r, const char *key, const diag_hist_t *h) {
+    int last = DIAG_BUCKETS - 1;
+    while (last > 0 && !h->bucket[last]) last--;
+    resp_field(r, key, "{\"n\":%lu,\"max\":%lu,\"mean\":%lu,\"hist\":[", (unsigned long)h->n,
+               (unsigned long)h->max_us, (unsigned long)(h->n ? h->sum_us / h->n : 0));
+    for (int k = 0; k <= last; k++) resp_append(r, "%s%lu", k ? "," : "", (unsigned long)h->bucket[k]);
+    resp_append(r, "]}");
+}
+
+// {"get":"diag"}: counters and latency histograms (microseconds)
+static void format_diag(resp_t *r) {
+    hal_sampler_stats_t st;
+    hal_sampler_stats(&st);
+    resp_field(r, "diag", "{");
+    r->first = 1;
+    resp_field(r, "uptime_us", "%llu", (unsigned long long)hal_time_us64());
+    resp_field(r, "samples", "%lu", (unsigned long)g_sample_seq);
+    resp_field(r, "ring_dropped", "%lu", (unsigned long)st.ring_dropped);
+    resp_field(r, "missed_conv", "%lu", (unsigned long)g_missed_conv);
+    resp_field(r, "alert_dropped", "%lu", (unsigned long)st.alert_dropped);
+    resp_field(r, "i2c_errors", "%lu", (unsigned long)st.i2c_errors);
+    resp_field(r, "i2c_nak", "%lu", (unsigned long)st.i2c_nak);
+    resp_field(r, "i2c_timeout", "%lu", (unsigned long)st.i2c_timeout);
+    resp_field(r, "i2c_retries", "%lu", (unsigned long)st.i2c_retries);
+    resp_field(r, "requests", "%lu", (unsigned long)g_diag_requests);
+    resp_field(r, "bad_requests", "%lu", (unsigned long)g_diag_bad_requests);
+    resp_field(r, "flash_writes", "%lu", (unsigned long)g_usb_stalls);
+    resp_field(r, "flash_fail", "%lu", (unsigned long)g_diag_flash_fail);
+    hal_mem_stats_t mem;
+    hal_mem_stats(&mem);
+    resp_field(r, "stack0_peak", "%lu", (unsigned long)mem.stack0_peak);
+    resp_field(r, "stack0_size", "%lu", (unsigned long)mem.stack0_size);
+    resp_field(r, "stack1_peak", "%lu", (unsigned long)mem.stack1_peak);
+    resp_field(r, "stack1_size", "%lu", (unsigned long)mem.stack1_size);
+    resp_field(r, "heap_used", "%lu", (unsigned long)mem.heap_used);
+    resp_field(r, "heap_peak", "%lu", (unsigned long)mem.heap_peak);
+    resp_field(r, "heap_size", "%lu", (unsigned long)mem.heap_size);
+    format_hist(r, "i2c_us", st.i2c_us);
+    format_hist(r, "loop_us", &g_diag_loop_us);
+    format_hist(r, "parse_us", &g_diag_parse_us);
+    format_hist(r, "format_us", &g_diag_format_us);
+    format_hist(r, "write_us", &g_diag_write_us);
+    format_hist(r, "req_us", &g_diag_req_us);
+    format_hist(r, "flash_us", &g_diag_flash_us);
+    resp_append(r, "}");
+    r->first = 0;
+}
+
+// GET fields that don't need a sensor reading
+static void format_config_fields(resp_t *r, uint64_t want) {
+    if (want & GET_BIT(GET_F_MIN_V))   resp_field(r, "min_v", "%.3f", g_min_v);
+    if (want & GET_BIT(GET_F_MAX_V))   resp_field(r, "max_v", "%.3f", g_max_v);
+    if (want & GET_BIT(GET_F_HRS_CAP)) resp_field(r, "hrs_capacity", "%.1f", g_hrs_capacity);
+    if (want & GET_BIT(GET_F_CHG_THR)) resp_field(r, "chg_threshold_a", "%.3f", g_chg_threshold_a);
+    if (want & GET_BIT(GET_F_MISSED_CONV))      resp_field(r, "missed_conv", "%lu", (unsigned long)g_missed_conv);
+    if (want & GET_BIT(GET_F_USB_STALLS))       resp_field(r, "usb_stalls", "%lu", (unsigned long)g_usb_stalls);
+    if (want & GET_BIT(GET_F_USB_STALL_MAX_US)) resp_field(r, "usb_stall_max_us", "%lu", (unsigned long)g_usb_stall_max_us);
+    if (want & GET_BIT(GET_F_DIRTY)) resp_field(r, "dirty", "%s", g_settings_dirty ? "true" : "false");
+    for (int k = 0; k < ALERT_RULE_COUNT; k++) {
+        if (want & GET_BIT(GET_F_ALERT_FIRST + k)) resp_field(r, k_get_fields[GET_F_ALERT_FIRST + k], "%.3f", g_alert_limit[k]);
+    }
+    if (want & GET_BIT(GET_F_ALERT_HW)) {
+        resp_field(r, "alert_hw", "\"%s\"", g_alert_hw_rule >= 0 ? ina226_alert_rule_name((alert_rule_t)g_alert_hw_rule) : "none");
+    }
+    if (want & GET_BIT(GET_F_CHG_HYST))  resp_field(r, "chg_hyst_a", "%.3f", g_chg_hyst_a);
+    if (want & GET_BIT(GET_F_CHG_DWELL)) resp_field(r, "chg_dwell_ms", "%lu", (unsigned long)g_chg_dwell_ms);
+    if (want & GET_BIT(GET_F_CAP_AH)) resp_field(r, "capacity_ah", "%.2f", g_capacity_ah);
+    if (want & GET_BIT(GET_F_R_INT))  resp_field(r, "r_int_ohm", "%.4f", g_r_int_ohm);
+    if (want & GET_BIT(GET_F_R_INT_SIGMA)) resp_field(r, "r_int_sigma", "%.4f", sqrtf(g_ir.var));
+    if (want & GET_BIT(GET_F_R_INT_STEPS)) resp_field(r, "r_int_steps", "%lu", (unsigned long)g_ir.steps);
+    if (want & GET_BIT(GET_F_R_LEARN))     resp_field(r, "r_learn", "%s", g_r_learn ? "true" : "false");
+    if (want & GET_BIT(GET_F_LEARNED_AH)) resp_field(r, "learned_ah", "%.3f", g_learned_ah);
+    if (want & GET_BIT(GET_F_LEARNED_WH)) resp_field(r, "learned_wh", "%.2f", g_learned_wh);
+    if (want & GET_BIT(GET_F_CAP_WEIGHT)) resp_field(r, "cap_weight", "%.0f", g_cap_weight);
+    if (want & GET_BIT(GET_F_CYCLES))     resp_field(r, "cycles", "%.2f", g_cycles);
+    if (want & GET_BIT(GET_F_SOH))        resp_field(r, "soh_pct", "%.1f", soh_pct());
+    if (want & GET_BIT(GET_F_CAP_LEARNING)) resp_field(r, "cap_learning", "%s", g_cap.counting ? "true" : "false");
+    if (want & GET_BIT(GET_F_CUTOFF_V))   resp_field(r, "cutoff_v", "%.3f", g_cutoff_v);
+    if (want & GET_BIT(GET_F_PWR_TAU))     resp_field(r, "power_tau_s", "%.1f", g_power_tau_s);
+    if (want & GET_BIT(GET_F_CHG_PWR_TAU)) resp_field(r, "chg_power_tau_s", "%.1f", g_chg_power_tau_s);
+    if (want & GET_BIT(GET_F_OCV_PRESET)) resp_field(r, "ocv_preset", "\"%s\"", ocv_preset_name((ocv_preset_t)g_ocv_preset));
+    if (want & GET_BIT(GET_F_OCV)) {
+        resp_field(r, "ocv", "[");
+        for (int k = 0; k < g_ocv.n; k++) {
+            resp_append(r, "%s[%.3f,%.2f]", k ? "," : "", g_ocv.v[k], g_ocv.pct[k]);
+        }
+        resp_append(r, "]");
+    }
+    if (want & GET_BIT(GET_F_DIAG)) format_diag(r);
+}
+
+// the fields that need a fresh sample (GET with the INA226 present)
+static void format_measurements(resp_t *r, uint64_t want) {
+    float vbus = g_sample.v, i = g_sample.i, p = g_sample.p;
+
+    if (want & GET_BIT(GET_F_FW)) resp_field(r, "fw", "\"%s\"", FW_VERSION);
+    if (want & GET_BIT(GET_F_T_US)) resp_field(r, "t_us", "%llu", (unsigned long long)g_sample.t_us);
+    if (want & GET_BIT(GET_F_V))  resp_field(r, "v", "%.3f", vbus);
+    if (want & GET_BIT(GET_F_V_OCV)) resp_field(r, "v_ocv", "%.3f", v_ocv(&g_sample));
+    if (want & GET_BIT(GET_F_A))  resp_field(r, "a", "%.4f", i);
+    if (want & GET_BIT(GET_F_W))  resp_field(r, "w", "%.4f", p);
+    float pct = 0.0f;
+    if (want & (GET_BIT(GET_F_PCT) | GET_BIT(GET_F_HRS_REM))) {
+        pct = ocv_pct(&g_ocv, v_ocv(&g_sample));
+    }
+    if (want & GET_BIT(GET_F_PCT)) resp_field(r, "pct", "%.2f", pct);
+    if (want & GET_BIT(GET_F_HRS_REM)) {
+        // legacy capacity-proxy estimate until the load average is usable
+        float hrs_remaining = g_rt.hrs_remaining >= 0.0f ? g_rt.hrs_remaining : g_hrs_capacity * pct * 0.01f;
+        resp_field(r, "hrs_remaining", "%.1f", hrs_remaining);
+    }
+    if (want & GET_BIT(GET_F_HRS_FULL)) {
+        if (g_rt.hrs_to_full >= 0.0f) resp_field(r, "hrs_to_full", "%.1f", g_rt.hrs_to_full);
+        else resp_field(r, "hrs_to_full", "null");
+    }
+    if (want & GET_BIT(GET_F_AVG_W))     resp_field(r, "avg_w", "%.3f", g_rt.avg_w);
+    if (want & GET_BIT(GET_F_AVG_CHG_W)) resp_field(r, "avg_chg_w", "%.3f", g_rt.avg_chg_w);
+    if (want & GET_BIT(GET_F_REM_WH))    resp_field(r, "remaining_wh", "%.2f", g_rt.now_wh);
+    if (want & GET_BIT(GET_F_SOC)) {
+        if (g_soc.ready) resp_field(r, "soc", "%.2f", soc_ekf_pct(&g_soc));
+        else resp_field(r, "soc", "null");
+    }
+    if (want & GET_BIT(GET_F_SOC_SIGMA)) {
+        if (g_soc.ready) resp_field(r, "soc_sigma", "%.2f", soc_ekf_sigma_pct(&g_soc));
+        else resp_field(r, "soc_sigma", "null");
+    }
+    if (want & GET_BIT(GET_F_CHG)) resp_field(r, "charging", "%s", g_chg.charging ? "true" : "false");
+    if (want & GET_BIT(GET_F_SESSION_AH)) resp_field(r, "session_ah", "%.4f", charge_session_ah());
+}
+
+// detect {"trace":"dump"}
+static int parse_trace_request(const char *s) {
+    const char *c = strstr(s, "\"trace\"");
+    if (!c) return 0;
+    c += strlen("\"trace\"");
+    while (*c == ' ' || *c == ':') c++;
+    return strncmp(c, "\"dump\"", 6) == 0 ? 1 : -1;
+}
+
+// ======= Input accumulator: capture one JSON object { ... } (no newline needed) =======
+// Returns the object's length, -1 if none is complete yet, or -2 when an object
+// did not fit in buf: it is read to its closing brace and dropped whole, so
+// nothing nested inside it is taken for a request of its own.
+static struct {
+    char   buf[1024];  // room for a full 32-point "ocv" upload
+    size_t n;
+    int    depth;
+    int    in_str;     // inside "..."
+    int    esc;        // after backslash
+    int    overflow;   // discarding the rest of an oversized object
+} g_rx;
+
+// Feed one byte; returns the length of the object it completes in g_rx.buf
+// (NUL-terminated), 0 if none, or -2 at the end of an oversized one.
+static int rx_byte(char c) {
+    if (!c) return 0; // would end the request early for the parsers
+
+    if (!g_rx.depth) {
+        if (c == '{') {
+            g_rx.buf[0] = c; g_rx.n = 1;
+            g_rx.depth = 1; g_rx.in_str = 0; g_rx.esc = 0; g_rx.overflow = 0;
+            TRACE_BEGIN(TR_READ_JSON);
+        }
+        return 0;
+    }
+
+    if (g_rx.n + 1 >= sizeof(g_rx.buf)) g_rx.overflow = 1;
+    if (!g_rx.overflow) g_rx.buf[g_rx.n++] = c;
+    if (g_rx.esc) { g_rx.esc = 0; return 0; }
+    if (c == '\\') { g_rx.esc = 1; return 0; }
+    if (c == '"') { g_rx.in_str = !g_rx.in_str; return 0; }
+    if (g_rx.in_str) return 0;
+
+    if (c == '{') g_rx.depth++;
+    else if (c == '}' && --g_rx.depth == 0) {
+        TRACE_END(TR_READ_JSON);
+        if (g_rx.overflow) return -2;
+        g_rx.buf[g_rx.n] = '\0';
+        return (int)g_rx.n;
+    }
+    return 0;
+}
+
+static int read_json_object(char *out, size_t cap, uint32_t poll_ms) {
+    uint64_t until = hal_time_us64() + (uint64_t)poll_ms * 1000u;
+
+    while (hal_time_us64() < until) {
+        int ch = hal_getchar();
+        if (ch < 0) { hal_idle(); continue; }
+        int n = rx_byte((char)ch);
+        if (n < 0) return n;
+        if (n == 0) continue;
+        size_t len = (size_t)n < cap ? (size_t)n : cap - 1;
+        memcpy(out, g_rx.buf, len);
+        out[len] = '\0';
+        return (int)len;
+    }
+    return -1; // no complete object yet
+}
+
+// ======= Microbenchmarks =======
+/*
+ * One operation per case. host/pm_bench.c times them in ns/op and counts heap
+ * allocations; PM_BENCH firmware runs them for {"bench":N} and reports SysTick
+ * cycles per op. Both go through the same table, so a change can be judged on
+ * the host and confirmed on the device.
+ */
+#ifdef PM_BENCH
+typedef struct {
+    const char *name;
+    void      (*run)(const char *req);
+    const char *req;    // request text for the reader and parser cases, else NULL
+} bench_case_t;
+
+static volatile uint32_t g_bench_sink; // keeps results live
+static char        g_bench_ocv32_req[512];
+static ocv_table_t g_bench_ocv32;
+
+static const char k_bench_get_list[] = "{\"get\":[\"v\",\"a\",\"w\",\"pct\",\"charging\"]}";
+
+static void bench_rx(const char *req) {
+    int n = 0;
+    while (*req) n = rx_byte(*req++);
+    g_bench_sink += (uint32_t)n;
+}
+
+static void bench_parse_get(const char *req) {
+    uint64_t want = 0;
+    char bad_field[32];
+    g_bench_sink += (uint32_t)parse_get_request(req, &want, bad_field, sizeof(bad_field)) + (uint32_t)want;
+}
+
+static void bench_parse_set(const char *req) {
+    set_request_t set;
+    g_bench_sink += (uint32_t)parse_set_request(req, &set) + set.present;
+}
+
+// sweep 64 voltages across the table so the search takes varying paths
+static float bench_sweep_v(void) {
+    static uint32_t k;
+    return g_min_v - 0.5f + (g_max_v - g_min_v + 1.0f) * (float)(k++ & 63u) / 63.0f;
+}
+
+static void bench_ocv_pct(const char *req) {
+    (void)req;
+    g_bench_sink += (uint32_t)ocv_pct(&g_ocv, bench_sweep_v());
+}
+
+static void bench_ocv_pct32(const char *req) {
+    (void)req;
+    g_bench_sink += (uint32_t)ocv_pct(&g_bench_ocv32, bench_sweep_v());
+}
+
+static void bench_format(uint64_t want) {
+    static char buf[2560]; // as handle_request()'s outbuf
+    resp_t r;
+    resp_begin(&r, buf, sizeof(buf));
+    resp_append(&r, "{");
+    format_measurements(&r, want);
+    format_config_fields(&r, want);
+    resp_append(&r, "}\n");
+    TRACE_END(TR_FORMAT);
+    g_bench_sink += (uint32_t)(r.w - r.buf);
+}
+
+static void bench_format_list(const char *req) {
+    (void)req;
+    bench_format(GET_BIT(GET_F_V) | GET_BIT(GET_F_A) | GET_BIT(GET_F_W) | GET_BIT(GET_F_PCT) | GET_BIT(GET_F_CHG));
+}
+
+static void bench_format_all(const char *req) {
+    (void)req;
+    bench_format(GET_ALL);
+}
+
+static const bench_case_t k_bench_cases[] = {
+    { "read_json_object/get_list",  bench_rx,          k_bench_get_list },
+    { "read_json_object/set_ocv32", bench_rx,          g_bench_ocv32_req },
+    { "parse_get_request/single",   bench_parse_get,   "{\"get\":\"v\"}" },
+    { "parse_get_request/list",     bench_parse_get,   k_bench_get_list },
+    { "parse_get_request/all",      bench_parse_get,   "{\"get\":\"all\"}" },
+    { "parse_get_request/invalid",  bench_parse_get,   "{\"get\":[\"v\",\"a\",\"bogus\"]}" },
+    { "parse_set_request/four",     bench_parse_set,   "{\"set\":{\"min_v\":21.0,\"max_v\":32.2,\"hrs_capacity\":10.0,\"chg_threshold_a\":-0.05}}" },
+    { "parse_set_request/ocv32",    bench_parse_set,   g_bench_ocv32_req },
+    { "ocv_pct/active",             bench_ocv_pct,     NULL },
+    { "ocv_pct/custom32",           bench_ocv_pct32,   NULL },
+    { "format_get/list",            bench_format_list, NULL },
+    { "format_get/all",             bench_format_all,  NULL },
+};
+#define BENCH_CASES (sizeof(k_bench_cases) / sizeof(k_bench_cases[0]))
+
+// A full-size "ocv" upload and table for the cases above.
+static void bench_setup(void) {
+    float v[OCV_MAX_POINTS], pct[OCV_MAX_POINTS];
+    size_t n = (size_t)snprintf(g_bench_ocv32_req, sizeof(g_bench_ocv32_req), "{\"set\":{\"ocv\":[");
+    for (int k = 0; k < OCV_MAX_POINTS; k++) {
+        v[k] = 21.0f + 0.2f * (float)k;
+        pct[k] = 100.0f * (float)k / (OCV_MAX_POINTS - 1);
+        n += (size_t)snprintf(g_bench_ocv32_req + n, sizeof(g_bench_ocv32_req) - n, "%s[%.1f,%.1f]", k ? "," : "", v[k], pct[k]);
+    }
+    snprintf(g_bench_ocv32_req + n, sizeof(g_bench_ocv32_req) - n, "]}}");
+    ocv_table_set(&g_bench_ocv32, v, pct, OCV_MAX_POINTS);
+}
+
+// {"bench":N}: every case N times on core 0. "cyc" is the mean and "min" the
+// fastest op, both less the cost of reading the counter; interrupts (USB, the
+// timer) land in the mean but rarely in the min.
+static void bench_run(uint32_t n) {
+    bench_setup();
+    uint32_t overhead = HAL_CYCLES_MASK;
+    for (int k = 0; k < 16; k++) {
+        uint32_t t0 = hal_cycles();
+        uint32_t d = (hal_cycles() - t0) & HAL_CYCLES_MASK;
+        if (d < overhead) overhead = d;
+    }
+    printf("{\"bench\":{\"clk_hz\":%lu,\"n\":%lu,\"cases\":[", (unsigned long)hal_cycles_hz(), (unsigned long)n);
+    for (size_t c = 0; c < BENCH_CASES; c++) {
+        const bench_case_t *bc = &k_bench_cases[c];
+        bc->run(bc->req); // warm caches and lazily built state
+        uint64_t sum = 0;
+        uint32_t min = HAL_CYCLES_MASK;
+        for (uint32_t k = 0; k < n; k++) {
+            uint32_t t0 = hal_cycles();
+            bc->run(bc->req);
+            uint32_t d = (hal_cycles() - t0) & HAL_CYCLES_MASK;
+            d = d > overhead ? d - overhead : 0;
+            sum += d;
+            if (d < min) min = d;
+        }
+        printf("%s{\"name\":\"%s\",\"cyc\":%lu,\"min\":%lu}", c ? "," : "", bc->name,
+               (unsigned long)((sum + n / 2) / n), (unsigned long)min);
+    }
+    printf("]}}\n");
+}
+#endif
+
+// parse {"bench":N} (1..1000); same return convention as parse_stream_request
+static int parse_bench_request(const char *s, uint32_t *n) {
+    const char *c = strstr(s, "\"bench\"");
+    if (!c) return 0;
+    c += strlen("\"bench\"");
+    while (*c == ' ' || *c == ':') c++;
+    char *end;
+    long v = strtol(c, &end, 10);
+    if (end == c || v < 1 || v > 1000) return -1;
+    *n = (uint32_t)v;
+    return 1;
+}
+
+// ======= Entry points (pm_core.h) =======
+static ina226_t g_ina;
+
+int pm_core_init(void) {
+    // Load persisted thresholds (or initialize defaults)
+    ir_est_init(&g_ir, g_r_int_ohm, R_INT_VAR0);
+    settings_load_or_default();
+    g_r_int_saved_ohm = g_r_int_ohm;
+    g_cap.cycles_saved = g_cycles;
+    soc_ekf_init(&g_soc);
+    soc_configure(1);
+
+    // INA226 init (shunt and full scale from ina226.h — adjust there)
+    int rc = ina226_init(&g_ina, INA226_ADDR, INA226_SHUNT_OHMS, INA226_I_MAX_A);
+    if (rc) {
+        // Non-fatal: keep USB CDC alive so the host can still talk to us.
+        // We'll answer requests with an explicit INA226-not-found message.
+        g_ina_ok = 0;
+        // Emit a one-time boot message for visibility (host might miss it if it connects later).
+        printf("{\"error\":\"ina226_not_found\",\"message\":\"INA226 not found\",\"code\":%d}\n", rc);
+    } else {
+        g_ina_ok = 1;
+        // From here on the sampler owns the I2C bus.
+        sampler_start();
+        alerts_apply(&g_ina);
+    }
+    return rc;
+}
+
+// One complete request from read_json_object, received at rx_us.
+static void handle_request(const char *inbuf, uint64_t rx_us) {
+    static char outbuf[2560]; // static: core 0 only has a 2 KB stack
+    g_diag_requests++;
+    if (g_ina_ok) sampler_poll(&g_ina);
+
+    if (has_both_get_and_set(inbuf)) {
+        printf("{\"error\":\"both_get_and_set\"}\n");
+        return;
+    }
+
+    // "commit":true flushes pending settings now, alone or alongside a SET
+    int want_commit = parse_commit_request(inbuf);
+
+    // --- SET handler ---
+    set_request_t req;
+    uint32_t parse_t = hal_time_us32();
+    TRACE_BEGIN(TR_PARSE_SET);
+    int set_rc = parse_set_request(inbuf, &req);
+    TRACE_END(TR_PARSE_SET);
+    uint32_t parse_us = hal_time_us32() - parse_t;
+    if (set_rc) {
+        diag_hist_add(&g_diag_parse_us, parse_us);
+        if (req.ocv_n < 0) {
+            printf("{\"error\":\"invalid_ocv\",\"message\":\"ocv must be [[v,pct],...] with 2 to %d points\"}\n", OCV_MAX_POINTS);
+            return;
+        }
+        if (req.ocv_n && req.ocv_preset != -1) {
+            printf("{\"error\":\"invalid_ocv\",\"message\":\"set either ocv or ocv_preset, not both\"}\n");
+            return;
+        }
+        if (req.ocv_preset == -2) {
+            printf("{\"error\":\"invalid_value\",\"field\":\"ocv_preset\"}\n");
+            return;
+        }
+        if (req.bad >= 0) {
+            printf("{\"error\":\"invalid_value\",\"field\":\"%s\"}\n", k_set_keys[req.bad]);
+            return;
+        }
+        ocv_table_t new_ocv;
+        if (req.ocv_n && ocv_table_set(&new_ocv, req.ocv_v, req.ocv_pct, req.ocv_n)) {
+            printf("{\"error\":\"invalid_ocv\",\"message\":\"ocv needs 2 to %d points, v strictly increasing, pct non-decreasing within 0..100\"}\n", OCV_MAX_POINTS);
+            return;
+        }
+        if (req.present || req.ocv_n || req.ocv_preset >= 0) {
+            float new_chg_thr = (req.present & SET_BIT(SET_K_CHG_THR)) ? req.val[SET_K_CHG_THR] : g_chg_threshold_a;
+            if (new_chg_thr == 0.0f || new_chg_thr <= -100.0f || new_chg_thr >= 100.0f) {
+                printf("{\"error\":\"invalid_chg_threshold\",\"message\":\"chg_threshold_a must be non-zero between -100 and 100\"}\n");
+                return;
+            }
+            int bad_alert = -1;
+            for (int k = 0; k < ALERT_RULE_COUNT; k++) {
+                if ((req.present & SET_BIT(SET_K_ALERT_FIRST + k)) &&
+                    !alert_limit_valid((alert_rule_t)k, req.val[SET_K_ALERT_FIRST + k])) { bad_alert = k; break; }
+            }
+            if (bad_alert >= 0) {
+                printf("{\"error\":\"invalid_alert\",\"field\":\"%s\",\"max\":%.3f}\n",
+                       k_set_keys[SET_K_ALERT_FIRST + bad_alert], alert_limit_max((alert_rule_t)bad_alert));
+                return;
+            }
+            if ((req.present & SET_BIT(SET_K_CHG_HYST)) && !chg_hyst_valid(req.val[SET_K_CHG_HYST])) {
+                printf("{\"error\":\"invalid_value\",\"field\":\"chg_hyst_a\"}\n");
+                return;
+            }
+            if ((req.present & SET_BIT(SET_K_CHG_DWELL)) && !chg_dwell_valid(req.val[SET_K_CHG_DWELL])) {
+                printf("{\"error\":\"invalid_value\",\"field\":\"chg_dwell_ms\"}\n");
+                return;
+            }
+            if ((req.present & SET_BIT(SET_K_CAP_AH)) && !capacity_ah_valid(req.val[SET_K_CAP_AH])) {
+                printf("{\"error\":\"invalid_value\",\"field\":\"capacity_ah\"}\n");
+                return;
+            }
+            if ((req.present & SET_BIT(SET_K_R_INT)) && !r_int_valid(req.val[SET_K_R_INT])) {
+                printf("{\"error\":\"invalid_value\",\"field\":\"r_int_ohm\"}\n");
+                return;
+            }
+            if ((req.present & SET_BIT(SET_K_CYCLES)) && !cycles_valid(req.val[SET_K_CYCLES])) {
+                printf("{\"error\":\"invalid_value\",\"field\":\"cycles\"}\n");
+                return;
+            }
+            if ((req.present & SET_BIT(SET_K_CUTOFF_V)) && !cutoff_v_valid(req.val[SET_K_CUTOFF_V])) {
+                printf("{\"error\":\"invalid_value\",\"field\":\"cutoff_v\"}\n");
+                return;
+            }
+            int bad_v = -1;
+            for (int k = SET_K_MIN_V; k <= SET_K_MAX_V; k++) {
+                if ((req.present & SET_BIT(k)) && !pack_v_valid(req.val[k])) { bad_v = k; break; }
+            }
+            if (bad_v >= 0) {
+                printf("{\"error\":\"invalid_value\",\"field\":\"%s\"}\n", k_set_keys[bad_v]);
+                return;
+            }
+            int bad_tau = -1;
+            for (int k = SET_K_PWR_TAU; k <= SET_K_CHG_PWR_TAU; k++) {
+                if ((req.present & SET_BIT(k)) && !power_tau_valid(req.val[k])) { bad_tau = k; break; }
+            }
+            if (bad_tau >= 0) {
+                printf("{\"error\":\"invalid_value\",\"field\":\"%s\"}\n", k_set_keys[bad_tau]);
+                return;
+            }
+            // anything settings_payload_valid() refuses would be accepted now
+            // and then lost, with every other setting, at the next boot
+            if ((req.present & SET_BIT(SET_K_HRS_CAP)) && !hrs_cap_valid(req.val[SET_K_HRS_CAP])) {
+                printf("{\"error\":\"invalid_value\",\"field\":\"hrs_capacity\"}\n");
+                return;
+            }
+            float new_max = (req.present & SET_BIT(SET_K_MAX_V)) ? req.val[SET_K_MAX_V] : g_max_v;
+            float new_min = (req.present & SET_BIT(SET_K_MIN_V)) ? req.val[SET_K_MIN_V] : g_min_v;
+            float new_hrs_cap = (req.present & SET_BIT(SET_K_HRS_CAP)) ? req.val[SET_K_HRS_CAP] : g_hrs_capacity;
+            if (new_max == new_min) {
+                printf("{\"error\":\"invalid_value\",\"field\":\"%s\"}\n",
+                       (req.present & SET_BIT(SET_K_MAX_V)) ? "max_v" : "min_v");
+                return;
+            }
+            // ensure sane ordering
+            if (new_max < new_min) { float t = new_max; new_max = new_min; new_min = t; }
+            g_max_v = new_max;
+            g_min_v = new_min;
+            g_hrs_capacity = new_hrs_cap;
+            g_chg_threshold_a = new_chg_thr;
+            int alerts_changed = 0;
+            for (int k = 0; k < ALERT_RULE_COUNT; k++) {
+                if (!(req.present & SET_BIT(SET_K_ALERT_FIRST + k))) continue;
+                g_alert_limit[k] = req.val[SET_K_ALERT_FIRST + k];
+                alerts_changed = 1;
+            }
+            if (alerts_changed && g_ina_ok) alerts_apply(&g_ina);
+            if (req.present & SET_BIT(SET_K_CHG_HYST)) g_chg_hyst_a = req.val[SET_K_CHG_HYST];
+            if (req.present & SET_BIT(SET_K_CHG_DWELL)) g_chg_dwell_ms = (uint32_t)(req.val[SET_K_CHG_DWELL] + 0.5f);
+            if (req.ocv_n) {
+                g_ocv = new_ocv;
+                g_ocv_preset = OCV_PRESET_CUSTOM;
+            } else if (req.ocv_preset >= 0) {
+                g_ocv_preset = (uint8_t)req.ocv_preset;
+            }
+            if (req.present & SET_BIT(SET_K_CAP_AH)) {
+                // a new rated capacity (e.g. a replaced battery) starts learning over
+                g_capacity_ah = req.val[SET_K_CAP_AH];
+                g_learned_ah = g_learned_wh = g_cap_weight = 0.0f;
+            }
+            if (req.present & SET_BIT(SET_K_CYCLES)) g_cycles = g_cap.cycles_saved = req.val[SET_K_CYCLES];
+            if (req.present & SET_BIT(SET_K_CUTOFF_V)) g_cutoff_v = req.val[SET_K_CUTOFF_V];
+            if (req.present & SET_BIT(SET_K_R_INT)) {
+                // a hand-set value restarts learning from it
+                g_r_int_ohm = req.val[SET_K_R_INT];
+                ir_est_init(&g_ir, g_r_int_ohm, R_INT_VAR0);
+                g_r_int_saved_ohm = g_r_int_ohm;
+            }
+            if (req.present & SET_BIT(SET_K_R_LEARN)) g_r_learn = req.val[SET_K_R_LEARN] != 0.0f;
+            if (req.present & SET_BIT(SET_K_PWR_TAU)) g_power_tau_s = req.val[SET_K_PWR_TAU];
+            if (req.present & SET_BIT(SET_K_CHG_PWR_TAU)) g_chg_power_tau_s = req.val[SET_K_CHG_PWR_TAU];
+            ocv_rebuild();
+            soc_configure(req.ocv_n || req.ocv_preset >= 0 ||
+                          (req.present & (SET_BIT(SET_K_MIN_V) | SET_BIT(SET_K_MAX_V))));
+            settings_mark_dirty();
+        }
+        if (want_commit && g_settings_dirty && settings_save()) {
+            fputs("{\"error\":\"flash_write\"}\n", stdout);
+            return;
+        }
+        resp_t r;
+        resp_begin(&r, outbuf, sizeof(outbuf));
+        resp_append(&r, "{");
+        resp_field(&r, "ok", "true");
+        format_config_fields(&r, GET_BIT(GET_F_MIN_V) | GET_BIT(GET_F_MAX_V) | GET_BIT(GET_F_HRS_CAP) | GET_BIT(GET_F_CHG_THR));
+        // echo any other keys that were set
+        uint64_t extra = 0;
+        for (int k = SET_K_CHG_THR + 1; k < SET_K_COUNT; k++) {
+            int f = get_field_index(k_set_keys[k], strlen(k_set_keys[k]));
+            if ((req.present & SET_BIT(k)) && f >= 0) extra |= GET_BIT(f);
+        }
+        if (req.ocv_n || req.ocv_preset >= 0) extra |= GET_BIT(GET_F_OCV_PRESET);
+        format_config_fields(&r, extra | GET_BIT(GET_F_DIRTY));
+        resp_append(&r, "}\n");
+        if (!g_ina_ok) {
+            // Always include INA226-not-found message for host-side clarity.
+            // Keep the response as JSON (even though the operation may still succeed).
+            // Trim trailing newline from outbuf and wrap with error/message prefix.
+            TRACE_END(TR_FORMAT);
+            size_t len = strlen(outbuf);
+            if (len && outbuf[len - 1] == '\n') outbuf[len - 1] = '\0';
+            printf("{\"error\":\"ina226_not_found\",\"message\":\"INA226 not found\",\"result\":%s}\n", outbuf);
+        } else {
+            resp_send(&r);
+        }
+        return;
+    }
+
+    // --- GET handler ---
+    uint64_t want = 0;
+    char bad_field[32] = {0};
+    parse_t = hal_time_us32();
+    TRACE_BEGIN(TR_PARSE_GET);
+    int get_rc = parse_get_request(inbuf, &want, bad_field, sizeof(bad_field));
+    TRACE_END(TR_PARSE_GET);
+    if (get_rc) diag_hist_add(&g_diag_parse_us, parse_us + (hal_time_us32() - parse_t));
+    if (get_rc == -1) {
+        // Invalid field requested; respond with explicit list of supported fields.
+        resp_t r;
+        resp_begin(&r, outbuf, sizeof(outbuf));
+        resp_append(&r, "{\"error\":\"invalid_get_field\",\"field\":\"%s\",\"supported\":[", bad_field);
+        for (size_t f = 0; f < k_get_fields_count; f++) {
+            resp_append(&r, "%s\"%s\"", f ? "," : "", k_get_fields[f]);
+        }
+        resp_append(&r, "]}\n");
+        resp_send(&r);
+        return;
+    }
+    if (get_rc == 1) {
+        resp_t r;
+        resp_begin(&r, outbuf, sizeof(outbuf));
+        resp_append(&r, "{");
+
+        // If INA226 is missing, still answer with a JSON object including the requested
+        // non-sensor fields plus an explicit message for host-side clarity.
+        if (!g_ina_ok) {
+            resp_field(&r, "error", "\"ina226_not_found\"");
+            resp_field(&r, "message", "\"INA226 not found\"");
+            if (want & GET_BIT(GET_F_FW)) resp_field(&r, "fw", "\"%s\"", FW_VERSION);
+            format_config_fields(&r, want);
+            // Note: v/a/w/pct/charging/hrs_remaining require INA226 measurements; omit them when missing.
+            resp_append(&r, "}\n");
+            resp_send(&r);
+            return;
+        }
+
+        if (!sampler_fresh()) { fputs("{\"error\":\"i2c_read\"}\n", stdout); return; }
+        format_measurements(&r, want);
+        format_config_fields(&r, want);
+        resp_append(&r, "}\n");
+        resp_send(&r);
+        return;
+    }
+
+    // --- STREAM handler ---
+    uint32_t every;
+    int stream_rc = parse_stream_request(inbuf, &every);
+    if (stream_rc) {
+        if (stream_rc < 0) { fputs("{\"error\":\"invalid_value\",\"field\":\"stream\"}\n", stdout); return; }
+        g_stream_every = every;
+        g_stream_skip = 0;
+        printf("{\"ok\":true,\"stream\":%lu,\"seq\":%lu}\n", (unsigned long)every, (unsigned long)g_sample_seq);
+        return;
+    }
+
+    // --- SYNC handler ---
+    int64_t host_us;
+    int sync_rc = parse_sync_request(inbuf, &host_us);
+    if (sync_rc) {
+        if (sync_rc < 0) { fputs("{\"error\":\"invalid_value\",\"field\":\"host_us\"}\n", stdout); return; }
+        sync_add(host_us, rx_us);
+        double offset, drift;
+        sync_fit(&offset, &drift);
+        printf("{\"host_us\":%lld,\"dev_us\":%llu,\"offset_us\":%.0f,\"drift_ppm\":%.3f,\"pairs\":%lu}\n",
+               (long long)host_us, (unsigned long long)rx_us, offset, drift * 1e6,
+               (unsigned long)(g_sync_n < SYNC_PAIRS ? g_sync_n : SYNC_PAIRS));
+        return;
+    }
+
+    // --- TRACE handler ---
+    int trace_rc = parse_trace_request(inbuf);
+    if (trace_rc) {
+#ifdef PM_TRACE
+        if (trace_rc > 0) hal_trace_dump();
+        else fputs("{\"error\":\"invalid_value\",\"field\":\"trace\"}\n", stdout);
+#else
+        fputs("{\"error\":\"trace_disabled\"}\n", stdout);
+#endif
+        return;
+    }
+
+    // --- BENCH handler ---
+    uint32_t bench_n;
+    int bench_rc = parse_bench_request(inbuf, &bench_n);
+    if (bench_rc) {
+        if (bench_rc < 0) { fputs("{\"error\":\"invalid_value\",\"field\":\"bench\"}\n", stdout); return; }
+#ifdef PM_BENCH
+        bench_run(bench_n);
+#else
+        fputs("{\"error\":\"bench_disabled\"}\n", stdout);
+#endif
+        return;
+    }
+
+    // --- COMMIT handler ---
+    if (want_commit) {
+        int was_dirty = g_settings_dirty;
+        if (was_dirty && settings_save()) { fputs("{\"error\":\"flash_write\"}\n", stdout); return; }
+        printf("{\"ok\":true,\"committed\":%s,\"dirty\":%s}\n",
+               was_dirty ? "true" : "false", g_settings_dirty ? "true" : "false");
+        return;
+    }
+
+    // Unknown request
+    g_diag_bad_requests++;
+    fputs("{\"error\":\"bad_request\"}\n", stdout);
+}
+
+static uint32_t g_poll_loop_t = 0, g_poll_req_t = 0;
+static int      g_poll_req_pending = 0;
+
+void pm_core_poll(void) {
+    static char inbuf[1024];
+
+    uint32_t now = hal_time_us32();
+    if (g_poll_loop_t) diag_hist_add(&g_diag_loop_us, now - g_poll_loop_t);
+    g_poll_loop_t = now;
+    if (g_poll_req_pending) {
+        diag_hist_add(&g_diag_req_us, now - g_poll_req_t);
+        g_poll_req_pending = 0;
+        TRACE_END(TR_REQUEST);
+    }
+
+    if (g_ina_ok) sampler_poll(&g_ina);
+    settings_service();
+    int n = read_json_object(inbuf, sizeof(inbuf), 10); // poll every 10 ms
+    if (n == -2) {
+        g_diag_bad_requests++;
+        fputs("{\"error\":\"request_too_long\"}\n", stdout);
+        return;
+    }
+    if (n <= 0) return;
+    uint64_t rx_us = hal_time_us64(); // arrival time for "sync"
+    g_poll_req_t = (uint32_t)rx_us;
+    g_poll_req_pending = 1;
+    TRACE_BEGIN(TR_REQUEST);
+    handle_request(inbuf, rx_us);
+}
+
+void pm_core_reset(void) {
+    g_min_v = 21.0f;
+    g_max_v = 32.2f;
+    g_hrs_capacity = 10.0f;
+    g_chg_threshold_a = -0.05f;
+    g_chg_hyst_a = 0.02f;
+    g_chg_dwell_ms = 3000;
+    memset(g_alert_limit, 0, sizeof(g_alert_limit));
+    g_ocv_preset = OCV_PRESET_KNEE;
+    memset(&g_ocv, 0, sizeof(g_ocv));
+    g_capacity_ah = 10.0f;
+    g_learned_ah = g_learned_wh = g_cap_weight = 0.0f;
+    g_cycles = 0.0f;
+    g_cutoff_v = 0.0f;
+    g_r_int_ohm = 0.05f;
+    g_r_learn = 1;
+    memset(&g_ir, 0, sizeof(g_ir));
+    g_power_tau_s = 300.0f;
+    g_chg_power_tau_s = 120.0f;
+    g_ina_ok = 0;
+    memset(&g_ina, 0, sizeof(g_ina));
+
+    g_settings_seq = 0;
+    g_settings_slot = -1;
+    g_settings_dirty = 0;
+    g_settings_first_dirty_us = g_settings_last_change_us = 0;
+
+    g_usb_stalls = g_usb_stall_max_us = 0;
+    memset(&g_diag_loop_us, 0, sizeof(g_diag_loop_us));
+    memset(&g_diag_parse_us, 0, sizeof(g_diag_parse_us));
+    memset(&g_diag_format_us, 0, sizeof(g_diag_format_us));
+    memset(&g_diag_write_us, 0, sizeof(g_diag_write_us));
+    memset(&g_diag_req_us, 0, sizeof(g_diag_req_us));
+    memset(&g_diag_flash_us, 0, sizeof(g_diag_flash_us));
+    g_diag_requests = g_diag_bad_requests = g_diag_flash_fail = 0;
+
+    memset(&g_sample, 0, sizeof(g_sample));
+    g_have_sample = 0;
+    g_missed_conv = 0;
+    g_sampler_period_us = 1000;
+    g_alert_hw_rule = -1;
+    memset(g_alert_active, 0, sizeof(g_alert_active));
+    memset(&g_alert_scale, 0, sizeof(g_alert_scale));
+    memset(&g_chg, 0, sizeof(g_chg));
+    memset(&g_soc, 0, sizeof(g_soc));
+    g_soc_last_t_us = 0;
+    g_r_int_saved_ohm = 0.0f;
+    g_r_int_saved_us = 0;
+    g_rt = (runtime_t){ .hrs_remaining = -1.0f, .hrs_to_full = -1.0f };
+    memset(&g_cap, 0, sizeof(g_cap));
+
+    g_stream_every = g_stream_skip = 0;
+    g_sample_seq = 0;
+    memset(g_sync, 0, sizeof(g_sync));
+    g_sync_n = 0;
+    memset(&g_rx, 0, sizeof(g_rx));
+    g_poll_loop_t = g_poll_req_t = 0;
+    g_poll_req_pending = 0;
+}
@@ -0,0 +1,23 @@
+#ifndef PM_CORE_H
+#define PM_CORE_H
+
+/*
+ * Platform-independent firmware: settings, estimators, alerts and the USB
+ * JSON protocol. Runs on core 0 on the RP2040 and natively on the host, on top
+ * of the platform layer in pm_hal.h.
+ */
+
+// Load settings, bring up the INA226 and start the sampler. Returns 0, or the
+// ina226_init() code if the chip did not answer (requests are still served).
+int  pm_core_init(void);
+
+// One main-loop iteration: drain samples, commit settings once they are quiet,
+// and handle at most one request (waits up to 10 ms for input).
+void pm_core_poll(void);
+
+// Put every piece of state back as it is at power-on, before pm_core_init().
+// For host harnesses that boot the firmware many times in one process; the
+// platform layer has its own reset (hal_host_reset()).
+void pm_core_reset(void);
+
+#endif
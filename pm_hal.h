@@ -0,0 +1,129 @@
+#ifndef PM_HAL_H
+#define PM_HAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Platform layer under pm_core.c. power_monitor.c implements it on the RP2040
+ * (core 1 sampler, XIP flash, USB CDC); host/hal_host.c implements it on Linux
+ * against simulated I2C devices, a RAM flash and a byte stream, so the firmware
+ * logic builds and runs natively. Responses are written with stdio on both.
+ */
+
+// ---- time ----
+uint64_t hal_time_us64(void);
+uint32_t hal_time_us32(void);
+void     hal_idle(void);                 // nothing to do for a moment (busy-poll hint)
+
+// ---- host link (USB CDC) ----
+int      hal_getchar(void);              // next input byte, or -1 if none is waiting
+
+// ---- I2C, core 0, before the sampler takes the bus ----
+int      hal_i2c_write16(uint8_t addr, uint8_t reg, uint16_t val); // 0 on success
+
+// ---- settings flash: two sector-sized slots, readable in place ----
+#define HAL_FLASH_PAGE_SIZE 256u
+const uint8_t *hal_flash_slot(int slot); // slot 1 is also where v1-v3 firmware kept its settings
+int      hal_flash_write_slot(int slot, const uint8_t *data, size_t len); // erase + program whole pages; 0 on success
+
+// ---- sampler ----
+// Polls the INA226 for finished conversions and queues them with their time.
+typedef struct {
+    uint64_t t_us;   // time the conversion-ready flag was observed
+    uint16_t bus;
+    int16_t  cur;
+    uint16_t pwr;
+    uint16_t mask;
+} raw_sample_t;
+
+// ALERT pin edges, timestamped as they happen.
+typedef struct {
+    uint64_t t_us;
+    uint8_t  asserted;
+} alert_edge_t;
+
+// Latency histogram: bucket k counts durations in [2^k, 2^(k+1)) us (bucket 0
+// also takes 0); the last one takes everything longer. Recording is a few
+// shifts and adds, inlined so the RP2040 sampler can use it from RAM.
+#define DIAG_BUCKETS 16
+
+typedef struct {
+    uint32_t n;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t bucket[DIAG_BUCKETS];
+} diag_hist_t;
+
+static inline __attribute__((always_inline)) void diag_hist_add(diag_hist_t *h, uint32_t us) {
+    uint32_t k = 0;
+    for (uint32_t x = us >> 1; x && k < DIAG_BUCKETS - 1; x >>= 1) k++;
+    h->bucket[k]++;
+    h->n++;
+    h->sum_us += us;
+    if (us > h->max_us) h->max_us = us;
+}
+
+typedef struct {
+    uint32_t ring_dropped;   // samples lost because core 0 fell behind
+    uint32_t alert_dropped;
+    uint32_t i2c_errors;
+    uint32_t i2c_nak;        // transactions aborted (NAK, arbitration)
+    uint32_t i2c_timeout;    // transactions that never finished
+    uint32_t i2c_retries;    // conversions read only after a failed attempt
+    const diag_hist_t *i2c_us;
+} hal_sampler_stats_t;
+
+void     hal_sampler_start(uint32_t period_us);       // nominal conversion period
+int      hal_sampler_pop(raw_sample_t *s);             // 1 if a sample was dequeued
+int      hal_sampler_write_reg(uint8_t reg, uint16_t val); // queued between conversions; -1 if full
+int      hal_alert_pop(uint64_t upto_us, alert_edge_t *e); // 1 if an edge at or before upto_us was dequeued
+void     hal_alert_flush(void);                        // drop queued edges
+void     hal_sampler_stats(hal_sampler_stats_t *st);
+
+// ---- memory ----
+// High-water marks for {"get":"diag"}, in bytes; a size of 0 means the
+// platform cannot tell.
+typedef struct {
+    uint32_t stack0_size, stack0_peak; // core 0: main loop and protocol
+    uint32_t stack1_size, stack1_peak; // core 1: sampler
+    uint32_t heap_size;                // room malloc can grow into
+    uint32_t heap_used;                // allocated now
+    uint32_t heap_peak;                // taken from the system so far
+} hal_mem_stats_t;
+
+void     hal_mem_stats(hal_mem_stats_t *m);
+
+// ---- tracing (PM_TRACE builds) ----
+typedef enum {
+    TR_READ_JSON = 0,   // first byte of a request to its closing brace
+    TR_REQUEST,         // complete request to the end of its handling
+    TR_PARSE_GET, TR_PARSE_SET,
+    TR_FORMAT,          // response built with the resp_* snprintf chain
+    TR_USB_WRITE,
+    TR_SETTINGS_SAVE,
+    TR_SAMPLER_POLL,    // core 0 draining the sample ring
+    TR_INA_MASK, TR_INA_BUS, TR_INA_CURRENT, TR_INA_POWER, TR_INA_WRITE, // sampler register transactions
+    TR_COUNT
+} trace_id_t;
+
+#define TRACE_END_BIT  (1u << 30)
+
+// ---- benchmarks (PM_BENCH builds) ----
+// Free-running cycle counter for {"bench":N}: counts up at hal_cycles_hz(),
+// modulo HAL_CYCLES_MASK + 1 (the RP2040's 24-bit SysTick).
+#define HAL_CYCLES_MASK 0x00FFFFFFu
+uint32_t hal_cycles(void);
+uint32_t hal_cycles_hz(void);
+
+#ifdef PM_TRACE
+void hal_trace_event(uint32_t id, uint32_t end);
+void hal_trace_dump(void);               // answers {"trace":"dump"}
+#define TRACE_BEGIN(id) hal_trace_event((id), 0)
+#define TRACE_END(id)   hal_trace_event((id), TRACE_END_BIT)
+#else
+#define TRACE_BEGIN(id) ((void)0)
+#define TRACE_END(id)   ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+"""Read the latest state of a monitor from pmd's shared-memory export.
+
+pmd (host/pmd) maps DIR/<name>.shm next to each device socket; the layout and
+its seqlock are described in host/pm_shm.h. A read here is a memory copy and
+a struct unpack: no syscalls, no socket round trip, no serial port.
+
+  ./pm_shm.py $XDG_RUNTIME_DIR/power_monitor/E6614C311B.shm          # one snapshot as JSON
+  ./pm_shm.py FILE --watch 1                                          # one line per second
+  ./pm_shm.py FILE --bench 3 --procs 8                                # reads/s, 8 reader processes
+
+As a library:
+  from pm_shm import ShmReader
+  snap = ShmReader(path).read()
+  print(snap.v, snap.soc, snap.sample_age_s())
+"""
+
+from __future__ import annotations
+
+import argparse
+import json
+import math
+import mmap
+import multiprocessing
+import struct
+import sys
+import time
+from dataclasses import asdict, dataclass
+
+MAGIC = 0x314D4850
+VERSION = 1
+LAYOUT = struct.Struct("<6IQ2I3Q3dQ7d3Q")  # pm_shm_t, 176 bytes
+SEQ = struct.Struct("<I")
+SEQ_OFFSET = 12
+
+CONNECTED = 0x1
+HAVE_SAMPLE = 0x2
+HAVE_STATE = 0x4
+CHARGING = 0x8
+
+
+@dataclass
+class Snapshot:
+    magic: int
+    version: int
+    size: int
+    seq: int
+    flags: int
+    writer_pid: int
+    update_mono_us: int
+    sample_seq: int
+    reserved0: int
+    dev_t_us: int
+    sample_mono_us: int
+    sample_wall_us: int
+    v: float
+    a: float
+    w: float
+    state_mono_us: int
+    pct: float
+    soc: float
+    soc_sigma: float
+    avg_w: float
+    remaining_wh: float
+    hrs_remaining: float
+    hrs_to_full: float
+    samples: int
+    reconnects: int
+    timeouts: int
+
+    @property
+    def connected(self) -> bool:
+        return bool(self.flags & CONNECTED) and self.writer_pid != 0
+
+    @property
+    def charging(self) -> bool:
+        return bool(self.flags & CHARGING)
+
+    def sample_age_s(self) -> float:
+        """Seconds since pmd received the sample (CLOCK_MONOTONIC, as time.monotonic())."""
+        if not self.flags & HAVE_SAMPLE:
+            return math.inf
+        return time.monotonic() - self.sample_mono_us * 1e-6
+
+    def as_json(self) -> dict:
+        keep = ("sample_seq", "dev_t_us", "sample_wall_us", "v", "a", "w", "pct", "soc", "soc_sigma",
+                "avg_w", "remaining_wh", "hrs_remaining", "hrs_to_full", "samples", "reconnects", "timeouts")
+        out = {k: v for k, v in asdict(self).items() if k in keep}
+        for k, v in out.items():
+            if isinstance(v, float) and math.isnan(v):
+                out[k] = None
+        out["connected"] = self.connected
+        out["charging"] = self.charging if self.flags & HAVE_STATE else None
+        out["sample_age_s"] = round(self.sample_age_s(), 3) if self.flags & HAVE_SAMPLE else None
+        return out
+
+
+class ShmReader:
+    def __init__(self, path: str):
+        with open(path, "rb") as f:
+            self._map = mmap.mmap(f.fileno(), LAYOUT.size, access=mmap.ACCESS_READ)
+        magic, version, size = struct.unpack_from("<3I", self._map, 0)
+        if (magic, version, size) != (MAGIC, VERSION, LAYOUT.size):
+            self._map.close()
+            raise ValueError(f"{path}: not a pmd export (version {VERSION})")
+
+    def read_raw(self) -> tuple:
+        """One consistent copy of the block as a tuple in LAYOUT order."""
+        m = self._map
+        while True:
+            s0 = SEQ.unpack_from(m, SEQ_OFFSET)[0]
+            if s0 & 1:
+                continue
+            data = m[: LAYOUT.size]
+            if SEQ.unpack_from(m, SEQ_OFFSET)[0] == s0:
+                return LAYOUT.unpack(data)
+
+    def read(self) -> Snapshot:
+        return Snapshot(*self.read_raw())
+
+    def close(self) -> None:
+        self._map.close()
+
+
+def _bench_proc(path: str, seconds: float, out) -> None:
+    r = ShmReader(path)
+    n = 0
+    until = time.monotonic() + seconds
+    while True:
+        for _ in range(1000):
+            r.read_raw()
+        n += 1000
+        if time.monotonic() >= until:
+            break
+    out.put(n)
+
+
+def bench(path: str, seconds: float, procs: int) -> None:
+    q = multiprocessing.Queue()
+    ps = [multiprocessing.Process(target=_bench_proc, args=(path, seconds, q)) for _ in range(procs)]
+    t0 = time.monotonic()
+    for p in ps:
+        p.start()
+    total = sum(q.get() for _ in ps)
+    for p in ps:
+        p.join()
+    dt = time.monotonic() - t0
+    print(f"readers={procs} reads={total} reads_per_s={total / dt:.0f} "
+          f"per_reader={total / dt / procs:.0f} us_per_read={1e6 * dt * procs / total:.2f}")
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("path", help="DIR/<name>.shm written by pmd")
+    ap.add_argument("--watch", type=float, metavar="S", help="print a snapshot every S seconds")
+    ap.add_argument("--bench", type=float, metavar="S", help="measure reads/s for S seconds")
+    ap.add_argument("--procs", type=int, default=1, help="reader processes for --bench (default 1)")
+    args = ap.parse_args()
+
+    try:
+        reader = ShmReader(args.path)
+    except (OSError, ValueError) as e:
+        print(f"pm_shm: {e}", file=sys.stderr)
+        return 1
+    if args.bench:
+        bench(args.path, args.bench, max(1, args.procs))
+        return 0
+    try:
+        while True:
+            print(json.dumps(reader.read().as_json()), flush=True)
+            if not args.watch:
+                return 0
+            time.sleep(args.watch)
+    except KeyboardInterrupt:
+        return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,70 @@
+#!/usr/bin/env tclsh9.0
+
+# usage:
+# tclsh9.0 pm_shm.tcl [file.shm]
+# returns {"v":29.680,"a":0.3683,"w":10.9314,"pct":77.50,"charging":true}
+#
+# The same answer as power_mon.tcl, taken from pmd's shared-memory export
+# (host/pm_shm.h) instead of the serial port, so it works while pmd owns the
+# port and never waits on the device. Core Tcl cannot mmap, so each read is a
+# read of the file (on tmpfs under $XDG_RUNTIME_DIR); the seqlock is checked by
+# reading the sequence number again after the block.
+
+
+
+proc pm_shm_default {} {
+  if {[info exists ::env(XDG_RUNTIME_DIR)] && $::env(XDG_RUNTIME_DIR) ne ""} {
+    set dir $::env(XDG_RUNTIME_DIR)/power_monitor
+  } else {
+    set dir /tmp/power_monitor-[exec id -u]
+  }
+  return [lindex [lsort [glob -nocomplain $dir/*.shm]] 0]
+}
+
+# One consistent snapshot as a dict, or an error if the file is not an export.
+proc pm_shm_read {path} {
+  set fd [open $path rb]
+  try {
+    while 1 {
+      seek $fd 0
+      set data [read $fd 176]
+      seek $fd 12
+      binary scan [read $fd 4] iu seq
+      if {[string length $data] != 176} { error "$path: not a pmd export" }
+      binary scan $data iu6wuiu2wu3q3wuq7wu3 \
+          head update_mono_us sample_ids dev_times vaw state_mono_us state counters
+      lassign $head magic version size seq0 flags writer_pid
+      if {$magic != 0x314d4850 || $version != 1 || $size != 176} { error "$path: not a pmd export" }
+      if {!($seq0 & 1) && $seq0 == $seq} { break }
+    }
+  } finally {
+    close $fd
+  }
+  lassign $vaw v a w
+  lassign $state pct soc soc_sigma avg_w remaining_wh hrs_remaining hrs_to_full
+  return [dict create flags $flags writer_pid $writer_pid sample_seq [lindex $sample_ids 0] \
+      t_us [lindex $dev_times 0] v $v a $a w $w pct $pct soc $soc charging [expr {($flags & 8) != 0}] \
+      connected [expr {($flags & 1) && $writer_pid}] have_sample [expr {($flags & 2) != 0}] \
+      have_state [expr {($flags & 4) != 0}]]
+}
+
+if {[info exists argv0] && [file tail $argv0] eq [file tail [info script]]} {
+  set path [expr {$argc > 0 ? [lindex $argv 0] : [pm_shm_default]}]
+  if {$path eq ""} {
+    puts stderr "no pmd export found (is pmd running?)"
+    exit 1
+  }
+  set s [pm_shm_read $path]
+  if {![dict get $s connected] || ![dict get $s have_sample]} {
+    puts stderr "pmd has no current reading from the device"
+    exit 1
+  }
+  set pct null
+  set chg null
+  if {[dict get $s have_state]} {
+    set pct [format %.2f [dict get $s pct]]
+    set chg [expr {[dict get $s charging] ? "true" : "false"}]
+  }
+  puts [format {{"v":%.3f,"a":%.4f,"w":%.4f,"pct":%s,"charging":%s}} \
+      [dict get $s v] [dict get $s a] [dict get $s w] $pct $chg]
+}
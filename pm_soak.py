@@ -0,0 +1,574 @@
+#!/usr/bin/env python3
+"""Soak and stress test a power monitor (or a power_monitor_host --pty mock).
+
+Sends randomized traffic for hours: GETs of random field sets, "all", SETs
+jittered around the unit's own settings, stream on/off, clock syncs and
+malformed objects, and reopens the port every so often. Every response is
+checked against its request. Each summary period it reads {"get":"diag"} and
+prints one line with the period's latency percentiles and their drift from
+the first period, errors, lost stream samples, device-side drops, flash
+writes and the stack and heap high-water marks.
+
+  ./pm_soak.py --port /dev/serial/by-id/usb-Homebase_power_monitor_XXXX-if00 --duration 8h
+  ./pm_soak.py --port /tmp/pm0 --duration 10m --summary-every 30 --log soak.jsonl --json soak.json
+
+The run ends with a report and a verdict (exit 1 on failure). The
+settings are restored and committed on the way out, Ctrl-C included.
+"""
+
+from __future__ import annotations
+
+import argparse
+import json
+import math
+import random
+import sys
+import time
+from collections import Counter
+from dataclasses import dataclass, field
+
+# request kinds and default weights; "bad" is a malformed object
+KINDS = ("get", "all", "set", "stream", "sync", "bad")
+DEFAULT_MIX = "get:50,all:10,set:8,stream:4,sync:4,bad:12"
+CONFIG_FIELDS = ["min_v", "max_v", "hrs_capacity", "chg_threshold_a"]
+CONFIG_DECIMALS = {"min_v": 3, "max_v": 3, "hrs_capacity": 1, "chg_threshold_a": 3}  # as the SET reply prints them
+SENSOR_ERRORS = ("i2c_read", "ina226_not_found")
+# diag counters tracked per period (as deltas)
+DIAG_COUNTERS = ("requests", "bad_requests", "ring_dropped", "missed_conv", "alert_dropped",
+                 "i2c_errors", "flash_writes", "flash_fail")
+STACK_MARGIN = 0.9  # a stack past this fraction of its size fails the run
+
+
+def parse_duration(text: str) -> float:
+    """"90", "90s", "15m", "8h" -> seconds."""
+    units = {"s": 1, "m": 60, "h": 3600}
+    scale = units.get(text[-1:], None)
+    value = float(text[:-1] if scale else text)
+    if value <= 0:
+        raise ValueError
+    return value * (scale or 1)
+
+
+def parse_mix(spec: str) -> dict[str, int]:
+    mix = {}
+    for part in spec.split(","):
+        kind, _, weight = part.strip().partition(":")
+        if kind not in KINDS:
+            raise ValueError(f"unknown kind {kind!r} (one of {', '.join(KINDS)})")
+        mix[kind] = int(weight) if weight else 1
+        if mix[kind] < 0:
+            raise ValueError(f"negative weight for {kind}")
+    if not any(mix.values()):
+        raise ValueError("all weights are 0")
+    return mix
+
+
+def percentile(sorted_vals: list[float], p: float) -> float:
+    return sorted_vals[max(0, math.ceil(p / 100.0 * len(sorted_vals)) - 1)]
+
+
+def lat_summary(vals: list[float]) -> dict | None:
+    if not vals:
+        return None
+    s = sorted(vals)
+    return {"n": len(s), "p50": round(percentile(s, 50)), "p90": round(percentile(s, 90)),
+            "p99": round(percentile(s, 99)), "max": round(s[-1])}
+
+
+def malformed(rng: random.Random) -> bytes:
+    """An object the firmware must reject, or junk it must skip, without losing sync.
+
+    Every case keeps braces balanced outside strings and quotes paired, so the
+    reader is back between objects when it ends; the sentinel after it checks that.
+    """
+    cases = [
+        b'{"get":[}',
+        b'{"get":["v",}',
+        b'{}',
+        b'{"a":{"b":{"c":{}}}}',
+        b'{"get":["soak_no_such_field"]}',
+        b'{"get":["v"],"set":{"min_v":21}}',
+        b'{"set":{"min_v":"abc"}}',
+        b'{"set":{"max_v":1e999}}',
+        b'{"set":{"hrs_capacity":-5}}',
+        b'{"stream":-1}',
+        b'{"sync":{"host_us":"x"}}',
+        b'{"get":"' + b"x" * rng.randint(1024, 1500) + b'"}',  # request_too_long
+        b"\r\n\x00junk outside any object\x7f\xff\r\n",
+    ]
+    if rng.random() < 0.3:
+        # random bytes with no braces or quotes, then a GET with its letters
+        # and digits scrambled (a SET could come out valid and change settings)
+        junk = bytes(b for b in rng.randbytes(rng.randint(1, 48)) if b not in b'{}"\\')
+        req = bytearray(b'{"get":["v","a","pct","min_v","t_us"]}')
+        for _ in range(rng.randint(1, 4)):
+            k = rng.randrange(len(req))
+            if chr(req[k]).isalnum():
+                req[k] = rng.choice(b"abcxyz0129.-e")
+        return junk + bytes(req)
+    return rng.choice(cases)
+
+
+@dataclass
+class Period:
+    """What happened since the last summary."""
+
+    latencies: dict[str, list[float]] = field(default_factory=dict)
+    sent: Counter = field(default_factory=Counter)
+    errors: Counter = field(default_factory=Counter)  # failures of the tool's checks, by cause
+    error_codes: Counter = field(default_factory=Counter)  # expected {"error":...} replies to "bad"
+    events: Counter = field(default_factory=Counter)
+    lost_samples: int = 0
+    reconnects: int = 0
+
+
+class Soak:
+    def __init__(self, args: argparse.Namespace) -> None:
+        from flash_and_test import Device, drain_input
+
+        self.Device = Device
+        self.drain_input = drain_input
+        self.args = args
+        self.rng = random.Random(args.seed)
+        self.mix = parse_mix(args.mix)
+        self.kinds = [k for k in self.mix if self.mix[k]]
+        self.weights = [self.mix[k] for k in self.kinds]
+        self.dev = None
+        self.fields: list[str] = []
+        self.settings: dict[str, float] = {}
+        self.stream_every = 0
+        self.last_seq: int | None = None
+        self.period = Period()
+        self.total = Period()
+        self.history: list[dict] = []
+        self.diag_first: dict | None = None
+        self.diag_prev: dict | None = None
+        self.reboots = 0
+        self.peaks = {"stack0_peak": 0, "stack1_peak": 0, "heap_used": 0, "heap_peak": 0}
+        self.sizes = {"stack0": 0, "stack1": 0}
+        self.last_summary = time.monotonic()
+        self.log_file = open(args.log, "a") if args.log else None
+
+    # ---- link ----
+    def open(self) -> None:
+        self.dev = self.Device(self.args.port, self.args.timeout, settle_s=0.2)
+        self.last_seq = None  # samples sent while closed were dropped on purpose
+
+    def reconnect(self) -> None:
+        self.dev.close()
+        time.sleep(self.rng.uniform(0.1, 1.0))
+        deadline = time.monotonic() + max(10.0, self.args.timeout * 3)
+        while True:
+            try:
+                self.open()
+                break
+            except OSError:
+                if time.monotonic() > deadline:
+                    raise
+                time.sleep(0.5)
+        self.period.reconnects += 1
+
+    def note_error(self, cause: str, detail: str) -> None:
+        self.period.errors[cause] += 1
+        if self.args.verbose or self.period.errors[cause] <= 3:
+            print(f"  {cause}: {detail}", file=sys.stderr)
+
+    def on_event(self, msg: dict) -> None:
+        kind = str(msg.get("event"))
+        self.period.events[kind] += 1
+        if kind != "sample" or "seq" not in msg:
+            return
+        seq = int(msg["seq"])
+        if self.last_seq is not None and self.stream_every:
+            gap = seq - self.last_seq
+            if gap > self.stream_every:
+                self.period.lost_samples += gap // self.stream_every - 1
+        self.last_seq = seq
+
+    def exchange(self, payload: bytes, done) -> tuple[list[dict], float | None]:
+        """Write payload and read responses until done(resp) is true.
+
+        Returns the responses and the round trip to the last one in us, or
+        None on a timeout (after draining whatever comes late).
+        """
+        ser = self.dev.ser
+        t0 = time.perf_counter_ns()
+        ser.write(payload)
+        ser.flush()
+        responses = []
+        deadline = time.monotonic() + self.args.timeout
+        while time.monotonic() < deadline:
+            raw = ser.readline()
+            if not raw:
+                break
+            line = raw.decode("utf-8", errors="replace").strip()
+            if not line:
+                continue
+            if self.args.verbose:
+                print(f"  RECV {line}")
+            try:
+                msg = json.loads(line)
+            except json.JSONDecodeError:
+                self.note_error("bad_json", line[:120])
+                continue
+            if not isinstance(msg, dict):
+                self.note_error("bad_json", line[:120])
+                continue
+            if "event" in msg:
+                self.on_event(msg)
+                continue
+            responses.append(msg)
+            if done(msg):
+                return responses, (time.perf_counter_ns() - t0) / 1000.0
+        self.drain_input(ser, 0.0)
+        return responses, None
+
+    def request(self, kind: str, req: dict) -> dict | None:
+        if self.args.verbose:
+            print(f"  SEND {json.dumps(req)}")
+        resps, lat = self.exchange(json.dumps(req, separators=(",", ":")).encode(), lambda r: True)
+        self.period.sent[kind] += 1
+        if lat is None:
+            self.note_error("timeout", f"{kind} {json.dumps(req)[:80]}")
+            return None
+        self.period.latencies.setdefault(kind, []).append(lat)
+        return resps[-1]
+
+    # ---- traffic ----
+    def check_get(self, kind: str, req: dict, resp: dict | None, keys: list[str]) -> None:
+        if resp is None:
+            return
+        if resp.get("error") in SENSOR_ERRORS:
+            self.period.errors["sensor"] += 1
+            return
+        missing = [k for k in keys if k not in resp]
+        if "error" in resp or missing:
+            self.note_error("bad_response", f"{json.dumps(req)} -> {json.dumps(resp)[:160]}")
+
+    def do_get(self) -> None:
+        keys = self.rng.sample(self.fields, self.rng.randint(1, min(6, len(self.fields))))
+        req = {"get": keys[0] if len(keys) == 1 and self.rng.random() < 0.3 else keys}
+        self.check_get("get", req, self.request("get", req), keys)
+
+    def do_all(self) -> None:
+        self.check_get("all", {"get": "all"}, self.request("all", {"get": "all"}), ["v", "min_v", "fw"])
+
+    def do_set(self) -> None:
+        vals = {}
+        for k in self.rng.sample(CONFIG_FIELDS, self.rng.randint(1, len(CONFIG_FIELDS))):
+            vals[k] = round(self.settings[k] * self.rng.uniform(0.99, 1.01), CONFIG_DECIMALS[k])
+        lo, hi = vals.get("min_v", self.settings["min_v"]), vals.get("max_v", self.settings["max_v"])
+        if lo >= hi:
+            vals.pop("min_v", None)
+            vals.pop("max_v", None)
+            vals.setdefault("hrs_capacity", self.settings["hrs_capacity"])
+        req = {"set": vals}
+        resp = self.request("set", req)
+        if resp is None:
+            return
+        bad = not resp.get("ok") or any(abs(resp.get(k, math.inf) - v) > 10 ** -CONFIG_DECIMALS[k] / 2 for k, v in vals.items())
+        if bad:
+            self.note_error("bad_response", f"{json.dumps(req)} -> {json.dumps(resp)[:160]}")
+
+    def do_stream(self) -> None:
+        every = 0 if self.stream_every else self.rng.randint(1, 20)
+        resp = self.request("stream", {"stream": every})
+        if resp is None:
+            return
+        if not resp.get("ok") or resp.get("stream") != every:
+            self.note_error("bad_response", f"stream {every} -> {json.dumps(resp)[:160]}")
+            return
+        self.stream_every = every
+        self.last_seq = resp.get("seq") if every else None
+
+    def do_sync(self) -> None:
+        host_us = time.time_ns() // 1000
+        resp = self.request("sync", {"sync": {"host_us": host_us}})
+        if resp is not None and (resp.get("host_us") != host_us or "dev_us" not in resp):
+            self.note_error("bad_response", f"sync -> {json.dumps(resp)[:160]}")
+
+    def do_bad(self) -> None:
+        # a sync after the object, with its own host_us, marks where its
+        # replies end (the firmware may not answer junk at all)
+        blob = malformed(self.rng)
+        host_us = time.time_ns() // 1000
+        sentinel = json.dumps({"sync": {"host_us": host_us}}, separators=(",", ":")).encode()
+        if self.args.verbose:
+            print(f"  SEND {blob[:80]!r} + {sentinel.decode()}")
+        resps, lat = self.exchange(blob + sentinel, lambda r: r.get("host_us") == host_us)
+        self.period.sent["bad"] += 1
+        if lat is None:
+            self.note_error("desync", f"no reply to the sync after {blob[:60]!r}")
+            return
+        self.period.latencies.setdefault("bad", []).append(lat)
+        for r in resps[:-1]:
+            self.period.error_codes[str(r.get("error", "no_error"))] += 1
+
+    # ---- diag and summaries ----
+    def read_diag(self) -> dict | None:
+        resp = self.request("diag", {"get": "diag"})
+        if resp is None or not isinstance(resp.get("diag"), dict):
+            if resp is not None:
+                self.note_error("bad_response", f"diag -> {json.dumps(resp)[:160]}")
+            return None
+        diag = resp["diag"]
+        if self.diag_prev and diag.get("uptime_us", 0) < self.diag_prev.get("uptime_us", 0):
+            self.reboots += 1
+            print("  device rebooted (uptime went back)", file=sys.stderr)
+            self.diag_prev = None
+        for k in self.peaks:
+            self.peaks[k] = max(self.peaks[k], int(diag.get(k, 0)))
+        self.sizes = {"stack0": int(diag.get("stack0_size", 0)), "stack1": int(diag.get("stack1_size", 0))}
+        return diag
+
+    def summarize(self, elapsed: float) -> None:
+        now = time.monotonic()
+        period_s, self.last_summary = now - self.last_summary, now
+        diag = self.read_diag()
+        p = self.period
+        n = sum(p.sent.values())
+        lat_all = [x for k, v in p.latencies.items() if k not in ("bad", "diag") for x in v]
+        entry = {
+            "t_s": round(elapsed, 1),
+            "requests": n,
+            "rps": round(n / period_s, 1) if period_s > 0 else 0.0,
+            "latency_us": lat_summary(lat_all),
+            "kinds": {k: lat_summary(v) for k, v in p.latencies.items()},
+            "errors": dict(p.errors),
+            "bad_replies": dict(p.error_codes),
+            "events": dict(p.events),
+            "lost_samples": p.lost_samples,
+            "reconnects": p.reconnects,
+        }
+        if diag is not None:
+            prev = self.diag_prev or {}
+            entry["device"] = {k: int(diag.get(k, 0)) - int(prev.get(k, 0)) for k in DIAG_COUNTERS}
+            entry["mem"] = {k: int(diag.get(k, 0)) for k in
+                            ("stack0_peak", "stack0_size", "stack1_peak", "stack1_size", "heap_used", "heap_peak")}
+            entry["uptime_us"] = int(diag.get("uptime_us", 0))
+            if self.diag_first is None:
+                self.diag_first = diag
+            self.diag_prev = diag
+        self.history.append(entry)
+        if self.log_file:
+            self.log_file.write(json.dumps(entry, separators=(",", ":")) + "\n")
+            self.log_file.flush()
+        self.print_period(entry)
+
+        for k, v in p.latencies.items():
+            self.total.latencies.setdefault(k, []).extend(v)
+        self.total.sent.update(p.sent)
+        self.total.errors.update(p.errors)
+        self.total.error_codes.update(p.error_codes)
+        self.total.events.update(p.events)
+        self.total.lost_samples += p.lost_samples
+        self.total.reconnects += p.reconnects
+        self.period = Period()
+
+    def print_period(self, e: dict) -> None:
+        h, rem = divmod(int(e["t_s"]), 3600)
+        line = f"[{h:02d}:{rem // 60:02d}:{rem % 60:02d}] {e['requests']} req ({e['rps']:.0f}/s)"
+        lat = e["latency_us"]
+        if lat:
+            base = self.history[0]["latency_us"] or lat
+            drift = (lat["p50"] - base["p50"]) / base["p50"] * 100 if base["p50"] else 0.0
+            line += f" p50 {lat['p50']} us ({drift:+.0f}%) p99 {lat['p99']} max {lat['max']}"
+        errs = sum(e["errors"].values())
+        line += f" | errors {errs}" + (f" {dict(e['errors'])}" if errs else "")
+        line += f" lost {e['lost_samples']} reconn {e['reconnects']}"
+        dev = e.get("device")
+        if dev:
+            line += (f" | dropped {dev['ring_dropped']}+{dev['missed_conv']} flash {dev['flash_writes']}"
+                     + (f" fail {dev['flash_fail']}" if dev["flash_fail"] else ""))
+            mem = e["mem"]
+            if mem["stack0_size"]:
+                line += f" stack {mem['stack0_peak']}/{mem['stack0_size']} {mem['stack1_peak']}/{mem['stack1_size']}"
+            line += f" heap {mem['heap_used']}"
+        print(line, flush=True)
+
+    # ---- run ----
+    def setup(self) -> None:
+        resp = self.request("setup", {"get": ["soak_no_such_field"]})
+        if not resp or "supported" not in resp:
+            raise RuntimeError(f"unexpected reply to an invalid GET: {resp}")
+        self.fields = [f for f in resp["supported"] if f != "diag"]
+        resp = self.request("setup", {"get": CONFIG_FIELDS + ["fw"]})
+        if not resp or any(k not in resp for k in CONFIG_FIELDS):
+            raise RuntimeError(f"could not read the settings: {resp}")
+        self.settings = {k: float(resp[k]) for k in CONFIG_FIELDS}
+        print(f"fw {resp.get('fw')}, {len(self.fields)} GET fields, settings {self.settings}")
+        self.period = Period()  # setup traffic is not part of the soak
+
+    def restore(self) -> None:
+        try:
+            if self.stream_every:
+                self.request("stream", {"stream": 0})
+            resp = self.request("restore", {"set": self.settings, "commit": True})
+            if not resp or not resp.get("ok"):
+                print(f"warning: settings restore failed: {resp}", file=sys.stderr)
+        except OSError as exc:
+            print(f"warning: settings restore failed: {exc}", file=sys.stderr)
+
+    def run(self) -> None:
+        args = self.args
+        actions = {"get": self.do_get, "all": self.do_all, "set": self.do_set,
+                   "stream": self.do_stream, "sync": self.do_sync, "bad": self.do_bad}
+        start = time.monotonic()
+        end = start + args.duration
+        next_summary = start + args.summary_every
+        next_reconnect = start + self.rng.uniform(0.5, 1.5) * args.reconnect_every if args.reconnect_every else math.inf
+        self.diag_prev = self.diag_first = self.read_diag()  # baseline for the first period's deltas
+        self.last_summary = start
+        while True:
+            now = time.monotonic()
+            if now >= next_summary or now >= end:
+                self.summarize(now - start)
+                next_summary = now + args.summary_every
+                if now >= end:
+                    break
+            if now >= next_reconnect:
+                self.reconnect()
+                next_reconnect = now + self.rng.uniform(0.5, 1.5) * args.reconnect_every
+            t0 = time.monotonic()
+            actions[self.rng.choices(self.kinds, self.weights)[0]]()
+            if args.rate:
+                time.sleep(max(0.0, 1.0 / args.rate - (time.monotonic() - t0)))
+
+    def report(self, elapsed: float) -> tuple[dict, list[str]]:
+        t = self.total
+        failures = []
+        if sum(t.errors.values()) - t.errors.get("sensor", 0):
+            failures.append(f"errors: {dict(t.errors)}")
+        if self.reboots:
+            failures.append(f"{self.reboots} device reboot(s)")
+        if t.lost_samples:
+            failures.append(f"{t.lost_samples} stream samples lost")
+        for core in ("stack0", "stack1"):
+            size = self.sizes.get(core, 0)
+            if size and self.peaks[f"{core}_peak"] >= size * STACK_MARGIN:
+                failures.append(f"{core} peak {self.peaks[f'{core}_peak']} of {size} bytes")
+        mems = [e["mem"] for e in self.history if "mem" in e]
+        if len(mems) >= 2 and mems[-1]["heap_used"] > mems[0]["heap_used"]:
+            failures.append(f"heap in use grew from {mems[0]['heap_used']} to {mems[-1]['heap_used']} bytes")
+        dev_total = {}
+        if self.diag_first and self.diag_prev and not self.reboots:
+            dev_total = {k: int(self.diag_prev.get(k, 0)) - int(self.diag_first.get(k, 0)) for k in DIAG_COUNTERS}
+            for k in ("ring_dropped", "missed_conv", "flash_fail"):
+                if dev_total.get(k):
+                    failures.append(f"device {k} +{dev_total[k]}")
+
+        # latency drift: least-squares slope of the per-period p50/p99 over time
+        drift = {}
+        pts = [(e["t_s"] / 3600.0, e["latency_us"]) for e in self.history if e["latency_us"]]
+        if len(pts) >= 3:
+            for q in ("p50", "p99"):
+                xs = [x for x, _ in pts]
+                ys = [lat[q] for _, lat in pts]
+                mx, my = sum(xs) / len(xs), sum(ys) / len(ys)
+                den = sum((x - mx) ** 2 for x in xs)
+                drift[f"{q}_us_per_h"] = round(sum((x - mx) * (y - my) for x, y in zip(xs, ys)) / den, 1) if den else 0.0
+
+        lat_all = [x for k, v in t.latencies.items() if k not in ("bad", "diag") for x in v]
+        report = {
+            "time": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+            "port": self.args.port,
+            "seed": self.args.seed,
+            "mix": self.args.mix,
+            "duration_s": round(elapsed, 1),
+            "requests": dict(t.sent),
+            "latency_us": lat_summary(lat_all),
+            "kinds": {k: lat_summary(v) for k, v in t.latencies.items()},
+            "latency_drift": drift,
+            "errors": dict(t.errors),
+            "bad_replies": dict(t.error_codes),
+            "events": dict(t.events),
+            "lost_samples": t.lost_samples,
+            "reconnects": t.reconnects,
+            "reboots": self.reboots,
+            "device": dev_total,
+            "mem_peaks": self.peaks,
+            "periods": len(self.history),
+            "pass": not failures,
+            "failures": failures,
+        }
+        return report, failures
+
+
+def print_report(report: dict) -> None:
+    print()
+    print(f"SOAK {report['duration_s'] / 3600:.2f} h on {report['port']}, seed {report['seed']}, "
+          f"{sum(report['requests'].values())} requests, {report['reconnects']} reconnects")
+    print(f"{'kind':<8} {'n':>9} {'p50 us':>8} {'p90 us':>8} {'p99 us':>8} {'max us':>9}")
+    for kind, s in sorted(report["kinds"].items()):
+        if s:
+            print(f"{kind:<8} {s['n']:>9} {s['p50']:>8} {s['p90']:>8} {s['p99']:>8} {s['max']:>9}")
+    if report["latency_drift"]:
+        print("latency drift: " + ", ".join(f"{k} {v:+g}" for k, v in report["latency_drift"].items()))
+    if report["bad_replies"]:
+        print("replies to malformed objects: " + ", ".join(f"{k}={v}" for k, v in sorted(report["bad_replies"].items())))
+    if report["device"]:
+        print("device: " + ", ".join(f"{k} +{v}" for k, v in report["device"].items()))
+    print("memory peaks: " + ", ".join(f"{k} {v}" for k, v in report["mem_peaks"].items()))
+    print(f"RESULT           {'PASS' if report['pass'] else 'FAIL'}")
+    for msg in report["failures"]:
+        print(f"  {msg}")
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description="Soak and stress test a power monitor over its serial port")
+    parser.add_argument("--port", required=True, help="Serial port (or the pty of power_monitor_host --pty)")
+    parser.add_argument("--duration", default="1h", help="How long to run: seconds, or with an s/m/h suffix")
+    parser.add_argument("--mix", default=DEFAULT_MIX, help=f"Weighted kinds out of {', '.join(KINDS)}")
+    parser.add_argument("--rate", type=float, default=0.0, help="Requests per second at most (default: as fast as it answers)")
+    parser.add_argument("--reconnect-every", type=float, default=300.0,
+                        help="Reopen the port about this often in seconds (randomized; 0: never)")
+    parser.add_argument("--summary-every", type=float, default=60.0, help="Seconds between summaries")
+    parser.add_argument("--seed", type=int, default=None, help="Random seed (default: from the clock)")
+    parser.add_argument("--timeout", type=float, default=2.0, help="Reply timeout in seconds")
+    parser.add_argument("--log", help="Append each summary as a JSON line to this file")
+    parser.add_argument("--json", help="Write the final report as JSON to this file")
+    parser.add_argument("--verbose", action="store_true", help="Print serial traffic")
+    args = parser.parse_args()
+    try:
+        args.duration = parse_duration(args.duration)
+        parse_mix(args.mix)
+    except ValueError as exc:
+        parser.error(f"{exc}" if str(exc) else f"bad --duration {args.duration!r}")
+    if args.seed is None:
+        args.seed = int(time.time())
+
+    soak = Soak(args)
+    try:
+        soak.open()
+        soak.setup()
+    except (OSError, RuntimeError) as exc:
+        print(f"error: {exc}", file=sys.stderr)
+        return 2
+    start = time.monotonic()
+    try:
+        try:
+            soak.run()
+        except KeyboardInterrupt:
+            print("interrupted", file=sys.stderr)
+            soak.drain_input(soak.dev.ser, 0.0)  # the reply to whatever was cut short
+            soak.summarize(time.monotonic() - start)
+        soak.restore()
+    except OSError as exc:
+        print(f"error: {exc}", file=sys.stderr)
+        soak.period.errors["port"] += 1
+        soak.total.errors.update(soak.period.errors)
+    finally:
+        if soak.dev is not None:
+            soak.dev.close()
+
+    report, _ = soak.report(time.monotonic() - start)
+    print_report(report)
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+            f.write("\n")
+    return 0 if report["pass"] else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""Fetch a PM_TRACE dump from the device and convert it to Chrome trace JSON.
+
+Firmware built with -DPM_TRACE=ON records begin/end events on both cores;
+{"trace":"dump"} returns them as a header line plus base64 chunks (see readme).
+Open the output in chrome://tracing or https://ui.perfetto.dev.
+
+  ./pm_trace.py --port /dev/serial/by-id/usb-Homebase_power_monitor_XXXX-if00 -o trace.json
+  ./pm_trace.py --port ... --save dump.jsonl     # keep the raw dump
+  ./pm_trace.py dump.jsonl -o trace.json         # convert a saved dump
+
+A per-span summary (count, mean, p99, max in microseconds) goes to stderr.
+"""
+
+from __future__ import annotations
+
+import argparse
+import base64
+import json
+import struct
+import sys
+from pathlib import Path
+
+CYC_MASK = 0xFFFFFF
+RESYNC_US = 2.0  # cycle-derived time may not stray further than this from the us timer
+CHAIN_MAX_US = 100_000  # SysTick wraps every 2^24 cycles (134 ms at 125 MHz)
+
+
+def fetch_dump(port: str, timeout: float, *, verbose: bool) -> list[dict]:
+    from flash_and_test import Device
+
+    dev = Device(port, timeout, settle_s=0.2)
+    try:
+        header = dev.query({"trace": "dump"}, verbose=verbose, retries=1)
+        if not header or "trace" not in header:
+            raise RuntimeError(f"unexpected reply: {header}")
+        lines = [header]
+        while len(lines) <= header["trace"]["chunks"]:
+            raw = dev.ser.readline().decode("utf-8", errors="replace").strip()
+            if not raw:
+                raise RuntimeError("dump ended early")
+            msg = json.loads(raw)
+            if "trace_data" in msg:
+                lines.append(msg)
+        return lines
+    finally:
+        dev.close()
+
+
+def load_dump(path: Path) -> list[dict]:
+    lines = []
+    for raw in path.read_text().splitlines():
+        raw = raw.strip()
+        if not raw:
+            continue
+        msg = json.loads(raw)
+        if "trace" in msg or "trace_data" in msg:
+            lines.append(msg)
+    if not lines or "trace" not in lines[0]:
+        raise ValueError(f"{path}: no trace header")
+    return lines
+
+
+def decode(lines: list[dict]) -> tuple[dict, dict[int, list[tuple[float, int, bool]]]]:
+    """Returns the header and, per core, (t_us, id, is_end) in recording order."""
+    header = lines[0]["trace"]
+    clk_mhz = header["clk_hz"] / 1e6
+    raw: dict[int, bytes] = {0: b"", 1: b""}
+    for msg in lines[1:]:
+        d = msg["trace_data"]
+        raw[d["core"]] += base64.b64decode(d["data"])
+
+    cores: dict[int, list[tuple[float, int, bool]]] = {}
+    for core, blob in raw.items():
+        events = []
+        prev = None  # (us unwrapped, cyc, t)
+        wraps = 0
+        for us, w in struct.iter_unpack("<II", blob):
+            cyc, ev_id, end = w & CYC_MASK, (w >> 24) & 0x3F, bool(w & (1 << 30))
+            if prev is not None and us + wraps < prev[0] - (1 << 31):
+                wraps += 1 << 32
+            us_abs = us + wraps
+            t = float(us_abs)
+            if prev is not None and 0 <= us_abs - prev[0] < CHAIN_MAX_US:
+                # SysTick counts down at clk_sys, so the cycles between events are exact
+                chained = prev[2] + ((prev[1] - cyc) & CYC_MASK) / clk_mhz
+                if abs(chained - us_abs) <= RESYNC_US:
+                    t = chained
+            events.append((t, ev_id, end))
+            prev = (us_abs, cyc, t)
+        cores[core] = events
+    return header, cores
+
+
+def to_chrome(header: dict, cores: dict[int, list[tuple[float, int, bool]]]) -> tuple[dict, dict[str, list[float]]]:
+    names = header["names"]
+    starts = [ev[0][0] for ev in cores.values() if ev]
+    t0 = min(starts) if starts else 0.0
+    out = [
+        {"name": "thread_name", "ph": "M", "pid": 0, "tid": core, "args": {"name": f"core{core}"}}
+        for core in cores
+    ]
+    spans: dict[str, list[float]] = {}
+    for core, events in cores.items():
+        open_at: dict[int, list[float]] = {}
+        for t, ev_id, end in events:
+            name = names[ev_id] if ev_id < len(names) else f"id{ev_id}"
+            if not end:
+                open_at.setdefault(ev_id, []).append(t)
+                continue
+            stack = open_at.get(ev_id)
+            if not stack:
+                continue  # its begin was overwritten in the ring
+            begin = stack.pop()
+            out.append({"name": name, "ph": "X", "pid": 0, "tid": core, "ts": begin - t0, "dur": t - begin})
+            spans.setdefault(name, []).append(t - begin)
+    out.sort(key=lambda e: e.get("ts", -1.0))
+    trace = {
+        "traceEvents": out,
+        "displayTimeUnit": "ns",
+        "otherData": {"clk_hz": header["clk_hz"], "lost": header["lost"]},
+    }
+    return trace, spans
+
+
+def print_summary(header: dict, spans: dict[str, list[float]]) -> None:
+    print(f"{'span':<20} {'count':>7} {'mean':>9} {'p99':>9} {'max':>9}  (us)", file=sys.stderr)
+    for name in header["names"]:
+        d = sorted(spans.get(name, []))
+        if not d:
+            continue
+        p99 = d[min(len(d) - 1, int(len(d) * 0.99))]
+        print(f"{name:<20} {len(d):>7} {sum(d) / len(d):>9.2f} {p99:>9.2f} {d[-1]:>9.2f}", file=sys.stderr)
+    if any(header["lost"]):
+        print(f"events overwritten before the dump: core0={header['lost'][0]} core1={header['lost'][1]}", file=sys.stderr)
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description="Convert a PM_TRACE dump to Chrome trace JSON")
+    parser.add_argument("dump", nargs="?", help="Saved dump (one JSON object per line)")
+    parser.add_argument("--port", help="Fetch the dump from this serial port instead")
+    parser.add_argument("--timeout", type=float, default=5.0, help="Serial read timeout in seconds")
+    parser.add_argument("--save", help="Also write the raw dump lines here")
+    parser.add_argument("-o", "--output", help="Chrome trace JSON (default: stdout)")
+    parser.add_argument("--verbose", action="store_true", help="Print serial traffic")
+    args = parser.parse_args()
+
+    if bool(args.dump) == bool(args.port):
+        parser.error("give either a dump file or --port")
+    try:
+        lines = fetch_dump(args.port, args.timeout, verbose=args.verbose) if args.port else load_dump(Path(args.dump))
+    except (OSError, ValueError, RuntimeError) as exc:
+        print(f"error: {exc}", file=sys.stderr)
+        return 1
+    if args.save:
+        Path(args.save).write_text("".join(json.dumps(m, separators=(",", ":")) + "\n" for m in lines))
+
+    header, cores = decode(lines)
+    trace, spans = to_chrome(header, cores)
+    text = json.dumps(trace)
+    if args.output:
+        Path(args.output).write_text(text)
+    else:
+        print(text)
+    print_summary(header, spans)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
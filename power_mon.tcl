@@ -1,7 +1,7 @@
 #!/usr/bin/env tclsh9.0
 
 # usage:
-# tclsh9.0 power_mon.tcl
+# tclsh9.0 power_mon.tcl [port]
 # returns {"v":29.680,"a":0.3683,"w":10.9314,"pct":77.50,"charging":true}
 
 
@@ -16,7 +16,11 @@ proc find_power_monitor {} {
   return ""
 }
 
-set port [find_power_monitor]
+if {$argc > 0} {
+  set port [lindex $argv 0]
+} else {
+  set port [find_power_monitor]
+}
 if {$port eq ""} {
   puts stderr "power_monitor not found under /dev/serial/by-id"
   exit 1
@@ -30,8 +34,10 @@ fconfigure $fd -buffering none -translation binary -blocking 1
 puts -nonewline $fd {{"get": ["v", "a", "w", "pct", "charging"]}}
 flush $fd
 
-# Read the response (single line)
-gets $fd response
+# Read the response (single line), skipping asynchronous {"event":...} lines
+while {[gets $fd response] >= 0} {
+  if {![string match {\{"event":*} $response]} { break }
+}
 
 # Close the connection
 close $fd
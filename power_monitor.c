@@ -1,422 +1,548 @@
+/*
+ * RP2040 platform layer (pm_hal.h) for the Waveshare RP2040-Zero: USB CDC
+ * stdio, XIP flash for settings, and the INA226 sampler on core 1. The
+ * protocol and estimators are in pm_core.c, which runs on core 0.
+ */
+#include <malloc.h>
 #include <stdio.h>
 #include <string.h>
-#include <ctype.h>
-#include <stdlib.h>
 
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/flash.h"
 #include "hardware/i2c.h"
 #include "hardware/flash.h"
 #include "hardware/sync.h"
-
-#ifndef FW_VERSION
-#define FW_VERSION "dev"
+#include "hardware/timer.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#if defined(PM_TRACE) || defined(PM_BENCH)
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
 #endif
 
-/*
- * USB CDC JSON protocol (single JSON object per request, no newline needed):
- * - Request must contain either:
- *     {"get":["v","a","w","pct","charging","min_v","max_v","hrs_capacity","hrs_remaining","fw","chg_threshold_a"]}
- *     or
- *     {"get":"all"} (equivalent to requesting every supported field)
- *   or
- *     {"set":{"min_v":<float>,"max_v":<float>,"hrs_capacity":<float>,"chg_threshold_a":<float>}}
- *   but not both in the same object.
- *   You can request or set only the fields you care about; a GET list may
- *   contain any subset of the supported keys, and SET may include any of
- *   min_v, max_v, hrs_capacity (one or more fields).
- * - Example responses:
- *     {"v":28.523,"a":0.1234,"w":3.5123,"pct":67.12,"charging":true,"hrs_remaining":5.0}
- *     {"ok":true,"min_v":21.000,"max_v":32.200,"hrs_capacity":10.0}
- * - Errors: {"error":"both_get_and_set"} | {"error":"bad_request"} | {"error":"i2c_read"} | {"error":"invalid_get_field","field":<str>,"supported":[...]}
- * - Notes:
- *     pct = 100 * clamp((v - min_v)/(max_v - min_v), 0, 1)
- *     hrs_remaining = hrs_capacity * (pct / 100), rounded to 0.1 hr
- *     charging is true when (chg_threshold_a > 0 ? i >= chg_threshold_a : i <= chg_threshold_a)
- *     defaults if unset: min_v = 21.0, max_v = 32.2, hrs_capacity = 10.0, chg_threshold_a = -0.05
- */
+#include "pm_core.h"
+#include "pm_hal.h"
+#include "ina226.h"
+#include "ina226_alert.h"
 
 // ======= I2C / INA226 wiring (Waveshare RP2040-Zero) =======
 #define I2C_INST       i2c0
+#define I2C_HW         i2c0_hw // register block used by the RAM-resident sampler
 #define PIN_I2C_SDA    0
 #define PIN_I2C_SCL    1
 #define I2C_FREQ_HZ    100000  // 100 kHz; raise to 400k if you like
-
-// ======= INA226 register map & address =======
-#define INA226_REG_CONFIG   0x00
-#define INA226_REG_SHUNT    0x01
-#define INA226_REG_BUS      0x02
-#define INA226_REG_POWER    0x03
-#define INA226_REG_CURRENT  0x04
-#define INA226_REG_CAL      0x05
-#define INA226_ADDR         0x40   // default 7-bit address
+#define PIN_INA226_ALERT 2     // INA226 ALERT (open-drain, active low)
+
+// Hot-path trace (build with -DPM_TRACE=ON). Each core records begin/end
+// events into its own RAM ring, overwriting the oldest: 8 bytes holding the
+// microsecond timer and the core's SysTick, a 24-bit down-counter at clk_sys,
+// so the host can resolve intervals to the cycle. {"trace":"dump"} sends both
+// rings base64-encoded and restarts them; pm_trace.py turns a dump into Chrome
+// trace JSON. Without PM_TRACE the macros compile to nothing.
+#ifdef PM_TRACE
+#ifndef PM_TRACE_LEN
+#define PM_TRACE_LEN 256            // events per core, power of two
+#endif
+#define TRACE_CYC_MASK 0x00FFFFFFu
 
 typedef struct {
-    uint8_t addr;
-    float shunt_ohms;
-    float i_max;
-    float current_lsb; // A/LSB
-    float power_lsb;   // W/LSB
-} ina226_t;
+    uint32_t us;
+    uint32_t w;   // SysTick count | id << 24 | TRACE_END_BIT
+} trace_ev_t;
+
+static const char *k_trace_names[TR_COUNT] = {
+    "read_json_object", "request", "parse_get_request", "parse_set_request",
+    "format", "usb_write", "settings_save", "sampler_poll",
+    "ina226_mask", "ina226_bus", "ina226_current", "ina226_power", "ina226_write"
+};
+static trace_ev_t g_trace[2][PM_TRACE_LEN];
+static volatile uint32_t g_trace_head[2];
+static volatile int g_trace_on = 1;
+
+static inline __attribute__((always_inline)) void trace_event(uint32_t id, uint32_t end) {
+    if (!g_trace_on) return;
+    uint32_t core = sio_hw->cpuid;
+    uint32_t h = g_trace_head[core];
+    trace_ev_t *e = &g_trace[core][h & (PM_TRACE_LEN - 1)];
+    e->w = (systick_hw->cvr & TRACE_CYC_MASK) | (id << 24) | end;
+    e->us = timer_hw->timerawl;
+    g_trace_head[core] = h + 1;
+}
 
-// ======= Persistent settings in flash (last 4KB sector) =======
+// pm_core.c goes through the out-of-line copy; the sampler inlines it so core 1
+// never leaves RAM.
+void __not_in_flash_func(hal_trace_event)(uint32_t id, uint32_t end) {
+    trace_event(id, end);
+}
+#undef TRACE_BEGIN
+#undef TRACE_END
+#define TRACE_BEGIN(id) trace_event((id), 0)
+#define TRACE_END(id)   trace_event((id), TRACE_END_BIT)
+#endif
 
-#ifndef PICO_FLASH_SIZE_BYTES
-#warning "PICO_FLASH_SIZE_BYTES not defined; defaulting to 2MB"
-#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+#if defined(PM_TRACE) || defined(PM_BENCH)
+// Free-running 24-bit SysTick on the calling core (each core has its own).
+static void systick_start(void) {
+    systick_hw->rvr = 0x00FFFFFFu;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5; // processor clock, enabled, no interrupt
+}
 #endif
 
-#define SETTINGS_OFFSET_FROM_START  (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
-#define SETTINGS_XIP_BASE           (XIP_BASE + SETTINGS_OFFSET_FROM_START)
-
-#define SETTINGS_MAGIC   0x53544731u  // 'STG1'
-#define SETTINGS_VERSION 3
-
-typedef struct __attribute__((packed)) {
-    uint32_t magic;
-    uint32_t version;
-    float    min_v;
-    float    max_v;
-    float    hrs_capacity;
-    float    chg_threshold_a;
-    uint32_t magic_inv;   // ~magic for light corruption check
-} settings_t;
-
-typedef struct __attribute__((packed)) {
-    uint32_t magic;
-    uint32_t version;
-    float    min_v;
-    float    max_v;
-    float    hrs_capacity;
-    uint32_t magic_inv;   // ~magic for light corruption check
-} settings_v2_t;
-
-typedef struct __attribute__((packed)) {
-    uint32_t magic;
-    uint32_t version;
-    float    min_v;
-    float    max_v;
-    uint32_t magic_inv;
-} settings_v1_t;
-
-// defaults (used if nothing valid in flash yet)
-static float g_min_v = 21.0f;
-static float g_max_v = 32.2f;
-static float g_hrs_capacity = 10.0f;
-static float g_chg_threshold_a = -0.05f; // signed; sign encodes direction
-static int   g_ina_ok = 0;
-
-// Supported GET fields (also used for validation and the "all" shortcut)
-static const char *k_get_fields[] = {
-    "v", "a", "w", "pct", "charging",
-    "min_v", "max_v", "hrs_capacity", "hrs_remaining",
-    "fw", "chg_threshold_a"
-};
-static const size_t k_get_fields_count = sizeof(k_get_fields) / sizeof(k_get_fields[0]);
-
-static void settings_save(float min_v, float max_v, float hrs_capacity, float chg_threshold_a) {
-    settings_t s = {
-        .magic = SETTINGS_MAGIC,
-        .version = SETTINGS_VERSION,
-        .min_v = min_v,
-        .max_v = max_v,
-        .hrs_capacity = hrs_capacity,
-        .chg_threshold_a = chg_threshold_a,
-        .magic_inv = ~SETTINGS_MAGIC,
-    };
-    uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase(SETTINGS_OFFSET_FROM_START, FLASH_SECTOR_SIZE);
-    flash_range_program(SETTINGS_OFFSET_FROM_START, (const uint8_t *)&s, sizeof(s));
-    restore_interrupts(ints);
+#ifdef PM_BENCH
+// {"bench":N} runs on core 0; SysTick counts down, the HAL counter up.
+uint32_t hal_cycles(void) { return ~systick_hw->cvr & HAL_CYCLES_MASK; }
+uint32_t hal_cycles_hz(void) { return clock_get_hz(clk_sys); }
+#endif
+
+
+// ======= Sampler (core 1, runs entirely from RAM) =======
+/*
+ * Core 1 owns the INA226 once it is launched. It polls the conversion-ready
+ * flag, reads BUS/CURRENT/POWER and pushes raw register values into a
+ * single-producer ring that the main loop drains. Code, ring and stack are in
+ * RAM and it only touches peripheral registers, so it keeps running while core 0
+ * has XIP disabled for a flash erase. Keep it that way: no string literals,
+ * const tables, float math, division or SDK calls that are not static inline.
+ */
+#define SAMPLE_RING_LEN        64      // power of two
+#define SAMPLER_POLL_US        100     // CVRF re-poll interval once a conversion is due
+#define SAMPLER_EARLY_US       500     // wake this long before the expected conversion
+#define SAMPLER_I2C_TIMEOUT_US 2000
+#define REG_WRITE_RING_LEN     8       // power of two
+#define ALERT_RING_LEN         16      // power of two
+
+static raw_sample_t g_ring[SAMPLE_RING_LEN];
+static volatile uint32_t g_ring_head = 0;        // written by core 1 only
+static volatile uint32_t g_ring_tail = 0;        // written by core 0 only
+static volatile uint32_t g_ring_dropped = 0;     // core 1: samples lost to a full ring
+static volatile uint32_t g_sampler_i2c_errors = 0;
+static uint32_t g_sampler_period_us = 0;         // set before core 1 launches
+static volatile int g_sampler_ready = 0;         // core 1 finished its (flash-resident) setup
+
+// Register writes requested by core 0, applied by core 1 between conversions.
+typedef struct {
+    uint8_t  reg;
+    uint16_t val;
+} reg_write_t;
+
+static reg_write_t g_wr_ring[REG_WRITE_RING_LEN];
+static volatile uint32_t g_wr_head = 0;          // written by core 0 only
+static volatile uint32_t g_wr_tail = 0;          // written by core 1 only
+
+// ALERT pin edges timestamped by the core 1 GPIO interrupt.
+static alert_edge_t g_alert_ring[ALERT_RING_LEN];
+static volatile uint32_t g_alert_head = 0;       // written by core 1 ISR only
+static volatile uint32_t g_alert_tail = 0;       // written by core 0 only
+static volatile uint32_t g_alert_dropped = 0;
+
+static diag_hist_t g_diag_i2c_us;                 // one register transaction
+static volatile uint32_t g_diag_i2c_nak = 0;      // transactions aborted (NAK, arbitration)
+static volatile uint32_t g_diag_i2c_timeout = 0;  // transactions that never finished
+static volatile uint32_t g_diag_i2c_retries = 0;  // conversions read only after a failed attempt
+
+static inline __attribute__((always_inline)) uint32_t sampler_now32(void) { return timer_hw->timerawl; }
+
+static uint64_t __not_in_flash_func(sampler_now64)(void) {
+    uint32_t hi = timer_hw->timerawh;
+    for (;;) {
+        uint32_t lo = timer_hw->timerawl;
+        uint32_t hi2 = timer_hw->timerawh;
+        if (hi == hi2) return ((uint64_t)hi << 32) | lo;
+        hi = hi2;
+    }
 }
 
-static void settings_load_or_default(void) {
-    const settings_t *s = (const settings_t *)SETTINGS_XIP_BASE;
-    if (s->magic == SETTINGS_MAGIC && s->magic_inv == ~SETTINGS_MAGIC) {
-        if (s->version == SETTINGS_VERSION &&
-            s->max_v > s->min_v &&
-            s->max_v < 1000.0f && s->min_v > -100.0f &&
-            s->hrs_capacity > 0.0f && s->hrs_capacity < 10000.0f &&
-            s->chg_threshold_a != 0.0f &&
-            s->chg_threshold_a > -100.0f && s->chg_threshold_a < 100.0f) {
-            g_min_v = s->min_v;
-            g_max_v = s->max_v;
-            g_hrs_capacity = s->hrs_capacity;
-            g_chg_threshold_a = s->chg_threshold_a;
-            return;
-        }
-        if (s->version == 2) {
-            const settings_v2_t *v2 = (const settings_v2_t *)SETTINGS_XIP_BASE;
-            if (v2->max_v > v2->min_v &&
-                v2->max_v < 1000.0f && v2->min_v > -100.0f &&
-                v2->hrs_capacity > 0.0f && v2->hrs_capacity < 10000.0f) {
-                g_min_v = v2->min_v;
-                g_max_v = v2->max_v;
-                g_hrs_capacity = v2->hrs_capacity;
-                g_chg_threshold_a = -0.05f; // default for legacy settings
-                return;
-            }
-        }
-        if (s->version == 1) {
-            const settings_v1_t *v1 = (const settings_v1_t *)SETTINGS_XIP_BASE;
-            if (v1->max_v > v1->min_v &&
-                v1->max_v < 1000.0f && v1->min_v > -100.0f) {
-                g_min_v = v1->min_v;
-                g_max_v = v1->max_v;
-                g_hrs_capacity = 10.0f;
-                g_chg_threshold_a = -0.05f;
-            }
+// Register-level equivalent of i2c_write_blocking(reg, nostop) + i2c_read_blocking(2).
+static int __not_in_flash_func(sampler_i2c_r16)(uint8_t reg, uint16_t *out) {
+    i2c_hw_t *hw = I2C_HW;
+    uint32_t t0 = sampler_now32();
+    hw->enable = 0;
+    hw->tar = INA226_ADDR;
+    hw->enable = 1;
+    (void)hw->clr_tx_abrt;
+    hw->data_cmd = reg;
+    hw->data_cmd = I2C_IC_DATA_CMD_RESTART_BITS | I2C_IC_DATA_CMD_CMD_BITS;
+    hw->data_cmd = I2C_IC_DATA_CMD_CMD_BITS | I2C_IC_DATA_CMD_STOP_BITS;
+    while (hw->rxflr < 2) {
+        if (hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) {
+            (void)hw->clr_tx_abrt;
+            g_diag_i2c_nak++;
+            return -1;
         }
+        if (sampler_now32() - t0 > SAMPLER_I2C_TIMEOUT_US) { g_diag_i2c_timeout++; return -2; }
     }
-    // initialize sector with defaults so future loads are fast
-    settings_save(g_min_v, g_max_v, g_hrs_capacity, g_chg_threshold_a);
+    uint8_t hi = (uint8_t)hw->data_cmd;
+    uint8_t lo = (uint8_t)hw->data_cmd;
+    *out = ((uint16_t)hi << 8) | lo;
+    diag_hist_add(&g_diag_i2c_us, sampler_now32() - t0);
+    return 0;
 }
 
-// ======= I2C low-level helpers =======
-static int i2c_w16(uint8_t addr, uint8_t reg, uint16_t val) {
-    uint8_t buf[3] = { reg, (uint8_t)(val >> 8), (uint8_t)(val & 0xFF) };
-    int wrote = i2c_write_blocking(I2C_INST, addr, buf, 3, false);
-    return (wrote == 3) ? 0 : -1;
+static int __not_in_flash_func(sampler_i2c_w16)(uint8_t reg, uint16_t val) {
+    i2c_hw_t *hw = I2C_HW;
+    uint32_t t0 = sampler_now32();
+    hw->enable = 0;
+    hw->tar = INA226_ADDR;
+    hw->enable = 1;
+    (void)hw->clr_tx_abrt;
+    (void)hw->clr_stop_det;
+    hw->data_cmd = reg;
+    hw->data_cmd = (uint8_t)(val >> 8);
+    hw->data_cmd = (uint8_t)(val & 0xFF) | I2C_IC_DATA_CMD_STOP_BITS;
+    while (!(hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_STOP_DET_BITS)) {
+        if (sampler_now32() - t0 > SAMPLER_I2C_TIMEOUT_US) { g_diag_i2c_timeout++; return -2; }
+    }
+    (void)hw->clr_stop_det;
+    if (hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) {
+        (void)hw->clr_tx_abrt;
+        g_diag_i2c_nak++;
+        return -1;
+    }
+    diag_hist_add(&g_diag_i2c_us, sampler_now32() - t0);
+    return 0;
 }
-static int i2c_r1_then_r(uint8_t addr, const uint8_t *wbuf, size_t wn, uint8_t *rbuf, size_t rn) {
-    int w = i2c_write_blocking(I2C_INST, addr, wbuf, wn, true);  // repeated start
-    if (w != (int)wn) return -1;
-    int r = i2c_read_blocking(I2C_INST, addr, rbuf, rn, false);
-    return (r == (int)rn) ? 0 : -2;
+
+static inline __attribute__((always_inline)) int sampler_read_traced(uint32_t id, uint8_t reg, uint16_t *out) {
+    (void)id;
+    TRACE_BEGIN(id);
+    int rc = sampler_i2c_r16(reg, out);
+    TRACE_END(id);
+    return rc;
 }
-static int i2c_r16(uint8_t addr, uint8_t reg, uint16_t *out) {
-    uint8_t rreg = reg, b[2];
-    int rc = i2c_r1_then_r(addr, &rreg, 1, b, 2);
-    if (rc) return rc;
-    *out = ((uint16_t)b[0] << 8) | b[1];
-    return 0;
+
+// Apply register writes queued by core 0, in order.
+static void __not_in_flash_func(sampler_apply_writes)(void) {
+    while (g_wr_tail != g_wr_head) {
+        uint32_t tail = g_wr_tail;
+        __dmb();
+        const reg_write_t *w = &g_wr_ring[tail & (REG_WRITE_RING_LEN - 1)];
+        TRACE_BEGIN(TR_INA_WRITE);
+        if (sampler_i2c_w16(w->reg, w->val)) g_sampler_i2c_errors++;
+        TRACE_END(TR_INA_WRITE);
+        __dmb();
+        g_wr_tail = tail + 1;
+    }
 }
-static int i2c_rs16(uint8_t addr, uint8_t reg, int16_t *out) {
-    uint16_t u;
-    int rc = i2c_r16(addr, reg, &u);
-    if (rc) return rc;
-    *out = (u & 0x8000) ? (int16_t)(u - 0x10000) : (int16_t)u;
-    return 0;
+
+// IO_IRQ_BANK0 on core 1: timestamp every ALERT edge as it happens.
+static void __not_in_flash_func(alert_isr)(void) {
+    uint64_t t = sampler_now64();
+    const uint32_t reg = PIN_INA226_ALERT / 8, shift = 4 * (PIN_INA226_ALERT % 8);
+    uint32_t ev = (io_bank0_hw->proc1_irq_ctrl.ints[reg] >> shift) & 0xFu;
+    if (!ev) return;
+    io_bank0_hw->intr[reg] = ev << shift; // acknowledge the edge events
+    uint32_t head = g_alert_head;
+    if (head - g_alert_tail >= ALERT_RING_LEN) { g_alert_dropped++; return; }
+    alert_edge_t *e = &g_alert_ring[head & (ALERT_RING_LEN - 1)];
+    e->t_us = t;
+    e->asserted = !(sio_hw->gpio_in & (1u << PIN_INA226_ALERT));
+    __dmb();
+    g_alert_head = head + 1;
 }
 
-// ======= INA226 API =======
-static int ina226_init(ina226_t *dev, uint8_t addr, float shunt_ohms, float i_max) {
-    dev->addr = addr;
-    dev->shunt_ohms = shunt_ohms;
-    dev->i_max = i_max;
-    dev->current_lsb = i_max / 32768.0f;        // A/LSB
-    dev->power_lsb   = 25.0f * dev->current_lsb;// W/LSB
+// Flash-resident setup, run by core 1 before it starts sampling. The IRQ must
+// be enabled from core 1 so it is delivered there.
+static void sampler_core1_init(void) {
+#ifdef PM_TRACE
+    systick_start();
+#endif
+    gpio_init(PIN_INA226_ALERT);
+    gpio_set_dir(PIN_INA226_ALERT, GPIO_IN);
+    gpio_pull_up(PIN_INA226_ALERT);
+    irq_set_exclusive_handler(IO_IRQ_BANK0, alert_isr);
+    gpio_set_irq_enabled(PIN_INA226_ALERT, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
 
-    float fcal = 0.00512f / (dev->current_lsb * dev->shunt_ohms);
-    if (fcal < 1.0f || fcal > 65535.0f) return -10;
-    uint16_t cal = (uint16_t)(fcal + 0.5f);
-    if (i2c_w16(dev->addr, INA226_REG_CAL, cal)) return -11;
+static void __not_in_flash_func(sampler_core1_main)(void) {
+    sampler_core1_init();
+    __dmb();
+    g_sampler_ready = 1;
+
+    const uint32_t nominal = g_sampler_period_us;
+    uint32_t period = nominal;
+    uint64_t last_t = 0;
+    uint32_t due = sampler_now32();
+    int retry = 0; // a transaction failed since the last sample
+
+    for (;;) {
+        while ((int32_t)(sampler_now32() - due) < 0) {
+            if (g_wr_tail != g_wr_head) sampler_apply_writes();
+            tight_loop_contents();
+        }
 
-    // AVG=16, VBUSCT=1.1ms, VSHCT=1.1ms, MODE=111 (cont shunt+bus)
-    uint16_t config = (0b100u << 9) | (0b100u << 6) | (0b100u << 3) | 0b111u;
-    if (i2c_w16(dev->addr, INA226_REG_CONFIG, config)) return -12;
+        uint16_t mask;
+        TRACE_BEGIN(TR_INA_MASK);
+        int mask_rc = sampler_i2c_r16(INA226_REG_MASK, &mask);
+        TRACE_END(TR_INA_MASK);
+        if (mask_rc) {
+            g_sampler_i2c_errors++;
+            retry = 1;
+            due = sampler_now32() + SAMPLER_POLL_US;
+            continue;
+        }
+        if (!(mask & INA226_MASK_CVRF)) {
+            due = sampler_now32() + SAMPLER_POLL_US;
+            continue;
+        }
+        uint64_t t = sampler_now64();
+
+        uint16_t bus, cur, pwr;
+        if (sampler_read_traced(TR_INA_BUS, INA226_REG_BUS, &bus) ||
+            sampler_read_traced(TR_INA_CURRENT, INA226_REG_CURRENT, &cur) ||
+            sampler_read_traced(TR_INA_POWER, INA226_REG_POWER, &pwr)) {
+            g_sampler_i2c_errors++;
+            retry = 1;
+            due = sampler_now32() + SAMPLER_POLL_US;
+            continue;
+        }
 
-    return 0;
+        uint32_t head = g_ring_head;
+        if (head - g_ring_tail >= SAMPLE_RING_LEN) {
+            g_ring_dropped++;
+        } else {
+            raw_sample_t *s = &g_ring[head & (SAMPLE_RING_LEN - 1)];
+            s->t_us = t;
+            s->bus = bus;
+            s->cur = (int16_t)cur;
+            s->pwr = pwr;
+            s->mask = mask;
+            __dmb();
+            g_ring_head = head + 1;
+        }
+        if (retry) { g_diag_i2c_retries++; retry = 0; }
+
+        // Track the chip's real conversion period (its oscillator is only
+        // accurate to a few %) so we don't sit polling the bus for long.
+        uint32_t gap = (uint32_t)(t - last_t);
+        if (last_t && gap > nominal - (nominal >> 2) && gap < nominal + (nominal >> 2)) period = gap;
+        last_t = t;
+        due = (uint32_t)t + period - SAMPLER_EARLY_US;
+    }
 }
-static int ina226_bus_voltage_V(ina226_t *dev, float *v) {
-    uint16_t raw; int rc = i2c_r16(dev->addr, INA226_REG_BUS, &raw);
-    if (rc) return rc; *v = (float)raw * 1.25e-3f; return 0;
+
+
+// ======= Memory high-water marks =======
+// Both stacks are filled with a pattern before they are used; the lowest word
+// that no longer holds it is as deep as that core has been. The heap grows
+// from the end of .bss up to the stack area (the SDK's _sbrk).
+#define STACK_PAINT 0x5AA5A55Au
+
+extern uint32_t __StackBottom[], __StackTop[];       // core 0
+extern uint32_t __StackOneBottom[], __StackOneTop[]; // core 1
+extern char __end__[], __StackLimit[];
+
+static inline __attribute__((always_inline)) void stack_paint(uint32_t *lo, uint32_t *hi) {
+    for (volatile uint32_t *p = lo; p < hi; p++) *p = STACK_PAINT;
 }
-static int ina226_shunt_voltage_V(ina226_t *dev, float *v) {
-    int16_t raw; int rc = i2c_rs16(dev->addr, INA226_REG_SHUNT, &raw);
-    if (rc) return rc; *v = (float)raw * 2.5e-6f; return 0;
+
+static uint32_t stack_peak(const uint32_t *lo, const uint32_t *hi) {
+    const uint32_t *p = lo;
+    while (p < hi && *p == STACK_PAINT) p++;
+    return (uint32_t)((hi - p) * sizeof(uint32_t));
 }
-static int ina226_current_A(ina226_t *dev, float *i) {
-    int16_t raw; int rc = i2c_rs16(dev->addr, INA226_REG_CURRENT, &raw);
-    if (rc) return rc; *i = (float)raw * dev->current_lsb; return 0;
+
+// Core 0 is already running on its stack: paint what lies below the caller's
+// frame, inline so no call frame of our own sits in the range.
+static inline __attribute__((always_inline)) void stack0_paint(void) {
+    uint32_t *sp;
+    __asm volatile ("mov %0, sp" : "=r"(sp));
+    stack_paint(__StackBottom, sp - 8);
 }
-static int ina226_power_W(ina226_t *dev, float *p) {
-    uint16_t raw; int rc = i2c_r16(dev->addr, INA226_REG_POWER, &raw);
-    if (rc) return rc; *p = (float)raw * dev->power_lsb; return 0;
+
+void hal_mem_stats(hal_mem_stats_t *m) {
+    struct mallinfo mi = mallinfo();
+    m->stack0_size = (uint32_t)((__StackTop - __StackBottom) * sizeof(uint32_t));
+    m->stack0_peak = stack_peak(__StackBottom, __StackTop);
+    m->stack1_size = (uint32_t)((__StackOneTop - __StackOneBottom) * sizeof(uint32_t));
+    m->stack1_peak = stack_peak(__StackOneBottom, __StackOneTop);
+    m->heap_size = (uint32_t)(__StackLimit - __end__);
+    m->heap_used = (uint32_t)mi.uordblks;
+    m->heap_peak = (uint32_t)mi.arena; // newlib only trims past 128 KB
 }
 
-// ======= Utils =======
-static float clampf(float x, float lo, float hi){ return x < lo ? lo : (x > hi ? hi : x); }
+// ======= Sampler interface (core 0) =======
+void hal_sampler_start(uint32_t period_us) {
+    g_sampler_period_us = period_us;
+    stack_paint(__StackOneBottom, __StackOneTop);
+    multicore_launch_core1(sampler_core1_main);
+    // core 1 runs flash code until it reports ready; no flash writes before that
+    while (!g_sampler_ready) tight_loop_contents();
+}
 
-static float pct_from_voltage_alt(float vbus, float min_v, float max_v) {
-    const float knee_v = 24.0f;
-    const float tail_fraction = 0.1f;
+int hal_sampler_pop(raw_sample_t *s) {
+    uint32_t tail = g_ring_tail;
+    if (tail == g_ring_head) return 0;
+    __dmb();
+    *s = g_ring[tail & (SAMPLE_RING_LEN - 1)];
+    __dmb();
+    g_ring_tail = tail + 1;
+    return 1;
+}
 
-    if (max_v <= min_v || knee_v <= min_v || max_v <= knee_v) {
-        return clampf((vbus - min_v) / (max_v - min_v), 0.0f, 1.0f);
-    }
-    if (vbus >= knee_v) {
-        float head = (vbus - knee_v) / (max_v - knee_v);
-        return clampf(tail_fraction + (1.0f - tail_fraction) * head, 0.0f, 1.0f);
-    }
-    float tail = (vbus - min_v) / (knee_v - min_v);
-    return clampf(tail_fraction * clampf(tail, 0.0f, 1.0f), 0.0f, 1.0f);
+// Queue an INA226 register write for core 1. Returns -1 if the queue is full.
+int hal_sampler_write_reg(uint8_t reg, uint16_t val) {
+    uint32_t head = g_wr_head;
+    if (head - g_wr_tail >= REG_WRITE_RING_LEN) return -1;
+    reg_write_t *w = &g_wr_ring[head & (REG_WRITE_RING_LEN - 1)];
+    w->reg = reg;
+    w->val = val;
+    __dmb();
+    g_wr_head = head + 1;
+    return 0;
 }
 
-// detect both "get" and "set" present
-static int has_both_get_and_set(const char *s) {
-    return strstr(s, "\"get\"") && strstr(s, "\"set\"");
+int hal_alert_pop(uint64_t upto_us, alert_edge_t *e) {
+    uint32_t tail = g_alert_tail;
+    if (tail == g_alert_head) return 0;
+    __dmb();
+    const alert_edge_t *q = &g_alert_ring[tail & (ALERT_RING_LEN - 1)];
+    if (q->t_us > upto_us) return 0;
+    *e = *q;
+    g_alert_tail = tail + 1;
+    return 1;
 }
 
-// set all GET wants to 1
-static void set_all_wants(int *want_v, int *want_a, int *want_w, int *want_pct, int *want_chg, int *want_min_v, int *want_max_v, int *want_hrs_cap, int *want_hrs_rem, int *want_fw, int *want_chg_thr) {
-    *want_v = *want_a = *want_w = *want_pct = *want_chg = *want_min_v = *want_max_v = *want_hrs_cap = *want_hrs_rem = *want_fw = *want_chg_thr = 1;
+void hal_alert_flush(void) {
+    g_alert_tail = g_alert_head;
 }
 
-// parse {"get":[ ... ]} or {"get":"all"}; validates against supported list
-// returns 1 on success, -1 on invalid field, 0 if no get found
-static int parse_get_request(const char *s, int *want_v, int *want_a, int *want_w, int *want_pct, int *want_chg, int *want_min_v, int *want_max_v, int *want_hrs_cap, int *want_hrs_rem, int *want_fw, int *want_chg_thr, char *bad_field, size_t bad_field_cap) {
-    const char *g = strstr(s, "\"get\"");
-    if (!g) return 0;
-    *want_v = *want_a = *want_w = *want_pct = *want_chg = *want_min_v = *want_max_v = *want_hrs_cap = *want_hrs_rem = *want_fw = *want_chg_thr = 0;
-
-    // support both {"get":"all"} and {"get":["..."]}
-    const char *lb = strchr(g, '[');
-    const char *rb = lb ? strchr(lb, ']') : NULL;
-    const char *q = strchr(g, '"'); // first quote after "get"
-    const char *after_get = q ? q + 1 : g;
-
-    // Shortcut: {"get":"all"}
-    const char *colon = strchr(after_get, ':');
-    if (colon) {
-        const char *quote_val = strchr(colon, '"');
-        if (quote_val) {
-            const char *quote_val_end = strchr(quote_val + 1, '"');
-            if (quote_val_end && (lb == NULL || quote_val < lb)) {
-                size_t len = (size_t)(quote_val_end - (quote_val + 1));
-                if (len == 3 && strncmp(quote_val + 1, "all", 3) == 0) {
-                    set_all_wants(want_v, want_a, want_w, want_pct, want_chg, want_min_v, want_max_v, want_hrs_cap, want_hrs_rem, want_fw, want_chg_thr);
-                    return 1;
-                }
-            }
-        }
-    }
+void hal_sampler_stats(hal_sampler_stats_t *st) {
+    st->ring_dropped = g_ring_dropped;
+    st->alert_dropped = g_alert_dropped;
+    st->i2c_errors = g_sampler_i2c_errors;
+    st->i2c_nak = g_diag_i2c_nak;
+    st->i2c_timeout = g_diag_i2c_timeout;
+    st->i2c_retries = g_diag_i2c_retries;
+    st->i2c_us = &g_diag_i2c_us;
+}
 
-    if (!lb || !rb || rb <= lb) return 0;
-
-    const char *p = lb;
-    while (p && p < rb) {
-        const char *q1 = strchr(p, '"');
-        if (!q1 || q1 >= rb) break;
-        const char *q2 = strchr(q1 + 1, '"');
-        if (!q2 || q2 > rb) break;
-        size_t len = (size_t)(q2 - (q1 + 1));
-        if (len == 0) { p = q2 + 1; continue; }
-
-        // copy token
-        size_t copy_len = len < bad_field_cap - 1 ? len : bad_field_cap - 1;
-        memcpy(bad_field, q1 + 1, copy_len);
-        bad_field[copy_len] = '\0';
-
-        int matched = 0;
-        if (len == 3 && strncmp(q1 + 1, "all", 3) == 0) {
-            set_all_wants(want_v, want_a, want_w, want_pct, want_chg, want_min_v, want_max_v, want_hrs_cap, want_hrs_rem, want_fw, want_chg_thr);
-            matched = 1;
-        } else {
-            if (len == 1 && bad_field[0] == 'v') { *want_v = 1; matched = 1; }
-            else if (len == 1 && bad_field[0] == 'a') { *want_a = 1; matched = 1; }
-            else if (len == 1 && bad_field[0] == 'w') { *want_w = 1; matched = 1; }
-            else if (len == 3 && strncmp(bad_field, "pct", 3) == 0) { *want_pct = 1; matched = 1; }
-            else if (len == 8 && strncmp(bad_field, "charging", 8) == 0) { *want_chg = 1; matched = 1; }
-            else if (len == 5 && strncmp(bad_field, "min_v", 5) == 0) { *want_min_v = 1; matched = 1; }
-            else if (len == 5 && strncmp(bad_field, "max_v", 5) == 0) { *want_max_v = 1; matched = 1; }
-            else if (len == 12 && strncmp(bad_field, "hrs_capacity", 12) == 0) { *want_hrs_cap = 1; matched = 1; }
-            else if (len == 13 && strncmp(bad_field, "hrs_remaining", 13) == 0) { *want_hrs_rem = 1; matched = 1; }
-            else if (len == 2 && strncmp(bad_field, "fw", 2) == 0) { *want_fw = 1; matched = 1; }
-            else if (len == 15 && strncmp(bad_field, "chg_threshold_a", 15) == 0) { *want_chg_thr = 1; matched = 1; }
-        }
+// ======= Time, USB CDC, I2C =======
+uint64_t hal_time_us64(void) { return time_us_64(); }
+uint32_t hal_time_us32(void) { return time_us_32(); }
+void     hal_idle(void) { tight_loop_contents(); }
 
-        if (!matched) {
-            return -1; // invalid field captured in bad_field
-        }
-        p = q2 + 1;
-    }
+int hal_getchar(void) {
+    int ch = getchar_timeout_us(0);
+    return ch == PICO_ERROR_TIMEOUT ? -1 : ch;
+}
 
-    return 1;
+int hal_i2c_write16(uint8_t addr, uint8_t reg, uint16_t val) {
+    uint8_t buf[3] = { reg, (uint8_t)(val >> 8), (uint8_t)(val & 0xFF) };
+    int wrote = i2c_write_blocking(I2C_INST, addr, buf, 3, false);
+    return (wrote == 3) ? 0 : -1;
 }
 
-// parse {"set":{"max_v":..,"min_v":..,"chg_threshold_a":..}}
-static int parse_set_request(const char *s, float *max_v, float *min_v, float *hrs_capacity, float *chg_threshold_a, int *changed, int *saw_chg_thr) {
-    const char *st = strstr(s, "\"set\"");
-    if (!st) return 0;
-    *changed = 0;
-    *saw_chg_thr = 0;
-    const char *lb = strchr(st, '{');
-    const char *rb = lb ? strchr(lb, '}') : NULL;
-    if (!lb || !rb || rb <= lb) return 0;
-
-    const char *mx = strstr(lb, "\"max_v\"");
-    if (mx && mx < rb) {
-        float v;
-        if (sscanf(mx, "\"max_v\"%*[^0-9.-]%f", &v) == 1) { *max_v = v; *changed = 1; }
-    }
-    const char *mn = strstr(lb, "\"min_v\"");
-    if (mn && mn < rb) {
-        float v;
-        if (sscanf(mn, "\"min_v\"%*[^0-9.-]%f", &v) == 1) { *min_v = v; *changed = 1; }
-    }
-    const char *hc = strstr(lb, "\"hrs_capacity\"");
-    if (hc && hc < rb) {
-        float v;
-        if (sscanf(hc, "\"hrs_capacity\"%*[^0-9.-]%f", &v) == 1) { *hrs_capacity = v; *changed = 1; }
-    }
-    const char *ct = strstr(lb, "\"chg_threshold_a\"");
-    if (ct && ct < rb) {
-        float v;
-        if (sscanf(ct, "\"chg_threshold_a\"%*[^0-9.-]%f", &v) == 1) { *chg_threshold_a = v; *changed = 1; *saw_chg_thr = 1; }
-    }
-    return 1;
+// ======= Settings flash (last two 4KB sectors) =======
+#ifndef PICO_FLASH_SIZE_BYTES
+#warning "PICO_FLASH_SIZE_BYTES not defined; defaulting to 2MB"
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+#endif
+
+#define SETTINGS_SLOT_A_OFFSET      (PICO_FLASH_SIZE_BYTES - 2 * FLASH_SECTOR_SIZE)
+#define SETTINGS_SLOT_B_OFFSET      (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)  // legacy single-sector location
+#define SETTINGS_FLASH_TIMEOUT_MS   50
+
+_Static_assert(HAL_FLASH_PAGE_SIZE == FLASH_PAGE_SIZE, "flash page size");
+
+static uint32_t settings_slot_offset(int slot) {
+    return slot ? SETTINGS_SLOT_B_OFFSET : SETTINGS_SLOT_A_OFFSET;
 }
 
-// ======= Input accumulator: capture one JSON object { ... } (no newline needed) =======
-static int read_json_object(char *out, size_t cap, uint32_t poll_ms) {
-    static char buf[512];
-    static size_t n = 0;
-    static int depth = 0;
-    static int in_str = 0;   // inside "..."
-    static int esc = 0;      // after backslash
-    absolute_time_t until = make_timeout_time_ms(poll_ms);
+const uint8_t *hal_flash_slot(int slot) {
+    return (const uint8_t *)(uintptr_t)(XIP_BASE + settings_slot_offset(slot));
+}
 
-    while (absolute_time_diff_us(get_absolute_time(), until) > 0) {
-        int ch = getchar_timeout_us(0);
-        if (ch == PICO_ERROR_TIMEOUT) { tight_loop_contents(); continue; }
-        char c = (char)ch;
+typedef struct {
+    uint32_t offset;
+    size_t   len;     // whole pages
+    const uint8_t *data;
+} settings_flash_op_t;
+
+// Runs on core 0 with interrupts masked; core 1 keeps sampling from RAM.
+static void settings_flash_commit(void *param) {
+    const settings_flash_op_t *op = (const settings_flash_op_t *)param;
+    flash_range_erase(op->offset, FLASH_SECTOR_SIZE);
+    flash_range_program(op->offset, op->data, op->len);
+}
 
-        if (n + 1 >= sizeof(buf)) { n = 0; depth = 0; in_str = 0; esc = 0; } // reset on overflow
+int hal_flash_write_slot(int slot, const uint8_t *data, size_t len) {
+    if (len > FLASH_SECTOR_SIZE || len % FLASH_PAGE_SIZE) return -1;
+    settings_flash_op_t op = { .offset = settings_slot_offset(slot), .len = len, .data = data };
+    return flash_safe_execute(settings_flash_commit, &op, SETTINGS_FLASH_TIMEOUT_MS) == PICO_OK ? 0 : -1;
+}
 
-        if (!depth) {
-            if (c == '{') { buf[n++] = c; depth = 1; in_str = 0; esc = 0; }
-            continue;
-        }
+#ifdef PM_TRACE
+#define TRACE_CHUNK_EVENTS 96
+
+static int base64_encode(char *out, const uint8_t *in, size_t n) {
+    static const char k_b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char *o = out;
+    for (size_t k = 0; k < n; k += 3) {
+        uint32_t v = (uint32_t)in[k] << 16;
+        if (k + 1 < n) v |= (uint32_t)in[k + 1] << 8;
+        if (k + 2 < n) v |= in[k + 2];
+        *o++ = k_b64[(v >> 18) & 63];
+        *o++ = k_b64[(v >> 12) & 63];
+        *o++ = k + 1 < n ? k_b64[(v >> 6) & 63] : '=';
+        *o++ = k + 2 < n ? k_b64[v & 63] : '=';
+    }
+    *o = '\0';
+    return (int)(o - out);
+}
 
-        buf[n++] = c;
-        if (esc) { esc = 0; continue; }
-        if (c == '\\') { esc = 1; continue; }
-        if (c == '"') { in_str = !in_str; continue; }
-        if (in_str) continue;
-
-        if (c == '{') depth++;
-        else if (c == '}') {
-            depth--;
-            if (depth == 0) {
-                buf[n] = '\0';
-                size_t len = n < cap ? n : cap - 1;
-                memcpy(out, buf, len);
-                out[len] = '\0';
-                n = 0; in_str = 0; esc = 0;
-                return (int)len;
+// One header line, then the events recorded since the last dump, oldest first,
+// as {"trace_data":{"core":c,"data":"<base64 of 8-byte little-endian records>"}}.
+// Recording pauses meanwhile; an event core 1 had already started may be lost.
+void hal_trace_dump(void) {
+    static uint32_t base[2];
+    static uint8_t raw[TRACE_CHUNK_EVENTS * sizeof(trace_ev_t)];
+    static char enc[(sizeof(raw) + 2) / 3 * 4 + 1];
+    g_trace_on = 0;
+    __dmb();
+    uint32_t head[2], n[2], lost[2], chunks = 0;
+    for (int c = 0; c < 2; c++) {
+        head[c] = g_trace_head[c];
+        n[c] = head[c] - base[c];
+        lost[c] = n[c] > PM_TRACE_LEN ? n[c] - PM_TRACE_LEN : 0;
+        n[c] -= lost[c];
+        chunks += (n[c] + TRACE_CHUNK_EVENTS - 1) / TRACE_CHUNK_EVENTS;
+    }
+    printf("{\"trace\":{\"clk_hz\":%lu,\"cyc_bits\":24,\"events\":[%lu,%lu],\"lost\":[%lu,%lu],\"chunks\":%lu,\"names\":[",
+           (unsigned long)clock_get_hz(clk_sys), (unsigned long)n[0], (unsigned long)n[1],
+           (unsigned long)lost[0], (unsigned long)lost[1], (unsigned long)chunks);
+    for (int k = 0; k < TR_COUNT; k++) printf("%s\"%s\"", k ? "," : "", k_trace_names[k]);
+    printf("]}}\n");
+    for (int c = 0; c < 2; c++) {
+        uint32_t i = head[c] - n[c];
+        while (i != head[c]) {
+            size_t len = 0;
+            for (; i != head[c] && len < sizeof(raw); i++) {
+                const trace_ev_t *e = &g_trace[c][i & (PM_TRACE_LEN - 1)];
+                for (int b = 0; b < 4; b++) raw[len + b] = (uint8_t)(e->us >> (8 * b));
+                for (int b = 0; b < 4; b++) raw[len + 4 + b] = (uint8_t)(e->w >> (8 * b));
+                len += sizeof(trace_ev_t);
             }
+            base64_encode(enc, raw, len);
+            printf("{\"trace_data\":{\"core\":%d,\"data\":\"%s\"}}\n", c, enc);
         }
+        base[c] = head[c];
     }
-    return -1; // no complete object yet
+    __dmb();
+    g_trace_on = 1;
 }
+#endif
 
 int main() {
+    stack0_paint();
+#if defined(PM_TRACE) || defined(PM_BENCH)
+    systick_start();
+#endif
     stdio_init_all();
     sleep_ms(1500); // allow USB CDC to enumerate
 
-    // Load persisted thresholds (or initialize defaults)
-    settings_load_or_default();
-
     // I2C init
     i2c_init(I2C_INST, I2C_FREQ_HZ);
     gpio_set_function(PIN_I2C_SDA, GPIO_FUNC_I2C);
@@ -424,141 +550,6 @@ int main() {
     gpio_pull_up(PIN_I2C_SDA);
     gpio_pull_up(PIN_I2C_SCL);
 
-    // INA226 init (0.1Ω shunt, 2A full-scale — adjust as needed)
-    ina226_t ina;
-    int rc = ina226_init(&ina, INA226_ADDR, 0.1f, 2.0f);
-    if (rc) {
-        // Non-fatal: keep USB CDC alive so the host can still talk to us.
-        // We'll answer requests with an explicit INA226-not-found message.
-        g_ina_ok = 0;
-        // Emit a one-time boot message for visibility (host might miss it if it connects later).
-        printf("{\"error\":\"ina226_not_found\",\"message\":\"INA226 not found\",\"code\":%d}\n", rc);
-    } else {
-        g_ina_ok = 1;
-    }
-
-    // Announce ready + current thresholds
-    char inbuf[256], outbuf[256];
-
-    while (true) {
-        int n = read_json_object(inbuf, sizeof(inbuf), 50); // poll every 50 ms
-        if (n <= 0) continue;
-
-        if (has_both_get_and_set(inbuf)) {
-            printf("{\"error\":\"both_get_and_set\"}\n");
-            continue;
-        }
-
-        // --- SET handler ---
-        int changed = 0;
-        int saw_chg_thr = 0;
-        float new_max = g_max_v, new_min = g_min_v, new_hrs_cap = g_hrs_capacity, new_chg_thr = g_chg_threshold_a;
-        if (parse_set_request(inbuf, &new_max, &new_min, &new_hrs_cap, &new_chg_thr, &changed, &saw_chg_thr)) {
-            if (changed) {
-                if (saw_chg_thr) {
-                    if (new_chg_thr == 0.0f || new_chg_thr <= -100.0f || new_chg_thr >= 100.0f) {
-                        printf("{\"error\":\"invalid_chg_threshold\",\"message\":\"chg_threshold_a must be non-zero between -100 and 100\"}\n");
-                        continue;
-                    }
-                }
-                // ensure sane ordering
-                if (new_max <= new_min) { float t = new_max; new_max = new_min; new_min = t; }
-                if (new_hrs_cap < 0.0f) new_hrs_cap = 0.0f;
-                if (new_hrs_cap > 10000.0f) new_hrs_cap = 10000.0f;
-                g_max_v = new_max;
-                g_min_v = new_min;
-                g_hrs_capacity = new_hrs_cap;
-                g_chg_threshold_a = new_chg_thr;
-                settings_save(g_min_v, g_max_v, g_hrs_capacity, g_chg_threshold_a);
-                snprintf(outbuf, sizeof(outbuf),
-                         "{\"ok\":true,\"min_v\":%.3f,\"max_v\":%.3f,\"hrs_capacity\":%.1f,\"chg_threshold_a\":%.3f}\n",
-                         g_min_v, g_max_v, g_hrs_capacity, g_chg_threshold_a);
-            } else {
-                snprintf(outbuf, sizeof(outbuf),
-                         "{\"ok\":true,\"min_v\":%.3f,\"max_v\":%.3f,\"hrs_capacity\":%.1f,\"chg_threshold_a\":%.3f}\n",
-                         g_min_v, g_max_v, g_hrs_capacity, g_chg_threshold_a);
-            }
-            if (!g_ina_ok) {
-                // Always include INA226-not-found message for host-side clarity.
-                // Keep the response as JSON (even though the operation may still succeed).
-                // Trim trailing newline from outbuf and wrap with error/message prefix.
-                size_t len = strlen(outbuf);
-                if (len && outbuf[len - 1] == '\n') outbuf[len - 1] = '\0';
-                printf("{\"error\":\"ina226_not_found\",\"message\":\"INA226 not found\",\"result\":%s}\n", outbuf);
-            } else {
-                fputs(outbuf, stdout);
-            }
-            continue;
-        }
-
-        // --- GET handler ---
-        int want_v, want_a, want_w, want_pct, want_chg, want_min_v, want_max_v, want_hrs_cap, want_hrs_rem, want_fw, want_chg_thr;
-        char bad_field[32] = {0};
-        int get_rc = parse_get_request(inbuf, &want_v, &want_a, &want_w, &want_pct, &want_chg, &want_min_v, &want_max_v, &want_hrs_cap, &want_hrs_rem, &want_fw, &want_chg_thr, bad_field, sizeof(bad_field));
-        if (get_rc == -1) {
-            // Invalid field requested; respond with explicit list of supported fields.
-            printf("{\"error\":\"invalid_get_field\",\"field\":\"%s\",\"supported\":[\"v\",\"a\",\"w\",\"pct\",\"charging\",\"min_v\",\"max_v\",\"hrs_capacity\",\"hrs_remaining\",\"fw\",\"chg_threshold_a\"]}\n", bad_field);
-            continue;
-        }
-        if (get_rc == 1) {
-            // If INA226 is missing, still answer with a JSON object including the requested
-            // non-sensor fields plus an explicit message for host-side clarity.
-            if (!g_ina_ok) {
-                char *w = outbuf; size_t rem = sizeof(outbuf); int first = 1;
-                w += snprintf(w, rem, "{"); rem = sizeof(outbuf)-(w-outbuf);
-                w += snprintf(w, rem, "\"error\":\"ina226_not_found\",\"message\":\"INA226 not found\""); first = 0; rem = sizeof(outbuf)-(w-outbuf);
-                if (want_fw) { w += snprintf(w, rem, "%s\"fw\":\"%s\"", first?"":",", FW_VERSION); first=0; rem = sizeof(outbuf)-(w-outbuf); }
-                if (want_min_v) { w += snprintf(w, rem, "%s\"min_v\":%.3f", first?"":",", g_min_v); first=0; rem = sizeof(outbuf)-(w-outbuf); }
-                if (want_max_v) { w += snprintf(w, rem, "%s\"max_v\":%.3f", first?"":",", g_max_v); first=0; rem = sizeof(outbuf)-(w-outbuf); }
-                if (want_hrs_cap) { w += snprintf(w, rem, "%s\"hrs_capacity\":%.1f", first?"":",", g_hrs_capacity); first=0; rem = sizeof(outbuf)-(w-outbuf); }
-                if (want_chg_thr) { w += snprintf(w, rem, "%s\"chg_threshold_a\":%.3f", first?"":",", g_chg_threshold_a); first=0; rem = sizeof(outbuf)-(w-outbuf); }
-                // Note: v/a/w/pct/charging/hrs_remaining require INA226 measurements; omit them when missing.
-                w += snprintf(w, rem, "}\n");
-                fputs(outbuf, stdout);
-                continue;
-            }
-
-            float vbus=0, i=0, p=0;
-            int ok = 1;
-            ok &= (ina226_bus_voltage_V(&ina, &vbus) == 0);
-            ok &= (ina226_current_A(&ina, &i) == 0);
-            if (want_w) ok &= (ina226_power_W(&ina, &p) == 0);
-            if (!ok) { fputs("{\"error\":\"i2c_read\"}\n", stdout); continue; }
-
-            char *w = outbuf; size_t rem = sizeof(outbuf); int first = 1;
-            w += snprintf(w, rem, "{"); rem = sizeof(outbuf)-(w-outbuf);
-            if (want_fw) { w += snprintf(w, rem, "%s\"fw\":\"%s\"", first?"":",", FW_VERSION); first=0; rem = sizeof(outbuf)-(w-outbuf); }
-            if (want_v)  { w += snprintf(w, rem, "%s\"v\":%.3f", first?"":",", vbus); first=0; rem = sizeof(outbuf)-(w-outbuf); }
-            if (want_a)  { w += snprintf(w, rem, "%s\"a\":%.4f", first?"":",", i);    first=0; rem = sizeof(outbuf)-(w-outbuf); }
-            if (want_w)  { w += snprintf(w, rem, "%s\"w\":%.4f", first?"":",", p);    first=0; rem = sizeof(outbuf)-(w-outbuf); }
-            float pct = 0.0f;
-            if (want_pct || want_hrs_rem){
-                pct = 100.0f * pct_from_voltage_alt(vbus, g_min_v, g_max_v);
-            }
-            if (want_pct){
-                w += snprintf(w, rem, "%s\"pct\":%.2f", first?"":",", pct); first=0; rem = sizeof(outbuf)-(w-outbuf);
-            }
-            if (want_hrs_rem){
-                float hrs_remaining = g_hrs_capacity * pct * 0.01f;
-                w += snprintf(w, rem, "%s\"hrs_remaining\":%.1f", first?"":",", hrs_remaining); first=0; rem = sizeof(outbuf)-(w-outbuf);
-            }
-            if (want_chg){
-                int charging = (g_chg_threshold_a > 0.0f) ? (i >= g_chg_threshold_a) : (i <= g_chg_threshold_a);
-                w += snprintf(w, rem, "%s\"charging\":%s", first?"":",", charging?"true":"false");
-                first=0; rem = sizeof(outbuf)-(w-outbuf);
-            }
-            if (want_min_v) { w += snprintf(w, rem, "%s\"min_v\":%.3f", first?"":",", g_min_v); first=0; rem = sizeof(outbuf)-(w-outbuf); }
-            if (want_max_v) { w += snprintf(w, rem, "%s\"max_v\":%.3f", first?"":",", g_max_v); first=0; rem = sizeof(outbuf)-(w-outbuf); }
-            if (want_hrs_cap) { w += snprintf(w, rem, "%s\"hrs_capacity\":%.1f", first?"":",", g_hrs_capacity); first=0; rem = sizeof(outbuf)-(w-outbuf); }
-            if (want_chg_thr) { w += snprintf(w, rem, "%s\"chg_threshold_a\":%.3f", first?"":",", g_chg_threshold_a); first=0; rem = sizeof(outbuf)-(w-outbuf); }
-            w += snprintf(w, rem, "}\n");
-            fputs(outbuf, stdout);
-            continue;
-        }
-
-        // Unknown request
-        fputs("{\"error\":\"bad_request\"}\n", stdout);
-    }
+    pm_core_init();
+    while (true) pm_core_poll();
 }
-
-
@@ -0,0 +1,173 @@
+#include "soc_ekf.h"
+
+#include <math.h>
+
+// Tuning, all as variances in Q30 (SOC_ONE^2 scaled down by 2^30) unless noted.
+#define SOC_EKF_P0          10737418   // (10%)^2 when seeded from a voltage
+#define SOC_EKF_P_MIN       1074       // (0.1%)^2 floor, keeps the filter listening
+#define SOC_EKF_P_MAX       (1 << 28)  // (50%)^2
+#define SOC_EKF_Q_PER_HOUR  26844      // (0.5%)^2 drift per hour (sensor offset)
+#define SOC_EKF_Q_SHIFT     10         // plus 1/1024 of every coulomb step (gain error)
+#define SOC_EKF_R_BASE_MV2  900        // (30 mV)^2 OCV curve error at rest
+#define SOC_EKF_R_LOAD_MOHM 50         // extra sigma of |I| * 50 mOhm under load
+#define SOC_EKF_DMV_MAX     65535      // slope cap; keeps every product inside int64
+#define SOC_EKF_I_MAX_MA    100000
+#define SOC_EKF_DT_CHUNK_US (1u << 21)
+#define SOC_EKF_INNOV_MAX   30000
+
+static int32_t clamp32(int64_t x, int32_t lo, int32_t hi) {
+    return x < lo ? lo : (x > hi ? hi : (int32_t)x);
+}
+
+void soc_ekf_init(soc_ekf_t *e) {
+    e->n = 0;
+    e->r_mohm = 0;
+    e->x = 0;
+    e->p = SOC_EKF_P0;
+    e->ready = 0;
+    soc_ekf_set_capacity(e, 10.0f);
+}
+
+int soc_ekf_set_curve(soc_ekf_t *e, const ocv_table_t *t) {
+    int n = 0;
+    for (int k = 0; k < t->n; k++) {
+        int32_t soc = (int32_t)(t->pct[k] * 0.01f * (float)SOC_ONE);
+        // points that add no SoC (flat pct) carry no information for the inverse
+        if (n && soc <= e->soc[n - 1]) continue;
+        e->soc[n] = soc;
+        e->mv[n] = (int32_t)lroundf(t->v[k] * 1000.0f);
+        n++;
+    }
+    for (int k = 0; k + 1 < n; k++) {
+        float dmv = (float)(e->mv[k + 1] - e->mv[k]) * (float)SOC_ONE / (float)(e->soc[k + 1] - e->soc[k]);
+        e->dmv[k] = dmv > SOC_EKF_DMV_MAX ? SOC_EKF_DMV_MAX : (int32_t)dmv;
+    }
+    if (n) e->dmv[n - 1] = n > 1 ? e->dmv[n - 2] : 0;
+    if (n) e->e_cum[0] = (int64_t)e->mv[0] * e->soc[0];  // flat below the first point
+    for (int k = 0; k + 1 < n; k++) {
+        e->e_cum[k + 1] = e->e_cum[k] + (int64_t)(e->mv[k] + e->mv[k + 1]) * (e->soc[k + 1] - e->soc[k]) / 2;
+    }
+    e->n = (uint8_t)(n > 1 ? n : 0);
+    e->ready = 0;
+    return e->n ? 0 : -1;
+}
+
+void soc_ekf_set_capacity(soc_ekf_t *e, float capacity_ah) {
+    if (!(capacity_ah >= 0.5f)) capacity_ah = 0.5f;
+    if (capacity_ah > 10000.0f) capacity_ah = 10000.0f;
+    double mah_us = (double)capacity_ah * 3.6e12;  // mA*us per Ah
+    e->coulomb_gain = (int64_t)(4611686018427387904.0 / mah_us);
+}
+
+void soc_ekf_set_r_int(soc_ekf_t *e, float ohms) {
+    if (!(ohms >= 0.0f)) ohms = 0.0f;
+    if (ohms > 10.0f) ohms = 10.0f;
+    e->r_mohm = (int32_t)lroundf(ohms * 1000.0f);
+}
+
+void soc_ekf_reset(soc_ekf_t *e) {
+    e->ready = 0;
+}
+
+void soc_ekf_anchor(soc_ekf_t *e, float pct, float sigma_pct) {
+    float x = pct * 0.01f, sd = sigma_pct * 0.01f;
+    e->x = clamp32((int64_t)(x * (float)SOC_ONE), 0, SOC_ONE);
+    e->p = clamp32((int64_t)(sd * sd * (float)SOC_ONE), SOC_EKF_P_MIN, SOC_EKF_P_MAX);
+    e->ready = e->n != 0;
+}
+
+// segment of the curve that holds SoC x (binary search)
+static int seg_for_soc(const soc_ekf_t *e, int32_t x) {
+    int lo = 0, hi = e->n - 1;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) >> 1;
+        if (x >= e->soc[mid]) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int seg_for_mv(const soc_ekf_t *e, int32_t mv) {
+    int lo = 0, hi = e->n - 1;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) >> 1;
+        if (mv >= e->mv[mid]) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void soc_ekf_step(soc_ekf_t *e, int32_t v_mv, int32_t i_ma, uint32_t dt_us) {
+    if (!e->n) return;
+    i_ma = clamp32(i_ma, -SOC_EKF_I_MAX_MA, SOC_EKF_I_MAX_MA);
+    int32_t ocv_mv = v_mv + (int32_t)((int64_t)i_ma * e->r_mohm / 1000);
+
+    if (!e->ready) {
+        // seed by inverting the curve
+        int k = seg_for_mv(e, ocv_mv);
+        int32_t x = e->soc[k];
+        if (ocv_mv > e->mv[k] && e->dmv[k] > 0) {
+            x = clamp32(e->soc[k] + ((int64_t)(ocv_mv - e->mv[k]) << 30) / e->dmv[k], e->soc[0], e->soc[e->n - 1]);
+        }
+        e->x = x;
+        e->p = SOC_EKF_P0;
+        e->ready = 1;
+        return;
+    }
+
+    // predict: coulomb counting; bounded chunks keep i * dt * gain within 63 bits
+    int64_t x = e->x;
+    int64_t p = e->p;
+    while (dt_us) {
+        uint32_t dt = dt_us > SOC_EKF_DT_CHUNK_US ? SOC_EKF_DT_CHUNK_US : dt_us;
+        dt_us -= dt;
+        int64_t dx = ((int64_t)i_ma * dt * e->coulomb_gain) >> 32;
+        x -= dx;
+        p += (int64_t)dt * SOC_EKF_Q_PER_HOUR / 3600000000LL + ((dx < 0 ? -dx : dx) >> SOC_EKF_Q_SHIFT);
+    }
+    if (p > SOC_EKF_P_MAX) p = SOC_EKF_P_MAX;
+
+    // update: h(x) = OCV(x), linearized on the segment holding x
+    int32_t xc = clamp32(x, e->soc[0], e->soc[e->n - 1]);
+    int k = seg_for_soc(e, xc);
+    int64_t h = e->dmv[k];
+    int32_t pred_mv = e->mv[k] + (int32_t)(((int64_t)(xc - e->soc[k]) * h) >> 30);
+    int64_t innov = clamp32((int64_t)ocv_mv - pred_mv, -SOC_EKF_INNOV_MAX, SOC_EKF_INNOV_MAX);
+
+    int64_t load_mv = (int64_t)(i_ma < 0 ? -i_ma : i_ma) * SOC_EKF_R_LOAD_MOHM / 1000;
+    int64_t s = ((h * h * p) >> 30) + SOC_EKF_R_BASE_MV2 + load_mv * load_mv;  // mV^2
+    int64_t hp = h * p;                                                       // Q30 * mV
+    x += hp * innov / s;
+    p -= ((h * hp / s) * p) >> 30;
+
+    e->x = clamp32(x, 0, SOC_ONE);
+    e->p = clamp32(p, SOC_EKF_P_MIN, SOC_EKF_P_MAX);
+}
+
+float soc_ekf_pct(const soc_ekf_t *e) {
+    return (float)e->x * (100.0f / (float)SOC_ONE);
+}
+
+float soc_ekf_sigma_pct(const soc_ekf_t *e) {
+    return sqrtf((float)e->p / (float)SOC_ONE) * 100.0f;
+}
+
+// area under the curve from 0% to SoC x, mV * Q30
+static int64_t energy_to(const soc_ekf_t *e, int32_t x) {
+    int last = e->n - 1;
+    if (x <= e->soc[0]) return (int64_t)e->mv[0] * x;
+    if (x >= e->soc[last]) return e->e_cum[last] + (int64_t)e->mv[last] * (x - e->soc[last]);
+    int k = seg_for_soc(e, x);
+    int32_t dx = x - e->soc[k];
+    int32_t mv = e->mv[k] + (int32_t)(((int64_t)dx * e->dmv[k]) >> 30);
+    if (mv > e->mv[k + 1]) mv = e->mv[k + 1];
+    return e->e_cum[k] + (int64_t)(e->mv[k] + mv) * dx / 2;
+}
+
+void soc_ekf_energy_wh(const soc_ekf_t *e, float capacity_ah, float *now_wh, float *full_wh) {
+    if (!e->n) { *now_wh = *full_wh = 0.0f; return; }
+    // mV * Q30 -> Wh per Ah
+    const float scale = capacity_ah * 1e-3f / (float)SOC_ONE;
+    *now_wh = (float)energy_to(e, e->x) * scale;
+    *full_wh = (float)energy_to(e, SOC_ONE) * scale;
+}
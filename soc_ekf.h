@@ -0,0 +1,54 @@
+#ifndef SOC_EKF_H
+#define SOC_EKF_H
+
+#include <stdint.h>
+
+#include "ocv.h"
+
+/*
+ * State-of-charge estimator: a scalar extended Kalman filter that predicts
+ * with coulomb counting and corrects with the OCV curve, using the terminal
+ * voltage plus an I*R correction as the OCV measurement.
+ *
+ * Integer-only on the per-sample path (no float, no loops beyond a 5-step
+ * binary search) so its cost is fixed on a core without an FPU. Configuration
+ * calls may use float. No Pico SDK dependencies.
+ */
+
+#define SOC_ONE  (1 << 30)   // Q30: SOC_ONE = 100%
+
+typedef struct {
+    // OCV curve in SoC order: Q30 SoC, mV, and mV per unit SoC up to the next point
+    uint8_t  n;
+    int32_t  soc[OCV_MAX_POINTS];
+    int32_t  mv[OCV_MAX_POINTS];
+    int32_t  dmv[OCV_MAX_POINTS];
+    int64_t  e_cum[OCV_MAX_POINTS];  // area under the curve from 0% to each point, mV * Q30
+    int64_t  coulomb_gain;  // 2^62 / capacity in mA*us
+    int32_t  r_mohm;        // series resistance for the I*R correction
+    int32_t  x;             // SoC estimate, Q30
+    int32_t  p;             // variance of x, Q30
+    int      ready;         // x has been seeded from a voltage
+} soc_ekf_t;
+
+void soc_ekf_init(soc_ekf_t *e);
+// Load the OCV curve; returns -1 (and disables the filter) if it has no usable slope.
+int  soc_ekf_set_curve(soc_ekf_t *e, const ocv_table_t *t);
+void soc_ekf_set_capacity(soc_ekf_t *e, float capacity_ah);   // clamped to 0.5..10000 Ah
+void soc_ekf_set_r_int(soc_ekf_t *e, float ohms);             // clamped to 0..10 ohm
+// Forget the estimate; the next step re-seeds from the voltage.
+void soc_ekf_reset(soc_ekf_t *e);
+// Pin the estimate to a known state of charge (e.g. 100% at end of charge).
+void soc_ekf_anchor(soc_ekf_t *e, float pct, float sigma_pct);
+
+// One sample: terminal voltage (mV), current (mA, positive = discharging) and
+// time since the previous sample (us; 0 skips the coulomb prediction).
+void soc_ekf_step(soc_ekf_t *e, int32_t v_mv, int32_t i_ma, uint32_t dt_us);
+
+float soc_ekf_pct(const soc_ekf_t *e);        // estimate in percent
+float soc_ekf_sigma_pct(const soc_ekf_t *e);  // 1-sigma uncertainty in percent
+
+// Energy along the OCV curve from empty to the estimate (*now_wh) and to full (*full_wh).
+void  soc_ekf_energy_wh(const soc_ekf_t *e, float capacity_ah, float *now_wh, float *full_wh);
+
+#endif